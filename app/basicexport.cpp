@@ -19,15 +19,20 @@
 #include "document.hpp"
 #include "conversioncontext.hpp"
 #include "modeloutput.hpp"
+#include "nativemodel.hpp"
+#include "optimisedmodel.hpp"
 #include "luaconverter/luaconverter.hpp"
 #include "luaconverter/optimiser.hpp"
+#include "cconverter/cconverter.hpp"
 #include <iostream>
 #include <algorithm>
+#include <limits>
+#include <sstream>
+#include <unordered_set>
 
 namespace PMMLDocument
 {
     extern const char* PMML_INFINITY;
-    extern bool hasInfinityValue;
 }
 
 namespace
@@ -84,6 +89,16 @@ static constexpr Function::Definition ReturnStatement =
 
 }
 
+void PMMLExporter::ErrorCollector::error(const char * msg, int lineNo) const
+{
+    m_errors += std::string(msg) + (lineNo ? " at " + std::to_string(lineNo) : std::string()) + "\n";
+}
+
+void PMMLExporter::ErrorCollector::errorWithArg(const char * msg, const char * arg, int lineNo) const
+{
+    m_errors += std::string(msg) + " (" + (arg ? arg : "") + ")" + (lineNo ? " at " + std::to_string(lineNo) : std::string()) + "\n";
+}
+
 void PMMLExporter::addFunctionHeader(LuaOutputter & output, const std::vector<PMMLExporter::ModelOutput> & inputColumns)
 {
     output.function("func");
@@ -174,29 +189,34 @@ void PMMLExporter::addTableReturnStatement(AstBuilder & builder, const std::vect
     builder.function(ReturnStatement, 1);
 }
 
-bool PMMLExporter::createScript(const char * sourceFile, LuaOutputter & luaOutputter,
-                                std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
-                                Format inputFormat, Format outputFormat)
+static void reportLoadFailure(const char * sourceFile, const char * error, const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook)
 {
-    tinyxml2::XMLDocument doc(sourceFile);
-    if (doc.LoadFile(sourceFile) != tinyxml2::XML_SUCCESS)
+    if (errorHook)
     {
-        printf("Failed to load file \"%s\": %s\n", sourceFile, doc.ErrorStr());
-        return false;
+        errorHook->errorWithArg("Failed to load file", error, 0);
     }
-    
-    AstBuilder builder;
-    if (!PMMLDocument::convertPMML( builder, doc.RootElement() ))
+    else
     {
-        return false;
+        printf("Failed to load file \"%s\": %s\n", sourceFile, error);
     }
+}
 
-    populateIOWithDictionary(inputs, builder.context().getInputs());
-    populateIOWithDictionary(outputs, builder.context().getOutputs());
+static bool loadFile(const char * sourceFile, PMMLDocument::StreamedDocument & document,
+                     const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook = nullptr)
+{
+    if (!document.load(sourceFile))
+    {
+        reportLoadFailure(sourceFile, document.errorStr(), errorHook);
+        return false;
+    }
+    return true;
+}
 
-    if (luaOutputter.lowercase())
+// Bind inputs to the fields of dataDictionary, by their names in lower case if lowercase is set.
+static bool bindInputs(std::vector<PMMLExporter::ModelOutput> & inputs, const PMMLDocument::DataDictionary & dataDictionary, bool lowercase)
+{
+    if (lowercase)
     {
-        const PMMLDocument::DataDictionary & dataDictionary = builder.context().getInputs();
         PMMLDocument::DataDictionary lowercaseDictionary;
         for (const auto & input : dataDictionary)
         {
@@ -205,90 +225,409 @@ bool PMMLExporter::createScript(const char * sourceFile, LuaOutputter & luaOutpu
             std::transform(input.first.begin(), input.first.end(), lower.begin(), ::tolower);
             lowercaseDictionary.emplace(lower, input.second);
         }
-          
-        if (!bindInputColumns(inputs, lowercaseDictionary))
-        {
-            return false;
-        }
+        return bindInputColumns(inputs, lowercaseDictionary);
     }
-    else
+    return bindInputColumns(inputs, dataDictionary);
+}
+
+// Convert doc into builder, then bind outputs to the fields of the model. The inputs are bound once it is known whether
+// they are matched without case. If doc is the skeleton of a streamed document, streamed is where its segments come from.
+static bool loadModel(const tinyxml2::XMLDocument & doc, const PMMLDocument::StreamedDocument * streamed, AstBuilder & builder,
+                      std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                      PMMLDocument::SegmentCache * segmentCache = nullptr)
+{
+    builder.context().setStreamedDocument(streamed);
+    builder.context().setSegmentCache(segmentCache);
+    if (!PMMLDocument::convertPMML( builder, doc.RootElement() ))
     {
-        if (!bindInputColumns(inputs, builder.context().getInputs()))
-        {
-            return false;
-        }
+        return false;
     }
 
-    size_t countBound = std::count_if(outputs.begin(), outputs.end(), [&builder](PMMLExporter::ModelOutput & output)
+    populateIOWithDictionary(inputs, builder.context().getInputs());
+    populateIOWithDictionary(outputs, builder.context().getOutputs());
+
+    // These are reported through the builder, so that they go wherever the errors of the model itself go.
+    const int lineNum = doc.RootElement()->GetLineNum();
+    size_t countBound = std::count_if(outputs.begin(), outputs.end(), [&builder, lineNum](PMMLExporter::ModelOutput & output)
     {
         if (output.bindToModel(builder.context()))
             return true;
-        std::cerr << "Output \"" <<  output.modelOutput << "\" was not found in the model." << std::endl;
+        builder.parsingError("Output was not found in the model", output.modelOutput.c_str(), lineNum);
         return false;
     });
     
     // If we can find ANYTHING useful from the model to bind, then that's probably good enough. If not, it's probably not.
     if (countBound == 0)
     {
-        std::cerr << "No outputs were successfully bound." << std::endl;
+        builder.parsingError("No outputs were successfully bound", lineNum);
         return false;
     }
-    
-    // This is a custom field that is a table containing all other attributes if you are passing them as a table.
-    std::vector<PMMLExporter::ModelOutput> tableInput;
-    if (inputFormat == Format::AS_TABLE)
-    {
-        // Put this in front of the model
-        AstNode model = builder.popNode();
-        
-        auto inputVar = builder.context().createVariable(PMMLDocument::TYPE_TABLE, "input", PMMLDocument::ORIGIN_DATA_DICTIONARY);
-        tableInput.emplace_back("input", "input");
-        tableInput.back().field = inputVar;
-        
-        // Add declarations to build the model's inputs from the fields of the table
-        for (const auto & input : inputs)
+    return true;
+}
+
+bool PMMLExporter::createScript(const char * sourceFile, LuaOutputter & luaOutputter,
+                                std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                                Format inputFormat, Format outputFormat, const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook)
+{
+    if (OptimisedModel::isSavedModel(sourceFile))
+    {
+        OptimisedModel model;
+        std::string error;
+        if (!model.load(sourceFile, error))
         {
-            if (auto field = input.field)
-            {
-                builder.constant(input.variableOrAttribute, PMMLDocument::TYPE_STRING);
-                builder.fieldIndirect(inputVar, 1);
-                builder.declare(field, AstBuilder::HAS_INITIAL_VALUE);
-            }
+            reportLoadFailure(sourceFile, error.c_str(), errorHook);
+            return false;
         }
-        
-        builder.pushNode(std::move(model));
+        return createScript(model, luaOutputter, inputs, outputs, inputFormat, outputFormat, errorHook);
     }
-    
-    if (outputFormat == Format::AS_MULTI_ARG)
+
+    PMMLDocument::StreamedDocument document;
+    if (!loadFile(sourceFile, document, errorHook))
     {
-        addMultiReturnStatement(builder, outputs);
+        return false;
     }
-    else // outputFormat == Format::AS_TABLE
+    return createScript(document, luaOutputter, inputs, outputs, inputFormat, outputFormat, errorHook);
+}
+
+bool PMMLExporter::createScriptFromBuffer(const char * pmml, size_t pmmlLength, LuaOutputter & luaOutputter,
+                                          std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                                          Format inputFormat, Format outputFormat)
+{
+    tinyxml2::XMLDocument doc;
+    if (doc.Parse(pmml, pmmlLength) != tinyxml2::XML_SUCCESS)
     {
-        addTableReturnStatement(builder, outputs);
+        std::cerr << "Failed to parse PMML: " << doc.ErrorStr() << std::endl;
+        return false;
     }
+    return createScript(doc, luaOutputter, inputs, outputs, inputFormat, outputFormat);
+}
+
+// Convert and optimise doc, keeping the result in optimised. The tree is optimised for maxVariables locals. It takes each of
+// the inputs and returns each of the outputs, which writeScript turns into tables if they are asked for.
+static bool optimiseDocument(const tinyxml2::XMLDocument & doc, const PMMLDocument::StreamedDocument * streamed, PMMLExporter::OptimisedModel & optimised,
+                             size_t maxVariables, std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                             const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook, PMMLDocument::SegmentCache * segmentCache)
+{
+    AstBuilder builder;
+    builder.m_customErrorHook = errorHook;
+    if (!loadModel(doc, streamed, builder, inputs, outputs, segmentCache))
+    {
+        return false;
+    }
+
+    PMMLExporter::addMultiReturnStatement(builder, outputs);
     
     // Put absolutely everything that's been added into a single block.
     builder.block(builder.stackSize());
     
-    AstNode astTree = builder.popNode();
-    PMMLDocument::optimiseAST(astTree, luaOutputter);
+    optimised.tree = builder.popNode();
+    // The optimiser leaves its decisions about locals in the outputter, which the model keeps until the script is written.
+    std::ostringstream unused;
+    LuaOutputter optimiserOutputter(unused);
+    optimiserOutputter.setMaxVariables(maxVariables);
+    PMMLDocument::optimiseAST(optimised.tree, optimiserOutputter);
+    optimised.aliasedVariables = optimiserOutputter.aliasedVariables();
+    optimised.overflowedVariables = optimiserOutputter.nOverflowedVariables();
     
-    if (inputFormat == Format::AS_MULTI_ARG)
+    optimised.inputs = inputs;
+    optimised.outputs = outputs;
+    optimised.inputDictionary = builder.context().getInputs();
+    // This is a custom field that is a table containing all other attributes if you are passing them as a table.
+    optimised.inputTable = builder.context().createVariable(PMMLDocument::TYPE_TABLE, LuaOutputter::INPUT_NAME, PMMLDocument::ORIGIN_DATA_DICTIONARY);
+    optimised.hasInfinityValue = builder.context().hasInfinityValue();
+    return true;
+}
+
+// When the inputs are passed as a table, this takes each of those that the model uses out of it, as if they were passed on
+// their own.
+static void declareTableInputs(const PMMLExporter::OptimisedModel & model, const std::vector<PMMLExporter::ModelOutput> & inputs,
+                               LuaOutputter & luaOutputter)
+{
+    std::unordered_set<const PMMLDocument::FieldDescription *> used;
+    std::vector<const AstNode *> pending(1, &model.tree);
+    while (!pending.empty())
     {
-        addFunctionHeader(luaOutputter, inputs);
+        const AstNode & node = *pending.back();
+        pending.pop_back();
+        if (node.fieldDescription)
+        {
+            used.insert(node.fieldDescription.get());
+        }
+        for (const AstNode & child : node.children)
+        {
+            pending.push_back(&child);
+        }
     }
-    else // inputFormat == Format::AS_TABLE
+
+    for (const auto & input : inputs)
     {
-        addFunctionHeader(luaOutputter, tableInput);
+        if (input.field && used.count(input.field.get()))
+        {
+            // As in addFunctionHeader, inputs that overflowed go straight into the overflow table.
+            if (input.field->overflowAssignment == 0)
+            {
+                luaOutputter.keyword("local");
+            }
+            luaOutputter.field(input.field).keyword("=").field(model.inputTable).keyword("and").field(model.inputTable);
+            luaOutputter.openBracket().literal(input.variableOrAttribute, PMMLDocument::TYPE_STRING).closeBracket().endline();
+        }
     }
+}
 
-    if (PMMLDocument::hasInfinityValue)
+// This writes the script of model in the formats asked for. The inputs of model are bound to its fields here, in the case
+// of luaOutputter, and put in inputs.
+static void writeScript(const PMMLExporter::OptimisedModel & model, LuaOutputter & luaOutputter, std::vector<PMMLExporter::ModelOutput> & inputs,
+                        PMMLExporter::Format inputFormat, PMMLExporter::Format outputFormat)
+{
+    inputs = model.inputs;
+    bindInputs(inputs, model.inputDictionary, luaOutputter.lowercase());
+
+    std::vector<std::string> returnedNames;
+    if (outputFormat == PMMLExporter::Format::AS_TABLE)
+    {
+        for (const PMMLExporter::ModelOutput & output : model.outputs)
+        {
+            if (output.field)
+            {
+                returnedNames.push_back(output.variableOrAttribute);
+            }
+        }
+    }
+    luaOutputter.setReturnedNames(std::move(returnedNames));
+    luaOutputter.setAliasedVariables(LuaOutputter::AliasedVariables(model.aliasedVariables));
+    luaOutputter.setOverflowedVariables(model.overflowedVariables);
+    // This is outside of the function, so that it is only worked out once, and so that the sections of a split script can
+    // use it too.
+    if (model.hasInfinityValue)
     {
         luaOutputter.keyword("local").keyword(PMMLDocument::PMML_INFINITY).keyword("=").keyword(LuaOutputter::LUA_INFINITY).endline();
     }
+    LuaConverter::convertSections(model.tree, luaOutputter);
+    if (inputFormat == PMMLExporter::Format::AS_MULTI_ARG)
+    {
+        PMMLExporter::addFunctionHeader(luaOutputter, inputs);
+    }
+    else
+    {
+        PMMLExporter::ModelOutput tableInput(LuaOutputter::INPUT_NAME, LuaOutputter::INPUT_NAME, model.inputTable);
+        PMMLExporter::addFunctionHeader(luaOutputter, std::vector<PMMLExporter::ModelOutput>(1, tableInput));
+    }
 
-    LuaConverter::convertAstToLua(astTree, luaOutputter);
+    if (inputFormat == PMMLExporter::Format::AS_TABLE)
+    {
+        declareTableInputs(model, inputs, luaOutputter);
+    }
+
+    LuaConverter::convertAstToLua(model.tree, luaOutputter);
     luaOutputter.endBlock();
+}
+
+static bool createScriptFromDocument(const tinyxml2::XMLDocument & doc, const PMMLDocument::StreamedDocument * streamed, LuaOutputter & luaOutputter,
+                                     std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                                     PMMLExporter::Format inputFormat, PMMLExporter::Format outputFormat,
+                                     const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook, PMMLDocument::SegmentCache * segmentCache)
+{
+    PMMLExporter::OptimisedModel model;
+    if (!optimiseDocument(doc, streamed, model, luaOutputter.getMaxVariables(), inputs, outputs, errorHook, segmentCache))
+    {
+        return false;
+    }
+    writeScript(model, luaOutputter, inputs, inputFormat, outputFormat);
+    return true;
+}
+
+bool PMMLExporter::createScript(const tinyxml2::XMLDocument & doc, LuaOutputter & luaOutputter,
+                                std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                                Format inputFormat, Format outputFormat,
+                                const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook, PMMLDocument::SegmentCache * segmentCache)
+{
+    return createScriptFromDocument(doc, nullptr, luaOutputter, inputs, outputs, inputFormat, outputFormat, errorHook, segmentCache);
+}
+
+bool PMMLExporter::createScript(const PMMLDocument::StreamedDocument & document, LuaOutputter & luaOutputter,
+                                std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                                Format inputFormat, Format outputFormat,
+                                const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook, PMMLDocument::SegmentCache * segmentCache)
+{
+    return createScriptFromDocument(document.skeleton(), &document, luaOutputter, inputs, outputs, inputFormat, outputFormat, errorHook,
+                                    segmentCache);
+}
+
+bool PMMLExporter::createOptimisedModel(const char * sourceFile, OptimisedModel & model,
+                                        std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs)
+{
+    PMMLDocument::StreamedDocument document;
+    if (!loadFile(sourceFile, document))
+    {
+        return false;
+    }
+    return createOptimisedModel(document, model, inputs, outputs);
+}
+
+bool PMMLExporter::createOptimisedModel(const tinyxml2::XMLDocument & doc, OptimisedModel & model,
+                                        std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                                        const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook, PMMLDocument::SegmentCache * segmentCache)
+{
+    return optimiseDocument(doc, nullptr, model, LuaOutputter::DEFAULT_MAX_VARIABLES, inputs, outputs, errorHook, segmentCache);
+}
+
+bool PMMLExporter::createOptimisedModel(const PMMLDocument::StreamedDocument & document, OptimisedModel & model,
+                                        std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                                        const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook, PMMLDocument::SegmentCache * segmentCache)
+{
+    return optimiseDocument(document.skeleton(), &document, model, LuaOutputter::DEFAULT_MAX_VARIABLES, inputs, outputs, errorHook,
+                            segmentCache);
+}
+
+// Convert doc with native models captured, and bind model to those that compute outputs. If doc is the skeleton of a streamed
+// document, streamed is where its segments come from.
+static bool captureNativeModel(const tinyxml2::XMLDocument & doc, const PMMLDocument::StreamedDocument * streamed, PMMLExporter::NativeModel & model,
+                               std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                               const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook)
+{
+    AstBuilder builder;
+    builder.m_customErrorHook = errorHook;
+    builder.context().setCaptureNativeModels(true);
+    const bool allOutputs = outputs.empty();
+    if (!loadModel(doc, streamed, builder, inputs, outputs) || !bindInputs(inputs, builder.context().getInputs(), false))
+    {
+        return false;
+    }
+
+    std::vector<size_t> unscored;
+    model.bind(builder.context(), inputs, outputs, unscored);
+    const int lineNum = doc.RootElement()->GetLineNum();
+    if (allOutputs)
+    {
+        // Only the outputs that can be scored were wanted.
+        for (auto output = unscored.rbegin(); output != unscored.rend(); ++output)
+        {
+            outputs.erase(outputs.begin() + *output);
+        }
+        if (outputs.empty())
+        {
+            builder.parsingError("No outputs can be scored natively", lineNum);
+            return false;
+        }
+        if (!unscored.empty())
+        {
+            model.bind(builder.context(), inputs, outputs, unscored);
+        }
+        return true;
+    }
+
+    for (size_t output : unscored)
+    {
+        builder.parsingError("Output cannot be scored natively", outputs[output].modelOutput.c_str(), lineNum);
+    }
+    return unscored.empty();
+}
+
+bool PMMLExporter::createNativeModel(const char * sourceFile, NativeModel & model,
+                                     std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                                     const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook)
+{
+    PMMLDocument::StreamedDocument document;
+    if (!loadFile(sourceFile, document, errorHook))
+    {
+        return false;
+    }
+    return createNativeModel(document, model, inputs, outputs, errorHook);
+}
+
+bool PMMLExporter::createNativeModel(const tinyxml2::XMLDocument & doc, NativeModel & model,
+                                     std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                                     const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook)
+{
+    return captureNativeModel(doc, nullptr, model, inputs, outputs, errorHook);
+}
+
+bool PMMLExporter::createNativeModel(const PMMLDocument::StreamedDocument & document, NativeModel & model,
+                                     std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                                     const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook)
+{
+    return captureNativeModel(document.skeleton(), &document, model, inputs, outputs, errorHook);
+}
+
+static bool sameColumns(const std::vector<PMMLExporter::ModelOutput> & a, const std::vector<PMMLExporter::ModelOutput> & b)
+{
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const PMMLExporter::ModelOutput & x, const PMMLExporter::ModelOutput & y)
+    {
+        return x.modelOutput == y.modelOutput && x.variableOrAttribute == y.variableOrAttribute && x.factor == y.factor &&
+               x.coefficient == y.coefficient && x.decimalPoints == y.decimalPoints;
+    });
+}
+
+// Errors that aren't from any line of a model go to errorHook if there is one, or to stderr.
+static void reportError(const char * error, const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook)
+{
+    if (errorHook)
+    {
+        errorHook->error(error, 0);
+    }
+    else
+    {
+        std::cerr << error << std::endl;
+    }
+}
+
+bool PMMLExporter::createScript(const OptimisedModel & model, LuaOutputter & luaOutputter,
+                                std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                                Format inputFormat, Format outputFormat, const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook)
+{
+    if (model.tree.pFunction == nullptr)
+    {
+        reportError("The model is empty.", errorHook);
+        return false;
+    }
+    if ((!inputs.empty() && !sameColumns(inputs, model.inputs)) || (!outputs.empty() && !sameColumns(outputs, model.outputs)))
+    {
+        reportError("The model was optimised for different inputs or outputs.", errorHook);
+        return false;
+    }
+    outputs = model.outputs;
+    writeScript(model, luaOutputter, inputs, inputFormat, outputFormat);
     return true;
 }
+
+bool PMMLExporter::createCSource(const char * sourceFile, std::ostream & output,
+                                 std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                                 const char * functionName)
+{
+    PMMLDocument::StreamedDocument document;
+    AstBuilder builder;
+    if (!loadFile(sourceFile, document) || !loadModel(document.skeleton(), &document, builder, inputs, outputs) ||
+        !bindInputs(inputs, builder.context().getInputs(), false))
+    {
+        return false;
+    }
+
+    addMultiReturnStatement(builder, outputs);
+    builder.block(builder.stackSize());
+
+    AstNode astTree = builder.popNode();
+    // The optimiser is shared with the Lua backend, but C has no limit on local variables so nothing should overflow.
+    std::ostringstream unused;
+    LuaOutputter optimiserOutputter(unused);
+    optimiserOutputter.setMaxVariables(std::numeric_limits<size_t>::max());
+    PMMLDocument::optimiseAST(astTree, optimiserOutputter);
+
+    CConverter::NamedFields inputFields;
+    for (const auto & input : inputs)
+    {
+        if (input.field)
+        {
+            inputFields.emplace_back(input.variableOrAttribute, input.field);
+        }
+    }
+    std::vector<std::string> outputNames;
+    for (const auto & modelOutput : outputs)
+    {
+        if (modelOutput.field)
+        {
+            outputNames.push_back(modelOutput.variableOrAttribute);
+        }
+    }
+
+    return CConverter::convertAstToC(astTree, inputFields, outputNames, functionName, output);
+}
@@ -18,7 +18,14 @@
 #ifndef basicexport_hpp
 #define basicexport_hpp
 
+#include <memory>
+#include <ostream>
+#include <string>
+#include "ast.hpp"
 #include "pmmldocumentdefs.hpp"
+#include "segmentcache.hpp"
+#include "streameddocument.hpp"
+#include "tinyxml2.h"
 
 
 namespace PMMLExporter
@@ -29,11 +36,81 @@ namespace PMMLExporter
         AS_TABLE
     };
     struct ModelOutput;
+    struct OptimisedModel;
+    class NativeModel;
+    // An error hook that keeps the errors of one model as text, so that they can be reported together, or handed back to
+    // whoever asked for the model, instead of being mixed up with those of other models on stderr. Errors that aren't from
+    // any line of the model, such as failing to load it, are given at line 0, which isn't written.
+    class ErrorCollector : public AstBuilder::CustomErrorHook
+    {
+        std::string & m_errors;
+    public:
+        explicit ErrorCollector(std::string & errors) : m_errors(errors) {}
+        void error(const char * msg, int lineNo) const override;
+        void errorWithArg(const char * msg, const char * arg, int lineNo) const override;
+    };
     // Generate a Lua script from sourceFile into the already-configured luaOutputter
     // inputs and outputs are both io parameters. If they are non-empty, they will be used. If they are empty, we will populate them from the model.
+    // sourceFile may also be a model saved by OptimisedModel::save, which can be written in any format, as long as it is for
+    // the same inputs and outputs. If errorHook is set, errors are reported to it rather than to stdout and stderr.
     bool createScript(const char * sourceFile, LuaOutputter & luaOutputter,
                       std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
-                      Format inputFormat = Format::AS_MULTI_ARG, Format outputFormat = Format::AS_MULTI_ARG);
+                      Format inputFormat = Format::AS_MULTI_ARG, Format outputFormat = Format::AS_MULTI_ARG,
+                      const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook = nullptr);
+    // The same, from a document that has already been loaded. Nothing is shared between calls, so separate documents can be
+    // converted on separate threads. If errorHook is set, errors in the model are reported to it rather than to stderr. If
+    // segmentCache is set, segments that were converted before with it are taken from it, see segmentcache.hpp.
+    bool createScript(const tinyxml2::XMLDocument & doc, LuaOutputter & luaOutputter,
+                      std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                      Format inputFormat = Format::AS_MULTI_ARG, Format outputFormat = Format::AS_MULTI_ARG,
+                      const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook = nullptr,
+                      PMMLDocument::SegmentCache * segmentCache = nullptr);
+    // The same, from a document that may be streamed from disk, see streameddocument.hpp.
+    bool createScript(const PMMLDocument::StreamedDocument & document, LuaOutputter & luaOutputter,
+                      std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                      Format inputFormat = Format::AS_MULTI_ARG, Format outputFormat = Format::AS_MULTI_ARG,
+                      const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook = nullptr,
+                      PMMLDocument::SegmentCache * segmentCache = nullptr);
+    // The same, from pmmlLength bytes of PMML held in memory.
+    bool createScriptFromBuffer(const char * pmml, size_t pmmlLength, LuaOutputter & luaOutputter,
+                                std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                                Format inputFormat = Format::AS_MULTI_ARG, Format outputFormat = Format::AS_MULTI_ARG);
+    // These convert and optimise a document into model, in the same way as createScript, so that its script can be written
+    // as many times as needed, in any format, or saved and written later, see optimisedmodel.hpp.
+    bool createOptimisedModel(const char * sourceFile, OptimisedModel & model,
+                              std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs);
+    bool createOptimisedModel(const tinyxml2::XMLDocument & doc, OptimisedModel & model,
+                              std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                              const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook = nullptr,
+                              PMMLDocument::SegmentCache * segmentCache = nullptr);
+    bool createOptimisedModel(const PMMLDocument::StreamedDocument & document, OptimisedModel & model,
+                              std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                              const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook = nullptr,
+                              PMMLDocument::SegmentCache * segmentCache = nullptr);
+    // These convert a document in the same way as createScript, but keep the parts of it that can be scored in process over
+    // blocks of rows, rather than writing a script, see nativemodel.hpp. If outputs is empty, it is set to every output of
+    // the model that can be scored that way. Otherwise this fails if any of them can't be.
+    bool createNativeModel(const char * sourceFile, NativeModel & model,
+                           std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                           const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook = nullptr);
+    bool createNativeModel(const tinyxml2::XMLDocument & doc, NativeModel & model,
+                           std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                           const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook = nullptr);
+    bool createNativeModel(const PMMLDocument::StreamedDocument & document, NativeModel & model,
+                           std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                           const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook = nullptr);
+    // Generate a Lua script from a model that has already been optimised. It fails if inputs or outputs are given but aren't
+    // those of model. Otherwise inputs are set to those of model, matched to its fields in the case of luaOutputter, and
+    // outputs to those of model.
+    bool createScript(const OptimisedModel & model, LuaOutputter & luaOutputter,
+                      std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                      Format inputFormat = Format::AS_MULTI_ARG, Format outputFormat = Format::AS_MULTI_ARG,
+                      const std::shared_ptr<const AstBuilder::CustomErrorHook> & errorHook = nullptr);
+    // Generate C source from sourceFile, see cconverter.hpp for the interface of the generated function.
+    // Tables cannot be expressed in C, so inputs and outputs are always passed as arrays in the order of inputs and outputs.
+    bool createCSource(const char * sourceFile, std::ostream & output,
+                       std::vector<PMMLExporter::ModelOutput> & inputs, std::vector<PMMLExporter::ModelOutput> & outputs,
+                       const char * functionName = "func");
     void addFunctionHeader(LuaOutputter & output, const std::vector<PMMLExporter::ModelOutput> & inputColumns);
     void addMultiReturnStatement(AstBuilder & builder, const std::vector<PMMLExporter::ModelOutput> & customOutputs);
     void addTableReturnStatement(AstBuilder & builder, const std::vector<PMMLExporter::ModelOutput> & customOutputs);
@@ -0,0 +1,215 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "batchexport.hpp"
+#include "conversioncontext.hpp"
+#include "modeloutput.hpp"
+#include "optimisedmodel.hpp"
+#include "parallel.hpp"
+#include "luaconverter/luaoutputter.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <unordered_set>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+namespace
+{
+    struct Conversion
+    {
+        std::string outputFile;
+        std::string errors;
+        bool succeeded = false;
+        double milliseconds = 0;
+        size_t scriptSize = 0;
+    };
+
+    bool hasModelExtension(const std::string & name)
+    {
+        for (const char * extension : { ".pmml", ".xml" })
+        {
+            const size_t length = strlen(extension);
+            if (name.size() > length && PMMLDocument::strcasecmp(name.c_str() + name.size() - length, extension) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // This is the name of the file, without its directory or extension.
+    std::string modelName(const std::string & path)
+    {
+        const size_t slash = path.find_last_of("/\\");
+        std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+        const size_t dot = name.rfind('.');
+        if (dot != std::string::npos && dot != 0)
+        {
+            name.resize(dot);
+        }
+        return name;
+    }
+
+    bool makeDirectory(const std::string & directory)
+    {
+#ifdef _WIN32
+        return _mkdir(directory.c_str()) == 0 || errno == EEXIST;
+#else
+        return mkdir(directory.c_str(), 0777) == 0 || errno == EEXIST;
+#endif
+    }
+
+    void convertFile(const std::string & sourceFile, unsigned int luaOptions,
+                     std::vector<PMMLExporter::ModelOutput> inputs, std::vector<PMMLExporter::ModelOutput> outputs,
+                     PMMLExporter::Format inputFormat, PMMLExporter::Format outputFormat, Conversion & conversion)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        std::ostringstream script;
+        LuaOutputter luaOutputter(script, luaOptions);
+        auto errorHook = std::make_shared<PMMLExporter::ErrorCollector>(conversion.errors);
+        // This loads the file in the same way as converting a single model, so saved models can be given as well.
+        if (!PMMLExporter::createScript(sourceFile.c_str(), luaOutputter, inputs, outputs, inputFormat, outputFormat, errorHook))
+        {
+            return;
+        }
+
+        const std::string text = script.str();
+        std::ofstream outFileStream(conversion.outputFile, std::ios::binary);
+        if (!outFileStream.write(text.data(), text.size()))
+        {
+            conversion.errors += "Cannot write " + conversion.outputFile + "\n";
+            return;
+        }
+
+        conversion.succeeded = true;
+        conversion.scriptSize = text.size();
+        conversion.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+bool PMMLExporter::listModels(const std::string & directory, std::vector<std::string> & files)
+{
+    std::vector<std::string> found;
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE handle = FindFirstFileA((directory + "\\*").c_str(), &data);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        std::cerr << "Cannot read directory " << directory << std::endl;
+        return false;
+    }
+    do
+    {
+        const std::string path = directory + "\\" + data.cFileName;
+        if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) == 0 &&
+            (hasModelExtension(data.cFileName) || PMMLExporter::OptimisedModel::isSavedModel(path.c_str())))
+        {
+            found.push_back(path);
+        }
+    } while (FindNextFileA(handle, &data));
+    FindClose(handle);
+#else
+    DIR * dir = opendir(directory.c_str());
+    if (dir == nullptr)
+    {
+        std::cerr << "Cannot read directory " << directory << std::endl;
+        return false;
+    }
+    while (const dirent * entry = readdir(dir))
+    {
+        const std::string path = directory + "/" + entry->d_name;
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode) &&
+            (hasModelExtension(entry->d_name) || PMMLExporter::OptimisedModel::isSavedModel(path.c_str())))
+        {
+            found.push_back(path);
+        }
+    }
+    closedir(dir);
+#endif
+    std::sort(found.begin(), found.end());
+    files.insert(files.end(), found.begin(), found.end());
+    return true;
+}
+
+bool PMMLExporter::convertFiles(const std::vector<std::string> & sourceFiles, const std::string & outputDirectory, unsigned int luaOptions,
+                                const std::vector<PMMLExporter::ModelOutput> & inputs, const std::vector<PMMLExporter::ModelOutput> & outputs,
+                                Format inputFormat, Format outputFormat, std::ostream & summary)
+{
+    if (!makeDirectory(outputDirectory))
+    {
+        std::cerr << "Cannot create directory " << outputDirectory << std::endl;
+        return false;
+    }
+
+    std::vector<Conversion> conversions(sourceFiles.size());
+    std::unordered_set<std::string> outputFiles;
+    for (size_t i = 0; i < sourceFiles.size(); ++i)
+    {
+        conversions[i].outputFile = outputDirectory + "/" + modelName(sourceFiles[i]) + ".lua";
+        if (!outputFiles.insert(conversions[i].outputFile).second)
+        {
+            std::cerr << "More than one model would be written to " << conversions[i].outputFile << std::endl;
+            return false;
+        }
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    size_t converted = 0;
+    size_t totalSize = 0;
+    summary << std::fixed << std::setprecision(1);
+    // Results are reported in the order that the files were given, as soon as each one is ready.
+    Parallel::forEachInOrder(sourceFiles.size(), [&](size_t i)
+    {
+        convertFile(sourceFiles[i], luaOptions, inputs, outputs, inputFormat, outputFormat, conversions[i]);
+    },
+    [&](size_t i)
+    {
+        const Conversion & conversion = conversions[i];
+        if (conversion.succeeded)
+        {
+            summary << sourceFiles[i] << " -> " << conversion.outputFile << ": " << conversion.milliseconds << " ms, "
+                    << conversion.scriptSize << " bytes" << std::endl;
+            converted++;
+            totalSize += conversion.scriptSize;
+        }
+        else
+        {
+            summary << sourceFiles[i] << ": FAILED" << std::endl;
+            if (!conversion.errors.empty())
+            {
+                std::cerr << sourceFiles[i] << ":\n" << conversion.errors << std::flush;
+            }
+        }
+        return true;
+    });
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    summary << "Converted " << converted << " of " << sourceFiles.size() << " models (" << totalSize << " bytes) in "
+            << std::setprecision(2) << seconds << " s" << std::endl;
+    return converted == sourceFiles.size();
+}
@@ -0,0 +1,39 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  This converts many PMML files to Lua scripts in one go, several at a time.
+
+#ifndef batchexport_hpp
+#define batchexport_hpp
+
+#include "basicexport.hpp"
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace PMMLExporter
+{
+    // This adds the path to every PMML document (ending in .pmml or .xml) and every saved model (see optimisedmodel.hpp) in
+    // directory to files, in alphabetical order.
+    bool listModels(const std::string & directory, std::vector<std::string> & files);
+
+    // Converts each of sourceFiles into a script of the same name, ending in .lua, in outputDirectory. Every model gets the same
+    // inputs and outputs, as for createScript. Errors are reported per file on stderr and a line per model, with the time that
+    // it took and the size of its script, is written to summary. This returns true only if every model was converted.
+    bool convertFiles(const std::vector<std::string> & sourceFiles, const std::string & outputDirectory, unsigned int luaOptions,
+                      const std::vector<PMMLExporter::ModelOutput> & inputs, const std::vector<PMMLExporter::ModelOutput> & outputs,
+                      Format inputFormat, Format outputFormat, std::ostream & summary);
+}
+
+#endif /* batchexport_hpp */
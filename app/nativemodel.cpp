@@ -0,0 +1,178 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "nativemodel.hpp"
+#include "native/linearmodel.hpp"
+#include "native/neuralnetwork.hpp"
+#include "native/treeensemble.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <unordered_map>
+
+namespace
+{
+    // Rows are handed to each part in blocks of this many, so that the columns laid out for it stay small.
+    const size_t BLOCK_SIZE = 1024;
+
+    // This applies the arithmetic and rounding of output to value, as addOutput does in the generated code.
+    double finishOutput(const PMMLExporter::ModelOutput & output, double value)
+    {
+        if (std::isnan(value))
+        {
+            return value;
+        }
+        value = value * output.factor + output.coefficient;
+        if (output.decimalPoints >= 0)
+        {
+            // Round through text, as the generated code does, so that halves go the same way.
+            char buffer[400];
+            snprintf(buffer, sizeof(buffer), "%.*f", output.decimalPoints, value);
+            value = strtod(buffer, nullptr);
+        }
+        return value;
+    }
+}
+
+void PMMLExporter::NativeModel::bind(const PMMLDocument::ConversionContext & context, const std::vector<ModelOutput> & inputs,
+                                     const std::vector<ModelOutput> & outputs, std::vector<size_t> & unscored)
+{
+    m_parts.clear();
+    m_inputCount = inputs.size();
+    m_outputs = outputs;
+
+    std::unordered_map<const PMMLDocument::FieldDescription *, ptrdiff_t> inputIndexes;
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        if (inputs[i].field)
+        {
+            inputIndexes.emplace(inputs[i].field.get(), ptrdiff_t(i));
+        }
+    }
+
+    // The first part that computes an output is the one that it is taken from.
+    std::vector<uint8_t> scored(outputs.size(), false);
+    auto addPart = [&](const std::vector<PMMLDocument::ConstFieldDescriptionPtr> & features,
+                       const std::vector<PMMLDocument::ConstFieldDescriptionPtr> & results,
+                       std::function<void(const double * rows, size_t rowCount, double * results)> && evaluate)
+    {
+        Part part;
+        part.resultCount = results.size();
+        for (size_t result = 0; result < results.size(); ++result)
+        {
+            for (size_t output = 0; output < outputs.size(); ++output)
+            {
+                if (!scored[output] && outputs[output].field && outputs[output].field == results[result])
+                {
+                    part.outputs.emplace_back(result, output);
+                    scored[output] = true;
+                }
+            }
+        }
+        if (part.outputs.empty())
+        {
+            return;
+        }
+        for (const auto & feature : features)
+        {
+            auto found = inputIndexes.find(feature.get());
+            part.columns.push_back(found != inputIndexes.end() ? found->second : -1);
+        }
+        part.evaluate = std::move(evaluate);
+        m_parts.push_back(std::move(part));
+    };
+
+    for (const auto & ensemble : context.getTreeEnsembles())
+    {
+        std::shared_ptr<const TreeEnsemble::Ensemble> tree = ensemble.second;
+        addPart(tree->features, {ensemble.first}, [tree](const double * rows, size_t rowCount, double * results)
+        {
+            TreeEnsemble::evaluate(*tree, rows, rowCount, results);
+        });
+    }
+
+    for (const auto & linearModel : context.getLinearModels())
+    {
+        std::shared_ptr<const LinearModel::Model> linear = linearModel.second;
+        addPart(linear->features, {linearModel.first}, [linear](const double * rows, size_t rowCount, double * results)
+        {
+            LinearModel::evaluate(*linear, rows, rowCount, results);
+        });
+    }
+
+    for (const auto & neuralNetwork : context.getNeuralNetworks())
+    {
+        std::vector<PMMLDocument::ConstFieldDescriptionPtr> results;
+        for (const NeuralNetwork::Output & output : neuralNetwork->outputs)
+        {
+            results.push_back(output.field);
+        }
+        std::shared_ptr<const NeuralNetwork::Network> network = neuralNetwork;
+        addPart(network->features, results, [network](const double * rows, size_t rowCount, double * partResults)
+        {
+            NeuralNetwork::evaluate(*network, rows, rowCount, partResults);
+        });
+    }
+
+    unscored.clear();
+    for (size_t i = 0; i < outputs.size(); ++i)
+    {
+        if (!scored[i])
+        {
+            unscored.push_back(i);
+        }
+    }
+}
+
+void PMMLExporter::NativeModel::score(const double * rows, size_t rowCount, double * results) const
+{
+    const size_t outputCount = m_outputs.size();
+    std::fill(results, results + rowCount * outputCount, std::numeric_limits<double>::quiet_NaN());
+
+    std::vector<double> partRows;
+    std::vector<double> partResults;
+    for (const Part & part : m_parts)
+    {
+        const size_t columnCount = part.columns.size();
+        for (size_t blockStart = 0; blockStart < rowCount; blockStart += BLOCK_SIZE)
+        {
+            const size_t blockRows = std::min(BLOCK_SIZE, rowCount - blockStart);
+            partRows.resize(blockRows * columnCount);
+            for (size_t row = 0; row < blockRows; ++row)
+            {
+                const double * input = rows + (blockStart + row) * m_inputCount;
+                for (size_t column = 0; column < columnCount; ++column)
+                {
+                    const ptrdiff_t from = part.columns[column];
+                    partRows[row * columnCount + column] = from < 0 ? std::numeric_limits<double>::quiet_NaN() : input[from];
+                }
+            }
+
+            partResults.resize(blockRows * part.resultCount);
+            part.evaluate(partRows.data(), blockRows, partResults.data());
+            for (size_t row = 0; row < blockRows; ++row)
+            {
+                double * output = results + (blockStart + row) * outputCount;
+                for (const auto & mapping : part.outputs)
+                {
+                    output[mapping.second] = finishOutput(m_outputs[mapping.second], partResults[row * part.resultCount + mapping.first]);
+                }
+            }
+        }
+    }
+}
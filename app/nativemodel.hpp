@@ -0,0 +1,59 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  This scores the outputs of a model in process, over whole blocks of rows, using the parts of it that native/ can compute
+//  rather than a generated script. See createNativeModel in basicexport.hpp.
+
+#ifndef nativemodel_hpp
+#define nativemodel_hpp
+
+#include "conversioncontext.hpp"
+#include "modeloutput.hpp"
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace PMMLExporter
+{
+    // Which outputs can be scored this way depends on the model, as only the parts of it that native/ can represent exactly
+    // are captured when it is converted.
+    class NativeModel
+    {
+        struct Part
+        {
+            // For each column of a row of the part, the input that it is taken from, or -1 if it is always missing.
+            std::vector<ptrdiff_t> columns;
+            size_t resultCount = 0;
+            // Each output that the part computes, as the index of its result and the index of the output.
+            std::vector<std::pair<size_t, size_t>> outputs;
+            std::function<void(const double * rows, size_t rowCount, double * results)> evaluate;
+        };
+
+        std::vector<Part> m_parts;
+        size_t m_inputCount = 0;
+        std::vector<ModelOutput> m_outputs;
+    public:
+        // This takes the parts of context that compute any of outputs from inputs. Each of outputs that none of them compute
+        // is put in unscored, and the model is only usable if there are none.
+        void bind(const PMMLDocument::ConversionContext & context, const std::vector<ModelOutput> & inputs,
+                  const std::vector<ModelOutput> & outputs, std::vector<size_t> & unscored);
+
+        // This scores rowCount rows. Each row is a value for each of the inputs that the model was bound to, in order, with
+        // NaN for a missing value. Each row writes a result for each of its outputs, in order, NaN where it is missing.
+        void score(const double * rows, size_t rowCount, double * results) const;
+    };
+}
+
+#endif /* nativemodel_hpp */
@@ -0,0 +1,491 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "optimisedmodel.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+namespace
+{
+    // A saved model starts with this, followed by the version of the layout that follows it.
+    const char MAGIC[] = "PamplemousseOptimisedModel";
+    const uint64_t VERSION = 3;
+
+    // Numbers are written 7 bits at a time, with the top bit set on all but the last byte, so that the small numbers that
+    // make up most of a tree only take a byte.
+    class Writer
+    {
+        std::ostream & m_output;
+    public:
+        explicit Writer(std::ostream & output) : m_output(output) {}
+
+        void number(uint64_t value)
+        {
+            char bytes[10];
+            size_t length = 0;
+            do
+            {
+                bytes[length++] = char((value & 0x7f) | (value > 0x7f ? 0x80 : 0));
+                value >>= 7;
+            }
+            while (value);
+            m_output.write(bytes, length);
+        }
+        void signedNumber(int64_t value)
+        {
+            // Small negative numbers are kept small by moving the sign to the bottom bit.
+            number(value < 0 ? (uint64_t(-(value + 1)) << 1) | 1 : uint64_t(value) << 1);
+        }
+        void real(double value)
+        {
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            char bytes[8];
+            for (size_t i = 0; i < sizeof(bytes); ++i)
+            {
+                bytes[i] = char(bits >> (i * 8));
+            }
+            m_output.write(bytes, sizeof(bytes));
+        }
+        void string(const std::string & value)
+        {
+            number(value.size());
+            m_output.write(value.data(), value.size());
+        }
+        // Function names may be null, which is written as 0, and anything else as its length plus one.
+        void optionalString(const char * value)
+        {
+            if (value == nullptr)
+            {
+                number(0);
+                return;
+            }
+            const size_t length = strlen(value);
+            number(length + 1);
+            m_output.write(value, length);
+        }
+    };
+
+    class Reader
+    {
+        std::istream & m_input;
+        bool m_failed = false;
+    public:
+        explicit Reader(std::istream & input) : m_input(input) {}
+
+        bool failed() const { return m_failed || !m_input; }
+
+        uint64_t number()
+        {
+            uint64_t value = 0;
+            for (unsigned int shift = 0; shift < 64; shift += 7)
+            {
+                const int byte = m_input.get();
+                if (byte == std::char_traits<char>::eof())
+                {
+                    m_failed = true;
+                    return 0;
+                }
+                value |= uint64_t(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0)
+                {
+                    return value;
+                }
+            }
+            m_failed = true;
+            return 0;
+        }
+        int64_t signedNumber()
+        {
+            const uint64_t value = number();
+            return value & 1 ? -int64_t(value >> 1) - 1 : int64_t(value >> 1);
+        }
+        // This reads a number that has to be no more than max, as for an enum.
+        uint64_t number(uint64_t max)
+        {
+            const uint64_t value = number();
+            if (value > max)
+            {
+                // Enumerations are built from what is returned before anything checks failed(), so keep it in range.
+                m_failed = true;
+                return 0;
+            }
+            return value;
+        }
+        double real()
+        {
+            unsigned char bytes[8] = {};
+            m_input.read(reinterpret_cast<char *>(bytes), sizeof(bytes));
+            uint64_t bits = 0;
+            for (size_t i = 0; i < sizeof(bytes); ++i)
+            {
+                bits |= uint64_t(bytes[i]) << (i * 8);
+            }
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+        void string(std::string & value, uint64_t length)
+        {
+            value.clear();
+            // A broken file could claim any length, so don't allocate much more than has actually been read.
+            char buffer[4096];
+            while (length > 0 && !failed())
+            {
+                const size_t toRead = size_t(std::min<uint64_t>(length, sizeof(buffer)));
+                m_input.read(buffer, toRead);
+                value.append(buffer, size_t(m_input.gcount()));
+                length -= toRead;
+            }
+        }
+        std::string string()
+        {
+            std::string value;
+            string(value, number());
+            return value;
+        }
+    };
+
+    // Every field and function in a model is written once, then referred to by its position. 0 means none.
+    struct Tables
+    {
+        std::vector<PMMLDocument::ConstFieldDescriptionPtr> fields;
+        std::vector<const Function::Definition *> functions;
+        std::unordered_map<const PMMLDocument::FieldDescription *, uint64_t> fieldIndices;
+        std::unordered_map<const Function::Definition *, uint64_t> functionIndices;
+
+        void add(const PMMLDocument::ConstFieldDescriptionPtr & field)
+        {
+            if (field && fieldIndices.emplace(field.get(), fields.size() + 1).second)
+            {
+                fields.push_back(field);
+            }
+        }
+        void add(const Function::Definition * function)
+        {
+            if (functionIndices.emplace(function, functions.size() + 1).second)
+            {
+                functions.push_back(function);
+            }
+        }
+        uint64_t indexOf(const PMMLDocument::ConstFieldDescriptionPtr & field) const
+        {
+            return field ? fieldIndices.at(field.get()) : 0;
+        }
+    };
+
+    void writeColumns(Writer & writer, const Tables & tables, const std::vector<PMMLExporter::ModelOutput> & columns)
+    {
+        writer.number(columns.size());
+        for (const PMMLExporter::ModelOutput & column : columns)
+        {
+            writer.string(column.modelOutput);
+            writer.string(column.variableOrAttribute);
+            writer.number(tables.indexOf(column.field));
+            writer.real(column.factor);
+            writer.real(column.coefficient);
+            writer.signedNumber(column.decimalPoints);
+        }
+    }
+
+    PMMLDocument::ConstFieldDescriptionPtr readField(Reader & reader, const std::vector<PMMLDocument::ConstFieldDescriptionPtr> & fields)
+    {
+        const uint64_t index = reader.number(fields.size());
+        return index == 0 || reader.failed() ? PMMLDocument::ConstFieldDescriptionPtr() : fields[index - 1];
+    }
+
+    void readColumns(Reader & reader, const std::vector<PMMLDocument::ConstFieldDescriptionPtr> & fields,
+                     std::vector<PMMLExporter::ModelOutput> & columns)
+    {
+        columns.clear();
+        for (uint64_t count = reader.number(); count > 0 && !reader.failed(); --count)
+        {
+            std::string modelOutput = reader.string();
+            std::string variableOrAttribute = reader.string();
+            columns.emplace_back(modelOutput, variableOrAttribute, readField(reader, fields));
+            columns.back().factor = reader.real();
+            columns.back().coefficient = reader.real();
+            columns.back().decimalPoints = int(reader.signedNumber());
+        }
+    }
+}
+
+bool PMMLExporter::OptimisedModel::save(std::ostream & output) const
+{
+    if (tree.pFunction == nullptr)
+    {
+        return false;
+    }
+    Tables tables;
+    // The tree can be very deep, so it is walked without recursion, both here and when it is written.
+    std::vector<const AstNode *> stack = {&tree};
+    while (!stack.empty())
+    {
+        const AstNode * node = stack.back();
+        stack.pop_back();
+        tables.add(node->pFunction);
+        tables.add(node->fieldDescription);
+        for (const AstNode & child : node->children)
+        {
+            stack.push_back(&child);
+        }
+    }
+    for (const std::vector<ModelOutput> * columns : {&inputs, &outputs})
+    {
+        for (const ModelOutput & column : *columns)
+        {
+            tables.add(column.field);
+        }
+    }
+    // Like the aliases, the dictionary is sorted.
+    std::vector<std::pair<std::string, PMMLDocument::ConstFieldDescriptionPtr>> dictionary(inputDictionary.begin(), inputDictionary.end());
+    std::sort(dictionary.begin(), dictionary.end(), [](const std::pair<std::string, PMMLDocument::ConstFieldDescriptionPtr> & a,
+                                                       const std::pair<std::string, PMMLDocument::ConstFieldDescriptionPtr> & b)
+    {
+        return a.first < b.first;
+    });
+    for (const auto & entry : dictionary)
+    {
+        tables.add(entry.second);
+    }
+    tables.add(inputTable);
+    // The aliases are in no particular order, so they are sorted to save the same model the same way every time.
+    std::vector<std::pair<PMMLDocument::ConstFieldDescriptionPtr, PMMLDocument::ConstFieldDescriptionPtr>> aliases(aliasedVariables.begin(), aliasedVariables.end());
+    std::sort(aliases.begin(), aliases.end(), [](const std::pair<PMMLDocument::ConstFieldDescriptionPtr, PMMLDocument::ConstFieldDescriptionPtr> & a,
+                                                 const std::pair<PMMLDocument::ConstFieldDescriptionPtr, PMMLDocument::ConstFieldDescriptionPtr> & b)
+    {
+        return a.first->id < b.first->id;
+    });
+    for (const auto & alias : aliases)
+    {
+        tables.add(alias.first);
+        tables.add(alias.second);
+    }
+
+    Writer writer(output);
+    output.write(MAGIC, sizeof(MAGIC));
+    writer.number(VERSION);
+    writer.number(overflowedVariables);
+    writer.number(hasInfinityValue);
+
+    writer.number(tables.fields.size());
+    for (const PMMLDocument::ConstFieldDescriptionPtr & field : tables.fields)
+    {
+        writer.number(field->field.dataType);
+        writer.number(field->field.opType);
+        writer.number(field->field.values.size());
+        for (const std::string & value : field->field.values)
+        {
+            writer.string(value);
+        }
+        writer.number(field->origin);
+        writer.string(field->luaName);
+        writer.number(field->id);
+        writer.number(field->overflowAssignment);
+    }
+
+    writer.number(tables.functions.size());
+    for (const Function::Definition * function : tables.functions)
+    {
+        writer.optionalString(function->luaFunction);
+        writer.number(function->functionType);
+        writer.number(function->outputType);
+        writer.signedNumber(function->operatorLevel);
+        writer.number(function->missingValueRule);
+    }
+
+    writeColumns(writer, tables, inputs);
+    writeColumns(writer, tables, outputs);
+    writer.number(dictionary.size());
+    for (const auto & entry : dictionary)
+    {
+        writer.string(entry.first);
+        writer.number(tables.indexOf(entry.second));
+    }
+    writer.number(tables.indexOf(inputTable));
+
+    writer.number(aliases.size());
+    for (const auto & alias : aliases)
+    {
+        writer.number(tables.indexOf(alias.first));
+        writer.number(tables.indexOf(alias.second));
+    }
+
+    // Each node is followed by its children.
+    stack = {&tree};
+    while (!stack.empty())
+    {
+        const AstNode * node = stack.back();
+        stack.pop_back();
+        writer.number(node->id);
+        writer.number(tables.functionIndices.at(node->pFunction));
+        writer.number(node->type);
+        writer.number(node->coercedType);
+        writer.string(node->content);
+        writer.number(tables.indexOf(node->fieldDescription));
+        writer.number(node->children.size());
+        for (auto child = node->children.rbegin(); child != node->children.rend(); ++child)
+        {
+            stack.push_back(&*child);
+        }
+    }
+    return bool(output);
+}
+
+bool PMMLExporter::OptimisedModel::save(const char * path) const
+{
+    std::ofstream output(path, std::ios::binary);
+    return output && save(output) && output.flush();
+}
+
+bool PMMLExporter::OptimisedModel::load(std::istream & input, std::string & error)
+{
+    char magic[sizeof(MAGIC)];
+    if (!input.read(magic, sizeof(magic)) || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0)
+    {
+        error = "Not a saved model";
+        return false;
+    }
+    Reader reader(input);
+    if (reader.number() != VERSION)
+    {
+        error = "Saved by a different version";
+        return false;
+    }
+
+    overflowedVariables = size_t(reader.number());
+    hasInfinityValue = reader.number(1) != 0;
+
+    std::vector<PMMLDocument::ConstFieldDescriptionPtr> fields;
+    for (uint64_t count = reader.number(); count > 0 && !reader.failed(); --count)
+    {
+        const PMMLDocument::FieldType dataType = PMMLDocument::FieldType(reader.number(PMMLDocument::TYPE_STRING_TABLE));
+        PMMLDocument::DataField dataField(dataType, PMMLDocument::OpType(reader.number(PMMLDocument::OPTYPE_INVALID)));
+        for (uint64_t values = reader.number(); values > 0 && !reader.failed(); --values)
+        {
+            dataField.values.push_back(reader.string());
+        }
+        const PMMLDocument::FieldOrigin origin = PMMLDocument::FieldOrigin(reader.number(PMMLDocument::ORIGIN_SPECIAL));
+        const std::string luaName = reader.string();
+        const unsigned int id = unsigned(reader.number());
+        auto field = std::make_shared<PMMLDocument::FieldDescription>(dataField, origin, luaName, id);
+        field->overflowAssignment = size_t(reader.number());
+        fields.push_back(field);
+    }
+
+    m_functionNames.clear();
+    m_functions.clear();
+    for (uint64_t count = reader.number(); count > 0 && !reader.failed(); --count)
+    {
+        const char * luaFunction = nullptr;
+        if (const uint64_t length = reader.number())
+        {
+            m_functionNames.emplace_back();
+            reader.string(m_functionNames.back(), length - 1);
+            luaFunction = m_functionNames.back().c_str();
+        }
+        const Function::FunctionType functionType = Function::FunctionType(reader.number(Function::UNSUPPORTED));
+        const PMMLDocument::FieldType outputType = PMMLDocument::FieldType(reader.number(PMMLDocument::TYPE_STRING_TABLE));
+        const int operatorLevel = int(reader.signedNumber());
+        const Function::MissingValueRule missingValueRule = Function::MissingValueRule(reader.number(Function::MAYBE_MISSING));
+        m_functions.emplace_back(luaFunction, functionType, outputType, operatorLevel, missingValueRule);
+    }
+
+    readColumns(reader, fields, inputs);
+    readColumns(reader, fields, outputs);
+    inputDictionary.clear();
+    bool missingField = false;
+    for (uint64_t count = reader.number(); count > 0 && !reader.failed(); --count)
+    {
+        std::string name = reader.string();
+        PMMLDocument::ConstFieldDescriptionPtr field = readField(reader, fields);
+        missingField = missingField || !field;
+        inputDictionary.emplace(std::move(name), std::move(field));
+    }
+    inputTable = readField(reader, fields);
+
+    aliasedVariables.clear();
+    for (uint64_t count = reader.number(); count > 0 && !reader.failed(); --count)
+    {
+        PMMLDocument::ConstFieldDescriptionPtr from = readField(reader, fields);
+        aliasedVariables.emplace(from, readField(reader, fields));
+    }
+
+    // Each node on the stack is still waiting for this many more children.
+    std::vector<std::pair<AstNode *, uint64_t>> stack;
+    AstNode * next = &tree;
+    while (next != nullptr)
+    {
+        const unsigned int id = unsigned(reader.number());
+        const uint64_t function = reader.number(m_functions.size());
+        const PMMLDocument::FieldType type = PMMLDocument::FieldType(reader.number(PMMLDocument::TYPE_STRING_TABLE));
+        const PMMLDocument::FieldType coercedType = PMMLDocument::FieldType(reader.number(PMMLDocument::TYPE_STRING_TABLE));
+        std::string content = reader.string();
+        PMMLDocument::ConstFieldDescriptionPtr field = readField(reader, fields);
+        const uint64_t children = reader.number();
+        if (reader.failed() || function == 0)
+        {
+            break;
+        }
+        *next = AstNode(id, m_functions[size_t(function - 1)], type, std::move(content), AstNode::Children());
+        next->coercedType = coercedType;
+        next->fieldDescription = std::move(field);
+        if (children)
+        {
+            stack.emplace_back(next, children);
+        }
+        while (!stack.empty() && stack.back().second == 0)
+        {
+            stack.pop_back();
+        }
+        next = nullptr;
+        if (!stack.empty())
+        {
+            // Only the last child of a node is ever on the stack, so adding more children to a node never moves any.
+            stack.back().second--;
+            stack.back().first->children.emplace_back(AstNode::invalidNode_t());
+            next = &stack.back().first->children.back();
+        }
+    }
+
+    if (reader.failed() || missingField || !inputTable || !stack.empty() || tree.pFunction == nullptr || input.peek() != std::char_traits<char>::eof())
+    {
+        error = "Saved model is damaged";
+        tree = AstNode::invalidNode_t();
+        return false;
+    }
+    return true;
+}
+
+bool PMMLExporter::OptimisedModel::load(const char * path, std::string & error)
+{
+    std::ifstream input(path, std::ios::binary);
+    if (!input)
+    {
+        error = "Cannot open file";
+        return false;
+    }
+    return load(input, error);
+}
+
+bool PMMLExporter::OptimisedModel::isSavedModel(const char * path)
+{
+    std::ifstream input(path, std::ios::binary);
+    char magic[sizeof(MAGIC)];
+    return input.read(magic, sizeof(magic)) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
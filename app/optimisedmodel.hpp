@@ -0,0 +1,66 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  This holds a model that has been converted and optimised, so that its script can be written again, or saved to a file and
+//  written from that, without going back to the PMML. See createOptimisedModel in basicexport.hpp.
+
+#ifndef optimisedmodel_hpp
+#define optimisedmodel_hpp
+
+#include "ast.hpp"
+#include "basicexport.hpp"
+#include "modeloutput.hpp"
+#include "luaconverter/luaoutputter.hpp"
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace PMMLExporter
+{
+    // The tree is optimised to take each input on its own and return each output on its own. Whether the script takes and
+    // returns tables instead, and whether the inputs are matched without case, is only decided when it is written, so a model
+    // can be written in any of these ways. It is only good for the inputs and outputs that it was created with.
+    struct OptimisedModel
+    {
+        AstNode tree = AstNode::invalidNode_t();
+        // The inputs as they were asked for, which are matched to inputDictionary when the script is written.
+        std::vector<ModelOutput> inputs;
+        std::vector<ModelOutput> outputs;
+        PMMLDocument::DataDictionary inputDictionary;
+        // The table that the inputs are passed in, if they are passed as a table.
+        PMMLDocument::ConstFieldDescriptionPtr inputTable;
+        LuaOutputter::AliasedVariables aliasedVariables;
+        size_t overflowedVariables = 0;
+        bool hasInfinityValue = false;
+
+        OptimisedModel() = default;
+        OptimisedModel(const OptimisedModel &) = delete;
+        OptimisedModel & operator=(const OptimisedModel &) = delete;
+
+        bool save(std::ostream & output) const;
+        bool save(const char * path) const;
+        // If these fail, error says why.
+        bool load(std::istream & input, std::string & error);
+        bool load(const char * path, std::string & error);
+
+        // This is true if the file at path starts like a saved model rather than PMML.
+        static bool isSavedModel(const char * path);
+    private:
+        // A loaded model can't point at the functions of the program that saved it, so it has copies of them.
+        std::deque<std::string> m_functionNames;
+        std::deque<Function::Definition> m_functions;
+    };
+}
+
+#endif /* optimisedmodel_hpp */
@@ -17,7 +17,9 @@
 
 #include "modeloutput.hpp"
 #include "basicexport.hpp"
+#include "batchexport.hpp"
 #include "luaconverter/luaoutputter.hpp"
+#include "optimisedmodel.hpp"
 #include "testrun.hpp"
 
 #include <fstream>
@@ -27,6 +29,7 @@
 #include <vector>
 
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #ifdef _WIN32
 
@@ -89,13 +92,16 @@ static int runUI(int argc, char *argv[], bool insensitive, std::vector<PMMLExpor
 
 static void printUsage(const char * programName, option* longopts)
 {
-    static constexpr size_t NUMBER_OF_MODES = 3;
+    static constexpr size_t NUMBER_OF_MODES = 4;
     static constexpr const char * DESCRIPTIONS[] = {
         "Check model output given a CSV input",
         "Convert model to LUA",
+        "Convert model to C source",
         "Display this message.",
         "Convert all strings to lower case",
         "Write to a file (defaults to stdout)",
+        "Write a script for each model to a directory",
+        "Also save the optimised model, to convert again",
         "Define input",
         "Output to a custom attribute.",
         "CSV input file",
@@ -109,7 +115,7 @@ static void printUsage(const char * programName, option* longopts)
     };
     
     printf("OVERVIEW:\tconverts PMML document to Lua\n");
-    printf("Usage: %s <mode> <option> <option>... <filename.pmml>\n\nModes:\n", programName);
+    printf("Usage: %s <mode> <option> <option>... <filename.pmml>...\n\nModes:\n", programName);
     
     for (size_t i = 0; longopts[i].name != nullptr; ++i)
     {
@@ -152,15 +158,60 @@ static void printUsage(const char * programName, option* longopts)
     printf("\nStarting without a mode specified will open the interactive GUI\n");
 #endif
     
+    printf("\nTo convert many models at once, give --convert several files or directories of .pmml/.xml files along with --output_dir.\n");
+    printf("They are converted at the same time, using as many threads as PAMPLEMOUSSE_THREADS (default: all of them).\n");
     printf("\nFor any output, you may reference any target/predicted or output value from the model. Furthermore, you may access any neuron's activation value through \"neuron:<id>\"\n");
     printf("You may also put expression using +, -, * and / after an model output, but not before.\n");
     printf("E.g. \"--prediction probability=predicted_value*100+3\" is acceptable, but \"--prediction probability=100*predicted_value+3\" is not\n");
 }
 
+// This converts every file, or every model in a directory, in sources into outputDirectory.
+static int convertMany(const char * programName, int sourceCount, char * sources[], const char * outputDirectory, const char * outputFile,
+                       bool insensitive, const std::vector<PMMLExporter::ModelOutput> & inputs, const std::vector<PMMLExporter::ModelOutput> & outputs,
+                       PMMLExporter::Format inputFormat, PMMLExporter::Format outputFormat)
+{
+    if (outputDirectory == nullptr || outputFile != nullptr)
+    {
+        std::cerr << programName << ": Converting more than one file requires -O/--output_dir, and not -o/--output\n";
+        return -1;
+    }
+
+    std::vector<std::string> sourceFiles;
+    for (int i = 0; i < sourceCount; ++i)
+    {
+        struct stat info;
+        if (stat(sources[i], &info) == 0 && (info.st_mode & S_IFMT) == S_IFDIR)
+        {
+            if (!PMMLExporter::listModels(sources[i], sourceFiles))
+            {
+                return -1;
+            }
+        }
+        else
+        {
+            sourceFiles.push_back(sources[i]);
+        }
+    }
+
+    if (sourceFiles.empty())
+    {
+        std::cerr << programName << ": No models found\n";
+        return -1;
+    }
+
+    if (!PMMLExporter::convertFiles(sourceFiles, outputDirectory, insensitive ? LuaOutputter::OPTION_LOWERCASE : 0, inputs, outputs,
+                                    inputFormat, outputFormat, std::cout))
+    {
+        return -1;
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
     int isTest = 0;
     int isConvert = 0;
+    int isCSource = 0;
     
     int inputFormat = int(PMMLExporter::Format::AS_MULTI_ARG);
     int outputFormat = int(PMMLExporter::Format::AS_MULTI_ARG);
@@ -168,13 +219,16 @@ int main(int argc, char *argv[])
     struct option longopts[] = {
         { "test",      no_argument,      NULL,         'T' },
         { "convert",   no_argument,      NULL,         'C' },
+        { "c_source",  no_argument,      NULL,         'c' },
+        { "help",      no_argument,      NULL,         'h' },
         { "insensitive", no_argument,    NULL,         'i' },
-        { "data",      required_argument,NULL,         'd' },
-        { "verify",    required_argument,NULL,         'v' },
         { "output",    required_argument,NULL,         'o' },
+        { "output_dir",required_argument,NULL,         'O' },
+        { "save_model",required_argument,NULL,         's' },
         { "feature",   required_argument,NULL,         'f' },
         { "prediction",required_argument,NULL,         'p' },
-        { "help",      no_argument,      NULL,         'h' },
+        { "data",      required_argument,NULL,         'd' },
+        { "verify",    required_argument,NULL,         'v' },
         { "epsilon",   required_argument,NULL,         'e' },
         { "input_multi",no_argument,     &inputFormat, int(PMMLExporter::Format::AS_MULTI_ARG) },
         { "input_table",no_argument,     &inputFormat, int(PMMLExporter::Format::AS_TABLE) },
@@ -183,11 +237,13 @@ int main(int argc, char *argv[])
         { NULL,        0,                NULL,          0 }
     };
     
-    static constexpr char OPTSTRING[] = "id:v:o:f:p:he:TC";
+    static constexpr char OPTSTRING[] = "id:v:o:O:s:f:p:he:TCc";
 
     const char * dataFile   = nullptr;
     const char * verifyFile = nullptr;
     const char * outputFile = nullptr;
+    const char * outputDirectory = nullptr;
+    const char * modelFile = nullptr;
     bool insensitive = false;
     double epsilon = 0.0001;
     std::vector<PMMLExporter::ModelOutput> inputs;
@@ -208,6 +264,10 @@ int main(int argc, char *argv[])
         {
             isConvert = 1;
         }
+        else if (c == 'c')
+        {
+            isCSource = 1;
+        }
         else if (c == 'i')
         {
             insensitive = true;
@@ -224,6 +284,14 @@ int main(int argc, char *argv[])
         {
             outputFile = optarg;
         }
+        else if (c == 'O')
+        {
+            outputDirectory = optarg;
+        }
+        else if (c == 's')
+        {
+            modelFile = optarg;
+        }
         else if (c == 'f')
         {
             inputs.emplace_back(optarg, optarg);
@@ -265,15 +333,15 @@ int main(int argc, char *argv[])
     }
 
 #ifdef INCLUDE_UI
-    if (isTest == 0 && isConvert == 0)
+    if (isTest == 0 && isConvert == 0 && isCSource == 0)
     {
         return runUI(argc, argv, insensitive, std::move(outputs), inputFormat, outputFormat);
     }
 #endif
 
-    if (isTest + isConvert != 1)
+    if (isTest + isConvert + isCSource != 1)
     {
-        fprintf( stderr, "%s: Requires exactly one of the following arguments: -T/--test, -C/--convert\n", argv[0]);
+        fprintf( stderr, "%s: Requires exactly one of the following arguments: -T/--test, -C/--convert, -c/--c_source\n", argv[0]);
         printUsage(argv[0], longopts);
         return -1;
     }
@@ -284,6 +352,12 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    if (isConvert && (outputDirectory || argc - optind > 1))
+    {
+        return convertMany(argv[0], argc - optind, argv + optind, outputDirectory, outputFile, insensitive, inputs, outputs,
+                           PMMLExporter::Format(inputFormat), PMMLExporter::Format(outputFormat));
+    }
+
     const char * sourceFile = argv[optind];
     std::ofstream outFileStream;
     if (outputFile)
@@ -313,7 +387,38 @@ int main(int argc, char *argv[])
     {
         LuaOutputter output(outputFile ? outFileStream : std::cout, insensitive ? LuaOutputter::OPTION_LOWERCASE : 0);
 
-        if (!PMMLExporter::createScript(sourceFile, output, inputs, outputs, PMMLExporter::Format(inputFormat), PMMLExporter::Format(outputFormat)))
+        if (modelFile)
+        {
+            // The script is written from the model that is saved, which can be written again in any format.
+            PMMLExporter::OptimisedModel model;
+            if (!PMMLExporter::createOptimisedModel(sourceFile, model, inputs, outputs))
+            {
+                return -1;
+            }
+            if (!model.save(modelFile))
+            {
+                std::cerr << argv[0] << ": Cannot save the model to " << modelFile << "\n";
+                return -1;
+            }
+            if (!PMMLExporter::createScript(model, output, inputs, outputs, PMMLExporter::Format(inputFormat), PMMLExporter::Format(outputFormat)))
+            {
+                return -1;
+            }
+        }
+        else if (!PMMLExporter::createScript(sourceFile, output, inputs, outputs, PMMLExporter::Format(inputFormat), PMMLExporter::Format(outputFormat)))
+        {
+            return -1;
+        }
+    }
+    else if (isCSource)
+    {
+        if (insensitive || inputFormat != int(PMMLExporter::Format::AS_MULTI_ARG) || outputFormat != int(PMMLExporter::Format::AS_MULTI_ARG))
+        {
+            std::cerr << argv[0] << ": C source only supports case sensitive, multiple parameter inputs and outputs\n";
+            return -1;
+        }
+
+        if (!PMMLExporter::createCSource(sourceFile, outputFile ? outFileStream : std::cout, inputs, outputs))
         {
             return -1;
         }
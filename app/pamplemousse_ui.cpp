@@ -308,6 +308,7 @@ void PamplemousseUI::on_actionExport_triggered()
     AstNode astTree = myBuilder.popNode();
     PMMLDocument::optimiseAST(astTree, luaOutputter);
 
+    LuaConverter::convertSections(astTree, luaOutputter);
     if (useTableInput)
     {
         PMMLExporter::addFunctionHeader(luaOutputter, tableInput);
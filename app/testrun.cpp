@@ -18,6 +18,7 @@
 #include "testrun.hpp"
 #include "modeloutput.hpp"
 #include "basicexport.hpp"
+#include "luaconverter/chunkedbuffer.hpp"
 #include "luaconverter/luaoutputter.hpp"
 #include <algorithm>
 #include <cstdlib>
@@ -144,9 +145,10 @@ namespace
     }
 
     // Create a new Lua environment with the given source code already loaded.
-    lua_State * buildEnv(const char * sourceFile, std::string & sourceCode, bool lowercase, std::vector<PMMLExporter::ModelOutput> & inputColumns, std::vector<PMMLExporter::ModelOutput> & customOutputs, int & nOverflowedVariables)
+    // The script is written into sourceCode, which is then loaded directly from its chunks.
+    lua_State * buildEnv(const char * sourceFile, ChunkedBuffer & sourceCode, bool lowercase, std::vector<PMMLExporter::ModelOutput> & inputColumns, std::vector<PMMLExporter::ModelOutput> & customOutputs, int & nOverflowedVariables)
     {
-        std::stringstream mystream;
+        std::ostream mystream(&sourceCode);
         LuaOutputter output(mystream, lowercase ? LuaOutputter::OPTION_LOWERCASE : 0);
 
         if (!PMMLExporter::createScript(sourceFile, output, inputColumns, customOutputs))
@@ -157,11 +159,15 @@ namespace
         nOverflowedVariables = int(output.nOverflowedVariables());
         
         lua_State * L = luaL_newstate();
-        sourceCode = mystream.str();
-        if (luaL_loadstring(L, sourceCode.c_str()))
+        ChunkedBuffer::Reader reader(sourceCode);
+#if LUA_VERSION_NUM >= 502
+        if (lua_load(L, ChunkedBuffer::Reader::luaReader, &reader, "=model", nullptr))
+#else
+        if (lua_load(L, ChunkedBuffer::Reader::luaReader, &reader, "=model"))
+#endif
         {
             std::cerr << lua_tostring( L , -1 ) << std::endl;
-            std::cerr << sourceCode;
+            sourceCode.writeTo(std::cerr);
             return nullptr;
         }
 
@@ -174,13 +180,13 @@ namespace
         if (lua_pcall(L, 0, LUA_MULTRET, 0))
         {
             std::cerr << lua_tostring( L , -1 ) << std::endl;
-            std::cerr << sourceCode;
+            sourceCode.writeTo(std::cerr);
             return nullptr;
         }
 
         luaL_openlibs(L);
 
-        printf("Loaded model (%zu bytes source, %zu bytes compiled)\n", sourceCode.length(), count);
+        printf("Loaded model (%zu bytes source, %zu bytes compiled)\n", sourceCode.size(), count);
         
         return L;
     }
@@ -434,7 +440,7 @@ namespace
     
     // When something didn't work (verification failed, or exception thrown), we try to give a hint why.
     // Like executeThisLine, but with tracing. Will print out annotated source code when it is done.
-    bool debugThisLine(lua_State * L, const std::string & lineBuffer, const std::vector<PMMLExporter::ModelOutput> & inputColumns, const std::string & sourceCode, bool insensitive, int nOverflow, size_t nOutputs)
+    bool debugThisLine(lua_State * L, const std::string & lineBuffer, const std::vector<PMMLExporter::ModelOutput> & inputColumns, const ChunkedBuffer & sourceCode, bool insensitive, int nOverflow, size_t nOutputs)
     {
         static std::vector<bool> linesExecuted;
         linesExecuted.clear();
@@ -454,7 +460,8 @@ namespace
         
         lua_sethook(L, nullptr, 0, 0);
         
-        std::stringstream lineReader(sourceCode);
+        ChunkedBuffer::InputBuffer sourceBuffer(sourceCode);
+        std::istream lineReader(&sourceBuffer);
         std::string sourceLineBuffer;
         size_t lineNumber = 1;
         while (std::getline(lineReader, sourceLineBuffer))
@@ -529,7 +536,7 @@ bool openVerificationFile(std::ifstream & verificationData, std::vector<PMMLExpo
 
 bool PMMLExporter::doTestRun(const char * sourceFile, const std::vector<ModelOutput> & customOutputs, const char * inputCSV, const char * verificationCSV, double verificationEpsilon, bool lowercase, std::ostream & output)
 {
-    std::string sourceCode;
+    ChunkedBuffer sourceCode;
     std::vector<ModelOutput> outputs = customOutputs;
 
     std::ifstream inputData;
@@ -0,0 +1,134 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "pamplemousse.h"
+#include "app/basicexport.hpp"
+#include "app/modeloutput.hpp"
+#include "luaconverter/chunkedbuffer.hpp"
+#include "luaconverter/luaoutputter.hpp"
+#include <exception>
+#include <memory>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+namespace
+{
+    // This copies length characters of text into a buffer that can be released with pamplemousse_free. It doesn't throw,
+    // so it can be used to report running out of memory.
+    char * copyToBuffer(const char * text, size_t length)
+    {
+        char * buffer = static_cast<char *>(malloc(length + 1));
+        if (buffer)
+        {
+            memcpy(buffer, text, length);
+            buffer[length] = '\0';
+        }
+        return buffer;
+    }
+
+    int fail(const char * message, char ** error)
+    {
+        if (error)
+        {
+            *error = copyToBuffer(message, strlen(message));
+        }
+        return -1;
+    }
+
+    int fail(const std::string & message, char ** error)
+    {
+        if (error)
+        {
+            *error = copyToBuffer(message.c_str(), message.size());
+        }
+        return -1;
+    }
+
+    int convert(const char * pmml, size_t pmmlLength, unsigned int options, char ** script, size_t * scriptLength, char ** error)
+    {
+        tinyxml2::XMLDocument doc;
+        if (doc.Parse(pmml, pmmlLength) != tinyxml2::XML_SUCCESS)
+        {
+            return fail(std::string("Failed to parse PMML: ") + doc.ErrorStr(), error);
+        }
+
+        ChunkedBuffer buffer;
+        std::ostream output(&buffer);
+        LuaOutputter luaOutputter(output, (options & PAMPLEMOUSSE_INSENSITIVE) ? LuaOutputter::OPTION_LOWERCASE : 0);
+        std::vector<PMMLExporter::ModelOutput> inputs;
+        std::vector<PMMLExporter::ModelOutput> outputs;
+        const PMMLExporter::Format inputFormat = (options & PAMPLEMOUSSE_INPUT_TABLE) ? PMMLExporter::Format::AS_TABLE : PMMLExporter::Format::AS_MULTI_ARG;
+        const PMMLExporter::Format outputFormat = (options & PAMPLEMOUSSE_OUTPUT_TABLE) ? PMMLExporter::Format::AS_TABLE : PMMLExporter::Format::AS_MULTI_ARG;
+        // The errors of the model are kept for this call, rather than written to stderr, where they would be mixed up with
+        // those of any other models being converted at the same time.
+        std::string errors;
+        if (!PMMLExporter::createScript(doc, luaOutputter, inputs, outputs, inputFormat, outputFormat,
+                                        std::make_shared<PMMLExporter::ErrorCollector>(errors)))
+        {
+            return fail(errors.empty() ? std::string("Failed to convert PMML") : "Failed to convert PMML:\n" + errors, error);
+        }
+
+        // The script is copied straight out of the chunks that it was written to.
+        const size_t length = buffer.size();
+        char * copy = static_cast<char *>(malloc(length + 1));
+        if (copy == nullptr)
+        {
+            return fail("Out of memory", error);
+        }
+        ChunkedBuffer::Reader reader(buffer);
+        size_t offset = 0;
+        size_t size;
+        while (const char * data = reader.next(size))
+        {
+            memcpy(copy + offset, data, size);
+            offset += size;
+        }
+        copy[length] = '\0';
+        *script = copy;
+        *scriptLength = length;
+        return 0;
+    }
+}
+
+int pamplemousse_convert(const char * pmml, size_t pmmlLength, unsigned int options,
+                         char ** script, size_t * scriptLength, char ** error)
+{
+    *script = nullptr;
+    *scriptLength = 0;
+    if (error)
+    {
+        *error = nullptr;
+    }
+
+    // Nothing may be thrown back into C, so anything that is thrown, such as running out of memory, is a failure.
+    try
+    {
+        return convert(pmml, pmmlLength, options, script, scriptLength, error);
+    }
+    catch (const std::exception & e)
+    {
+        return fail(e.what(), error);
+    }
+    catch (...)
+    {
+        return fail("Failed to convert PMML", error);
+    }
+}
+
+void pamplemousse_free(char * buffer)
+{
+    free(buffer);
+}
@@ -0,0 +1,51 @@
+/*  Copyright 2018-2020 Lexis Nexis Risk Solutions
+
+    Licensed under the Apache License, Version 2.0 (the "License");
+    you may not use this file except in compliance with the License.
+    You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+
+    This is a C interface for converting PMML held in memory into a Lua script held in memory. Each call is independent of
+    every other, so any number of models may be converted at once from different threads.
+*/
+
+#ifndef pamplemousse_h
+#define pamplemousse_h
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Options for pamplemousse_convert, which may be combined with |. These are the same as --insensitive, --input_table and
+   --output_table on the command line. */
+enum
+{
+    PAMPLEMOUSSE_INSENSITIVE = 1,
+    PAMPLEMOUSSE_INPUT_TABLE = 2,
+    PAMPLEMOUSSE_OUTPUT_TABLE = 4
+};
+
+/* Converts pmmlLength bytes of PMML at pmml into a Lua script, using every input and output of the model. On success, this
+   returns 0 and sets *script to a null terminated buffer of *scriptLength characters, which must be released with
+   pamplemousse_free. On failure this returns non-zero, sets *script to NULL and, if error is not NULL, sets *error to a null
+   terminated description of what went wrong, which must also be released with pamplemousse_free. */
+int pamplemousse_convert(const char * pmml, size_t pmmlLength, unsigned int options,
+                         char ** script, size_t * scriptLength, char ** error);
+
+void pamplemousse_free(char * buffer);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* pamplemousse_h */
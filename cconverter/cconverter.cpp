@@ -0,0 +1,869 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "cconverter.hpp"
+#include "coutputter.hpp"
+#include "functiondispatch.hpp"
+#include <ctype.h>
+#include <stdio.h>
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace
+{
+    // Regression tables and neural networks produce long sums of products with constant coefficients, anything with at least
+    // this many of them is written as a static weight array and a single loop instead of a chain of pm_add calls.
+    const size_t MIN_WEIGHTED_TERMS = 4;
+
+    // Represents a single C function being written, either the main scoring function or a hoisted lambda.
+    struct Scope
+    {
+        explicit Scope(bool lambda) : isLambda(lambda) {}
+        const bool isLambda;
+        // Variables that must be declared at the top of the function (in order of first use).
+        std::vector<PMMLDocument::ConstFieldDescriptionPtr> locals;
+        // IDs of fields that already have a C variable in this function (parameters, inputs and locals)
+        std::unordered_set<unsigned int> known;
+        // Number of "int c_N" temporaries used by ternary expressions.
+        size_t nConditions = 0;
+        size_t nOutputs = 0;
+    };
+
+    class Converter
+    {
+    public:
+        bool ok = true;
+        std::ostringstream constants;
+        std::ostringstream prototypes;
+        std::ostringstream functions;
+
+        void expression(const AstNode & node, Scope & scope, COutputter & output);
+        void statement(const AstNode & node, Scope & scope, COutputter & output);
+
+        // Expressions
+        void process(Function::UnaryOperator, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::NotOperator, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::Operator, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::Comparison, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::BooleanXor, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::Functionlike, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::RoundMacro, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::Log10Macro, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::MeanMacro, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::TernaryMacro, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::BoundMacro, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::IsMissing, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::IsNotMissing, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::IsIn, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::SubstringMacro, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::TrimBlank, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::Constant, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::FieldRef, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::SurrogateMacro, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::BooleanAnd, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::BooleanOr, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::DefaultMacro, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::ThresholdMacro, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::RunLambda, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::FunctionTypeBase, const AstNode & node, Scope & scope, COutputter & output);
+
+        void unsupported(const AstNode & node, const char * what);
+        void writeFunction(const std::string & signature, const Scope & scope, const std::string & body, const char * initialisation);
+    private:
+        std::unordered_map<unsigned int, std::string> m_lambdaNames;
+        size_t m_nextConstant = 0;
+        size_t m_nextLambda = 0;
+
+        void call(const char * function, bool usesArena, const AstNode & node, Scope & scope, COutputter & output);
+        void leftFold(const char * function, bool usesArena, const AstNode & node, size_t begin, size_t end, Scope & scope, COutputter & output);
+        bool weightedSum(const AstNode & node, Scope & scope, COutputter & output);
+        bool constantSet(const AstNode & node, const char * function, Scope & scope, COutputter & output);
+        void addLocal(const PMMLDocument::ConstFieldDescriptionPtr & field, Scope & scope);
+        std::string hoistLambda(const AstNode & node, const std::string & name);
+
+        friend class StatementConverter;
+    };
+
+    class StatementConverter
+    {
+        Converter & m_converter;
+    public:
+        explicit StatementConverter(Converter & converter) : m_converter(converter) {}
+        void process(Function::Block, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::Declartion, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::Assignment, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::IfChain, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::ReturnStatement, const AstNode & node, Scope & scope, COutputter & output);
+        void process(Function::FunctionTypeBase, const AstNode & node, Scope & scope, COutputter & output);
+    };
+
+    bool isIdentifier(const char * name)
+    {
+        if (name == nullptr || !(isalpha(*name) || *name == '_'))
+        {
+            return false;
+        }
+        for (; *name; ++name)
+        {
+            if (!(isalnum(*name) || *name == '_'))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool isTable(PMMLDocument::FieldType type)
+    {
+        return type == PMMLDocument::TYPE_TABLE || type == PMMLDocument::TYPE_STRING_TABLE;
+    }
+
+    // If node is a product of a numeric constant and something else, returns the index of the constant (otherwise -1)
+    int weightIndex(const AstNode & node)
+    {
+        if (node.function().functionType != Function::OPERATOR ||
+            strcmp(node.function().luaFunction, "*") != 0 ||
+            node.children.size() != 2)
+        {
+            return -1;
+        }
+        std::string unused;
+        for (int i = 0; i < 2; ++i)
+        {
+            const AstNode & child = node.children[i];
+            if (child.function().functionType == Function::CONSTANT && child.coercedType == PMMLDocument::TYPE_NUMBER &&
+                COutputter::translateNumber(child.content, unused))
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+}
+
+void Converter::unsupported(const AstNode & node, const char * what)
+{
+    if (ok)
+    {
+        fprintf(stderr, "Cannot convert to C: %s is not supported (AST node %u)\n", what, node.id);
+    }
+    ok = false;
+}
+
+void Converter::expression(const AstNode & node, Scope & scope, COutputter & output)
+{
+    if (node.function().functionType == Function::UNSUPPORTED)
+    {
+        unsupported(node, "this function");
+        return;
+    }
+    // Constant doesn't need coersion (as it uses coercedType itself)
+    if (node.function().functionType != Function::CONSTANT && node.coercedType != node.type)
+    {
+        if (node.coercedType == PMMLDocument::TYPE_NUMBER)
+        {
+            output.keyword("pm_tonumber(");
+            Function::dispatchFunctionType<void>(*this, node.function().functionType, node, scope, output);
+            output.keyword(")");
+            return;
+        }
+        else if (node.coercedType == PMMLDocument::TYPE_STRING)
+        {
+            output.keyword("pm_tostring(").keyword(COutputter::ARENA_NAME).comma();
+            Function::dispatchFunctionType<void>(*this, node.function().functionType, node, scope, output);
+            output.keyword(")");
+            return;
+        }
+    }
+    Function::dispatchFunctionType<void>(*this, node.function().functionType, node, scope, output);
+}
+
+void Converter::statement(const AstNode & node, Scope & scope, COutputter & output)
+{
+    StatementConverter converter(*this);
+    Function::dispatchFunctionType<void>(converter, node.function().functionType, node, scope, output);
+}
+
+// Writes function(arena, child1, child2...)
+void Converter::call(const char * function, bool usesArena, const AstNode & node, Scope & scope, COutputter & output)
+{
+    output.keyword(function).keyword("(");
+    bool notFirst = false;
+    if (usesArena)
+    {
+        output.keyword(COutputter::ARENA_NAME);
+        notFirst = true;
+    }
+    for (const AstNode & child : node.children)
+    {
+        if (notFirst)
+        {
+            output.comma();
+        }
+        notFirst = true;
+        expression(child, scope, output);
+    }
+    output.keyword(")");
+}
+
+// Writes function(function(child1, child2), child3)... for children in [begin, end), matching the left to right evaluation of Lua operators.
+void Converter::leftFold(const char * function, bool usesArena, const AstNode & node, size_t begin, size_t end, Scope & scope, COutputter & output)
+{
+    for (size_t i = begin + 1; i < end; ++i)
+    {
+        output.keyword(function).keyword("(");
+        if (usesArena)
+        {
+            output.keyword(COutputter::ARENA_NAME).comma();
+        }
+    }
+    expression(node.children[begin], scope, output);
+    for (size_t i = begin + 1; i < end; ++i)
+    {
+        output.comma();
+        expression(node.children[i], scope, output);
+        output.keyword(")");
+    }
+}
+
+// Writes a sum where all but some leading terms are products of a constant as a dot product against a static weight array.
+bool Converter::weightedSum(const AstNode & node, Scope & scope, COutputter & output)
+{
+    size_t firstWeighted = 0;
+    while (firstWeighted < node.children.size() && weightIndex(node.children[firstWeighted]) < 0)
+    {
+        ++firstWeighted;
+    }
+    if (node.children.size() - firstWeighted < MIN_WEIGHTED_TERMS)
+    {
+        return false;
+    }
+    for (size_t i = firstWeighted; i < node.children.size(); ++i)
+    {
+        if (weightIndex(node.children[i]) < 0)
+        {
+            return false;
+        }
+    }
+
+    const size_t arrayID = m_nextConstant++;
+    COutputter constantOutput(constants);
+    constantOutput.keyword("static const double pm_weights_").literal(arrayID).keyword("[] = {").endline();
+    for (size_t i = firstWeighted; i < node.children.size(); ++i)
+    {
+        const AstNode & term = node.children[i];
+        constantOutput.keyword("    ").numberLiteral(term.children[weightIndex(term)].content);
+        constantOutput.keyword(i + 1 < node.children.size() ? "," : "").endline();
+    }
+    constantOutput.keyword("};").endline();
+
+    output.keyword("pm_dot(");
+    if (firstWeighted == 0)
+    {
+        output.keyword("pm_num(0)");
+    }
+    else
+    {
+        leftFold("pm_add", false, node, 0, firstWeighted, scope, output);
+    }
+    output.comma().keyword("pm_weights_").literal(arrayID).comma().keyword("(pmml_value[]){");
+    for (size_t i = firstWeighted; i < node.children.size(); ++i)
+    {
+        const AstNode & term = node.children[i];
+        if (i != firstWeighted)
+        {
+            output.comma();
+        }
+        expression(term.children[1 - weightIndex(term)], scope, output);
+    }
+    output.keyword("}").comma().literal(node.children.size() - firstWeighted).keyword(")");
+    return true;
+}
+
+// Writes a set membership test against a static array if everything that is compared against is constant.
+bool Converter::constantSet(const AstNode & node, const char * function, Scope & scope, COutputter & output)
+{
+    for (size_t i = 1; i < node.children.size(); ++i)
+    {
+        if (node.children[i].function().functionType != Function::CONSTANT)
+        {
+            return false;
+        }
+    }
+
+    const size_t arrayID = m_nextConstant++;
+    COutputter constantOutput(constants);
+    constantOutput.keyword("static const pmml_value pm_set_").literal(arrayID).keyword("[] = {").endline();
+    for (size_t i = 1; i < node.children.size(); ++i)
+    {
+        const AstNode & value = node.children[i];
+        std::string number;
+        constantOutput.keyword("    {");
+        if (value.coercedType == PMMLDocument::TYPE_STRING)
+        {
+            constantOutput.keyword("PMML_STRING, 0, ").stringLiteral(value.content.c_str());
+        }
+        else if (value.coercedType == PMMLDocument::TYPE_BOOL)
+        {
+            constantOutput.keyword("PMML_BOOL, ").keyword(PMMLDocument::strcasecmp(value.content.c_str(), "true") == 0 ? "1" : "0").keyword(", NULL");
+        }
+        else if (COutputter::translateNumber(value.content, number))
+        {
+            constantOutput.keyword("PMML_NUMBER, ").keyword(number).keyword(", NULL");
+        }
+        else
+        {
+            constantOutput.keyword("PMML_MISSING, 0, NULL");
+        }
+        constantOutput.keyword(i + 1 < node.children.size() ? "}," : "}").endline();
+    }
+    constantOutput.keyword("};").endline();
+
+    output.keyword(function).keyword("(");
+    expression(node.children.front(), scope, output);
+    output.comma().keyword("pm_set_").literal(arrayID).comma().literal(node.children.size() - 1).keyword(")");
+    return true;
+}
+
+void Converter::addLocal(const PMMLDocument::ConstFieldDescriptionPtr & field, Scope & scope)
+{
+    if (scope.known.insert(field->id).second)
+    {
+        scope.locals.push_back(field);
+    }
+}
+
+void Converter::writeFunction(const std::string & signature, const Scope & scope, const std::string & body, const char * initialisation)
+{
+    COutputter output(functions);
+    output.keyword(signature).endline().openBlock();
+    if (initialisation)
+    {
+        output.keyword(initialisation).endline();
+    }
+    for (const auto & local : scope.locals)
+    {
+        output.keyword("pmml_value ").field(local).keyword(" = pm_missing();").endline();
+    }
+    for (size_t i = 0; i < scope.nConditions; ++i)
+    {
+        output.keyword("int c_").literal(i).keyword(";").endline();
+    }
+    output.keyword("(void)").keyword(COutputter::ARENA_NAME).keyword(";").endline();
+    functions << body;
+    output.closeBlock().endline();
+}
+
+// Lambdas are written as static functions. Since C has no closures, lambdas may only use their own parameters and locals.
+std::string Converter::hoistLambda(const AstNode & node, const std::string & name)
+{
+    Scope scope(true);
+    std::string signature = "static pmml_value " + name + "(pm_arena * " + COutputter::ARENA_NAME;
+    for (size_t i = 0; i + 1 < node.children.size(); ++i)
+    {
+        const AstNode & parameter = node.children[i];
+        if (parameter.function().functionType != Function::FIELD_REF || isTable(parameter.fieldDescription->field.dataType))
+        {
+            unsupported(parameter, "a table or non-field lambda parameter");
+            return name;
+        }
+        scope.known.insert(parameter.fieldDescription->id);
+        signature += ", pmml_value ";
+        signature += COutputter::VARIABLE_PREFIX;
+        signature += parameter.fieldDescription->luaName;
+    }
+    signature += ")";
+    prototypes << signature << ";\n";
+
+    std::ostringstream body;
+    COutputter output(body, 1);
+    const AstNode & lambdaBody = node.children.back();
+    if (lambdaBody.function().functionType == Function::BLOCK && !lambdaBody.children.empty())
+    {
+        for (size_t i = 0; i + 1 < lambdaBody.children.size(); ++i)
+        {
+            statement(lambdaBody.children[i], scope, output);
+        }
+        output.keyword("return ");
+        expression(lambdaBody.children.back(), scope, output);
+        output.keyword(";").endline();
+    }
+    else
+    {
+        output.keyword("return ");
+        expression(lambdaBody, scope, output);
+        output.keyword(";").endline();
+    }
+    writeFunction(signature, scope, body.str(), nullptr);
+    return name;
+}
+
+void Converter::process(Function::UnaryOperator, const AstNode & node, Scope & scope, COutputter & output)
+{
+    if (strcmp(node.function().luaFunction, "-") != 0)
+    {
+        unsupported(node, node.function().luaFunction);
+        return;
+    }
+    call("pm_neg", false, node, scope, output);
+}
+
+void Converter::process(Function::NotOperator, const AstNode & node, Scope & scope, COutputter & output)
+{
+    call("pm_not", false, node, scope, output);
+}
+
+void Converter::process(Function::Operator, const AstNode & node, Scope & scope, COutputter & output)
+{
+    static const std::unordered_map<std::string, const char *> operators = {
+        {"*", "pm_mul"}, {"+", "pm_add"}, {"-", "pm_sub"}, {"/", "pm_div"}, {"%", "pm_mod"}, {"^", "pm_pow"}, {"..", "pm_concat"}
+    };
+    auto found = operators.find(node.function().luaFunction);
+    if (found == operators.end())
+    {
+        unsupported(node, node.function().luaFunction);
+        return;
+    }
+    if (node.children.size() == 1)
+    {
+        expression(node.children.front(), scope, output);
+        return;
+    }
+    if (strcmp(found->first.c_str(), "+") == 0 && weightedSum(node, scope, output))
+    {
+        return;
+    }
+    leftFold(found->second, found->first == "..", node, 0, node.children.size(), scope, output);
+}
+
+void Converter::process(Function::Comparison, const AstNode & node, Scope & scope, COutputter & output)
+{
+    static const std::unordered_map<std::string, const char *> comparisons = {
+        {"==", "pm_eq"}, {"~=", "pm_ne"}, {"<", "pm_lt"}, {"<=", "pm_le"}, {">", "pm_gt"}, {">=", "pm_ge"}
+    };
+    auto found = comparisons.find(node.function().luaFunction);
+    if (found == comparisons.end())
+    {
+        unsupported(node, node.function().luaFunction);
+        return;
+    }
+    call(found->second, false, node, scope, output);
+}
+
+void Converter::process(Function::BooleanXor, const AstNode & node, Scope & scope, COutputter & output)
+{
+    leftFold("pm_xor", false, node, 0, node.children.size(), scope, output);
+}
+
+void Converter::process(Function::Functionlike, const AstNode & node, Scope & scope, COutputter & output)
+{
+    struct CFunction
+    {
+        const char * name;
+        bool usesArena;
+        bool variadic;
+    };
+    static const std::unordered_map<std::string, CFunction> functionNames = {
+        {"math.abs", {"pm_abs", false, false}}, {"math.acos", {"pm_acos", false, false}}, {"math.asin", {"pm_asin", false, false}},
+        {"math.atan", {"pm_atan", false, false}}, {"math.ceil", {"pm_ceil", false, false}}, {"math.cos", {"pm_cos", false, false}},
+        {"math.cosh", {"pm_cosh", false, false}}, {"math.exp", {"pm_exp", false, false}}, {"math.floor", {"pm_floor", false, false}},
+        {"math.log", {"pm_log", false, false}}, {"math.sin", {"pm_sin", false, false}}, {"math.sinh", {"pm_sinh", false, false}},
+        {"math.sqrt", {"pm_sqrt", false, false}}, {"math.tan", {"pm_tan", false, false}}, {"math.tanh", {"pm_tanh", false, false}},
+        {"math.max", {"pm_max", false, true}}, {"math.min", {"pm_min", false, true}},
+        {"string.format", {"pm_format_number", true, false}}, {"string.lower", {"pm_lower", true, false}},
+        {"string.upper", {"pm_upper", true, false}}
+    };
+    auto found = node.function().luaFunction ? functionNames.find(node.function().luaFunction) : functionNames.end();
+    if (found == functionNames.end())
+    {
+        unsupported(node, node.function().luaFunction ? node.function().luaFunction : "this function");
+        return;
+    }
+    if (found->second.variadic)
+    {
+        leftFold(found->second.name, found->second.usesArena, node, 0, node.children.size(), scope, output);
+    }
+    else
+    {
+        call(found->second.name, found->second.usesArena, node, scope, output);
+    }
+}
+
+void Converter::process(Function::RoundMacro, const AstNode & node, Scope & scope, COutputter & output)
+{
+    call("pm_round", false, node, scope, output);
+}
+
+void Converter::process(Function::Log10Macro, const AstNode & node, Scope & scope, COutputter & output)
+{
+    call("pm_log10", false, node, scope, output);
+}
+
+void Converter::process(Function::MeanMacro, const AstNode & node, Scope & scope, COutputter & output)
+{
+    output.keyword("pm_div(");
+    leftFold("pm_add", false, node, 0, node.children.size(), scope, output);
+    output.comma().keyword("pm_num(").literal(node.children.size()).keyword(")").keyword(")");
+}
+
+// The predicate is stored in a temporary so that it is only evaluated once: missing -> missing, true -> b, false -> c
+void Converter::process(Function::TernaryMacro, const AstNode & node, Scope & scope, COutputter & output)
+{
+    const size_t condition = scope.nConditions++;
+    output.keyword("((c_").literal(condition).keyword(" = pm_condition(");
+    expression(node.children[0], scope, output);
+    output.keyword(")) > 0 ? ");
+    expression(node.children[1], scope, output);
+    output.keyword(" : c_").literal(condition).keyword(" == 0 ? ");
+    if (node.children.size() > 2)
+    {
+        expression(node.children[2], scope, output);
+    }
+    else
+    {
+        output.keyword("pm_missing()");
+    }
+    output.keyword(" : pm_missing())");
+}
+
+void Converter::process(Function::BoundMacro, const AstNode & node, Scope & scope, COutputter & output)
+{
+    call("pm_bound", false, node, scope, output);
+}
+
+void Converter::process(Function::IsMissing, const AstNode & node, Scope & scope, COutputter & output)
+{
+    call("pm_is_missing", false, node, scope, output);
+}
+
+void Converter::process(Function::IsNotMissing, const AstNode & node, Scope & scope, COutputter & output)
+{
+    call("pm_is_not_missing", false, node, scope, output);
+}
+
+void Converter::process(Function::IsIn, const AstNode & node, Scope & scope, COutputter & output)
+{
+    // and for isNotIn, or for isIn
+    const bool isIn = strcmp(node.function().luaFunction, "==") == 0;
+    if (node.children.size() < 2 || constantSet(node, isIn ? "pm_is_in" : "pm_is_not_in", scope, output))
+    {
+        return;
+    }
+
+    // Not everything is constant, build it out of comparisons.
+    for (size_t i = 2; i < node.children.size(); ++i)
+    {
+        output.keyword(isIn ? "pm_or(" : "pm_and(");
+    }
+    for (size_t i = 1; i < node.children.size(); ++i)
+    {
+        if (i > 1)
+        {
+            output.comma();
+        }
+        output.keyword(isIn ? "pm_eq(" : "pm_ne(");
+        expression(node.children.front(), scope, output);
+        output.comma();
+        expression(node.children[i], scope, output);
+        output.keyword(i > 1 ? "))" : ")");
+    }
+}
+
+void Converter::process(Function::SubstringMacro, const AstNode & node, Scope & scope, COutputter & output)
+{
+    call("pm_substring", true, node, scope, output);
+}
+
+void Converter::process(Function::TrimBlank, const AstNode & node, Scope & scope, COutputter & output)
+{
+    call("pm_trim", true, node, scope, output);
+}
+
+void Converter::process(Function::Constant, const AstNode & node, Scope &, COutputter & output)
+{
+    output.literal(node.content, node.coercedType);
+}
+
+void Converter::process(Function::FieldRef, const AstNode & node, Scope & scope, COutputter & output)
+{
+    if (!node.children.empty() || isTable(node.fieldDescription->field.dataType))
+    {
+        unsupported(node, "a table");
+        return;
+    }
+    if (node.fieldDescription->field.dataType == PMMLDocument::TYPE_LAMBDA || m_lambdaNames.count(node.fieldDescription->id))
+    {
+        unsupported(node, "a lambda used as a value");
+        return;
+    }
+    if (scope.known.find(node.fieldDescription->id) == scope.known.end())
+    {
+        if (scope.isLambda)
+        {
+            unsupported(node, "a lambda capturing a variable");
+            return;
+        }
+        addLocal(node.fieldDescription, scope);
+    }
+    output.field(node.fieldDescription);
+}
+
+// The first non-missing value.
+void Converter::process(Function::SurrogateMacro, const AstNode & node, Scope & scope, COutputter & output)
+{
+    leftFold("pm_default", false, node, 0, node.children.size(), scope, output);
+}
+
+void Converter::process(Function::BooleanAnd, const AstNode & node, Scope & scope, COutputter & output)
+{
+    leftFold("pm_and", false, node, 0, node.children.size(), scope, output);
+}
+
+void Converter::process(Function::BooleanOr, const AstNode & node, Scope & scope, COutputter & output)
+{
+    leftFold("pm_or", false, node, 0, node.children.size(), scope, output);
+}
+
+void Converter::process(Function::DefaultMacro, const AstNode & node, Scope & scope, COutputter & output)
+{
+    output.keyword("pm_default(");
+    expression(node.children.front(), scope, output);
+    output.comma().literal(node.content, node.type).keyword(")");
+}
+
+void Converter::process(Function::ThresholdMacro, const AstNode & node, Scope & scope, COutputter & output)
+{
+    call("pm_threshold", false, node, scope, output);
+}
+
+void Converter::process(Function::RunLambda, const AstNode & node, Scope & scope, COutputter & output)
+{
+    if (node.children.empty())
+    {
+        unsupported(node, "an empty lambda call");
+        return;
+    }
+    const AstNode & lambda = node.children.back();
+    std::string name;
+    if (lambda.function().functionType == Function::FIELD_REF)
+    {
+        auto found = m_lambdaNames.find(lambda.fieldDescription->id);
+        if (found == m_lambdaNames.end())
+        {
+            unsupported(node, "a lambda that is not declared before use");
+            return;
+        }
+        name = found->second;
+    }
+    else if (lambda.function().functionType == Function::LAMBDA)
+    {
+        name = hoistLambda(lambda, std::string(COutputter::LAMBDA_PREFIX) + "_inline_" + std::to_string(m_nextLambda++));
+    }
+    else
+    {
+        unsupported(node, "calling a computed lambda");
+        return;
+    }
+
+    output.keyword(name).keyword("(").keyword(COutputter::ARENA_NAME);
+    for (size_t i = 0; i + 1 < node.children.size(); ++i)
+    {
+        output.comma();
+        expression(node.children[i], scope, output);
+    }
+    output.keyword(")");
+}
+
+void Converter::process(Function::FunctionTypeBase, const AstNode & node, Scope &, COutputter &)
+{
+    unsupported(node, "this expression");
+}
+
+void StatementConverter::process(Function::Block, const AstNode & node, Scope & scope, COutputter & output)
+{
+    for (const AstNode & child : node.children)
+    {
+        m_converter.statement(child, scope, output);
+    }
+}
+
+void StatementConverter::process(Function::Declartion, const AstNode & node, Scope & scope, COutputter & output)
+{
+    const PMMLDocument::ConstFieldDescriptionPtr & field = node.fieldDescription;
+    // Not all lambda variables are typed as TYPE_LAMBDA (see Function::prologue), so go by what is being declared.
+    const bool isLambda = !node.children.empty() && node.children.front().function().functionType == Function::LAMBDA;
+    if (isLambda || field->field.dataType == PMMLDocument::TYPE_LAMBDA)
+    {
+        if (!isLambda || m_converter.m_lambdaNames.count(field->id))
+        {
+            m_converter.unsupported(node, "a lambda variable that is not a single definition");
+            return;
+        }
+        std::string name = COutputter::LAMBDA_PREFIX + field->luaName;
+        m_converter.m_lambdaNames.emplace(field->id, name);
+        m_converter.hoistLambda(node.children.front(), name);
+        return;
+    }
+    if (isTable(field->field.dataType))
+    {
+        m_converter.unsupported(node, "a table");
+        return;
+    }
+
+    // All variables are declared (as missing) at the top of the function, so a declaration is just an assignment.
+    m_converter.addLocal(field, scope);
+    if (!node.children.empty())
+    {
+        output.field(field).keyword(" = ");
+        m_converter.expression(node.children.front(), scope, output);
+        output.keyword(";").endline();
+    }
+}
+
+void StatementConverter::process(Function::Assignment, const AstNode & node, Scope & scope, COutputter & output)
+{
+    // The children apart from the first are indirections.
+    if (node.children.size() != 1 || isTable(node.fieldDescription->field.dataType) ||
+        node.fieldDescription->field.dataType == PMMLDocument::TYPE_LAMBDA)
+    {
+        m_converter.unsupported(node, "assignment to a table or lambda");
+        return;
+    }
+    if (scope.isLambda && scope.known.find(node.fieldDescription->id) == scope.known.end())
+    {
+        m_converter.unsupported(node, "a lambda capturing a variable");
+        return;
+    }
+    m_converter.addLocal(node.fieldDescription, scope);
+    output.field(node.fieldDescription).keyword(" = ");
+    m_converter.expression(node.children.front(), scope, output);
+    output.keyword(";").endline();
+}
+
+// Children are body, predicate, body, predicate... with an optional final else body.
+void StatementConverter::process(Function::IfChain, const AstNode & node, Scope & scope, COutputter & output)
+{
+    for (size_t i = 0; i < node.children.size(); i += 2)
+    {
+        if (i + 1 < node.children.size())
+        {
+            output.keyword(i == 0 ? "if (pm_is_true(" : "else if (pm_is_true(");
+            m_converter.expression(node.children[i + 1], scope, output);
+            output.keyword("))").endline();
+        }
+        else
+        {
+            output.keyword("else").endline();
+        }
+        output.openBlock();
+        m_converter.statement(node.children[i], scope, output);
+        output.closeBlock();
+    }
+}
+
+void StatementConverter::process(Function::ReturnStatement, const AstNode & node, Scope & scope, COutputter & output)
+{
+    if (scope.isLambda || node.children.size() != scope.nOutputs)
+    {
+        m_converter.unsupported(node, "a return statement that does not match the outputs");
+        return;
+    }
+    for (size_t i = 0; i < node.children.size(); ++i)
+    {
+        output.keyword("outputs[").literal(i).keyword("] = ");
+        m_converter.expression(node.children[i], scope, output);
+        output.keyword(";").endline();
+    }
+    output.keyword("return ").keyword(COutputter::ARENA_NAME).keyword("->exhausted ? -1 : 0;").endline();
+}
+
+void StatementConverter::process(Function::FunctionTypeBase, const AstNode & node, Scope & scope, COutputter & output)
+{
+    output.keyword("(void)");
+    m_converter.expression(node, scope, output);
+    output.keyword(";").endline();
+}
+
+bool CConverter::convertAstToC(const AstNode & node, const NamedFields & inputs, const std::vector<std::string> & outputNames,
+                               const char * functionName, std::ostream & output)
+{
+    if (!isIdentifier(functionName))
+    {
+        fprintf(stderr, "Cannot convert to C: \"%s\" is not a valid function name\n", functionName ? functionName : "");
+        return false;
+    }
+
+    Converter converter;
+    Scope scope(false);
+    scope.nOutputs = outputNames.size();
+
+    std::ostringstream initialisation;
+    initialisation << "pm_arena arenaState = { scratch, scratch + scratchSize, 0 };\n";
+    initialisation << "    pm_arena * " << COutputter::ARENA_NAME << " = &arenaState;";
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        const auto & field = inputs[i].second;
+        if (!field || isTable(field->field.dataType) || !scope.known.insert(field->id).second)
+        {
+            fprintf(stderr, "Cannot convert to C: input \"%s\" is missing, duplicated or a table\n", inputs[i].first.c_str());
+            return false;
+        }
+        initialisation << "\n    pmml_value " << COutputter::VARIABLE_PREFIX << field->luaName << " = inputs[" << i << "];";
+    }
+
+    std::ostringstream body;
+    {
+        COutputter bodyOutput(body, 1);
+        converter.statement(node, scope, bodyOutput);
+        const bool endsInReturn = node.function().functionType == Function::BLOCK && !node.children.empty() &&
+            node.children.back().function().functionType == Function::RETURN_STATEMENT;
+        if (!endsInReturn)
+        {
+            bodyOutput.keyword("(void)outputs;").endline();
+            bodyOutput.keyword("return ").keyword(COutputter::ARENA_NAME).keyword("->exhausted ? -1 : 0;").endline();
+        }
+    }
+
+    const std::string signature = std::string("int ") + functionName +
+        "(const pmml_value * inputs, pmml_value * outputs, char * scratch, size_t scratchSize)";
+    converter.writeFunction(signature, scope, body.str(), initialisation.str().c_str());
+
+    if (!converter.ok)
+    {
+        return false;
+    }
+
+    COutputter header(output);
+    header.keyword("/* Generated by pamplemousse. */").endline().runtime().endline();
+    header.keyword("const size_t ").keyword(functionName).keyword("_input_count = ").literal(inputs.size()).keyword(";").endline();
+    header.keyword("const char * const ").keyword(functionName).keyword("_input_names[] = {");
+    for (const auto & input : inputs)
+    {
+        header.stringLiteral(input.first.c_str()).keyword(", ");
+    }
+    header.keyword("NULL };").endline();
+    header.keyword("const size_t ").keyword(functionName).keyword("_output_count = ").literal(outputNames.size()).keyword(";").endline();
+    header.keyword("const char * const ").keyword(functionName).keyword("_output_names[] = {");
+    for (const auto & outputName : outputNames)
+    {
+        header.stringLiteral(outputName.c_str()).keyword(", ");
+    }
+    header.keyword("NULL };").endline().endline();
+
+    output << converter.constants.str() << '\n' << converter.prototypes.str() << '\n' << converter.functions.str();
+    return true;
+}
@@ -0,0 +1,46 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  This is an alternative backend to LuaConverter. It takes the same (optimised) AST and emits a self contained C99 translation
+//  unit that can be compiled into a host application or shared library.
+//
+//  The generated function looks like:
+//      int functionName(const pmml_value * inputs, pmml_value * outputs, char * scratch, size_t scratchSize);
+//  inputs and outputs are in the order given to convertAstToC, and are also described by functionName_input_names
+//  and functionName_output_names. Any strings created while scoring are allocated from scratch, the function returns -1 if
+//  that was too small and 0 otherwise.
+//
+//  Tables (as used by the table input/output formats and some reason code/median logic) have no C equivalent, models
+//  requiring them are rejected.
+
+#ifndef cconverter_hpp
+#define cconverter_hpp
+
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+#include "ast.hpp"
+
+namespace CConverter
+{
+    typedef std::vector<std::pair<std::string, PMMLDocument::ConstFieldDescriptionPtr>> NamedFields;
+
+    // Convert an AST (ending in a return statement with one child per output) to C source. Returns false (after printing
+    // the reason to stderr) if the AST uses anything that cannot be expressed in C.
+    bool convertAstToC(const AstNode & node, const NamedFields & inputs, const std::vector<std::string> & outputNames,
+                       const char * functionName, std::ostream & output);
+}
+
+#endif /* cconverter_hpp */
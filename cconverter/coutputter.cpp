@@ -0,0 +1,612 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "coutputter.hpp"
+#include "conversioncontext.hpp"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+
+const char * COutputter::VARIABLE_PREFIX = "v_";
+const char * COutputter::LAMBDA_PREFIX = "l_";
+const char * COutputter::ARENA_NAME = "arena";
+
+namespace
+{
+// The runtime mirrors what the generated Lua gets for free: nil (PMML_MISSING) propagates through every operation in the same
+// way that the Lua converter's null clauses do. All strings created at runtime are allocated from a caller supplied scratch buffer,
+// so the generated code never calls malloc.
+const char * RUNTIME_SOURCE = R"RUNTIME(#include <ctype.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#ifndef PMML_VALUE_DEFINED
+#define PMML_VALUE_DEFINED
+enum pmml_type
+{
+    PMML_MISSING = 0,
+    PMML_NUMBER = 1,
+    PMML_STRING = 2,
+    PMML_BOOL = 3
+};
+
+typedef struct pmml_value
+{
+    int type;
+    double number;
+    const char * string;
+} pmml_value;
+#endif
+
+typedef struct pm_arena
+{
+    char * next;
+    char * end;
+    int exhausted;
+} pm_arena;
+
+static inline pmml_value pm_missing(void) { pmml_value v; v.type = PMML_MISSING; v.number = 0; v.string = NULL; return v; }
+static inline pmml_value pm_num(double n) { pmml_value v; v.type = PMML_NUMBER; v.number = n; v.string = NULL; return v; }
+static inline pmml_value pm_bool(int b) { pmml_value v; v.type = PMML_BOOL; v.number = b ? 1 : 0; v.string = NULL; return v; }
+static inline pmml_value pm_str(const char * s) { pmml_value v; v.type = PMML_STRING; v.number = 0; v.string = s; return v; }
+
+static inline char * pm_alloc(pm_arena * arena, size_t size)
+{
+    char * out;
+    if ((size_t)(arena->end - arena->next) < size)
+    {
+        arena->exhausted = 1;
+        return NULL;
+    }
+    out = arena->next;
+    arena->next += size;
+    return out;
+}
+
+#define PM_ANY_MISSING(a, b) ((a).type == PMML_MISSING || (b).type == PMML_MISSING)
+
+/* Truthiness follows Lua: only missing (nil) and false are not true. */
+static inline int pm_is_true(pmml_value a) { return a.type == PMML_BOOL ? a.number != 0 : a.type != PMML_MISSING; }
+static inline int pm_is_false(pmml_value a) { return a.type == PMML_BOOL && a.number == 0; }
+/* Returns -1 for missing, otherwise 1 or 0. Used by "if" to evaluate its predicate once. */
+static inline int pm_condition(pmml_value a) { return a.type == PMML_MISSING ? -1 : pm_is_true(a); }
+
+static inline pmml_value pm_add(pmml_value a, pmml_value b) { return PM_ANY_MISSING(a, b) ? pm_missing() : pm_num(a.number + b.number); }
+static inline pmml_value pm_sub(pmml_value a, pmml_value b) { return PM_ANY_MISSING(a, b) ? pm_missing() : pm_num(a.number - b.number); }
+static inline pmml_value pm_mul(pmml_value a, pmml_value b) { return PM_ANY_MISSING(a, b) ? pm_missing() : pm_num(a.number * b.number); }
+static inline pmml_value pm_div(pmml_value a, pmml_value b) { return PM_ANY_MISSING(a, b) ? pm_missing() : pm_num(a.number / b.number); }
+static inline pmml_value pm_mod(pmml_value a, pmml_value b) { return PM_ANY_MISSING(a, b) ? pm_missing() : pm_num(a.number - floor(a.number / b.number) * b.number); }
+static inline pmml_value pm_pow(pmml_value a, pmml_value b) { return PM_ANY_MISSING(a, b) ? pm_missing() : pm_num(pow(a.number, b.number)); }
+static inline pmml_value pm_max(pmml_value a, pmml_value b) { return PM_ANY_MISSING(a, b) ? pm_missing() : pm_num(a.number < b.number ? b.number : a.number); }
+static inline pmml_value pm_min(pmml_value a, pmml_value b) { return PM_ANY_MISSING(a, b) ? pm_missing() : pm_num(b.number < a.number ? b.number : a.number); }
+static inline pmml_value pm_threshold(pmml_value a, pmml_value b) { return PM_ANY_MISSING(a, b) ? pm_missing() : pm_num(a.number > b.number ? 1 : 0); }
+static inline pmml_value pm_neg(pmml_value a) { return a.type == PMML_MISSING ? a : pm_num(-a.number); }
+static inline pmml_value pm_round(pmml_value a) { return a.type == PMML_MISSING ? a : pm_num(floor(a.number + 0.5)); }
+
+#define PM_MATH_FUNCTION(name, function) \
+static inline pmml_value name(pmml_value a) { return a.type == PMML_MISSING ? a : pm_num(function(a.number)); }
+PM_MATH_FUNCTION(pm_abs, fabs)
+PM_MATH_FUNCTION(pm_acos, acos)
+PM_MATH_FUNCTION(pm_asin, asin)
+PM_MATH_FUNCTION(pm_atan, atan)
+PM_MATH_FUNCTION(pm_ceil, ceil)
+PM_MATH_FUNCTION(pm_cos, cos)
+PM_MATH_FUNCTION(pm_cosh, cosh)
+PM_MATH_FUNCTION(pm_exp, exp)
+PM_MATH_FUNCTION(pm_floor, floor)
+PM_MATH_FUNCTION(pm_log, log)
+PM_MATH_FUNCTION(pm_log10, log10)
+PM_MATH_FUNCTION(pm_sin, sin)
+PM_MATH_FUNCTION(pm_sinh, sinh)
+PM_MATH_FUNCTION(pm_sqrt, sqrt)
+PM_MATH_FUNCTION(pm_tan, tan)
+PM_MATH_FUNCTION(pm_tanh, tanh)
+
+/* Sums weights[i] * values[i] onto bias, in the same order the Lua expression would. */
+static inline pmml_value pm_dot(pmml_value bias, const double * weights, const pmml_value * values, size_t n)
+{
+    double total = bias.number;
+    size_t i;
+    if (bias.type == PMML_MISSING)
+    {
+        return bias;
+    }
+    for (i = 0; i < n; ++i)
+    {
+        if (values[i].type == PMML_MISSING)
+        {
+            return pm_missing();
+        }
+        total += values[i].number * weights[i];
+    }
+    return pm_num(total);
+}
+
+static inline pmml_value pm_eq(pmml_value a, pmml_value b)
+{
+    if (PM_ANY_MISSING(a, b))
+    {
+        return pm_missing();
+    }
+    if (a.type != b.type)
+    {
+        return pm_bool(0);
+    }
+    if (a.type == PMML_STRING)
+    {
+        return pm_bool(strcmp(a.string, b.string) == 0);
+    }
+    return pm_bool(a.number == b.number);
+}
+
+static inline pmml_value pm_ne(pmml_value a, pmml_value b)
+{
+    pmml_value equal = pm_eq(a, b);
+    return equal.type == PMML_MISSING ? equal : pm_bool(equal.number == 0);
+}
+
+#define PM_ORDERING_FUNCTION(name, op) \
+static inline pmml_value name(pmml_value a, pmml_value b) \
+{ \
+    if (PM_ANY_MISSING(a, b) || a.type != b.type) \
+    { \
+        return pm_missing(); \
+    } \
+    return pm_bool(a.type == PMML_STRING ? strcmp(a.string, b.string) op 0 : a.number op b.number); \
+}
+PM_ORDERING_FUNCTION(pm_lt, <)
+PM_ORDERING_FUNCTION(pm_le, <=)
+PM_ORDERING_FUNCTION(pm_gt, >)
+PM_ORDERING_FUNCTION(pm_ge, >=)
+
+/* And and Or use PMML's three valued logic: a known result wins over a missing one. */
+static inline pmml_value pm_and(pmml_value a, pmml_value b)
+{
+    if (pm_is_false(a) || pm_is_false(b))
+    {
+        return pm_bool(0);
+    }
+    return PM_ANY_MISSING(a, b) ? pm_missing() : pm_bool(1);
+}
+
+static inline pmml_value pm_or(pmml_value a, pmml_value b)
+{
+    if (pm_is_true(a) || pm_is_true(b))
+    {
+        return pm_bool(1);
+    }
+    return PM_ANY_MISSING(a, b) ? pm_missing() : pm_bool(0);
+}
+
+static inline pmml_value pm_xor(pmml_value a, pmml_value b) { return PM_ANY_MISSING(a, b) ? pm_missing() : pm_bool(pm_is_true(a) != pm_is_true(b)); }
+static inline pmml_value pm_not(pmml_value a) { return a.type == PMML_MISSING ? a : pm_bool(!pm_is_true(a)); }
+static inline pmml_value pm_is_missing(pmml_value a) { return pm_bool(a.type == PMML_MISSING); }
+static inline pmml_value pm_is_not_missing(pmml_value a) { return pm_bool(a.type != PMML_MISSING); }
+static inline pmml_value pm_default(pmml_value a, pmml_value replacement) { return a.type == PMML_MISSING ? replacement : a; }
+static inline pmml_value pm_bound(pmml_value predicate, pmml_value a) { return pm_is_true(predicate) ? a : pm_missing(); }
+
+static inline pmml_value pm_is_in(pmml_value a, const pmml_value * set, size_t n)
+{
+    size_t i;
+    if (a.type == PMML_MISSING)
+    {
+        return a;
+    }
+    for (i = 0; i < n; ++i)
+    {
+        if (pm_is_true(pm_eq(a, set[i])))
+        {
+            return pm_bool(1);
+        }
+    }
+    return pm_bool(0);
+}
+
+static inline pmml_value pm_is_not_in(pmml_value a, const pmml_value * set, size_t n) { return pm_not(pm_is_in(a, set, n)); }
+
+/* Equivalent of Lua's tonumber: strings must be entirely numeric. */
+static inline pmml_value pm_tonumber(pmml_value a)
+{
+    char * end;
+    double value;
+    if (a.type == PMML_NUMBER || a.type == PMML_MISSING)
+    {
+        return a;
+    }
+    if (a.type != PMML_STRING)
+    {
+        return pm_missing();
+    }
+    value = strtod(a.string, &end);
+    while (isspace((unsigned char)*end))
+    {
+        end++;
+    }
+    if (end == a.string || *end != '\0')
+    {
+        return pm_missing();
+    }
+    return pm_num(value);
+}
+
+static inline pmml_value pm_tostring(pm_arena * arena, pmml_value a)
+{
+    char * buffer;
+    if (a.type == PMML_STRING || a.type == PMML_MISSING)
+    {
+        return a;
+    }
+    if (a.type == PMML_BOOL)
+    {
+        return pm_str(a.number != 0 ? "true" : "false");
+    }
+    buffer = pm_alloc(arena, 32);
+    if (buffer == NULL)
+    {
+        return pm_missing();
+    }
+    snprintf(buffer, 32, "%.14g", a.number);
+    return pm_str(buffer);
+}
+
+static inline pmml_value pm_concat(pm_arena * arena, pmml_value a, pmml_value b)
+{
+    size_t lengthA;
+    size_t lengthB;
+    char * buffer;
+    a = pm_tostring(arena, a);
+    b = pm_tostring(arena, b);
+    if (PM_ANY_MISSING(a, b))
+    {
+        return pm_missing();
+    }
+    lengthA = strlen(a.string);
+    lengthB = strlen(b.string);
+    buffer = pm_alloc(arena, lengthA + lengthB + 1);
+    if (buffer == NULL)
+    {
+        return pm_missing();
+    }
+    memcpy(buffer, a.string, lengthA);
+    memcpy(buffer + lengthA, b.string, lengthB + 1);
+    return pm_str(buffer);
+}
+
+static inline pmml_value pm_copy_string(pm_arena * arena, pmml_value a, size_t start, size_t length, int (*transform)(int))
+{
+    char * buffer;
+    size_t i;
+    buffer = pm_alloc(arena, length + 1);
+    if (buffer == NULL)
+    {
+        return pm_missing();
+    }
+    for (i = 0; i < length; ++i)
+    {
+        char c = a.string[start + i];
+        buffer[i] = transform ? (char)transform((unsigned char)c) : c;
+    }
+    buffer[length] = '\0';
+    return pm_str(buffer);
+}
+
+static inline pmml_value pm_lower(pm_arena * arena, pmml_value a)
+{
+    a = pm_tostring(arena, a);
+    return a.type == PMML_MISSING ? a : pm_copy_string(arena, a, 0, strlen(a.string), tolower);
+}
+
+static inline pmml_value pm_upper(pm_arena * arena, pmml_value a)
+{
+    a = pm_tostring(arena, a);
+    return a.type == PMML_MISSING ? a : pm_copy_string(arena, a, 0, strlen(a.string), toupper);
+}
+
+/* PMML substrings are a 1 based start and a length, clamped to the string like string.sub. */
+static inline pmml_value pm_substring(pm_arena * arena, pmml_value a, pmml_value start, pmml_value length)
+{
+    double first;
+    double last;
+    double size;
+    a = pm_tostring(arena, a);
+    if (PM_ANY_MISSING(a, start) || length.type == PMML_MISSING)
+    {
+        return pm_missing();
+    }
+    size = (double)strlen(a.string);
+    first = start.number < 1 ? 1 : floor(start.number);
+    last = floor(start.number) + floor(length.number) - 1;
+    if (last > size)
+    {
+        last = size;
+    }
+    if (first > last)
+    {
+        return pm_str("");
+    }
+    return pm_copy_string(arena, a, (size_t)first - 1, (size_t)(last - first) + 1, NULL);
+}
+
+static inline pmml_value pm_trim(pm_arena * arena, pmml_value a)
+{
+    size_t start = 0;
+    size_t end;
+    a = pm_tostring(arena, a);
+    if (a.type == PMML_MISSING)
+    {
+        return a;
+    }
+    end = strlen(a.string);
+    while (start < end && isspace((unsigned char)a.string[start]))
+    {
+        start++;
+    }
+    while (end > start && isspace((unsigned char)a.string[end - 1]))
+    {
+        end--;
+    }
+    return pm_copy_string(arena, a, start, end - start, NULL);
+}
+
+/* Integer conversions are handed a long long, as Lua's string.format would do, everything else gets the double. */
+static inline pmml_value pm_format_number(pm_arena * arena, pmml_value format, pmml_value a)
+{
+    char specifier[32];
+    const char * conversion;
+    char * buffer;
+    size_t prefixLength;
+    int written;
+    if (PM_ANY_MISSING(format, a) || format.type != PMML_STRING || a.type != PMML_NUMBER)
+    {
+        return pm_missing();
+    }
+    conversion = strchr(format.string, '%');
+    if (conversion == NULL)
+    {
+        return format;
+    }
+    conversion += strspn(conversion + 1, "-+ #0123456789.") + 1;
+    prefixLength = (size_t)(conversion - format.string);
+    if (prefixLength + 3 >= sizeof(specifier) || strchr(conversion + 1, '%') != NULL)
+    {
+        return pm_missing();
+    }
+    buffer = pm_alloc(arena, 64);
+    if (buffer == NULL)
+    {
+        return pm_missing();
+    }
+    memcpy(specifier, format.string, prefixLength);
+    if (*conversion == 'd' || *conversion == 'i')
+    {
+        specifier[prefixLength] = 'l';
+        specifier[prefixLength + 1] = 'l';
+        specifier[prefixLength + 2] = *conversion;
+        specifier[prefixLength + 3] = '\0';
+        written = snprintf(buffer, 64, specifier, (long long)a.number);
+    }
+    else if (*conversion != '\0' && strchr("eEfgG", *conversion) != NULL)
+    {
+        specifier[prefixLength] = *conversion;
+        specifier[prefixLength + 1] = '\0';
+        written = snprintf(buffer, 64, specifier, a.number);
+    }
+    else
+    {
+        return pm_missing();
+    }
+    if (written < 0 || written >= 64)
+    {
+        return pm_missing();
+    }
+    if (conversion[1] != '\0')
+    {
+        return pm_concat(arena, pm_str(buffer), pm_str(conversion + 1));
+    }
+    return pm_str(buffer);
+}
+)RUNTIME";
+}
+
+COutputter::COutputter(std::ostream & output, int indentLevel) :
+    m_output(output),
+    m_indentLevel(indentLevel),
+    m_atLineStart(true)
+{
+    m_output.precision(17); // 17 digits is required to ensure that value is rounded down to its original value.
+}
+
+void COutputter::doIndent()
+{
+    if (m_atLineStart)
+    {
+        for (int i = 0; i < m_indentLevel; ++i)
+        {
+            m_output << "    ";
+        }
+        m_atLineStart = false;
+    }
+}
+
+COutputter & COutputter::runtime()
+{
+    m_output << RUNTIME_SOURCE;
+    m_atLineStart = true;
+    return *this;
+}
+
+COutputter & COutputter::keyword(const char * keyword)
+{
+    doIndent();
+    m_output << keyword;
+    return *this;
+}
+
+COutputter & COutputter::endline()
+{
+    m_output << '\n';
+    m_atLineStart = true;
+    return *this;
+}
+
+COutputter & COutputter::comma()
+{
+    return keyword(", ");
+}
+
+COutputter & COutputter::openBlock()
+{
+    keyword("{").endline();
+    m_indentLevel++;
+    return *this;
+}
+
+COutputter & COutputter::closeBlock()
+{
+    m_indentLevel--;
+    return keyword("}").endline();
+}
+
+COutputter & COutputter::stringLiteral(const char * literalString)
+{
+    doIndent();
+    m_output << '"';
+    for (const char * thisChar = literalString; *thisChar != '\0'; thisChar++)
+    {
+        const unsigned char c = static_cast<unsigned char>(*thisChar);
+        switch (c)
+        {
+            case '\n':
+                m_output << "\\n";
+                break;
+            case '\t':
+                m_output << "\\t";
+                break;
+            case '\r':
+                m_output << "\\r";
+                break;
+            case '\\':
+                m_output << "\\\\";
+                break;
+            case '"':
+                m_output << "\\\"";
+                break;
+            case '?':
+                // Prevents accidental trigraphs
+                m_output << "\\?";
+                break;
+            default:
+                if (c < 0x20 || c >= 0x7f)
+                {
+                    // Octal escapes, unlike hex ones, never swallow the characters that follow.
+                    m_output << '\\' << char('0' + (c >> 6)) << char('0' + ((c >> 3) & 7)) << char('0' + (c & 7));
+                }
+                else
+                {
+                    m_output << *thisChar;
+                }
+                break;
+        }
+    }
+    m_output << '"';
+    return *this;
+}
+
+bool COutputter::translateNumber(const std::string & literalString, std::string & out)
+{
+    // These are constants that are written as Lua expressions by some models.
+    if (literalString == "math.pi")
+    {
+        out = "3.14159265358979323846";
+        return true;
+    }
+    if (literalString == "(1 / math.pi)")
+    {
+        out = "(1 / 3.14159265358979323846)";
+        return true;
+    }
+
+    const char * start = literalString.c_str();
+    char * end = nullptr;
+    double value = strtod(start, &end);
+    if (end == start || *end != '\0')
+    {
+        return false;
+    }
+    if (std::isnan(value))
+    {
+        out = "NAN";
+    }
+    else if (std::isinf(value))
+    {
+        out = value < 0 ? "-HUGE_VAL" : "HUGE_VAL";
+    }
+    else
+    {
+        // Reformat rather than copy, strtod accepts a few things (like hex) that are not valid double literals in C.
+        std::ostringstream formatted;
+        formatted.precision(17);
+        formatted << value;
+        out = formatted.str();
+    }
+    return true;
+}
+
+COutputter & COutputter::numberLiteral(const std::string & literalString)
+{
+    std::string translated;
+    if (!translateNumber(literalString, translated))
+    {
+        translated = "NAN";
+    }
+    return keyword(translated);
+}
+
+COutputter & COutputter::literal(size_t literal)
+{
+    doIndent();
+    m_output << literal;
+    return *this;
+}
+
+COutputter & COutputter::literal(const std::string & literalString, PMMLDocument::FieldType type)
+{
+    std::string translated;
+    if (type == PMMLDocument::TYPE_STRING)
+    {
+        return keyword("pm_str(").stringLiteral(literalString.c_str()).keyword(")");
+    }
+    else if (type == PMMLDocument::TYPE_BOOL ||
+             PMMLDocument::strcasecmp(literalString.c_str(), "true") == 0 ||
+             PMMLDocument::strcasecmp(literalString.c_str(), "false") == 0)
+    {
+        return keyword(PMMLDocument::strcasecmp(literalString.c_str(), "true") == 0 ? "pm_bool(1)" : "pm_bool(0)");
+    }
+    else if (translateNumber(literalString, translated))
+    {
+        return keyword("pm_num(").keyword(translated).keyword(")");
+    }
+    // Lua would read an unknown identifier as nil.
+    return keyword("pm_missing()");
+}
+
+COutputter & COutputter::field(const PMMLDocument::ConstFieldDescriptionPtr & fieldDescription)
+{
+    return keyword(VARIABLE_PREFIX).keyword(fieldDescription->luaName);
+}
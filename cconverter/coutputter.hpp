@@ -0,0 +1,67 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  This is the C equivalent of LuaOutputter. It is a lot simpler, since the generated C is mostly calls to the
+//  small runtime written out by runtime(), so there is no operator precedence to worry about.
+
+#ifndef coutputter_hpp
+#define coutputter_hpp
+
+#include <ostream>
+#include <string>
+
+#include "pmmldocumentdefs.hpp"
+
+class COutputter
+{
+    std::ostream & m_output;
+    int m_indentLevel;
+    bool m_atLineStart;
+    void doIndent();
+public:
+    // Prefixes for generated identifiers, so PMML names can never collide with C keywords or the runtime.
+    static const char * VARIABLE_PREFIX;
+    static const char * LAMBDA_PREFIX;
+    static const char * ARENA_NAME;
+
+    COutputter(std::ostream & output, int indentLevel = 0);
+
+    // Writes out the type definitions and helper functions that all generated code relies on.
+    COutputter & runtime();
+
+    COutputter & keyword(const char * keyword);
+    COutputter & keyword(const std::string & keyword)
+    {
+        return this->keyword(keyword.c_str());
+    }
+    COutputter & endline();
+    COutputter & comma();
+    COutputter & openBlock();
+    COutputter & closeBlock();
+
+    // These write raw C literals.
+    COutputter & stringLiteral(const char * literalString);
+    COutputter & numberLiteral(const std::string & literalString);
+    COutputter & literal(size_t literal);
+
+    // This writes a literal wrapped as a pmml_value of the given type.
+    COutputter & literal(const std::string & literalString, PMMLDocument::FieldType type);
+
+    COutputter & field(const PMMLDocument::ConstFieldDescriptionPtr & fieldDescription);
+
+    // Checks if literalString can be written as a C double literal, writing the C version into out
+    static bool translateNumber(const std::string & literalString, std::string & out);
+};
+
+#endif /* coutputter_hpp */
@@ -19,6 +19,7 @@
 #include "analyser.hpp"
 #include "functiondispatch.hpp"
 #include "conversioncontext.hpp"
+#include "framestack.hpp"
 #include <algorithm>
 #include <assert.h>
 
@@ -252,54 +253,6 @@ namespace
             }
         }
         
-        static void process(Function::Block, const AstNode & node, Assumption, NonNoneAssertionStackGuard & assertions)
-        {
-            for (const AstNode & childNode : node.children)
-            {
-                assertions.addAssertionsForCheck(childNode, NO_ASSUMPTIONS);
-            }
-        }
-        
-        static void process(Function::IfChain, const AstNode & node, Assumption assumption, NonNoneAssertionStackGuard & assertions)
-        {
-            // Essentially, the assertions drawn from an if chain is the intersection of the paths leading to this point.
-            NonNoneAssertionStackGuard::AssertionIntersection intersection;
-            ChildAssertionIterator iter(assertions.context(), node);
-            bool startedIntersection = false;
-            bool implicitElse = true;
-            for (;iter.valid(); ++iter)
-            {
-                NonNoneAssertionStackGuard localAssertions(assertions.context());
-                localAssertions.addAssertionsForCheck(*iter, assumption);
-                
-                if (!startedIntersection)
-                {
-                    intersection.add(iter);
-                    intersection.add(localAssertions);
-                    startedIntersection = true;
-                }
-                else
-                {
-                    intersection.intersect(iter, localAssertions);
-                }
-                
-                // If the last time we increment this, it's still valid, it means that there is no explicit else clause
-                // If the last predicate always evaluates to true, that's as good as an else though.
-                if (!(++iter).valid() ||
-                    assertions.context().checkIfTrivial(*iter) == ALWAYS_TRUE)
-                {
-                    implicitElse = false;
-                    break;
-                }
-            }
-            // no else clause? Essentially make a blank else clause with JUST the false assertions of the if statements.
-            if (implicitElse)
-            {
-                intersection.intersect(iter);
-            }
-            intersection.apply(assertions);
-        }
-        
         static void process(Function::TernaryMacro, const AstNode & node, Assumption assumption, NonNoneAssertionStackGuard & assertions)
         {
             if (!(assumption == NO_ASSUMPTIONS || assumption == ASSUME_MISSING))
@@ -352,9 +305,13 @@ namespace
             assertions.addAssertionsForCheck(node.children.back(), assumption);
         }
         
-        static void process(Function::FieldRef, const AstNode & node, Assumption, NonNoneAssertionStackGuard & assertions)
+        static void process(Function::FieldRef, const AstNode & node, Assumption assumption, NonNoneAssertionStackGuard & assertions)
         {
-            assertions.addVariableAssertion(*node.fieldDescription);
+            // A variable that was only found not to be true, or not to be false, may have been missing.
+            if (assumption == ASSUME_NOT_MISSING || assumption == ASSUME_TRUE || assumption == ASSUME_FALSE)
+            {
+                assertions.addVariableAssertion(*node.fieldDescription);
+            }
         }
         
         // Catch all
@@ -374,6 +331,147 @@ namespace
         }
     };
     
+    // Blocks and if chains can be nested thousands deep, so rather than recursing through AddAssertionsForCheck, the assertions
+    // of statements are added by this. It keeps a Frame for each statement from the outermost down to the one being looked at.
+    class StatementAssertions
+    {
+        struct Frame
+        {
+            const AstNode & node;
+            const Assumption assumption;
+            NonNoneAssertionStackGuard & assertions;
+            // For blocks, this doesn't maintain assertions, and is only used to count through the children.
+            ChildAssertionIterator iter;
+            // For if chains, what the branch being looked at asserts, and the intersection of the paths leading to the end of the chain.
+            NonNoneAssertionStackGuard localAssertions;
+            NonNoneAssertionStackGuard::AssertionIntersection intersection;
+            bool startedIntersection = false;
+            bool visitingChild = false;
+
+            Frame(AnalyserContext & context, const AstNode & n, Assumption a, NonNoneAssertionStackGuard & target) :
+                node(n),
+                assumption(a),
+                assertions(target),
+                iter(context, n, n.function().functionType == Function::IF_CHAIN),
+                localAssertions(context)
+            {
+            }
+        };
+
+        AnalyserContext & m_context;
+        FrameStack<Frame> m_frames;
+
+        // This adds what node asserts to assertions, or if it is a statement, starts a frame for it and returns true.
+        bool add(const AstNode & node, Assumption assumption, NonNoneAssertionStackGuard & assertions)
+        {
+            if (isStatement(node))
+            {
+                m_frames.push(m_context, node, assumption, assertions);
+                return true;
+            }
+            assertions.addAssertionsForCheck(node, assumption);
+            return false;
+        }
+
+        // These return true if they have started a frame for a child, or false once the statement is finished.
+        bool processBlock(Frame & frame)
+        {
+            for (; frame.iter.valid(); ++frame.iter)
+            {
+                if (add(*frame.iter, NO_ASSUMPTIONS, frame.assertions))
+                {
+                    ++frame.iter;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool processIfChain(Frame & frame)
+        {
+            // Essentially, the assertions drawn from an if chain is the intersection of the paths leading to this point.
+            ChildAssertionIterator & iter = frame.iter;
+            bool implicitElse = true;
+            for (;;)
+            {
+                if (frame.visitingChild)
+                {
+                    frame.visitingChild = false;
+                    if (!frame.startedIntersection)
+                    {
+                        frame.intersection.add(iter);
+                        frame.intersection.add(frame.localAssertions);
+                        frame.startedIntersection = true;
+                    }
+                    else
+                    {
+                        frame.intersection.intersect(iter, frame.localAssertions);
+                    }
+                    
+                    // If the last time we increment this, it's still valid, it means that there is no explicit else clause
+                    // If the last predicate always evaluates to true, that's as good as an else though.
+                    const bool lastBranch = !(++iter).valid() || m_context.checkIfTrivial(*iter) == ALWAYS_TRUE;
+                    frame.localAssertions.clear();
+                    if (lastBranch)
+                    {
+                        implicitElse = false;
+                        break;
+                    }
+                    ++iter;
+                }
+                else if (iter.valid())
+                {
+                    frame.visitingChild = true;
+                    if (add(*iter, frame.assumption, frame.localAssertions))
+                    {
+                        return true;
+                    }
+                }
+                else
+                {
+                    break;
+                }
+            }
+            // no else clause? Essentially make a blank else clause with JUST the false assertions of the if statements.
+            if (implicitElse)
+            {
+                frame.intersection.intersect(iter);
+            }
+            frame.intersection.apply(frame.assertions);
+            return false;
+        }
+    public:
+        explicit StatementAssertions(AnalyserContext & context) :
+            m_context(context)
+        {
+        }
+
+        static bool isStatement(const AstNode & node)
+        {
+            return node.function().functionType == Function::BLOCK || node.function().functionType == Function::IF_CHAIN;
+        }
+
+        void run(const AstNode & node, Assumption assumption, NonNoneAssertionStackGuard & assertions)
+        {
+            add(node, assumption, assertions);
+            while (!m_frames.empty())
+            {
+                Frame & frame = m_frames.back();
+                const bool startedChild = frame.node.function().functionType == Function::BLOCK ? processBlock(frame) : processIfChain(frame);
+                if (startedChild)
+                {
+                    continue;
+                }
+                // Unknown values may be treated as false in if statements, so we cannot assume known as well.
+                if (frame.assumption == ASSUME_NOT_MISSING || frame.assumption == ASSUME_TRUE || frame.assumption == ASSUME_FALSE)
+                {
+                    frame.assertions.addClauseAssertion(frame.node.id);
+                }
+                m_frames.pop();
+            }
+        }
+    };
+    
     class CheckIfTrivial
     {
     public:
@@ -633,6 +731,13 @@ const AstNode * ChildAssertionIterator::operator->()
 // It makes things like dead code removal, as well as non-missing assertions far more aggressive.
 void NonNoneAssertionStackGuard::addAssertionsForCheck(const AstNode & node, Assumption assumption)
 {
+    if (StatementAssertions::isStatement(node))
+    {
+        StatementAssertions statementAssertions(m_context);
+        statementAssertions.run(node, assumption, *this);
+        return;
+    }
+    
     AddAssertionsForCheck addAssertionsForCheck;
     Function::dispatchFunctionType<void>(addAssertionsForCheck, node.function().functionType, node, assumption, *this);
     
@@ -643,46 +748,56 @@ void NonNoneAssertionStackGuard::addAssertionsForCheck(const AstNode & node, Ass
     }
 }
     
-void NonNoneAssertionStackGuard::AssertionIntersection::addToIntersection(VarSet & vs, ClauseSet & cs, const NonNoneAssertionStackGuard & src) const
+void NonNoneAssertionStackGuard::AssertionIntersection::gather(VarSet & vs, ClauseSet & cs, const NonNoneAssertionStackGuard & src)
+{
+    vs.insert(vs.end(), src.m_frameContentVariables.begin(), src.m_frameContentVariables.end());
+    cs.insert(cs.end(), src.m_frameContentClauses.begin(), src.m_frameContentClauses.end());
+}
+
+void NonNoneAssertionStackGuard::AssertionIntersection::gather(VarSet & vs, ClauseSet & cs, const Analyser::ChildAssertionIterator & src)
 {
-    for (const auto & i : src.m_frameContentVariables)
+    gather(vs, cs, src.runningAssertions);
+    gather(vs, cs, src.blockAssertions);
+}
+
+void NonNoneAssertionStackGuard::AssertionIntersection::sortAndRemoveDuplicates(std::vector<unsigned int> & ids)
+{
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+}
+
+// This leaves only the IDs that are also in others, which doesn't need to be sorted beforehand.
+void NonNoneAssertionStackGuard::AssertionIntersection::keepCommon(std::vector<unsigned int> & ids, std::vector<unsigned int> & others)
+{
+    std::sort(others.begin(), others.end());
+    auto kept = ids.begin();
+    auto other = others.begin();
+    for (unsigned int id : ids)
     {
-        if (variables.count(i->first))
+        while (other != others.end() && *other < id)
         {
-            vs.insert(i->first);
+            ++other;
         }
-    }
-    for (const auto & i :src.m_frameContentClauses)
-    {
-        if (clauses.count(i->first))
+        if (other != others.end() && *other == id)
         {
-            cs.insert(i->first);
+            *kept++ = id;
         }
     }
-}
-
-void NonNoneAssertionStackGuard::AssertionIntersection::addToIntersection(VarSet & vs, ClauseSet & cs, const Analyser::ChildAssertionIterator & src) const
-{
-    addToIntersection(vs, cs, src.runningAssertions);
-    addToIntersection(vs, cs, src.blockAssertions);
+    ids.erase(kept, ids.end());
 }
 
 void NonNoneAssertionStackGuard::AssertionIntersection::add(const NonNoneAssertionStackGuard & src)
 {
-    for (const auto & i : src.m_frameContentVariables)
-    {
-        variables.insert(i->first);
-    }
-    for (const auto & i : src.m_frameContentClauses)
-    {
-        clauses.insert(i->first);
-    }
+    gather(variables, clauses, src);
+    sortAndRemoveDuplicates(variables);
+    sortAndRemoveDuplicates(clauses);
 }
 
 void NonNoneAssertionStackGuard::AssertionIntersection::add(const Analyser::ChildAssertionIterator & src)
 {
-    add(src.runningAssertions);
-    add(src.blockAssertions);
+    gather(variables, clauses, src);
+    sortAndRemoveDuplicates(variables);
+    sortAndRemoveDuplicates(clauses);
 }
 
 void NonNoneAssertionStackGuard::AssertionIntersection::apply(NonNoneAssertionStackGuard & guard) const
@@ -19,10 +19,9 @@
 #ifndef analyser_hpp
 #define analyser_hpp
 
-#include <list>
+#include <memory>
 #include <string>
-#include <unordered_map>
-#include <unordered_set>
+#include <vector>
 #include "ast.hpp"
 
 namespace Analyser
@@ -38,6 +37,42 @@ namespace Analyser
         ASSUME_NOT_FALSE
     };
     
+    // This counts how many times each field or AST node ID has been asserted not to be missing. IDs are handed out from counters,
+    // so the counts are indexed directly by ID. They are kept in pages which are only allocated once something in them is
+    // asserted, as a context is often only used for a small part of a big tree.
+    class AssertionCounts
+    {
+        static const unsigned int PAGE_BITS = 12;
+        static const unsigned int PAGE_SIZE = 1 << PAGE_BITS;
+        std::vector<std::unique_ptr<size_t[]>> m_pages;
+    public:
+        bool contains(unsigned int id) const
+        {
+            const size_t page = id >> PAGE_BITS;
+            return page < m_pages.size() && m_pages[page] && m_pages[page][id & (PAGE_SIZE - 1)] != 0;
+        }
+
+        void add(unsigned int id)
+        {
+            const size_t page = id >> PAGE_BITS;
+            if (page >= m_pages.size())
+            {
+                m_pages.resize(page + 1);
+            }
+            if (!m_pages[page])
+            {
+                m_pages[page].reset(new size_t[PAGE_SIZE]());
+            }
+            ++m_pages[page][id & (PAGE_SIZE - 1)];
+        }
+
+        // This must only be called for IDs that have been added.
+        void remove(unsigned int id)
+        {
+            --m_pages[id >> PAGE_BITS][id & (PAGE_SIZE - 1)];
+        }
+    };
+
     // This represents a particular point of execution and what is known (or can be inferred) to be true, false or not missing at that point.
     // It is created empty (representing the totally unknown state at the beginning of the generated program) and is mutated by
     // NonNoneAssertionStackGuard and ChildAssertionIterator to represent moving through the tree.
@@ -48,14 +83,14 @@ namespace Analyser
         // It allows us to skip a bunch of unneeded conditions.
         bool mightVariableBeMissing(const PMMLDocument::FieldDescription & field) const
         {
-            return m_assertNotMissing.find(field.id) == m_assertNotMissing.end();
+            return !m_assertNotMissing.contains(field.id);
         }
         
         // This checks if an assertion has already been made up the stack that this expression isn't missing.
         // It allows us to skip a bunch of unneeded conditions.
         bool mightClauseBeMissing(unsigned int clauseID) const
         {
-            return m_assertClauseNotMissing.find(clauseID) == m_assertClauseNotMissing.end();
+            return !m_assertClauseNotMissing.contains(clauseID);
         }
         
         // Returns true if the node in this context may possibly evaluate to an unknown value.
@@ -64,9 +99,9 @@ namespace Analyser
         TrivialValue checkIfTrivial(const AstNode & node);
     private:
         // This is a set of variables that cannot be null in this context
-        std::unordered_map<unsigned int, size_t> m_assertNotMissing;
+        AssertionCounts m_assertNotMissing;
         // This is a set of ASTNode ids that cannot be null in this context
-        std::unordered_map<unsigned int, size_t> m_assertClauseNotMissing;
+        AssertionCounts m_assertClauseNotMissing;
         
         friend class NonNoneAssertionStackGuard;
     };
@@ -83,29 +118,34 @@ namespace Analyser
     class NonNoneAssertionStackGuard
     {
         AnalyserContext & m_context;
-        std::vector<std::unordered_map<unsigned int, size_t>::iterator> m_frameContentVariables;
-        std::vector<std::unordered_map<unsigned int, size_t>::iterator> m_frameContentClauses;
+        std::vector<unsigned int> m_frameContentVariables;
+        std::vector<unsigned int> m_frameContentClauses;
         NonNoneAssertionStackGuard(const NonNoneAssertionStackGuard &) = delete;
         
     public:
         // Used to find an intersection of assertions, finding the minimum set of assertions of any of multiple branches.
         class AssertionIntersection
         {
-            typedef std::unordered_set<unsigned int> VarSet;
-            typedef std::unordered_set<unsigned int> ClauseSet;
+            // These are kept sorted, which makes intersecting them a single pass over each. There are usually only a handful
+            // of assertions in each branch, so this is much cheaper than hashing them.
+            typedef std::vector<unsigned int> VarSet;
+            typedef std::vector<unsigned int> ClauseSet;
             VarSet variables;
             ClauseSet clauses;
-            void addToIntersection(VarSet & vs, ClauseSet & cs, const NonNoneAssertionStackGuard & src) const;
-            void addToIntersection(VarSet & vs, ClauseSet & cs, const ChildAssertionIterator & src) const;
-            void addIfIntersects(VarSet &, ClauseSet &) const {}
+            static void gather(VarSet & vs, ClauseSet & cs, const NonNoneAssertionStackGuard & src);
+            static void gather(VarSet & vs, ClauseSet & cs, const ChildAssertionIterator & src);
+            static void gatherAll(VarSet &, ClauseSet &) {}
             
             template<typename T, typename... Args>
-            void addIfIntersects(VarSet & vs, ClauseSet & cs, const T & first, const Args & ... args) const
+            static void gatherAll(VarSet & vs, ClauseSet & cs, const T & first, const Args & ... args)
             {
-                addToIntersection(vs, cs, first);
-                addIfIntersects(vs, cs, args...);
+                gather(vs, cs, first);
+                gatherAll(vs, cs, args...);
             }
             
+            static void sortAndRemoveDuplicates(std::vector<unsigned int> & ids);
+            static void keepCommon(std::vector<unsigned int> & ids, std::vector<unsigned int> & others);
+            
         public:
             void add(const NonNoneAssertionStackGuard & src);
             void add(const ChildAssertionIterator & src);
@@ -116,12 +156,10 @@ namespace Analyser
             {
                 VarSet new_variables;
                 ClauseSet new_clauses;
-                new_variables.reserve(variables.size());
-                new_clauses.reserve(clauses.size());
-                addIfIntersects(new_variables, new_clauses, args...);
+                gatherAll(new_variables, new_clauses, args...);
                 
-                variables.swap(new_variables);
-                clauses.swap(new_clauses);
+                keepCommon(variables, new_variables);
+                keepCommon(clauses, new_clauses);
             }
             void apply(NonNoneAssertionStackGuard & guard) const;
         };
@@ -130,13 +168,14 @@ namespace Analyser
         {}
         
         AnalyserContext & context() { return m_context; }
+        // What this guard has asserted, in the order it was asserted.
+        const std::vector<unsigned int> & variableIDs() const { return m_frameContentVariables; }
+        const std::vector<unsigned int> & clauseIDs() const { return m_frameContentClauses; }
         // Mark a variable as not being missing
         void addVariableAssertionByID(unsigned int fieldID)
         {
-            auto inserted = m_context.m_assertNotMissing.emplace(fieldID, 0);
-            // Increase ref count
-            ++inserted.first->second;
-            m_frameContentVariables.push_back(inserted.first);
+            m_context.m_assertNotMissing.add(fieldID);
+            m_frameContentVariables.push_back(fieldID);
         }
         
         void addVariableAssertion(const PMMLDocument::FieldDescription & field)
@@ -146,27 +185,19 @@ namespace Analyser
         // Mark an AST noode as not being missing
         void addClauseAssertion(unsigned int clauseID)
         {
-            auto inserted = m_context.m_assertClauseNotMissing.emplace(clauseID, 0);
-            // Increase ref count
-            ++inserted.first->second;
-            m_frameContentClauses.push_back(inserted.first);
+            m_context.m_assertClauseNotMissing.add(clauseID);
+            m_frameContentClauses.push_back(clauseID);
         }
         
         void clear()
         {
-            for (const auto & i : m_frameContentVariables)
+            for (unsigned int id : m_frameContentVariables)
             {
-                if (--(i->second) == 0)
-                {
-                    m_context.m_assertNotMissing.erase(i);
-                }
+                m_context.m_assertNotMissing.remove(id);
             }
-            for (const auto & i : m_frameContentClauses)
+            for (unsigned int id : m_frameContentClauses)
             {
-                if (--(i->second) == 0)
-                {
-                    m_context.m_assertClauseNotMissing.erase(i);
-                }
+                m_context.m_assertClauseNotMissing.remove(id);
             }
             m_frameContentVariables.clear();
             m_frameContentClauses.clear();
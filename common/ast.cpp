@@ -26,7 +26,9 @@
 #include "analyser.hpp"
 #include "conversioncontext.hpp"
 #include "luaconverter/luaoutputter.hpp"
+#include <iterator>
 #include <sstream>
+#include <unordered_map>
 #include <algorithm>
 #include <assert.h>
 
@@ -401,10 +403,31 @@ bool AstBuilder::coerceToSpecificTypes(size_t nEntries, const PMMLDocument::Fiel
 }
 
 void AstBuilder::parsingError(const char * error_message, int line_num) const
+{
+    reportError(error_message, nullptr, false, line_num + m_lineOffset);
+}
+
+void AstBuilder::parsingError(const char * error_message, const char * error_param, int line_num) const
+{
+    reportError(error_message, error_param, true, line_num + m_lineOffset);
+}
+
+void AstBuilder::reportError(const char * error_message, const char * error_param, bool hasParam, int line_num) const
 {
     if (m_customErrorHook)
     {
-        m_customErrorHook->error(error_message, line_num);
+        if (hasParam)
+        {
+            m_customErrorHook->errorWithArg(error_message, error_param, line_num);
+        }
+        else
+        {
+            m_customErrorHook->error(error_message, line_num);
+        }
+    }
+    else if (hasParam)
+    {
+        std::fprintf(stderr, "%s (%s) at %i\n", error_message, error_param, line_num);
     }
     else
     {
@@ -412,16 +435,132 @@ void AstBuilder::parsingError(const char * error_message, int line_num) const
     }
 }
 
-void AstBuilder::parsingError(const char * error_message, const char * error_param, int line_num) const
+// This holds on to the errors of a fork, so that they can be reported in order when it is joined.
+class AstBuilder::ErrorBuffer : public AstBuilder::CustomErrorHook
 {
-    if (m_customErrorHook)
+public:
+    struct Error
+    {
+        std::string message;
+        bool hasParam;
+        std::string param;
+        int lineNum;
+    };
+    mutable std::vector<Error> errors;
+
+    void error(const char * msg, int lineNo) const override
     {
-        m_customErrorHook->errorWithArg(error_message, error_param, line_num);
+        errors.push_back(Error{msg, false, std::string(), lineNo});
     }
-    else
+    void errorWithArg(const char * msg, const char * arg, int lineNo) const override
     {
-        std::fprintf(stderr, "%s (%s) at %i\n", error_message, error_param, line_num);
+        errors.push_back(Error{msg, true, arg ? arg : "", lineNo});
+    }
+};
+
+AstBuilder AstBuilder::fork() const
+{
+    AstBuilder forked;
+    forked.m_context = m_context.fork();
+    forked.m_nextID = m_nextID;
+    forked.m_forkedID = m_nextID;
+    forked.m_lineOffset = m_lineOffset;
+    forked.m_forkErrors = std::make_shared<ErrorBuffer>();
+    forked.m_customErrorHook = forked.m_forkErrors;
+    return forked;
+}
+
+void AstBuilder::join(AstBuilder & forked)
+{
+    for (const ErrorBuffer::Error & error : forked.m_forkErrors->errors)
+    {
+        // The fork has already added its line offset.
+        reportError(error.message.c_str(), error.param.c_str(), error.hasParam, error.lineNum);
+    }
+    forked.m_forkErrors->errors.clear();
+
+    std::unordered_map<const PMMLDocument::FieldDescription *, std::string> oldNames;
+    m_context.join(forked.m_context, oldNames);
+
+    // Nodes from before the fork (such as those imported from the TransformationDictionary) keep their IDs, everything else
+    // is moved along to follow on from what has been built here. This is done without recursion, as trees can be very deep.
+    std::vector<AstNode *> toVisit;
+    for (AstNode & node : forked.m_stack)
+    {
+        toVisit.push_back(&node);
+    }
+    while (!toVisit.empty())
+    {
+        AstNode & node = *toVisit.back();
+        toVisit.pop_back();
+        if (node.id >= forked.m_forkedID)
+        {
+            node.id = node.id - forked.m_forkedID + m_nextID;
+        }
+        if (node.fieldDescription)
+        {
+            auto found = oldNames.find(node.fieldDescription.get());
+            if (found != oldNames.end() && node.content == found->second)
+            {
+                node.content = node.fieldDescription->luaName;
+            }
+        }
+        for (AstNode & child : node.children)
+        {
+            toVisit.push_back(&child);
+        }
+    }
+    m_nextID += forked.m_nextID - forked.m_forkedID;
+    forked.m_nextID = forked.m_forkedID;
+
+    std::move(forked.m_stack.begin(), forked.m_stack.end(), std::back_inserter(m_stack));
+    forked.m_stack.clear();
+}
+
+bool AstBuilder::copyFork(AstBuilder & copy, PMMLDocument::ForkFieldMap & fields) const
+{
+    if (m_forkErrors == nullptr || !m_forkErrors->errors.empty())
+    {
+        return false;
+    }
+    copy = AstBuilder();
+    copy.m_nextID = m_nextID;
+    copy.m_forkedID = m_forkedID;
+    copy.m_lineOffset = m_lineOffset;
+    copy.m_forkErrors = std::make_shared<ErrorBuffer>();
+    copy.m_customErrorHook = copy.m_forkErrors;
+    if (!m_context.copyFork(copy.m_context, fields))
+    {
+        return false;
+    }
+
+    // Each node is copied without its children, which are then copied in turn, as trees can be very deep.
+    std::vector<std::pair<const AstNode *, AstNode *>> toCopy;
+    copy.m_stack.reserve(m_stack.size());
+    for (const AstNode & node : m_stack)
+    {
+        copy.m_stack.emplace_back(node.id, node.function(), node.type, std::string(node.content), AstNode::Children());
+        toCopy.emplace_back(&node, &copy.m_stack.back());
+    }
+    while (!toCopy.empty())
+    {
+        const AstNode & from = *toCopy.back().first;
+        AstNode & to = *toCopy.back().second;
+        toCopy.pop_back();
+        to.coercedType = from.coercedType;
+        to.fieldDescription = from.fieldDescription;
+        if (!fields.map(to.fieldDescription))
+        {
+            return false;
+        }
+        to.children.reserve(from.children.size());
+        for (const AstNode & child : from.children)
+        {
+            to.children.emplace_back(child.id, child.function(), child.type, std::string(child.content), AstNode::Children());
+            toCopy.emplace_back(&child, &to.children.back());
+        }
     }
+    return true;
 }
 
 // This method swaps two nodes in the builder's stack
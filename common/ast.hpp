@@ -73,7 +73,9 @@ struct AstNode
     static constexpr invalidNode_t invalidNode = {};
     AstNode(invalidNode_t) :
         id(0),
-        pFunction(nullptr)
+        pFunction(nullptr),
+        type(PMMLDocument::TYPE_INVALID),
+        coercedType(PMMLDocument::TYPE_INVALID)
     {
     }
     
@@ -166,6 +168,22 @@ public:
 
     void parsingError(const char * error_message, int line_num) const;
     void parsingError(const char * error_message, const char * error_param, int line_num) const;
+    // This is added to the line numbers of errors, for when elements come from a document that is part of a larger file.
+    void setLineOffset(int lineOffset) { m_lineOffset = lineOffset; }
+    int lineOffset() const { return m_lineOffset; }
+
+    // This makes an empty builder with a fork of this builder's context, see ConversionContext::fork. Forks of the same builder
+    // may be used on different threads. Errors in a fork are held until it is joined.
+    AstBuilder fork() const;
+    // This moves everything on the stack of forked onto this one, renumbering its nodes as if they had been built here, and
+    // reports any errors that it had.
+    void join(AstBuilder & forked);
+    // This makes copy into a copy of this fork that can be joined in its place, either to the builder it was forked from, or
+    // to any builder in the same state, such as in another conversion of the same document. Fields are mapped through
+    // fields, and this fails if one of them can't be. Forks that had errors can't be copied.
+    bool copyFork(AstBuilder & copy, PMMLDocument::ForkFieldMap & fields) const;
+    // For a fork, the first node ID that it built, which is also the next ID of the builder it was forked from.
+    unsigned int forkedID() const { return m_forkedID; }
     
     static const Function::Definition CONSTANT_DEF;
     static const Function::Definition FIELD_DEF;
@@ -190,6 +208,12 @@ private:
     PMMLDocument::ConversionContext m_context;
     std::vector<AstNode> m_stack;
     unsigned int m_nextID = 0;
+    int m_lineOffset = 0;
+    // For a fork, the first node ID that it built, and where its errors go.
+    unsigned int m_forkedID = 0;
+    class ErrorBuffer;
+    std::shared_ptr<ErrorBuffer> m_forkErrors;
+    void reportError(const char * error_message, const char * error_param, bool hasParam, int line_num) const;
 };
 
 #ifdef DEBUG_AST_BUILDING
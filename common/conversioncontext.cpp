@@ -21,6 +21,9 @@
 #include "ast.hpp"
 #include "model/output.hpp"
 #include "functiondispatch.hpp"
+#include "native/linearmodel.hpp"
+#include "native/neuralnetwork.hpp"
+#include "native/treeensemble.hpp"
 #include <cstring>
 #include <string>
 #include <algorithm>
@@ -28,8 +31,6 @@
 
 namespace PMMLDocument
 {
-    unsigned int FieldDescription::next_id = 0;
-    
     void ConversionContext::setupInputs(const DataFieldVector & inputs, const std::unordered_set<std::string> & activeFields, const std::unordered_set<std::string> & outFields)
     {
         for (const auto & input : inputs)
@@ -83,7 +84,151 @@ namespace PMMLDocument
     ConstFieldDescriptionPtr ConversionContext::createVariable(FieldType type, const std::string & name, FieldOrigin origin)
     {
         std::string variableName = makeSaneAndUniqueVariable(name);
-        return std::make_shared<FieldDescription>(type, origin, OPTYPE_INVALID, variableName);
+        std::shared_ptr<FieldDescription> out = std::make_shared<FieldDescription>(type, origin, OPTYPE_INVALID, variableName, m_nextFieldID++);
+        recordCreatedField(out, name);
+        return out;
+    }
+
+    ConversionContext ConversionContext::fork() const
+    {
+        ConversionContext forked(*this);
+        forked.m_recordCreatedFields = true;
+        forked.m_createdFields.clear();
+        forked.m_hasInfinityValue = false;
+        // These are appended to the parent when the fork is joined.
+        forked.m_treeEnsembles.clear();
+        forked.m_linearModels.clear();
+        forked.m_neuralNetworks.clear();
+        forked.m_fieldsByID.reset();
+        return forked;
+    }
+
+    void ConversionContext::join(ConversionContext & forked, std::unordered_map<const FieldDescription *, std::string> & oldNames)
+    {
+        for (auto & created : forked.m_createdFields)
+        {
+            FieldDescription & field = *created.first;
+            oldNames.emplace(&field, field.luaName);
+            field.id = m_nextFieldID++;
+            field.luaName = makeSaneAndUniqueVariable(created.second);
+            recordCreatedField(created.first, created.second);
+        }
+        forked.m_createdFields.clear();
+
+        m_hasInfinityValue = m_hasInfinityValue || forked.m_hasInfinityValue;
+        m_treeEnsembles.insert(m_treeEnsembles.end(), forked.m_treeEnsembles.begin(), forked.m_treeEnsembles.end());
+        m_linearModels.insert(m_linearModels.end(), forked.m_linearModels.begin(), forked.m_linearModels.end());
+        m_neuralNetworks.insert(m_neuralNetworks.end(), forked.m_neuralNetworks.begin(), forked.m_neuralNetworks.end());
+        // The first neuron to be marked wins, as it would have here.
+        m_neurons.insert(forked.m_neurons.begin(), forked.m_neurons.end());
+    }
+
+    void ConversionContext::setSegmentCache(SegmentCache * cache)
+    {
+        m_segmentCache = cache;
+        if (cache != nullptr && !m_fieldsByID)
+        {
+            m_fieldsByID = std::make_shared<std::vector<ConstFieldDescriptionPtr>>();
+        }
+    }
+
+    bool ForkFieldMap::map(ConstFieldDescriptionPtr & field)
+    {
+        if (field == nullptr)
+        {
+            return true;
+        }
+        auto found = m_fields.find(field.get());
+        if (found != m_fields.end())
+        {
+            field = found->second;
+            return true;
+        }
+        if (m_fieldsByID == nullptr)
+        {
+            return true;
+        }
+        // The name is checked as well, in case the document that the fork came from wasn't the same after all.
+        const unsigned int id = field->id;
+        if (id >= m_fieldsByID->size() || (*m_fieldsByID)[id] == nullptr || (*m_fieldsByID)[id]->luaName != field->luaName)
+        {
+            return false;
+        }
+        m_fields.emplace(field.get(), (*m_fieldsByID)[id]);
+        field = (*m_fieldsByID)[id];
+        return true;
+    }
+
+    static bool mapFields(std::vector<ConstFieldDescriptionPtr> & fields, ForkFieldMap & map)
+    {
+        for (ConstFieldDescriptionPtr & field : fields)
+        {
+            if (!map.map(field))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool ConversionContext::copyFork(ConversionContext & copy, ForkFieldMap & fields) const
+    {
+        copy.m_recordCreatedFields = true;
+        for (const auto & created : m_createdFields)
+        {
+            auto field = std::make_shared<FieldDescription>(*created.first);
+            fields.m_fields.emplace(created.first.get(), field);
+            copy.m_createdFields.emplace_back(field, created.second);
+        }
+
+        copy.m_hasInfinityValue = m_hasInfinityValue;
+        copy.m_captureNativeModels = m_captureNativeModels;
+        for (const auto & ensemble : m_treeEnsembles)
+        {
+            ConstFieldDescriptionPtr output = ensemble.first;
+            auto copied = std::make_shared<TreeEnsemble::Ensemble>(*ensemble.second);
+            if (!fields.map(output) || !mapFields(copied->features, fields))
+            {
+                return false;
+            }
+            copy.m_treeEnsembles.emplace_back(output, copied);
+        }
+        for (const auto & model : m_linearModels)
+        {
+            ConstFieldDescriptionPtr output = model.first;
+            auto copied = std::make_shared<LinearModel::Model>(*model.second);
+            if (!fields.map(output) || !mapFields(copied->features, fields))
+            {
+                return false;
+            }
+            copy.m_linearModels.emplace_back(output, copied);
+        }
+        for (const auto & network : m_neuralNetworks)
+        {
+            auto copied = std::make_shared<NeuralNetwork::Network>(*network);
+            if (!mapFields(copied->features, fields))
+            {
+                return false;
+            }
+            for (NeuralNetwork::Output & output : copied->outputs)
+            {
+                if (!fields.map(output.field))
+                {
+                    return false;
+                }
+            }
+            copy.m_neuralNetworks.push_back(copied);
+        }
+        for (const auto & neuron : m_neurons)
+        {
+            ConstFieldDescriptionPtr field = neuron.second;
+            if (!fields.map(field))
+            {
+                return false;
+            }
+            copy.m_neurons.emplace(neuron.first, field);
+        }
+        return true;
     }
 
     void ConversionContext::setTransformationDictionary(const std::shared_ptr<const TransformationDictionary> & dictionary)
@@ -103,42 +248,28 @@ namespace PMMLDocument
         std::replace_copy_if(key.begin(), key.end(), std::back_inserter(sanitised), [](char a){return !isalnum(a);}, '_');
 
         // We're now using this identifier, don't use it again.
-        if (m_variableNames.insert(std::string(sanitised)).second)
+        if (m_variableNames.insert(sanitised).second)
         {
             // Nobody was using it, we can use it.
             return sanitised;
         }
 
-        // Find a unique identifer that hasn't been used yet by sticking various numbers after it.
-        // This has been optimised since it is known to take a _long_ time on Gradient Boosted Trees
-        size_t offset = sanitised.length();
+        // Find a unique identifer that hasn't been used yet by sticking a number after it.
+        // Gradient Boosted Trees can ask for the same name thousands of times, so rather than trying every number from 1 each
+        // time, carry on from the last one used. Names are never released, so every number before that is still taken.
+        size_t & nextSuffix = m_nextSuffixes.emplace(sanitised, 1).first->second;
         sanitised.push_back('_');
-
-        for (uint8_t depth = 1; ; depth++)
+        const size_t offset = sanitised.length();
+        for (;; nextSuffix++)
         {
-            sanitised.push_back('0');
-            sanitised.at(offset + 1) = '1';
-        newvalue:
+            sanitised.resize(offset);
+            sanitised += std::to_string(nextSuffix);
             if (m_variableNames.insert(sanitised).second)
             {
                 // Nobody was using it, we can use it.
+                nextSuffix++;
                 return sanitised;
             }
-
-            // increment the bottom column and carry.
-            for (uint8_t iterator = depth; iterator > 0; iterator--)
-            {
-                char & value = sanitised.at(offset + iterator);
-                if (value < '9')
-                {
-                    value++;
-                    goto newvalue;
-                }
-                else
-                {
-                    value = '0';
-                }
-            }
         }
     }
 
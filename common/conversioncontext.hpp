@@ -19,7 +19,7 @@
 #ifndef conversioncontext_hpp
 #define conversioncontext_hpp
 
-#include <map>
+#include <algorithm>
 #include <memory>
 #include <unordered_map>
 #include <unordered_set>
@@ -35,10 +35,47 @@
 #include <strings.h>
 #endif
 
+namespace TreeEnsemble
+{
+    struct Ensemble;
+}
+
+namespace LinearModel
+{
+    struct Model;
+}
+
+namespace NeuralNetwork
+{
+    struct Network;
+}
+
 namespace PMMLDocument
 {
+    class StreamedDocument;
+    class SegmentCache;
     typedef std::unordered_map<std::string, MiningField> MiningSchema;
     typedef std::unordered_map<std::string, AstNode> TransformationDictionary;
+    // Natively scorable tree ensembles, along with the variable that each one computes.
+    typedef std::vector<std::pair<ConstFieldDescriptionPtr, std::shared_ptr<const TreeEnsemble::Ensemble>>> TreeEnsembles;
+    typedef std::vector<std::pair<ConstFieldDescriptionPtr, std::shared_ptr<const LinearModel::Model>>> LinearModels;
+    // Neural networks may compute several variables, so these are listed in the network itself.
+    typedef std::vector<std::shared_ptr<const NeuralNetwork::Network>> NeuralNetworks;
+
+    // This says what each field of a fork becomes in a copy of it, see AstBuilder::copyFork. Fields that the fork made are
+    // copied, so that joining the copy doesn't change them. Any others are replaced by the field with the same ID in
+    // fieldsByID, which is how a copy is moved into another conversion of the same document, or kept if it is null.
+    class ForkFieldMap
+    {
+    public:
+        explicit ForkFieldMap(const std::vector<ConstFieldDescriptionPtr> * fieldsByID) : m_fieldsByID(fieldsByID) {}
+        // This sets field to what it becomes, returning false if there's nothing for it to become.
+        bool map(ConstFieldDescriptionPtr & field);
+    private:
+        friend class ConversionContext;
+        const std::vector<ConstFieldDescriptionPtr> * m_fieldsByID;
+        std::unordered_map<const FieldDescription *, ConstFieldDescriptionPtr> m_fields;
+    };
 
     class ConversionContext
     {
@@ -49,8 +86,9 @@ namespace PMMLDocument
         // Declare a new field without scope.
         ConstFieldDescriptionPtr addUnscopedDataField(const std::string & key, const DataField & field, FieldOrigin origin)
         {
-            std::shared_ptr<FieldDescription> out = std::make_shared<FieldDescription>(field, origin, makeSaneAndUniqueVariable(key));
-            m_dataDictionary.emplace(key, out);
+            std::shared_ptr<FieldDescription> out = std::make_shared<FieldDescription>(field, origin, makeSaneAndUniqueVariable(key), m_nextFieldID++);
+            recordCreatedField(out, key);
+            m_dataDictionary[key].push_back(out);
             return out;
         }
 
@@ -59,9 +97,9 @@ namespace PMMLDocument
         const ConstFieldDescriptionPtr getFieldDescription(const char * field) const
         {
             auto found = m_dataDictionary.find(field);
-            if (found != m_dataDictionary.end())
+            if (found != m_dataDictionary.end() && !found->second.empty())
             {
-                return found->second;
+                return found->second.front();
             }
             return nullptr;
         }
@@ -132,14 +170,76 @@ namespace PMMLDocument
         {
             return m_variableNames.find(name) != m_variableNames.end();
         }
+
+        // Set if any predicate compares against PMML_INFINITY, which then needs to be defined in the generated script.
+        bool hasInfinityValue() const { return m_hasInfinityValue; }
+        void setHasInfinityValue() { m_hasInfinityValue = true; }
+
+        // The generated code is still the reference implementation, these are an alternative way of computing parts of it. They
+        // are only captured if asked for, as capturing them costs time and memory that the generated code doesn't need.
+        bool capturesNativeModels() const { return m_captureNativeModels; }
+        void setCaptureNativeModels(bool capture) { m_captureNativeModels = capture; }
+        void addTreeEnsemble(const ConstFieldDescriptionPtr & output, const std::shared_ptr<const TreeEnsemble::Ensemble> & ensemble)
+        {
+            m_treeEnsembles.emplace_back(output, ensemble);
+        }
+        const TreeEnsembles & getTreeEnsembles() const { return m_treeEnsembles; }
+        void addLinearModel(const ConstFieldDescriptionPtr & output, const std::shared_ptr<const LinearModel::Model> & model)
+        {
+            m_linearModels.emplace_back(output, model);
+        }
+        const LinearModels & getLinearModels() const { return m_linearModels; }
+        void addNeuralNetwork(const std::shared_ptr<const NeuralNetwork::Network> & network)
+        {
+            m_neuralNetworks.push_back(network);
+        }
+        const NeuralNetworks & getNeuralNetworks() const { return m_neuralNetworks; }
+
+        // If the document being converted is streamed, this is where its segments are loaded from.
+        const StreamedDocument * streamedDocument() const { return m_streamedDocument; }
+        void setStreamedDocument(const StreamedDocument * document) { m_streamedDocument = document; }
+
+        // If set, segments that have been converted before are taken from here rather than converted again. This must be set
+        // before anything is converted, as from then on every field is recorded by its ID so that the fields of a segment
+        // can be found again in another conversion.
+        SegmentCache * segmentCache() const { return m_segmentCache; }
+        void setSegmentCache(SegmentCache * cache);
+        // Every field made so far, by ID, if there is a segment cache. Forks don't keep these.
+        const std::vector<ConstFieldDescriptionPtr> * fieldsByID() const { return m_fieldsByID.get(); }
+
+        // A fork is a copy of this context that an independent part of a model can be converted into on another thread. When
+        // it is joined back, every field it created is renamed and renumbered as if it had been created here, so as long as
+        // forks are joined in order, the result doesn't depend on how the work was scheduled. oldNames is filled with the
+        // name each of those fields had in the fork.
+        ConversionContext fork() const;
+        void join(ConversionContext & forked, std::unordered_map<const FieldDescription *, std::string> & oldNames);
+        // This copies everything that this fork made into copy, which is otherwise empty, so that it can be joined in place
+        // of this fork. Fields are mapped through fields, failing if one of them can't be. See AstBuilder::copyFork.
+        bool copyFork(ConversionContext & copy, ForkFieldMap & fields) const;
     private:
+        void recordCreatedField(const std::shared_ptr<FieldDescription> & field, const std::string & key)
+        {
+            if (m_recordCreatedFields)
+            {
+                m_createdFields.emplace_back(field, key);
+            }
+            else if (m_fieldsByID)
+            {
+                if (field->id >= m_fieldsByID->size())
+                {
+                    m_fieldsByID->resize(field->id + 1);
+                }
+                (*m_fieldsByID)[field->id] = field;
+            }
+        }
         
         DataDictionary m_inputs;
         DataDictionary m_outputs;
         DataDictionary m_neurons;
         
-        // This is a multimap so that we can more easily insert
-        typedef std::multimap<std::string, std::shared_ptr<FieldDescription>> Fields;
+        // Every field with a name that is in scope, in the order they were declared. The first one declared is the one found.
+        typedef std::vector<std::shared_ptr<FieldDescription>> FieldStack;
+        typedef std::unordered_map<std::string, FieldStack> Fields;
         Fields m_dataDictionary;
 
         MiningSchema m_miningSchema;
@@ -147,8 +247,22 @@ namespace PMMLDocument
         std::shared_ptr<const TransformationDictionary> m_transformationDictionary;
         bool m_loadingTransformationDictionary = false;
         std::unordered_set<std::string> m_variableNames;
+        // For each name that has been asked for more than once, the next number to try after it to make it unique.
+        std::unordered_map<std::string, size_t> m_nextSuffixes;
         
         std::string m_application;
+        unsigned int m_nextFieldID = 0;
+        bool m_hasInfinityValue = false;
+        // Only forks record the fields they create, along with the name that was asked for.
+        bool m_recordCreatedFields = false;
+        std::vector<std::pair<std::shared_ptr<FieldDescription>, std::string>> m_createdFields;
+        bool m_captureNativeModels = false;
+        TreeEnsembles m_treeEnsembles;
+        LinearModels m_linearModels;
+        NeuralNetworks m_neuralNetworks;
+        const StreamedDocument * m_streamedDocument = nullptr;
+        SegmentCache * m_segmentCache = nullptr;
+        std::shared_ptr<std::vector<ConstFieldDescriptionPtr>> m_fieldsByID;
 
         friend class ScopedVariableDefinitionStackGuard;
         friend class MiningSchemaStackGuard;
@@ -157,7 +271,8 @@ namespace PMMLDocument
 
     class ScopedVariableDefinitionStackGuard
     {
-        std::vector<ConversionContext::Fields::iterator> m_fieldIterators;
+        // Elements of an unordered_map stay where they are when it grows, so the stacks can be pointed to.
+        std::vector<std::pair<ConversionContext::FieldStack *, std::shared_ptr<FieldDescription>>> m_declaredFields;
         ConversionContext & m_context;
     public:
         ScopedVariableDefinitionStackGuard(ConversionContext & context) :
@@ -165,17 +280,20 @@ namespace PMMLDocument
         {}
         ~ScopedVariableDefinitionStackGuard()
         {
-            for (ConversionContext::Fields::iterator element : m_fieldIterators)
+            for (const auto & declared : m_declaredFields)
             {
-                m_context.m_dataDictionary.erase(element);
+                ConversionContext::FieldStack & stack = *declared.first;
+                stack.erase(std::find(stack.begin(), stack.end(), declared.second));
             }
         }
         ConstFieldDescriptionPtr addDataField(const std::string & variable, FieldType type, FieldOrigin origin, OpType optype)
         {
             std::string luaRepr = m_context.makeSaneAndUniqueVariable(variable);
-            std::shared_ptr<FieldDescription> field = std::make_shared<FieldDescription>(type, origin, optype, luaRepr);
-            ConversionContext::Fields::iterator iter = m_context.m_dataDictionary.emplace(variable, field);
-            m_fieldIterators.push_back(iter);
+            std::shared_ptr<FieldDescription> field = std::make_shared<FieldDescription>(type, origin, optype, luaRepr, m_context.m_nextFieldID++);
+            m_context.recordCreatedField(field, variable);
+            ConversionContext::FieldStack & stack = m_context.m_dataDictionary[variable];
+            stack.push_back(field);
+            m_declaredFields.emplace_back(&stack, field);
             return field;
         }
     };
@@ -31,11 +31,12 @@
 #include "model/treemodel.hpp"
 #include "luaconverter/luaconverter.hpp"
 #include "luaconverter/optimiser.hpp"
+#include <algorithm>
+#include <vector>
 
 namespace PMMLDocument
 {
     const char* PMML_INFINITY = "Infinity";
-    bool hasInfinityValue = false;
 
 namespace
 {
@@ -83,33 +84,43 @@ bool parseDataDictionary(const AstBuilder & builder, const tinyxml2::XMLElement
 }
 
 
-void findAllInputs(const tinyxml2::XMLElement * element, std::unordered_set<std::string> & names, std::unordered_set<std::string> & outputs)
+// Tree models can nest Nodes thousands deep, so this keeps its own list of elements to visit rather than recursing.
+void findAllInputs(const tinyxml2::XMLElement * root, std::unordered_set<std::string> & names, std::unordered_set<std::string> & outputs)
 {
-    if (const tinyxml2::XMLElement * miningSchema = element->FirstChildElement("MiningSchema"))
+    std::vector<const tinyxml2::XMLElement *> toVisit(1, root);
+    while (!toVisit.empty())
     {
-        for (const tinyxml2::XMLElement * miningField = miningSchema->FirstChildElement("MiningField");
-             miningField; miningField = miningField->NextSiblingElement("MiningField"))
+        const tinyxml2::XMLElement * element = toVisit.back();
+        toVisit.pop_back();
+        if (const tinyxml2::XMLElement * miningSchema = element->FirstChildElement("MiningSchema"))
         {
-            // Note, this first pass doesn't care about errors... they will be silently ignored
-            if (const char * name = miningField->Attribute("name"))
+            for (const tinyxml2::XMLElement * miningField = miningSchema->FirstChildElement("MiningField");
+                 miningField; miningField = miningField->NextSiblingElement("MiningField"))
             {
-                MiningFieldUsage usage = getMiningFieldUsage(miningField);
-                if (usage == USAGE_IN)
+                // Note, this first pass doesn't care about errors... they will be silently ignored
+                if (const char * name = miningField->Attribute("name"))
                 {
-                    names.insert(name);
-                }
-                else if (usage == USAGE_OUT)
-                {
-                    outputs.insert(name);
+                    MiningFieldUsage usage = getMiningFieldUsage(miningField);
+                    if (usage == USAGE_IN)
+                    {
+                        names.insert(name);
+                    }
+                    else if (usage == USAGE_OUT)
+                    {
+                        outputs.insert(name);
+                    }
                 }
             }
         }
-    }
 
-    for (const tinyxml2::XMLElement * iterator = element->FirstChildElement();
-         iterator; iterator = iterator->NextSiblingElement())
-    {
-        findAllInputs(iterator, names, outputs);
+        // Pushed backwards, so that they come off in document order.
+        const size_t firstChild = toVisit.size();
+        for (const tinyxml2::XMLElement * iterator = element->FirstChildElement();
+             iterator; iterator = iterator->NextSiblingElement())
+        {
+            toVisit.push_back(iterator);
+        }
+        std::reverse(toVisit.begin() + firstChild, toVisit.end());
     }
 }
 }
@@ -0,0 +1,82 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  A stack for walking deep trees without recursing.
+
+#ifndef framestack_hpp
+#define framestack_hpp
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Trees are walked with one of these in place of the native stack, so T is pushed and popped once for most nodes. Nothing
+// in it ever moves, so a T can refer to the ones below it, and T doesn't need to be movable, which the stack guards in the
+// analyser aren't. A std::deque would do all that, but it allocates even when it's empty, and frees and allocates its
+// storage again as it goes up and down. Most walks are shallow, so this keeps the first frames in itself, and anything
+// past them in chunks that are kept until it is destroyed.
+template<typename T>
+class FrameStack
+{
+    static const size_t CHUNK_SIZE = 16;
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type Storage;
+    Storage m_first[CHUNK_SIZE];
+    std::vector<std::unique_ptr<Storage[]>> m_chunks;
+    size_t m_size = 0;
+
+    T * at(size_t index)
+    {
+        Storage * storage = index < CHUNK_SIZE ? &m_first[index] : &m_chunks[index / CHUNK_SIZE - 1][index % CHUNK_SIZE];
+        return reinterpret_cast<T *>(storage);
+    }
+public:
+    FrameStack() = default;
+    FrameStack(const FrameStack &) = delete;
+    FrameStack & operator=(const FrameStack &) = delete;
+
+    ~FrameStack()
+    {
+        while (!empty())
+        {
+            pop();
+        }
+    }
+
+    bool empty() const { return m_size == 0; }
+    size_t size() const { return m_size; }
+    T & back() { return *at(m_size - 1); }
+
+    template<typename... Args>
+    T & push(Args &&... args)
+    {
+        if (m_size == (m_chunks.size() + 1) * CHUNK_SIZE)
+        {
+            m_chunks.emplace_back(new Storage[CHUNK_SIZE]);
+        }
+        T * pushed = new (at(m_size)) T(std::forward<Args>(args)...);
+        m_size++;
+        return *pushed;
+    }
+
+    void pop()
+    {
+        T * popped = at(m_size - 1);
+        m_size--;
+        popped->~T();
+    }
+};
+
+#endif /* framestack_hpp */
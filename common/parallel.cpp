@@ -0,0 +1,114 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "parallel.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    thread_local bool isWorker = false;
+    std::atomic<size_t> chosenThreadCount(0);
+}
+
+void Parallel::setThreadCount(size_t count)
+{
+    chosenThreadCount = count;
+}
+
+size_t Parallel::threadCount()
+{
+    if (isWorker)
+    {
+        return 1;
+    }
+    if (const size_t chosen = chosenThreadCount)
+    {
+        return chosen;
+    }
+    if (const char * threads = getenv("PAMPLEMOUSSE_THREADS"))
+    {
+        const long count = strtol(threads, nullptr, 10);
+        if (count > 0)
+        {
+            return count;
+        }
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+bool Parallel::forEachInOrder(size_t count, const std::function<void(size_t)> & work, const std::function<bool(size_t)> & finish)
+{
+    const size_t threads = std::min(threadCount(), count);
+    if (threads <= 1)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            work(i);
+            if (!finish(i))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::mutex mutex;
+    std::condition_variable workDone;
+    std::vector<bool> done(count, false);
+    // Work is handed out in order, so that the next thing to finish is usually already being worked on.
+    std::atomic<size_t> next(0);
+    std::atomic<bool> stop(false);
+
+    std::vector<std::thread> pool;
+    for (size_t thread = 0; thread < threads; ++thread)
+    {
+        pool.emplace_back([&]()
+        {
+            isWorker = true;
+            for (size_t i = next++; i < count && !stop; i = next++)
+            {
+                work(i);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    done[i] = true;
+                }
+                workDone.notify_all();
+            }
+        });
+    }
+
+    bool succeeded = true;
+    for (size_t i = 0; i < count && succeeded; ++i)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            workDone.wait(lock, [&]() { return done[i]; });
+        }
+        succeeded = finish(i);
+    }
+
+    stop = true;
+    for (std::thread & thread : pool)
+    {
+        thread.join();
+    }
+    return succeeded;
+}
@@ -0,0 +1,38 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  A small worker pool for doing independent parts of a conversion at the same time.
+
+#ifndef parallel_hpp
+#define parallel_hpp
+
+#include <cstddef>
+#include <functional>
+
+namespace Parallel
+{
+    // The number of worker threads to use. This is the number given to setThreadCount, or failing that the PAMPLEMOUSSE_THREADS
+    // environment variable, or failing that the number of hardware threads. Inside a worker this is always 1, so nested work
+    // is done on the worker that found it.
+    size_t threadCount();
+    // This sets the number of worker threads for the whole process, or with 0, goes back to the default.
+    void setThreadCount(size_t count);
+
+    // This calls work for every index from 0 to count - 1 on a pool of worker threads, and finish for each index on the calling
+    // thread, in order, as soon as its work is done. If finish returns false, no more work is started, no more finishes are
+    // called and this returns false.
+    bool forEachInOrder(size_t count, const std::function<void(size_t)> & work, const std::function<bool(size_t)> & finish);
+}
+
+#endif /* parallel_hpp */
@@ -87,20 +87,20 @@ namespace PMMLDocument
         OUTLIER_TREATMENT_INVALID
     };
     
+    // IDs are handed out by the ConversionContext that creates the field, so they are only unique within one conversion.
     struct FieldDescription
     {
-        static unsigned int next_id;
-        FieldDescription(const DataField & t, FieldOrigin o, const std::string & name) :
+        FieldDescription(const DataField & t, FieldOrigin o, const std::string & name, unsigned int i) :
             field(t),
             origin(o),
             luaName(name),
-            id(next_id++)
+            id(i)
         {}
-        FieldDescription(FieldType t, FieldOrigin o, OpType ot, const std::string & name) :
+        FieldDescription(FieldType t, FieldOrigin o, OpType ot, const std::string & name, unsigned int i) :
             field(t, ot),
             origin(o),
             luaName(name),
-            id(next_id++)
+            id(i)
         {}
         const DataField field;
         FieldOrigin origin;
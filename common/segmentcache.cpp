@@ -0,0 +1,169 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "segmentcache.hpp"
+#include <cstring>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace
+{
+    // 64 bit FNV-1a, which is quick and good enough to tell versions of a segment apart.
+    const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ULL;
+    const uint64_t FNV_PRIME = 1099511628211ULL;
+
+    struct Hasher
+    {
+        uint64_t hash = FNV_OFFSET_BASIS;
+        size_t length = 0;
+
+        void add(char c)
+        {
+            hash = (hash ^ uint8_t(c)) * FNV_PRIME;
+            length++;
+        }
+        // Strings are hashed with their terminator, so that where one ends and the next starts is part of the hash.
+        void add(const char * text)
+        {
+            if (text != nullptr)
+            {
+                for (; *text != '\0'; ++text)
+                {
+                    add(*text);
+                }
+            }
+            add('\0');
+        }
+    };
+
+    // This hashes element and everything in it, apart from the Segments of skipped. It is done without recursion, as trees
+    // can be very deep.
+    void hashElement(const tinyxml2::XMLElement * element, const tinyxml2::XMLElement * skipped, Hasher & hasher)
+    {
+        // Each node is visited on the way in, and elements again on the way out.
+        std::vector<std::pair<const tinyxml2::XMLNode *, bool>> toVisit;
+        std::vector<const tinyxml2::XMLNode *> children;
+        toVisit.emplace_back(element, false);
+        while (!toVisit.empty())
+        {
+            const tinyxml2::XMLNode * node = toVisit.back().first;
+            const bool leaving = toVisit.back().second;
+            toVisit.pop_back();
+            const tinyxml2::XMLElement * nodeElement = node->ToElement();
+            if (leaving)
+            {
+                hasher.add('/');
+                continue;
+            }
+            if (nodeElement == nullptr)
+            {
+                hasher.add('t');
+                hasher.add(node->Value());
+                continue;
+            }
+
+            hasher.add('<');
+            hasher.add(nodeElement->Name());
+            for (const tinyxml2::XMLAttribute * attribute = nodeElement->FirstAttribute(); attribute != nullptr; attribute = attribute->Next())
+            {
+                hasher.add(attribute->Name());
+                hasher.add(attribute->Value());
+            }
+            hasher.add('>');
+            toVisit.emplace_back(node, true);
+
+            children.clear();
+            for (const tinyxml2::XMLNode * child = node->FirstChild(); child != nullptr; child = child->NextSibling())
+            {
+                const tinyxml2::XMLElement * childElement = child->ToElement();
+                if (node != skipped || childElement == nullptr || std::strcmp(childElement->Name(), "Segment") != 0)
+                {
+                    children.push_back(child);
+                }
+            }
+            for (auto child = children.rbegin(); child != children.rend(); ++child)
+            {
+                toVisit.emplace_back(*child, false);
+            }
+        }
+    }
+}
+
+bool PMMLDocument::SegmentCache::Key::operator<(const Key & other) const
+{
+    return std::tie(document, segment, length, nativeModels) < std::tie(other.document, other.segment, other.length, other.nativeModels);
+}
+
+bool PMMLDocument::SegmentCache::hashDocument(const tinyxml2::XMLElement * segmentation, uint64_t & hash)
+{
+    const tinyxml2::XMLElement * root = segmentation;
+    for (const tinyxml2::XMLNode * parent = root->Parent(); parent != nullptr && parent->ToElement() != nullptr; parent = parent->Parent())
+    {
+        root = parent->ToElement();
+        if (std::strcmp(root->Name(), "Segment") == 0)
+        {
+            return false;
+        }
+    }
+    Hasher hasher;
+    hashElement(root, segmentation, hasher);
+    hash = hasher.hash;
+    return true;
+}
+
+PMMLDocument::SegmentCache::Key PMMLDocument::SegmentCache::makeKey(uint64_t documentHash, const tinyxml2::XMLElement * segment, bool nativeModels)
+{
+    Hasher hasher;
+    hashElement(segment, nullptr, hasher);
+    return Key{documentHash, hasher.hash, hasher.length, nativeModels};
+}
+
+std::shared_ptr<const PMMLDocument::SegmentCache::Segment> PMMLDocument::SegmentCache::find(const Key & key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_segments.find(key);
+    if (found == m_segments.end())
+    {
+        return nullptr;
+    }
+    m_hits++;
+    return found->second;
+}
+
+void PMMLDocument::SegmentCache::insert(const Key & key, std::shared_ptr<const Segment> && segment)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_segments[key] = std::move(segment);
+}
+
+size_t PMMLDocument::SegmentCache::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_segments.size();
+}
+
+size_t PMMLDocument::SegmentCache::hits() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_hits;
+}
+
+void PMMLDocument::SegmentCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_segments.clear();
+    m_hits = 0;
+}
@@ -0,0 +1,82 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  This keeps what the Segments of a model were converted into, so that they don't need converting again.
+
+#ifndef segmentcache_hpp
+#define segmentcache_hpp
+
+#include "ast.hpp"
+#include "tinyxml2.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace PMMLDocument
+{
+    // A retrained ensemble often only differs from the one before it in some of its segments. If the same cache is set on
+    // the context of each conversion (see ConversionContext::setSegmentCache), each Segment of the outermost Segmentation
+    // that has been converted before is copied from here, and only the segments that changed are converted again.
+    //
+    // What a segment is converted into depends on the segment and everything in the document before it, so a segment is
+    // found by a hash of its XML and a hash of the rest of the document, apart from the other segments, along with whether
+    // native models are being captured. Segments that had errors aren't kept. Nothing is dropped from the cache until it is
+    // cleared.
+    class SegmentCache
+    {
+    public:
+        struct Key
+        {
+            uint64_t document;
+            uint64_t segment;
+            // The number of bytes that went into the hash of the segment.
+            size_t length;
+            // Whether native models were captured, see ConversionContext::capturesNativeModels.
+            bool nativeModels;
+            bool operator<(const Key & other) const;
+        };
+
+        // A copy of the fork that a segment was converted in, see AstBuilder::copyFork, and how many times it always counts.
+        struct Segment
+        {
+            AstBuilder converted;
+            double constCount = 0;
+        };
+
+        SegmentCache() = default;
+        SegmentCache(const SegmentCache &) = delete;
+        SegmentCache & operator=(const SegmentCache &) = delete;
+
+        // This hashes the document that segmentation is in, apart from its Segments. It returns false if segmentation is
+        // inside a Segment, as then what its segments are converted into also depends on the segments around it.
+        static bool hashDocument(const tinyxml2::XMLElement * segmentation, uint64_t & hash);
+        static Key makeKey(uint64_t documentHash, const tinyxml2::XMLElement * segment, bool nativeModels);
+
+        // These may be called from several threads at once. find returns nullptr if the segment hasn't been seen before.
+        std::shared_ptr<const Segment> find(const Key & key);
+        void insert(const Key & key, std::shared_ptr<const Segment> && segment);
+
+        size_t size() const;
+        // The number of segments that have been found here, rather than converted again.
+        size_t hits() const;
+        void clear();
+    private:
+        mutable std::mutex m_mutex;
+        std::map<Key, std::shared_ptr<const Segment>> m_segments;
+        size_t m_hits = 0;
+    };
+}
+
+#endif /* segmentcache_hpp */
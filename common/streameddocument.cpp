@@ -0,0 +1,357 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "streameddocument.hpp"
+#include "ast.hpp"
+#include "conversioncontext.hpp"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+namespace
+{
+    const size_t BLOCK_SIZE = 1 << 20;
+
+    enum MarkupType
+    {
+        TEXT,
+        START_TAG,
+        EMPTY_TAG,
+        END_TAG,
+        OTHER_MARKUP
+    };
+
+    // This splits a file into text and markup, reading it a block at a time. Only what is needed to find where each element
+    // starts and ends is understood, checking everything else is left to tinyxml2.
+    class Scanner
+    {
+        std::ifstream & m_stream;
+        // This is the part of the file that is being looked at, m_position is how much of it has already been dealt with.
+        std::string m_window;
+        size_t m_position = 0;
+        std::streamoff m_windowOffset = 0;
+
+        bool readBlock()
+        {
+            m_window.erase(0, m_position);
+            m_windowOffset += m_position;
+            m_position = 0;
+            char block[4096];
+            const size_t oldSize = m_window.size();
+            while (m_window.size() - oldSize < BLOCK_SIZE && m_stream.read(block, sizeof(block)).gcount() > 0)
+            {
+                m_window.append(block, size_t(m_stream.gcount()));
+            }
+            return m_window.size() > oldSize;
+        }
+
+        // This returns how far from the current position the end of terminator is, or 0 if the file ends before it.
+        size_t find(const char * terminator, size_t from)
+        {
+            const size_t length = strlen(terminator);
+            for (;;)
+            {
+                const size_t found = m_window.find(terminator, m_position + from);
+                if (found != std::string::npos)
+                {
+                    return found + length - m_position;
+                }
+                // The terminator may be split between this block and the next.
+                from = std::max(from, (m_window.size() - m_position) - std::min(m_window.size() - m_position, length - 1));
+                if (!readBlock())
+                {
+                    return 0;
+                }
+            }
+        }
+
+        // The same for the end of a tag or declaration, where '>' may be quoted or, in a DOCTYPE, in brackets.
+        size_t findTagEnd()
+        {
+            char quote = 0;
+            int brackets = 0;
+            for (size_t i = 1;; ++i)
+            {
+                if (m_position + i == m_window.size() && !readBlock())
+                {
+                    return 0;
+                }
+                const char c = m_window[m_position + i];
+                if (quote)
+                {
+                    quote = c == quote ? 0 : quote;
+                }
+                else if (c == '"' || c == '\'')
+                {
+                    quote = c;
+                }
+                else if (c == '[')
+                {
+                    brackets++;
+                }
+                else if (c == ']')
+                {
+                    brackets--;
+                }
+                else if (c == '>' && brackets <= 0)
+                {
+                    return i + 1;
+                }
+            }
+        }
+
+        bool startsWith(const char * prefix)
+        {
+            const size_t length = strlen(prefix);
+            while (m_window.size() - m_position < length)
+            {
+                if (!readBlock())
+                {
+                    return false;
+                }
+            }
+            return m_window.compare(m_position, length, prefix) == 0;
+        }
+    public:
+        explicit Scanner(std::ifstream & stream) : m_stream(stream) {}
+
+        bool atEnd()
+        {
+            return m_position == m_window.size() && !readBlock();
+        }
+
+        // This finds the next piece of text or markup, which is then available from text() until the next call. Long runs of
+        // text may be split into several pieces. Returns false if the file ends in the middle of some markup.
+        bool next(MarkupType & type, size_t & length)
+        {
+            if (m_window[m_position] != '<')
+            {
+                const size_t found = m_window.find('<', m_position);
+                type = TEXT;
+                length = (found == std::string::npos ? m_window.size() : found) - m_position;
+                return true;
+            }
+
+            type = OTHER_MARKUP;
+            if (startsWith("<!--"))
+            {
+                length = find("-->", 4);
+            }
+            else if (startsWith("<![CDATA["))
+            {
+                length = find("]]>", 9);
+            }
+            else if (startsWith("<?"))
+            {
+                length = find("?>", 2);
+            }
+            else
+            {
+                length = findTagEnd();
+                if (length > 2 && !startsWith("<!"))
+                {
+                    type = m_window[m_position + 1] == '/' ? END_TAG : m_window[m_position + length - 2] == '/' ? EMPTY_TAG : START_TAG;
+                }
+            }
+            return length != 0;
+        }
+
+        const char * text() const { return m_window.data() + m_position; }
+        std::streamoff offset() const { return m_windowOffset + std::streamoff(m_position); }
+        void consume(size_t length) { m_position += length; }
+    };
+
+    std::string tagName(const char * tag, size_t length)
+    {
+        const char * begin = tag + (tag[1] == '/' ? 2 : 1);
+        const char * end = begin;
+        while (end < tag + length && !strchr(" \t\r\n/>", *end))
+        {
+            end++;
+        }
+        return std::string(begin, end);
+    }
+}
+
+bool PMMLDocument::StreamedDocument::load(const char * path, size_t streamingSize)
+{
+    m_path = path;
+    m_error.clear();
+    m_segments.clear();
+
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream.seekg(0, std::ios::end) || size_t(stream.tellg()) < streamingSize || !stream.seekg(0))
+    {
+        return m_skeleton.LoadFile(path) == tinyxml2::XML_SUCCESS;
+    }
+
+    // Only Segments at this path are left on disk. Those of MiningModels inside them are loaded along with them.
+    static const std::vector<std::string> SEGMENTATION_PATH = {"PMML", "MiningModel", "Segmentation"};
+    Scanner scanner(stream);
+    std::string skeleton;
+    std::vector<std::string> openElements;
+    // Each Segment at that path, in order, along with where it is in the file. Empty ones aren't left on disk.
+    std::vector<Range> ranges;
+    bool inSegment = false;
+    while (!scanner.atEnd())
+    {
+        MarkupType type;
+        size_t length;
+        if (!scanner.next(type, length))
+        {
+            m_error = "Unexpected end of file in markup";
+            return false;
+        }
+        const char * text = scanner.text();
+        const std::streamoff begin = scanner.offset();
+        if (type == START_TAG || type == EMPTY_TAG)
+        {
+            const std::string name = tagName(text, length);
+            if (!inSegment && name == "Segment" && openElements == SEGMENTATION_PATH)
+            {
+                ranges.push_back(Range{begin, 0});
+                skeleton.append(text, length);
+                inSegment = type == START_TAG;
+                text += length;
+                length = 0;
+            }
+            if (type == START_TAG)
+            {
+                openElements.push_back(name);
+            }
+        }
+        else if (type == END_TAG)
+        {
+            if (openElements.empty() || openElements.back() != tagName(text, length))
+            {
+                m_error = "Mismatched element " + tagName(text, length);
+                return false;
+            }
+            openElements.pop_back();
+            if (inSegment && openElements.size() == SEGMENTATION_PATH.size())
+            {
+                ranges.back().length = size_t(begin - ranges.back().begin) + length;
+                inSegment = false;
+            }
+        }
+
+        if (inSegment)
+        {
+            // Keep the lines in the skeleton the same as in the file.
+            skeleton.append(std::count(text, text + length, '\n'), '\n');
+        }
+        else
+        {
+            skeleton.append(text, length);
+        }
+        scanner.consume(text + length - scanner.text());
+    }
+
+    if (m_skeleton.Parse(skeleton.data(), skeleton.size()) != tinyxml2::XML_SUCCESS)
+    {
+        return false;
+    }
+
+    std::vector<const tinyxml2::XMLElement *> segments;
+    const tinyxml2::XMLElement * pmml = m_skeleton.RootElement();
+    for (const tinyxml2::XMLElement * model = pmml ? pmml->FirstChildElement("MiningModel") : nullptr; model != nullptr; model = model->NextSiblingElement("MiningModel"))
+    {
+        for (const tinyxml2::XMLElement * segmentation = model->FirstChildElement("Segmentation");
+             segmentation != nullptr; segmentation = segmentation->NextSiblingElement("Segmentation"))
+        {
+            for (const tinyxml2::XMLElement * segment = segmentation->FirstChildElement("Segment");
+                 segment != nullptr; segment = segment->NextSiblingElement("Segment"))
+            {
+                segments.push_back(segment);
+            }
+        }
+    }
+    if (segments.size() != ranges.size())
+    {
+        m_error = "Segments could not be found";
+        return false;
+    }
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        if (ranges[i].length)
+        {
+            m_segments.emplace(segments[i], ranges[i]);
+        }
+    }
+    return true;
+}
+
+const char * PMMLDocument::StreamedDocument::errorStr() const
+{
+    return m_error.empty() ? m_skeleton.ErrorStr() : m_error.c_str();
+}
+
+const tinyxml2::XMLElement * PMMLDocument::StreamedDocument::loadSegment(const tinyxml2::XMLElement * segment, tinyxml2::XMLDocument & document,
+                                                                        int & lineOffset) const
+{
+    lineOffset = 0;
+    auto found = m_segments.find(segment);
+    if (found == m_segments.end())
+    {
+        return segment;
+    }
+
+    // Each load has its own stream, so that they can happen at the same time.
+    std::ifstream stream(m_path, std::ios::binary);
+    std::string text(found->second.length, '\0');
+    if (!stream.seekg(found->second.begin) || !stream.read(&text[0], std::streamsize(text.size())) ||
+        document.Parse(text.data(), text.size()) != tinyxml2::XML_SUCCESS)
+    {
+        return nullptr;
+    }
+    lineOffset = segment->GetLineNum() - 1;
+    return document.RootElement();
+}
+
+PMMLDocument::LoadedSegment::LoadedSegment(AstBuilder & builder, const tinyxml2::XMLElement * segment) :
+    m_segment(segment)
+{
+    if (const StreamedDocument * document = builder.context().streamedDocument())
+    {
+        int lineOffset;
+        m_segment = document->loadSegment(segment, m_document, lineOffset);
+        m_builder = &builder;
+        m_savedLineOffset = builder.lineOffset();
+        builder.setLineOffset(m_savedLineOffset + lineOffset);
+        if (m_segment == nullptr)
+        {
+            builder.parsingError("Cannot read segment", segment->GetLineNum());
+        }
+    }
+}
+
+PMMLDocument::LoadedSegment::LoadedSegment(const ConversionContext & context, const tinyxml2::XMLElement * segment) :
+    m_segment(segment)
+{
+    if (const StreamedDocument * document = context.streamedDocument())
+    {
+        int lineOffset;
+        m_segment = document->loadSegment(segment, m_document, lineOffset);
+    }
+}
+
+PMMLDocument::LoadedSegment::~LoadedSegment()
+{
+    if (m_builder)
+    {
+        m_builder->setLineOffset(m_savedLineOffset);
+    }
+}
@@ -0,0 +1,90 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  This loads a PMML file without holding all of it in memory at once, for models too big to comfortably load as a whole.
+
+#ifndef streameddocument_hpp
+#define streameddocument_hpp
+
+#include "tinyxml2.h"
+#include <cstddef>
+#include <ios>
+#include <string>
+#include <unordered_map>
+
+class AstBuilder;
+
+namespace PMMLDocument
+{
+    class ConversionContext;
+
+    // Almost all of a large model is usually the Segments of a MiningModel, each of which can be converted on its own. So
+    // those Segments are left on disk when the rest of the file is loaded, and each is read back when it is converted.
+    //
+    // The rest of the file is the skeleton, in which each Segment that was left on disk is an empty element with the same
+    // attributes. Line numbers in the skeleton are the same as in the file.
+    class StreamedDocument
+    {
+        struct Range
+        {
+            std::streamoff begin;
+            size_t length;
+        };
+        std::string m_path;
+        std::string m_error;
+        tinyxml2::XMLDocument m_skeleton;
+        std::unordered_map<const tinyxml2::XMLElement *, Range> m_segments;
+    public:
+        // Files smaller than this are just loaded, as there is little to gain from streaming them.
+        static const size_t DEFAULT_STREAMING_SIZE = 32 << 20;
+
+        StreamedDocument() = default;
+        StreamedDocument(const StreamedDocument &) = delete;
+        StreamedDocument & operator=(const StreamedDocument &) = delete;
+
+        bool load(const char * path, size_t streamingSize = DEFAULT_STREAMING_SIZE);
+        // Why load failed.
+        const char * errorStr() const;
+
+        const tinyxml2::XMLDocument & skeleton() const { return m_skeleton; }
+        bool isStreamed(const tinyxml2::XMLElement * segment) const { return m_segments.count(segment) != 0; }
+
+        // This reads a Segment of the skeleton back from disk into document and returns it, or nullptr if it can't be read.
+        // Its line numbers start again from 1, lineOffset is set to what needs to be added to them. Segments that were never
+        // left on disk are returned as they are. This may be called from several threads at once.
+        const tinyxml2::XMLElement * loadSegment(const tinyxml2::XMLElement * segment, tinyxml2::XMLDocument & document, int & lineOffset) const;
+    };
+
+    // This holds a Segment in memory while it is being converted. If the document is being streamed, the Segment is loaded
+    // from disk and the line offset of builder is adjusted to match until this goes away.
+    class LoadedSegment
+    {
+        tinyxml2::XMLDocument m_document;
+        const tinyxml2::XMLElement * m_segment;
+        AstBuilder * m_builder = nullptr;
+        int m_savedLineOffset = 0;
+    public:
+        LoadedSegment(AstBuilder & builder, const tinyxml2::XMLElement * segment);
+        // For when there's nothing to report errors to.
+        LoadedSegment(const ConversionContext & context, const tinyxml2::XMLElement * segment);
+        ~LoadedSegment();
+        LoadedSegment(const LoadedSegment &) = delete;
+        LoadedSegment & operator=(const LoadedSegment &) = delete;
+
+        // The Segment, or nullptr if it couldn't be read.
+        const tinyxml2::XMLElement * get() const { return m_segment; }
+    };
+}
+
+#endif /* streameddocument_hpp */
@@ -0,0 +1,120 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "chunkedbuffer.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    // Chunks start small, so that small scripts don't waste much, and double up to this size.
+    const size_t FIRST_CHUNK_SIZE = 4096;
+    const size_t MAX_CHUNK_SIZE = 1 << 20;
+}
+
+void ChunkedBuffer::settle()
+{
+    if (!m_chunks.empty())
+    {
+        m_chunks.back().size = pptr() - pbase();
+        m_size += m_chunks.back().size;
+    }
+}
+
+void ChunkedBuffer::addChunk()
+{
+    settle();
+    const size_t capacity = m_chunks.empty() ? FIRST_CHUNK_SIZE : std::min(MAX_CHUNK_SIZE, size_t(epptr() - pbase()) * 2);
+    Chunk chunk;
+    chunk.data.reset(new char[capacity]);
+    chunk.size = 0;
+    setp(chunk.data.get(), chunk.data.get() + capacity);
+    m_chunks.push_back(std::move(chunk));
+}
+
+ChunkedBuffer::int_type ChunkedBuffer::overflow(int_type c)
+{
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+    {
+        return traits_type::not_eof(c);
+    }
+    addChunk();
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
+}
+
+std::streamsize ChunkedBuffer::xsputn(const char * s, std::streamsize count)
+{
+    std::streamsize written = 0;
+    while (written < count)
+    {
+        if (pptr() == epptr())
+        {
+            addChunk();
+        }
+        const std::streamsize toCopy = std::min<std::streamsize>(count - written, epptr() - pptr());
+        memcpy(pptr(), s + written, toCopy);
+        // pbump takes an int, and toCopy is never more than a chunk.
+        pbump(int(toCopy));
+        written += toCopy;
+    }
+    return written;
+}
+
+void ChunkedBuffer::writeTo(std::ostream & output) const
+{
+    Reader reader(*this);
+    size_t size;
+    while (const char * data = reader.next(size))
+    {
+        output.write(data, size);
+    }
+}
+
+const char * ChunkedBuffer::Reader::next(size_t & size)
+{
+    while (m_next < m_buffer.m_chunks.size())
+    {
+        const Chunk & chunk = m_buffer.m_chunks[m_next++];
+        // The last chunk may still be being written to, so its size comes from the put area.
+        size = m_next == m_buffer.m_chunks.size() ? size_t(m_buffer.pptr() - m_buffer.pbase()) : chunk.size;
+        if (size > 0)
+        {
+            return chunk.data.get();
+        }
+    }
+    size = 0;
+    return nullptr;
+}
+
+const char * ChunkedBuffer::Reader::luaReader(lua_State *, void * reader, size_t * size)
+{
+    return static_cast<Reader *>(reader)->next(*size);
+}
+
+ChunkedBuffer::InputBuffer::int_type ChunkedBuffer::InputBuffer::underflow()
+{
+    size_t size;
+    const char * data = m_reader.next(size);
+    if (data == nullptr)
+    {
+        return traits_type::eof();
+    }
+    // The get area is never written to, so it is safe to point it at the chunk.
+    char * begin = const_cast<char *>(data);
+    setg(begin, begin, begin + size);
+    return traits_type::to_int_type(*begin);
+}
@@ -0,0 +1,82 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  This is somewhere for a LuaOutputter to write a script to, so that it can be loaded into Lua without being copied.
+
+#ifndef chunkedbuffer_hpp
+#define chunkedbuffer_hpp
+
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+struct lua_State;
+
+// A stream buffer that grows by adding chunks, rather than by reallocating and copying what has already been written.
+// Use it as the buffer of a std::ostream, then read it back, one chunk at a time, with a Reader.
+class ChunkedBuffer : public std::streambuf
+{
+    struct Chunk
+    {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+    std::vector<Chunk> m_chunks;
+    size_t m_size = 0;
+
+    void addChunk();
+    // This records how much of the last chunk has been written.
+    void settle();
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char * s, std::streamsize count) override;
+public:
+    ChunkedBuffer() = default;
+    ChunkedBuffer(const ChunkedBuffer &) = delete;
+    ChunkedBuffer & operator=(const ChunkedBuffer &) = delete;
+
+    // The number of characters written so far.
+    size_t size() const
+    {
+        return m_size + (pptr() - pbase());
+    }
+
+    void writeTo(std::ostream & output) const;
+
+    // This gives each chunk of a buffer in turn, without copying.
+    class Reader
+    {
+        const ChunkedBuffer & m_buffer;
+        size_t m_next = 0;
+    public:
+        explicit Reader(const ChunkedBuffer & buffer) : m_buffer(buffer) {}
+        // Returns the next chunk, or nullptr once there are none left.
+        const char * next(size_t & size);
+        // This is a lua_Reader, for passing to lua_load along with a pointer to a Reader.
+        static const char * luaReader(lua_State *, void * reader, size_t * size);
+    };
+
+    // A stream buffer for reading back the contents of a ChunkedBuffer, such as with std::getline.
+    class InputBuffer : public std::streambuf
+    {
+        Reader m_reader;
+    protected:
+        int_type underflow() override;
+    public:
+        explicit InputBuffer(const ChunkedBuffer & buffer) : m_reader(buffer) {}
+    };
+};
+
+#endif /* chunkedbuffer_hpp */
@@ -123,6 +123,11 @@ void LuaConverter::Converter::process(Function::BooleanAnd, Analyser::AnalyserCo
             outputMissing(context, **iter, true, output);
             assertionsIfTrue.addAssertionsForCheck(**iter, Analyser::ASSUME_NOT_MISSING);
         }
+        // Those checks give back the value that was checked, which is only as good as true in an if statement.
+        if (secondLastIter != deferred.begin())
+        {
+            output.keyword("and").keyword("true");
+        }
     }
 }
 
@@ -18,6 +18,7 @@
 #include "luaconverter-internal.hpp"
 #include "analyser.hpp"
 #include "conversioncontext.hpp"
+#include "framestack.hpp"
 #include <assert.h>
 
 void LuaConverter::Converter::process(Function::Assignment, Analyser::AnalyserContext & context, const AstNode & node, DefaultIfMissing, LuaOutputter & output)
@@ -51,73 +52,180 @@ void LuaConverter::Converter::process(Function::Declartion, Analyser::AnalyserCo
     }
 }
 
-void LuaConverter::Converter::process(Function::Block, Analyser::AnalyserContext & context, const AstNode & node, DefaultIfMissing, LuaOutputter & output)
+namespace LuaConverter
 {
-    for (Analyser::ChildAssertionIterator iter(context, node); iter.valid(); ++iter)
-    {
-        // The assertions carry into this statement
-        // As these have no return values,
-        convertAstSkipNullChecks(context, *iter, DEFAULT_TO_NIL, output);
-        output.endline();
-    }
-}
-
-// An if chain is like:
-// A if a or B if b or C if c or D
-// The predicate comes after the expression, which seems funny at first, but it works better this way.
-void LuaConverter::Converter::process(Function::IfChain, Analyser::AnalyserContext & context, const AstNode & node, DefaultIfMissing, LuaOutputter & output)
+namespace
 {
-    bool hasStartedBlock = false;
-    // This set of assertions is maintained down the chain, based on the if conditions _not_ taken.
-    Analyser::NonNoneAssertionStackGuard continuingNonNullAssertions(context);
-    AstNode::Children::const_iterator iter = node.children.begin();
-    while (iter != node.children.end())
+    // Trees can nest if chains thousands deep, so blocks and if chains are written by this, rather than by recursing through
+    // Converter. It keeps a Frame for each of them from the outermost down to the one being written.
+    class StatementWriter
     {
-        Analyser::NonNoneAssertionStackGuard thisClauseAssertions(context);
-        // Every second child is the body of the if statement, starting from the first.
-        AstNode::Children::const_iterator body = (iter++);
-        bool hasWrittenPredicate = false;
-        AstNode::Children::const_iterator predicate = iter;
-        // If we're not at the end of the list, the following condition is a predicate.
-        if (predicate != node.children.end())
+        struct Frame
         {
-            ++iter;
-            
-            if (!hasStartedBlock)
+            const AstNode & node;
+            // For blocks, this carries the assertions of each statement into the next.
+            Analyser::ChildAssertionIterator iter;
+            // For if chains, the assertions maintained down the chain, based on the if conditions _not_ taken, and those of the clause being written.
+            Analyser::NonNoneAssertionStackGuard continuingNonNullAssertions;
+            Analyser::NonNoneAssertionStackGuard thisClauseAssertions;
+            // Every second child of an if chain is the body of the if statement, starting from the first.
+            size_t body = 0;
+            bool hasStartedBlock = false;
+            bool writingChild = false;
+
+            Frame(Analyser::AnalyserContext & context, const AstNode & n) :
+                node(n),
+                iter(context, n, n.function().functionType == Function::BLOCK),
+                continuingNonNullAssertions(context),
+                thisClauseAssertions(context)
             {
-                output.startIf();
-                hasStartedBlock = true;
             }
-            else
+        };
+
+        Analyser::AnalyserContext & m_context;
+        LuaOutputter & m_output;
+        FrameStack<Frame> m_frames;
+
+        static bool isStatement(const AstNode & node)
+        {
+            return (node.function().functionType == Function::BLOCK || node.function().functionType == Function::IF_CHAIN) && node.coercedType == node.type;
+        }
+
+        // Because there is no return value here, skip the null checks. This starts a frame for blocks and if chains, and returns true.
+        bool write(const AstNode & node)
+        {
+            if (isStatement(node))
+            {
+                m_frames.push(m_context, node);
+                return true;
+            }
+            convertAstSkipNullChecks(m_context, node, DEFAULT_TO_NIL, m_output);
+            return false;
+        }
+
+        // These return true if they have started a frame for a child, or false once the statement is written.
+        bool writeBlock(Frame & frame)
+        {
+            Analyser::ChildAssertionIterator & iter = frame.iter;
+            if (frame.writingChild)
+            {
+                frame.writingChild = false;
+                m_output.endline();
+                ++iter;
+            }
+            for (; iter.valid(); ++iter)
+            {
+                // The assertions carry into this statement
+                if (write(*iter))
+                {
+                    frame.writingChild = true;
+                    return true;
+                }
+                m_output.endline();
+            }
+            return false;
+        }
+
+        // An if chain is like:
+        // A if a or B if b or C if c or D
+        // The predicate comes after the expression, which seems funny at first, but it works better this way.
+        bool writeIfChain(Frame & frame)
+        {
+            const AstNode::Children & children = frame.node.children;
+            for (;;)
             {
-                output.startElseIf();
+                if (frame.writingChild)
+                {
+                    frame.writingChild = false;
+                    finishClause(frame);
+                }
+                if (frame.body >= children.size())
+                {
+                    break;
+                }
+                
+                // If we're not at the end of the list, the following condition is a predicate.
+                const size_t predicate = frame.body + 1;
+                if (predicate < children.size())
+                {
+                    if (!frame.hasStartedBlock)
+                    {
+                        m_output.startIf();
+                        frame.hasStartedBlock = true;
+                    }
+                    else
+                    {
+                        m_output.startElseIf();
+                    }
+                    
+                    convertAstToLuaWithNullAssertions(m_context, children[predicate], DEFAULT_TO_FALSE, m_output);
+                    frame.thisClauseAssertions.addAssertionsForCheck(children[predicate], Analyser::ASSUME_TRUE);
+                    m_output.endPredicate();
+                }
+                else if (frame.hasStartedBlock)
+                {
+                    // If there is an odd number of items, then the final child is an else.
+                    m_output.startElse();
+                }
+                
+                frame.writingChild = true;
+                if (write(children[frame.body]))
+                {
+                    return true;
+                }
             }
             
-            convertAstToLuaWithNullAssertions(context, *predicate, DEFAULT_TO_FALSE, output);
-            thisClauseAssertions.addAssertionsForCheck(*predicate, Analyser::ASSUME_TRUE);
-            output.endPredicate();
-            hasWrittenPredicate = true;
+            if (frame.hasStartedBlock)
+            {
+                m_output.endBlock();
+            }
+            return false;
         }
-        
-        if (!hasWrittenPredicate && hasStartedBlock)
+
+        void finishClause(Frame & frame)
         {
-            // If there is an odd number of items, then the final child is an else.
-            output.startElse();
+            m_output.endline();
+            // Now that this clause is over, anything afterwards can assume it was not true.
+            const size_t predicate = frame.body + 1;
+            if (predicate < frame.node.children.size())
+            {
+                frame.continuingNonNullAssertions.addAssertionsForCheck(frame.node.children[predicate], Analyser::ASSUME_NOT_TRUE);
+            }
+            frame.thisClauseAssertions.clear();
+            frame.body += 2;
         }
-        
-        // Because there is no return value here, skip the null checks.
-        convertAstSkipNullChecks(context, *body, DEFAULT_TO_NIL, output);
-        
-        output.endline();
-        // Now that this clause is over, anything afterwards can assume it was not true.
-        if (predicate != node.children.end())
+    public:
+        StatementWriter(Analyser::AnalyserContext & context, LuaOutputter & output) :
+            m_context(context),
+            m_output(output)
         {
-            continuingNonNullAssertions.addAssertionsForCheck(*predicate, Analyser::ASSUME_NOT_TRUE);
         }
-    }
-    
-    if (hasStartedBlock)
-    {
-        output.endBlock();
-    }
+
+        void run(const AstNode & node)
+        {
+            m_frames.push(m_context, node);
+            while (!m_frames.empty())
+            {
+                Frame & frame = m_frames.back();
+                const bool startedChild = frame.node.function().functionType == Function::BLOCK ? writeBlock(frame) : writeIfChain(frame);
+                if (!startedChild)
+                {
+                    m_frames.pop();
+                }
+            }
+        }
+    };
+}
+}
+
+void LuaConverter::Converter::process(Function::Block, Analyser::AnalyserContext & context, const AstNode & node, DefaultIfMissing, LuaOutputter & output)
+{
+    StatementWriter writer(context, output);
+    writer.run(node);
+}
+
+void LuaConverter::Converter::process(Function::IfChain, Analyser::AnalyserContext & context, const AstNode & node, DefaultIfMissing, LuaOutputter & output)
+{
+    StatementWriter writer(context, output);
+    writer.run(node);
 }
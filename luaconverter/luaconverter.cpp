@@ -21,8 +21,13 @@
 #include "luaconverter.hpp"
 #include "luaconverter-internal.hpp"
 #include "functiondispatch.hpp"
+#include "chunkedbuffer.hpp"
+#include "parallel.hpp"
 #include <assert.h>
 #include <algorithm>
+#include <memory>
+#include <ostream>
+#include <vector>
 
 namespace LuaConverter
 {
@@ -35,13 +40,227 @@ namespace LuaConverter
     
 }
 
+namespace
+{
+    // A script is only written in parts if each part can have at least this many nodes, and there are at most this many parts.
+    const size_t MIN_PART_NODES = 1 << 14;
+    const size_t MAX_PARTS = 256;
+
+    size_t countNodes(const AstNode & node)
+    {
+        size_t nodes = 0;
+        std::vector<const AstNode *> pending(1, &node);
+        while (!pending.empty())
+        {
+            const AstNode & next = *pending.back();
+            pending.pop_back();
+            nodes++;
+            for (const AstNode & child : next.children)
+            {
+                pending.push_back(&child);
+            }
+        }
+        return nodes;
+    }
+
+    // A section of a script that was split up is run by a statement with no value, holding the section, and the table of
+    // sections it is in.
+    bool isSection(const AstNode & node)
+    {
+        return node.function().functionType == Function::RUN_LAMBDA && node.type == PMMLDocument::TYPE_VOID &&
+            node.fieldDescription != nullptr && !node.children.empty() && node.children.back().function().functionType == Function::LAMBDA;
+    }
+
+    // Some of the statements of a block, which are written into a buffer of their own.
+    struct Part
+    {
+        size_t begin;
+        size_t end;
+        // How many of the assertions made by the statements before this part apply to it.
+        size_t variables;
+        size_t clauses;
+        std::unique_ptr<ChunkedBuffer> buffer;
+        std::unique_ptr<std::ostream> stream;
+        std::unique_ptr<LuaOutputter> output;
+    };
+}
+
+// This writes the statements of a block in parts on a pool of worker threads, then adds them to output in order, which gives
+// the same script as writing them one after another. Each part needs to know what earlier statements asserted about missing
+// values, which is found by going through the statements first. Returns false, without writing anything, if the block isn't
+// big enough to be worth it.
+static bool convertBlockInParts(const AstNode & block, LuaOutputter & output)
+{
+    const size_t count = block.children.size();
+    std::vector<size_t> nodesBefore(count + 1, 0);
+    for (size_t i = 0; i < count; ++i)
+    {
+        nodesBefore[i + 1] = nodesBefore[i] + countNodes(block.children[i]);
+    }
+    const size_t partNodes = std::max(MIN_PART_NODES, nodesBefore[count] / MAX_PARTS);
+    if (nodesBefore[count] < partNodes * 2)
+    {
+        return false;
+    }
+
+    // This makes the same assertions as a ChildAssertionIterator going through the block.
+    Analyser::AnalyserContext context;
+    Analyser::NonNoneAssertionStackGuard previous(context);
+    std::vector<Part> parts;
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (parts.empty() || nodesBefore[i] - nodesBefore[parts.back().begin] >= partNodes)
+        {
+            Part part;
+            part.begin = i;
+            part.end = count;
+            part.variables = previous.variableIDs().size();
+            part.clauses = previous.clauseIDs().size();
+            if (!parts.empty())
+            {
+                parts.back().end = i;
+            }
+            parts.push_back(std::move(part));
+        }
+        previous.addAssertionsForCheck(block.children[i], Analyser::NO_ASSUMPTIONS);
+    }
+    if (parts.size() < 2)
+    {
+        return false;
+    }
+
+    // Every statement starts and ends with output in the same state, so each part starts from where output is now.
+    for (Part & part : parts)
+    {
+        part.buffer.reset(new ChunkedBuffer());
+        part.stream.reset(new std::ostream(part.buffer.get()));
+        part.output.reset(new LuaOutputter(*part.stream, output));
+    }
+
+    Parallel::forEachInOrder(parts.size(), [&](size_t i)
+    {
+        Part & part = parts[i];
+        Analyser::AnalyserContext partContext;
+        Analyser::NonNoneAssertionStackGuard before(partContext);
+        for (size_t j = 0; j < part.variables; ++j)
+        {
+            before.addVariableAssertionByID(previous.variableIDs()[j]);
+        }
+        for (size_t j = 0; j < part.clauses; ++j)
+        {
+            before.addClauseAssertion(previous.clauseIDs()[j]);
+        }
+
+        Analyser::NonNoneAssertionStackGuard within(partContext);
+        for (size_t j = part.begin; j < part.end; ++j)
+        {
+            if (j > part.begin)
+            {
+                within.addAssertionsForCheck(block.children[j - 1], Analyser::NO_ASSUMPTIONS);
+            }
+            LuaConverter::convertAstSkipNullChecks(partContext, block.children[j], LuaConverter::DEFAULT_TO_NIL, *part.output);
+            part.output->endline();
+        }
+    },
+    [&](size_t i)
+    {
+        Part & part = parts[i];
+        output.append(*part.output, *part.buffer);
+        part.output.reset();
+        part.stream.reset();
+        part.buffer.reset();
+        return true;
+    });
+    return true;
+}
+
 // This is the function that most external users call.
 void LuaConverter::convertAstToLua(const AstNode & node, LuaOutputter & output)
 {
+    // The outermost block of a big model is usually made of many statements, such as one for each segment, which can be
+    // written at the same time.
+    if (node.function().functionType == Function::BLOCK && node.coercedType == node.type && Parallel::threadCount() > 1 &&
+        convertBlockInParts(node, output))
+    {
+        return;
+    }
+
     Analyser::AnalyserContext analyserContext;
     convertAstToLuaWithNullAssertions(analyserContext, node, DEFAULT_TO_FALSE, output);
 }
 
+// Each section of a tree that was split up is written as a function in a table of sections, which is then called where the
+// section was. They are written at the same time, each knowing what the statements before it asserted about missing values,
+// as in convertBlockInParts.
+void LuaConverter::convertSections(const AstNode & tree, LuaOutputter & output)
+{
+    if (tree.function().functionType != Function::BLOCK)
+    {
+        return;
+    }
+    Analyser::AnalyserContext context;
+    Analyser::NonNoneAssertionStackGuard previous(context);
+    std::vector<Part> parts;
+    for (size_t i = 0; i < tree.children.size(); ++i)
+    {
+        if (isSection(tree.children[i]))
+        {
+            Part part;
+            part.begin = i;
+            part.end = i + 1;
+            part.variables = previous.variableIDs().size();
+            part.clauses = previous.clauseIDs().size();
+            parts.push_back(std::move(part));
+        }
+        previous.addAssertionsForCheck(tree.children[i], Analyser::NO_ASSUMPTIONS);
+    }
+    if (parts.empty())
+    {
+        return;
+    }
+
+    output.declare(tree.children[parts.front().begin].fieldDescription, false).endline();
+    for (Part & part : parts)
+    {
+        part.buffer.reset(new ChunkedBuffer());
+        part.stream.reset(new std::ostream(part.buffer.get()));
+        part.output.reset(new LuaOutputter(*part.stream, output));
+        // What a section returns goes back to the variables it was called with, rather than being the result of the script.
+        part.output->setReturnedNames(std::vector<std::string>());
+    }
+
+    Parallel::forEachInOrder(parts.size(), [&](size_t i)
+    {
+        Part & part = parts[i];
+        Analyser::AnalyserContext partContext;
+        Analyser::NonNoneAssertionStackGuard before(partContext);
+        for (size_t j = 0; j < part.variables; ++j)
+        {
+            before.addVariableAssertionByID(previous.variableIDs()[j]);
+        }
+        for (size_t j = 0; j < part.clauses; ++j)
+        {
+            before.addClauseAssertion(previous.clauseIDs()[j]);
+        }
+
+        const AstNode & section = tree.children[part.begin];
+        part.output->rawField(section.fieldDescription).openBracket().literal(section.content, PMMLDocument::TYPE_NUMBER).closeBracket().keyword("=");
+        // This passes what is known of the arguments on to the parameters.
+        Analyser::ChildAssertionIterator iter(partContext, section);
+        std::advance(iter, section.children.size() - 1);
+        convertAstToLuaWithNullAssertions(partContext, *iter, DEFAULT_TO_NIL, *part.output);
+    },
+    [&](size_t i)
+    {
+        Part & part = parts[i];
+        output.append(*part.output, *part.buffer);
+        part.output.reset();
+        part.stream.reset();
+        part.buffer.reset();
+        return true;
+    });
+}
+
 // Output an expression in Lua. This will potentially add a bit in the front to make sure that it correctly returns nil if it would have
 // evaluated to missing according to PMML's logic (rather than throwing an exception or something).
 void LuaConverter::convertAstToLuaWithNullAssertions(Analyser::AnalyserContext & context,
@@ -233,18 +452,35 @@ void LuaConverter::Converter::process(Function::UnaryOperator, Analyser::Analyse
 void LuaConverter::Converter::process(Function::ReturnStatement, Analyser::AnalyserContext & context, const AstNode & node, DefaultIfMissing, LuaOutputter & output)
 {
     output.keyword("return");
+    const std::vector<std::string> & names = output.returnedNames();
+    assert(names.empty() || names.size() == node.children.size());
+    if (!names.empty())
+    {
+        output.keyword("{");
+    }
     for (size_t i = 0; i < node.children.size(); i++)
     {
         if (i != 0)
         {
             output.comma();
         }
+        if (!names.empty())
+        {
+            output.openBracket().literal(names[i], PMMLDocument::TYPE_STRING).closeBracket().keyword("=");
+        }
         convertAstToLuaWithNullAssertions(context, node.children[i], DEFAULT_TO_NIL, output);
     }
+    if (!names.empty())
+    {
+        output.keyword("}");
+    }
 }
 
 void LuaConverter::Converter::process(Function::Constant, Analyser::AnalyserContext &, const AstNode & node, DefaultIfMissing, LuaOutputter & output)
 {
+    // A negative number is a unary minus to Lua, so it needs brackets when it is raised to a power, for instance.
+    const bool isNegativeNumber = node.coercedType == PMMLDocument::TYPE_NUMBER && node.content[0] == '-';
+    LuaOutputter::OperatorScopeHelper negativeScope(output, LuaOutputter::PRECEDENCE_UNARY, isNegativeNumber);
     output.literal(node.content.c_str(), node.coercedType);
 }
 
@@ -293,13 +529,41 @@ void LuaConverter::Converter::process(Function::Functionlike, Analyser::Analyser
 
 void LuaConverter::Converter::process(Function::RunLambda, Analyser::AnalyserContext & context, const AstNode & node, DefaultIfMissing, LuaOutputter & output)
 {
+    // A section of a script that was split up is defined before the script, see convertSections, so it is only called here,
+    // giving whatever it returns back to the variables passed in for it.
+    if (isSection(node))
     {
+        const AstNode & lambda = node.children.back();
+        const AstNode & body = lambda.children.back();
+        if (!body.children.empty() && body.children.back().function().functionType == Function::RETURN_STATEMENT)
+        {
+            bool notFirst = false;
+            for (const AstNode & result : body.children.back().children)
+            {
+                size_t parameter = 0;
+                while (lambda.children[parameter].fieldDescription != result.fieldDescription)
+                {
+                    ++parameter;
+                }
+                if (notFirst)
+                {
+                    output.comma();
+                }
+                notFirst = true;
+                output.rawField(node.children[parameter].fieldDescription);
+            }
+            output.keyword("=");
+        }
+        output.rawField(node.fieldDescription).openBracket().literal(node.content, PMMLDocument::TYPE_NUMBER).closeBracket();
+    }
+    else
+    {
+        const bool isInline = node.children.empty() || node.children.back().function().functionType != Function::FIELD_REF;
         Analyser::ChildAssertionIterator iter(context, node);
         assert(iter.valid());
         // Go to the last bit (the lambda itself)
         std::advance(iter, node.children.size() - 1);
         
-        const bool isInline =node.children.empty() ||  node.children.back().function().functionType != Function::FIELD_REF;
         // Lua doesn't like inline lambdas to not have parenthesis
         LuaOutputter::OperatorScopeHelper parenScope(output, LuaOutputter::PRECEDENCE_PARENTHESIS, isInline);
         convertAstToLuaWithNullAssertions(context, *iter, DEFAULT_TO_NIL, output);
@@ -335,7 +599,12 @@ void LuaConverter::Converter::process(Function::Lambda, Analyser::AnalyserContex
     }
     output.finishedArguments();
     const AstNode & body = node.children.back();
-    if (body.function().functionType != Function::BLOCK)
+    // Sections have nothing to return, and can be as long as any other block of statements.
+    if (node.type == PMMLDocument::TYPE_VOID)
+    {
+        convertAstSkipNullChecks(context, body, DEFAULT_TO_NIL, output);
+    }
+    else if (body.function().functionType != Function::BLOCK)
     {
         output.keyword("return");
         convertAstToLuaWithNullAssertions(context, body, DEFAULT_TO_NIL, output);
@@ -54,6 +54,10 @@ namespace LuaConverter
     // If "invert" is true, then this function outputs code that returns true if not unknown and nil if unknown.
     void outputMissing(Analyser::AnalyserContext & context, const AstNode & node,
                        bool invert, LuaOutputter & output);
+
+    // If node was split into sections by the optimiser, this defines them, which must be done before node is written, outside of
+    // the function it is written in.
+    void convertSections(const AstNode & node, LuaOutputter & output);
 }
 
 #endif /* luaconverter_hpp */
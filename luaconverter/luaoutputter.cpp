@@ -16,6 +16,7 @@
 //
 
 #include "luaoutputter.hpp"
+#include "chunkedbuffer.hpp"
 #include "conversioncontext.hpp"
 #include <assert.h>
 #include <algorithm>
@@ -32,12 +33,39 @@ LuaOutputter::LuaOutputter(std::ostream & output, unsigned int options) :
     m_indentLevel(0),
     m_operatorPrecedence(PRECEDENCE_PARENTHESIS),
     m_spaceState(AFTER_LINE_END),
-    m_maxVariables(195),
+    m_aliasedVariables(std::make_shared<const AliasedVariables>()),
+    m_returnedNames(std::make_shared<const std::vector<std::string>>()),
+    m_maxVariables(DEFAULT_MAX_VARIABLES),
     m_options(options)
 {
     m_output.precision(17); // 17 digits is required to ensure that value is rounded down to its original value.
 }
 
+LuaOutputter::LuaOutputter(std::ostream & output, const LuaOutputter & other) :
+    m_output(output),
+    m_indentLevel(other.m_indentLevel),
+    m_operatorPrecedence(other.m_operatorPrecedence),
+    m_spaceState(other.m_spaceState),
+    m_stack(other.m_stack),
+    m_aliasedVariables(other.m_aliasedVariables),
+    m_returnedNames(other.m_returnedNames),
+    m_overflowedVariables(other.m_overflowedVariables),
+    m_maxVariables(other.m_maxVariables),
+    m_options(other.m_options)
+{
+    m_output.precision(17);
+}
+
+LuaOutputter & LuaOutputter::append(const LuaOutputter & part, const ChunkedBuffer & buffer)
+{
+    buffer.writeTo(m_output);
+    m_indentLevel = part.m_indentLevel;
+    m_operatorPrecedence = part.m_operatorPrecedence;
+    m_spaceState = part.m_spaceState;
+    m_stack = part.m_stack;
+    return *this;
+}
+
 LuaOutputter & LuaOutputter::startIf()
 {
     assert(isBlock(getContext()));
@@ -151,9 +179,13 @@ void LuaOutputter::doIndent()
 {
     if (m_spaceState == AFTER_LINE_END)
     {
-        for (int i = 0; i < m_indentLevel; i++)
+        // Deep trees are indented thousands of levels, so the spaces are written a block at a time.
+        static const char SPACES[] = "                                                                ";
+        for (size_t left = 2 * size_t(std::max(m_indentLevel, 0)); left > 0;)
         {
-            m_output << "  ";
+            const size_t count = std::min(left, sizeof(SPACES) - 1);
+            m_output.write(SPACES, count);
+            left -= count;
         }
     }
     else if (m_spaceState == AFTER_KEYWORD)
@@ -335,8 +367,8 @@ LuaOutputter & LuaOutputter::nullCheck(PMMLDocument::ConstFieldDescriptionPtr fi
 LuaOutputter & LuaOutputter::declare(PMMLDocument::ConstFieldDescriptionPtr fieldDescription,
                                      bool hasValue)
 {
-    auto alias = m_aliasedVariables.find(fieldDescription);
-    bool aliased = (alias != m_aliasedVariables.end()) && (alias->second != fieldDescription);
+    auto alias = m_aliasedVariables->find(fieldDescription);
+    bool aliased = (alias != m_aliasedVariables->end()) && (alias->second != fieldDescription);
     if (!aliased && fieldDescription->overflowAssignment == 0)
     {
         keyword("local");
@@ -386,8 +418,8 @@ LuaOutputter & LuaOutputter::nullReplacement(const char * literal, PMMLDocument:
 
 LuaOutputter & LuaOutputter::rawField(PMMLDocument::ConstFieldDescriptionPtr fieldDescription)
 {
-    auto aliased = m_aliasedVariables.find(fieldDescription);
-    if (aliased != m_aliasedVariables.end())
+    auto aliased = m_aliasedVariables->find(fieldDescription);
+    if (aliased != m_aliasedVariables->end())
     {
         fieldDescription = aliased->second;
     }
@@ -18,6 +18,7 @@
 #ifndef luaoutputter_hpp
 #define luaoutputter_hpp
 
+#include <memory>
 #include <string>
 #include <vector>
 #include <ostream>
@@ -29,6 +30,8 @@ namespace PMMLDocument
     struct FieldDescription;
 }
 
+class ChunkedBuffer;
+
 class LuaOutputter
 {
 public:
@@ -36,6 +39,8 @@ public:
     static const char * INPUT_NAME;
     static const char * OVERFLOW_NAME;
     static const char * LUA_INFINITY;
+    // How many locals a script may have before the rest overflow into a table, see setMaxVariables.
+    static const size_t DEFAULT_MAX_VARIABLES = 195;
     
     typedef std::unordered_map<PMMLDocument::ConstFieldDescriptionPtr, int> OverflowedVariables;
     typedef std::unordered_map<PMMLDocument::ConstFieldDescriptionPtr, PMMLDocument::ConstFieldDescriptionPtr> AliasedVariables;
@@ -83,7 +88,9 @@ private:
         return m_stack.empty() ? GLOBAL : m_stack.back();
     }
     
-    AliasedVariables m_aliasedVariables;
+    // This is shared with any LuaOutputters carrying on from this one, as it doesn't change while writing.
+    std::shared_ptr<const AliasedVariables> m_aliasedVariables;
+    std::shared_ptr<const std::vector<std::string>> m_returnedNames;
     size_t m_overflowedVariables = 0;
     size_t m_maxVariables;
     const unsigned int m_options;
@@ -94,6 +101,7 @@ public:
     };
     
     bool lowercase() const { return m_options & OPTION_LOWERCASE; }
+    unsigned int options() const { return m_options; }
     
     enum
     {
@@ -153,6 +161,11 @@ public:
     };
     
     LuaOutputter(std::ostream & m_output, unsigned int options = 0);
+    // This carries on from wherever other has got to, but writes to output. Parts of a script can be written like this at the
+    // same time, then added back to other in order with append.
+    LuaOutputter(std::ostream & output, const LuaOutputter & other);
+    // This writes what part wrote into buffer, and carries on from wherever part finished.
+    LuaOutputter & append(const LuaOutputter & part, const ChunkedBuffer & buffer);
     LuaOutputter & startIf();
     LuaOutputter & startElseIf();
     LuaOutputter & startElse();
@@ -207,13 +220,31 @@ public:
     LuaOutputter & closeBracket();
     
     size_t getMaxVariables() const { return m_maxVariables; }
+    // Lua limits a function to 200 locals, other backends sharing the optimiser may not have this limit.
+    void setMaxVariables(size_t maxVariables)
+    {
+        m_maxVariables = maxVariables;
+    }
     void setOverflowedVariables(size_t hasOverflow)
     {
         m_overflowedVariables = hasOverflow;
     }
     void setAliasedVariables(AliasedVariables && aliasedVariables)
     {
-        m_aliasedVariables = aliasedVariables;
+        m_aliasedVariables = std::make_shared<const AliasedVariables>(std::move(aliasedVariables));
+    }
+    const AliasedVariables & aliasedVariables() const
+    {
+        return *m_aliasedVariables;
+    }
+    // If these are set, a return statement returns a table with a field of each name, rather than each value on its own.
+    void setReturnedNames(std::vector<std::string> && returnedNames)
+    {
+        m_returnedNames = std::make_shared<const std::vector<std::string>>(std::move(returnedNames));
+    }
+    const std::vector<std::string> & returnedNames() const
+    {
+        return *m_returnedNames;
     }
     size_t nOverflowedVariables() const
     {
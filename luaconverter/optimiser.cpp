@@ -19,6 +19,8 @@
 //  The first and least important is removing dead code and inlining useless variables... this way the variable count goes down.
 //  The second is working out which variables to "overflow", that is, to shove in an array and access indirectly.
 //  It also culls unneeded branches and other rubbish that doesn't need to be in the final output, making the output faster and easier to read.
+//  Arithmetic on constants is worked out beforehand too.
+//  Expressions that are worked out more than once are worked out once into a variable where that is safe.
 
 #include "optimiser.hpp"
 
@@ -26,10 +28,25 @@
 #include "analyser.hpp"
 #include "conversioncontext.hpp"
 #include "luaoutputter.hpp"
+#include "framestack.hpp"
 #include "functiondispatch.hpp"
+#include "parallel.hpp"
 
 #include <algorithm>
+#include <assert.h>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <limits>
+#include <map>
+#include <queue>
+#include <set>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
 
 enum VisitorResponse
 {
@@ -42,155 +59,269 @@ static bool isSpecialVar(const PMMLDocument::FieldDescription * description)
     return description->origin == PMMLDocument::ORIGIN_SPECIAL;
 }
 
+// A section of a script split into several functions is a lambda with no value. See FunctionSplitter.
+static bool isSection(const AstNode & node)
+{
+    return node.function().functionType == Function::LAMBDA && node.type == PMMLDocument::TYPE_VOID;
+}
 
-template<bool maintainAssertions, typename ASTVisitor>
-static VisitorResponse traverseNode(Analyser::AnalyserContext & ctx, AstNode & node, size_t & counter, ASTVisitor & visitor, Analyser::NonNoneAssertionStackGuard * parentAssertions);
 
+// This traverses an AST, node by node, calling the visitor when entering and leaving a statement.
+// counter should be initialized to zero and is incremented for each statement, it is used for analysing variable usage.
+// maintainAssertions is whether or not to populate the non none assertions when traversing. This is very useful for culling dead code, but is expensive.
+// Trees can be thousands of levels deep, so rather than recursing, this keeps a Frame for every node from the root down to the one being visited.
 template<bool maintainAssertions, typename ASTVisitor>
 class AstTraverser
 {
-public:
-    static void process(Function::IfChain, Analyser::AnalyserContext & ctx, AstNode & node, size_t & counter, ASTVisitor & visitor, Analyser::NonNoneAssertionStackGuard * parentAssertions)
+    struct Frame
     {
-        size_t savedCounter = counter;
-        counter++; // The conditions have their own counter value, which is different to the counter values of internal instructions. The conditions' counter value will still be in savedCounter.
-        bool isProceduralBit = true; // Every second node is a block or other procedural instruction.
+        AstNode & node;
+        // This may be the counter of the frame above.
+        size_t & counter;
+        size_t savedCounter;
+        Analyser::NonNoneAssertionStackGuard * parentAssertions;
+        Function::FunctionType functionType = Function::UNSUPPORTED;
+        bool started = false;
+        // Whether a child has been entered, and once it has been left, what its visitor said about it.
+        bool visitingChild = false;
+        VisitorResponse childResponse = RESPONSE_CONTINUE;
+        size_t index = 0;
+        // The conditions of an if chain have their own counter value.
+        size_t conditionCounter = 0;
+        bool isProceduralBit = true;
         Analyser::NonNoneAssertionStackGuard::AssertionIntersection intersection;
-        Analyser::ChildAssertionIterator iter(ctx, node, maintainAssertions);
-        for (; iter.valid(); ++iter)
+        std::unordered_set<unsigned int> nodesToKill;
+
+        Frame(AstNode & n, size_t & c, Analyser::NonNoneAssertionStackGuard * pa) :
+            node(n),
+            counter(c),
+            savedCounter(c),
+            parentAssertions(pa)
+        {
+        }
+    };
+
+    Analyser::AnalyserContext & m_ctx;
+    ASTVisitor & m_visitor;
+    FrameStack<Frame> m_frames;
+    // The ChildAssertionIterators of the if chains and expressions in m_frames.
+    FrameStack<Analyser::ChildAssertionIterator> m_iterators;
+    // What the children of if chains and lambdas being visited assert.
+    FrameStack<Analyser::NonNoneAssertionStackGuard> m_innerAssertions;
+
+    void enter(AstNode & node, size_t & counter, Analyser::NonNoneAssertionStackGuard * parentAssertions)
+    {
+        // If we don't want to maintain assertions, we have nothing to propagate up.
+        if (maintainAssertions == false)
+        {
+            parentAssertions = nullptr;
+        }
+        m_frames.push(node, counter, parentAssertions);
+        m_visitor.enterNode(m_ctx, node, counter);
+        m_frames.back().functionType = node.function().functionType;
+    }
+
+    static void removeKilledNodes(Frame & frame)
+    {
+        if (!frame.nodesToKill.empty())
+        {
+            auto iter = std::remove_if(frame.node.children.begin(), frame.node.children.end(), [&](const AstNode & child){ return frame.nodesToKill.count(child.id) > 0; });
+            frame.node.children.erase(iter, frame.node.children.end());
+        }
+    }
+public:
+    AstTraverser(Analyser::AnalyserContext & ctx, ASTVisitor & visitor) :
+        m_ctx(ctx),
+        m_visitor(visitor)
+    {
+    }
+
+    VisitorResponse traverse(AstNode & node, size_t & counter, Analyser::NonNoneAssertionStackGuard * parentAssertions)
+    {
+        enter(node, counter, parentAssertions);
+        for (;;)
+        {
+            Frame & frame = m_frames.back();
+            // Each process function enters the next child of a node and returns true, or finishes the node once there are none left.
+            if (Function::dispatchFunctionType<bool>(*this, frame.functionType, frame))
+            {
+                continue;
+            }
+            VisitorResponse response = m_visitor.exitNode(m_ctx, frame.node, frame.savedCounter);
+            m_frames.pop();
+            if (m_frames.empty())
+            {
+                return response;
+            }
+            m_frames.back().childResponse = response;
+        }
+    }
+
+    bool process(Function::IfChain, Frame & frame)
+    {
+        if (!frame.started)
+        {
+            frame.started = true;
+            frame.conditionCounter = frame.counter;
+            frame.counter++; // The conditions have their own counter value, which is different to the counter values of internal instructions. The conditions' counter value will still be in conditionCounter.
+            m_iterators.push(m_ctx, frame.node, maintainAssertions);
+        }
+        Analyser::ChildAssertionIterator & iter = m_iterators.back();
+        if (frame.visitingChild)
         {
+            frame.visitingChild = false;
             auto & child = const_cast<AstNode &>(*iter);
-            
-            // We want to find out what the statements are all asserting
-            Analyser::NonNoneAssertionStackGuard innerAssertions(ctx);
-            VisitorResponse childResponse = traverseNode<maintainAssertions>(ctx, child, isProceduralBit ? counter : savedCounter, visitor, &innerAssertions);
-            
-            if (isProceduralBit && parentAssertions != nullptr)
+            if (frame.isProceduralBit && frame.parentAssertions != nullptr)
             {
+                // We want to find out what the statements are all asserting.
                 // This bit copies the logic of AstNode::addAssertionsForCheck, but in here, to cut down on the crazy recursion. Unfortunately using AstNode::addAssertionsForCheck here is neat but makes conversion far too slow.
                 if (iter.index() == 0)
                 {
-                    intersection.add(iter);
-                    intersection.add(innerAssertions);
+                    frame.intersection.add(iter);
+                    frame.intersection.add(m_innerAssertions.back());
                 }
                 else
                 {
-                    intersection.intersect(iter, innerAssertions);
+                    frame.intersection.intersect(iter, m_innerAssertions.back());
                 }
             }
             
             // If the bit inside the if contains a normal instruction (not a block) bump the counter
-            if (isProceduralBit && child.function().functionType != Function::BLOCK)
+            if (frame.isProceduralBit && child.function().functionType != Function::BLOCK)
             {
-                counter++;
+                frame.counter++;
             }
             
             // Because removing nodes from an if chain changes the meaning of the other nodes, just blank it out into an empty block
             // Remember not to remove until traversal has finished, to preserve consistency of IDs
-            if (childResponse == RESPONSE_KILL_NODE_AND_CONTINUE)
+            if (frame.childResponse == RESPONSE_KILL_NODE_AND_CONTINUE)
             {
                 child.pFunction = &AstBuilder::BLOCK_DEF;
                 child.children.clear();
             }
             
-            isProceduralBit = !isProceduralBit;
+            m_innerAssertions.pop();
+            frame.isProceduralBit = !frame.isProceduralBit;
+            ++iter;
+        }
+        
+        if (iter.valid())
+        {
+            auto & child = const_cast<AstNode &>(*iter);
+            m_innerAssertions.push(m_ctx);
+            frame.visitingChild = true;
+            enter(child, frame.isProceduralBit ? frame.counter : frame.conditionCounter, &m_innerAssertions.back());
+            return true;
         }
         
-        if (parentAssertions)
+        if (frame.parentAssertions)
         {
             // Add a virtual else clause to the intersection if needed, to cover all paths.
             // See AstNode::addAssertionsForCheck
-            if (node.children.size() % 2 == 0)
+            if (frame.node.children.size() % 2 == 0)
             {
-                intersection.intersect(iter);
+                frame.intersection.intersect(iter);
             }
-            intersection.apply(*parentAssertions);
+            frame.intersection.apply(*frame.parentAssertions);
         }
+        m_iterators.pop();
+        return false;
     }
     
-    
-    static void process(Function::Lambda, Analyser::AnalyserContext & ctx, AstNode & node, size_t & counter, ASTVisitor & visitor, Analyser::NonNoneAssertionStackGuard *)
+    bool process(Function::Lambda, Frame & frame)
     {
+        if (frame.visitingChild)
+        {
+            frame.visitingChild = false;
+            m_innerAssertions.pop();
+            return false;
+        }
         // Do not touch the parameters, skip to the body.
-        if (!node.children.empty())
+        if (frame.node.children.empty())
         {
-            Analyser::NonNoneAssertionStackGuard innerAssertions(ctx);
-            traverseNode<maintainAssertions>(ctx, node.children.back(), counter, visitor, &innerAssertions);
+            return false;
         }
+        m_innerAssertions.push(m_ctx);
+        frame.visitingChild = true;
+        enter(frame.node.children.back(), frame.counter, &m_innerAssertions.back());
+        return true;
     }
     
-    static void process(Function::Block, Analyser::AnalyserContext & ctx, AstNode & node, size_t & counter, ASTVisitor & visitor, Analyser::NonNoneAssertionStackGuard * parentAssertions)
+    bool process(Function::Block, Frame & frame)
     {
-        std::unordered_set<unsigned int> nodesToKill;
         // Don't use ChildAssertionIterator, it's simply too costly here, given the number of times we dart up and down the heirachy, particularly with if statements.
-        for (auto & child : node.children)
+        if (frame.visitingChild)
         {
-            if (traverseNode<maintainAssertions>(ctx, child, counter, visitor, parentAssertions) == RESPONSE_KILL_NODE_AND_CONTINUE)
+            frame.visitingChild = false;
+            if (frame.childResponse == RESPONSE_KILL_NODE_AND_CONTINUE)
             {
-                nodesToKill.insert(child.id);
+                frame.nodesToKill.insert(frame.node.children[frame.index].id);
             }
-            counter++;
+            frame.counter++;
+            frame.index++;
         }
         
-        if (!nodesToKill.empty())
+        if (frame.index < frame.node.children.size())
         {
-            auto iter = std::remove_if(node.children.begin(), node.children.end(), [&](const AstNode & child){ return nodesToKill.count(child.id) > 0; });
-            node.children.erase(iter, node.children.end());
+            frame.visitingChild = true;
+            enter(frame.node.children[frame.index], frame.counter, frame.parentAssertions);
+            return true;
         }
+        
+        removeKilledNodes(frame);
+        return false;
     }
 
-    static void process(Function::FunctionTypeBase, Analyser::AnalyserContext & ctx, AstNode & node, size_t & counter, ASTVisitor & visitor, Analyser::NonNoneAssertionStackGuard * parentAssertions)
+    bool process(Function::FunctionTypeBase, Frame & frame)
     {
-        std::unordered_set<unsigned int> nodesToKill;
-        for (Analyser::ChildAssertionIterator iter(ctx, node, maintainAssertions); iter.valid(); ++iter)
+        // Most of these are constants and fields, which have nothing to iterate through.
+        if (!frame.node.children.empty())
         {
-            auto & child = const_cast<AstNode &>(*iter);
-            if (traverseNode<maintainAssertions>(ctx, child, counter, visitor, nullptr) == RESPONSE_KILL_NODE_AND_CONTINUE)
+            if (!frame.started)
+            {
+                frame.started = true;
+                m_iterators.push(m_ctx, frame.node, maintainAssertions);
+            }
+            Analyser::ChildAssertionIterator & iter = m_iterators.back();
+            if (frame.visitingChild)
             {
-                nodesToKill.insert(child.id);
+                frame.visitingChild = false;
+                if (frame.childResponse == RESPONSE_KILL_NODE_AND_CONTINUE)
+                {
+                    frame.nodesToKill.insert(iter->id);
+                }
+                ++iter;
+            }
+            
+            if (iter.valid())
+            {
+                auto & child = const_cast<AstNode &>(*iter);
+                frame.visitingChild = true;
+                enter(child, frame.counter, nullptr);
+                return true;
             }
+            m_iterators.pop();
         }
+        
         // This will potentially re-iterate the loop above, in order to find out what it's saying about the inputs.
         // However, these situations are typically one statement at the most, meaning
-        if (parentAssertions)
+        if (frame.parentAssertions)
         {
-            parentAssertions->addAssertionsForCheck(node, Analyser::NO_ASSUMPTIONS);
+            frame.parentAssertions->addAssertionsForCheck(frame.node, Analyser::NO_ASSUMPTIONS);
         }
         
-        if (!nodesToKill.empty())
-        {
-            auto iter = std::remove_if(node.children.begin(), node.children.end(), [&](const AstNode & child){ return nodesToKill.count(child.id) > 0; });
-            node.children.erase(iter, node.children.end());
-        }
+        removeKilledNodes(frame);
+        return false;
     }
 };
 
-// This traverses an AST, node by node, calling the visitor when entering and leaving a statement.
-// counter should be initialized to zero and is incremented for each statement, it is used for analysing variable usage.
-// maintainAssertions is whether or not to populate the non none assertions when traversing. This is very useful for culling dead code, but is expensive.
-template<bool maintainAssertions, typename ASTVisitor>
-static VisitorResponse traverseNode(Analyser::AnalyserContext & ctx, AstNode & node, size_t & counter, ASTVisitor & visitor, Analyser::NonNoneAssertionStackGuard * parentAssertions)
-{
-    // If we don't want to maintain assertions, we have nothing to propagate up.
-    if (maintainAssertions == false)
-    {
-        parentAssertions = nullptr;
-    }
-    size_t savedCounter = counter;
-    visitor.enterNode(ctx, node, counter);
-    
-    AstTraverser<maintainAssertions, ASTVisitor> traverser;
-    Function::dispatchFunctionType<void>(traverser, node.function().functionType, ctx, node, counter, visitor, parentAssertions);
-    
-    return visitor.exitNode(ctx, node, savedCounter);
-}
-
 template<bool maintainAssertions, typename ASTVisitor>
 void traverseTree(Analyser::AnalyserContext & ctx, AstNode & node, ASTVisitor & visitor)
 {
     size_t counter = 1;
     Analyser::NonNoneAssertionStackGuard assertions(ctx);
-    traverseNode<maintainAssertions>(ctx, node, counter, visitor, &assertions);
+    AstTraverser<maintainAssertions, ASTVisitor> traverser(ctx, visitor);
+    traverser.traverse(node, counter, &assertions);
 }
 
 static const size_t COUNT_UNINITIALIZED = 0;
@@ -205,6 +336,8 @@ struct VariableInfo
     size_t lastUsed;
     size_t usedNTimes;
     bool unmovable;
+    // Whether there is more than one declaration of this variable.
+    bool redeclared;
 
     VariableInfo(size_t counter, bool hasInit) :
         firstDeclared(counter),
@@ -214,7 +347,8 @@ struct VariableInfo
         firstUsed(0),
         lastUsed(0),
         usedNTimes(0),
-        unmovable(false)
+        unmovable(false),
+        redeclared(false)
     {}
 
     void used(size_t counter, bool inLambda)
@@ -249,25 +383,123 @@ struct VariableInfo
     }
 };
 
-typedef std::unordered_map<PMMLDocument::ConstFieldDescriptionPtr, VariableInfo> VariableInfoMap;
-// This is a helpful structure for creating lists of variables sorted on a particular parameter. Used in both recycling and overflowing variables.
-struct SortedVariableInfoReference
+// This holds the VariableInfo of each variable, indexed by field ID. Field IDs are handed out one after the other by the
+// ConversionContext, so they are dense enough to look up in a vector, which is a lot cheaper than hashing the field pointers.
+class VariableInfoMap
 {
-    size_t sortKey;
-    VariableInfoMap::iterator infoMapReference;
-    bool operator<(const SortedVariableInfoReference & other) const { return sortKey < other.sortKey; }
-    SortedVariableInfoReference(size_t sort, VariableInfoMap::iterator iter) : sortKey(sort), infoMapReference(iter) {}
-};
+public:
+    typedef std::pair<PMMLDocument::ConstFieldDescriptionPtr, VariableInfo> value_type;
+    typedef std::vector<value_type>::iterator iterator;
+    typedef std::vector<value_type>::const_iterator const_iterator;
+private:
+    std::vector<value_type> m_entries;
+    // For each field ID, one more than where it is in m_entries, or 0 if it isn't there.
+    std::vector<size_t> m_positions;
+public:
+    iterator begin() { return m_entries.begin(); }
+    iterator end() { return m_entries.end(); }
+    const_iterator begin() const { return m_entries.begin(); }
+    const_iterator end() const { return m_entries.end(); }
+    size_t size() const { return m_entries.size(); }
+
+    void clear()
+    {
+        m_entries.clear();
+        m_positions.clear();
+    }
+
+    iterator find(const PMMLDocument::ConstFieldDescriptionPtr & field)
+    {
+        const size_t position = field->id < m_positions.size() ? m_positions[field->id] : 0;
+        if (position == 0)
+        {
+            return m_entries.end();
+        }
+        // Every field in the AST must have its own ID for this to work.
+        assert(m_entries[position - 1].first == field);
+        return m_entries.begin() + (position - 1);
+    }
+
+    const_iterator find(const PMMLDocument::ConstFieldDescriptionPtr & field) const
+    {
+        return const_cast<VariableInfoMap *>(this)->find(field);
+    }
+
+    // This adds a variable if it isn't already there, constructing its VariableInfo from info.
+    template<typename... Args>
+    std::pair<iterator, bool> emplace(const PMMLDocument::ConstFieldDescriptionPtr & field, Args &&... info)
+    {
+        iterator found = find(field);
+        if (found != m_entries.end())
+        {
+            return std::make_pair(found, false);
+        }
+        if (field->id >= m_positions.size())
+        {
+            m_positions.resize(field->id + 1, 0);
+        }
+        m_entries.emplace_back(std::piecewise_construct, std::forward_as_tuple(field), std::forward_as_tuple(std::forward<Args>(info)...));
+        m_positions[field->id] = m_entries.size();
+        return std::make_pair(m_entries.end() - 1, true);
+    }
 
+    // Removing a variable moves the last one into its place, so this invalidates iterators.
+    void erase(const PMMLDocument::ConstFieldDescriptionPtr & field)
+    {
+        iterator found = find(field);
+        if (found == m_entries.end())
+        {
+            return;
+        }
+        m_positions[field->id] = 0;
+        if (found + 1 != m_entries.end())
+        {
+            *found = std::move(m_entries.back());
+            m_positions[found->first->id] = size_t(found - m_entries.begin()) + 1;
+        }
+        m_entries.pop_back();
+    }
+
+    // This removes every variable that shouldRemove returns true for, keeping the rest in order.
+    template<typename Predicate>
+    void eraseIf(Predicate shouldRemove)
+    {
+        size_t kept = 0;
+        for (value_type & entry : m_entries)
+        {
+            if (shouldRemove(entry))
+            {
+                m_positions[entry.first->id] = 0;
+            }
+            else
+            {
+                m_positions[entry.first->id] = kept + 1;
+                if (&m_entries[kept] != &entry)
+                {
+                    m_entries[kept] = std::move(entry);
+                }
+                kept++;
+            }
+        }
+        m_entries.erase(m_entries.begin() + kept, m_entries.end());
+    }
+
+    // This is one more than the largest field ID in the map.
+    size_t idLimit() const { return m_positions.size(); }
+};
 // This scans the AST to find what variables are being used where
 class BuildVariableInfoMapVisitor
 {
     VariableInfoMap & m_map;
     int inLambda;
+    // Whether variables that are used without being declared are tracked as well as inputs, as is needed when only part of
+    // the tree is being looked at.
+    const bool m_trackUndeclared;
 public:
-    BuildVariableInfoMapVisitor(VariableInfoMap & map, Analyser::AnalyserContext &) :
+    BuildVariableInfoMapVisitor(VariableInfoMap & map, Analyser::AnalyserContext &, bool trackUndeclared = false) :
         m_map(map),
-        inLambda(0)
+        inLambda(0),
+        m_trackUndeclared(trackUndeclared)
     {
         map.clear();
     }
@@ -277,9 +509,13 @@ public:
         Function::dispatchFunctionType<void>(*this, node.function().functionType, node, counter);
     }
     
-    void process(Function::Lambda, AstNode &, size_t)
+    void process(Function::Lambda, AstNode & node, size_t)
     {
-        inLambda++;
+        // A section is only called where it is in the tree, so nothing it uses is held on to, as it would be by a lambda.
+        if (!isSection(node))
+        {
+            inLambda++;
+        }
     }
         
     void process(Function::FieldRef, AstNode & node, size_t counter)
@@ -290,20 +526,20 @@ public:
             variable->second.used(counter, inLambda > 0);
         }
         // We allow inputs to be undeclared and assumed to come in from the top.
-        else if (node.fieldDescription->origin == PMMLDocument::ORIGIN_DATA_DICTIONARY)
+        else if (node.fieldDescription->origin == PMMLDocument::ORIGIN_DATA_DICTIONARY || m_trackUndeclared)
         {
-            auto inserted = m_map.emplace(std::piecewise_construct,
-                                          std::forward_as_tuple(node.fieldDescription),
-                                          std::forward_as_tuple(0, !node.children.empty()));
+            auto inserted = m_map.emplace(node.fieldDescription, 0, !node.children.empty());
             inserted.first->second.used(counter, inLambda > 0);
         }
     }
 
     void process(Function::Declartion, AstNode & node, size_t counter)
     {
-        m_map.emplace(std::piecewise_construct,
-                      std::forward_as_tuple(node.fieldDescription),
-                      std::forward_as_tuple(counter, !node.children.empty()));
+        auto inserted = m_map.emplace(node.fieldDescription, counter, !node.children.empty());
+        if (!inserted.second)
+        {
+            inserted.first->second.redeclared = true;
+        }
     }
     
     void process(Function::Assignment, AstNode & node, size_t counter)
@@ -313,6 +549,10 @@ public:
         {
             variable->second.assign(counter);
         }
+        else if (m_trackUndeclared)
+        {
+            m_map.emplace(node.fieldDescription, 0, false).first->second.assign(counter);
+        }
     }
 
     void process(Function::Functionlike, AstNode & node, size_t counter)
@@ -334,7 +574,7 @@ public:
         
     VisitorResponse exitNode(Analyser::AnalyserContext &, AstNode & node, size_t)
     {
-        if (node.function().functionType == Function::LAMBDA)
+        if (node.function().functionType == Function::LAMBDA && !isSection(node))
         {
             inLambda--;
         }
@@ -342,573 +582,3158 @@ public:
     }
 };
 
-// This automatically inlines not-particularly-useful variables into the expression that generated it. It only works for SSA and SSA-like variables.
-class InlineVariableVisitor
+// This keeps the use counts in a VariableInfoMap up to date as code is removed, counting uses the same way as
+// BuildVariableInfoMapVisitor does. It collects every variable that is left with no uses at all.
+class UseTracker
 {
     VariableInfoMap & m_map;
-    std::unordered_map<std::string, std::pair<AstNode, int>> m_replacements;
-    bool m_killedAnything;
-    unsigned int currentDeclaration;
-    int currentCost;
-    // This is how many instructions it is willing to bloat by in order remove a variable.
-    int m_priceOfVariable = 5;
-    static constexpr int COST_OF_REF = 1;
-    void clearCurrentDeclaration() { currentDeclaration = std::numeric_limits<unsigned int>::max(); }
+    std::vector<unsigned int> m_unusedVariables;
 public:
-    InlineVariableVisitor(VariableInfoMap & map, int variablePrice) :
-        m_map(map),
-        m_killedAnything(false),
-        m_priceOfVariable(variablePrice)
-    {
-        clearCurrentDeclaration();
-    }
-    
-    void enterNode(Analyser::AnalyserContext &, AstNode & node, size_t counter)
+    explicit UseTracker(VariableInfoMap & map) :
+        m_map(map)
+    {}
+
+    // Call this on anything that is about to be removed from the tree.
+    void forget(const AstNode & node)
     {
-        switch (node.function().functionType)
+        std::vector<const AstNode *> pending(1, &node);
+        while (!pending.empty())
         {
-            case Function::DECLARATION:
-                if (!isSpecialVar(node.fieldDescription.get()) && node.children.size() == 1)
-                {
-                    auto value = m_map.find(node.fieldDescription);
-                    if (value->second.lastSet == counter)
-                    {
-                        // If this is an ordinary assignment and the variable is not re-assigned later, it is a candidate for inlining
-                        // Mark it and start counting the cost
-                        currentCost = 0;
-                        currentDeclaration = node.id;
-                    }
-                }
-                else
-                {
-                    currentCost += 1;
-                }
-                break;
-            case Function::FIELD_REF:
+            const AstNode & next = *pending.back();
+            pending.pop_back();
+            Function::dispatchFunctionType<void>(*this, next.function().functionType, next);
+            if (next.function().functionType == Function::LAMBDA)
+            {
+                // Lambda parameters are never traversed, so only the body counts.
+                if (!next.children.empty())
                 {
-                    auto found = m_map.find(node.fieldDescription);
-                    // If this field is set again after this, anything referring to it cannot be inlined
-                    if (found != m_map.end() && found->second.lastSet > counter)
-                    {
-                        clearCurrentDeclaration();
-                    }
-                    currentCost += COST_OF_REF;
+                    pending.push_back(&next.children.back());
                 }
-                break;
-                
-            case Function::FUNCTIONLIKE:
-                currentCost += 4;
-                break;
-                
-            case Function::CONSTANT:
-                currentCost += 1;
-                break;
-                
-            default:
-                currentCost += 1;
+                continue;
+            }
+            for (const AstNode & child : next.children)
+            {
+                pending.push_back(&child);
+            }
         }
     }
-    
-    VisitorResponse exitNode(Analyser::AnalyserContext &, AstNode & node, size_t)
+
+    void process(Function::FieldRef, const AstNode & node)
     {
-        if (node.function().functionType == Function::FIELD_REF)
+        forgetUse(node.fieldDescription);
+    }
+
+    void process(Function::Functionlike, const AstNode & node)
+    {
+        if (node.fieldDescription != nullptr)
         {
-            // Rewrite already-repaced variable in field refs.
-            auto found = m_replacements.find(node.content);
-            if (found != m_replacements.end())
-            {
-                // Maintain the coerced type from where it is applied.
-                const PMMLDocument::FieldType oldType = node.coercedType;
-                node = found->second.first;
-                node.coercedType = oldType;
-                // Apply additional cost of the substitution back to this node.
-                currentCost += (found->second.second - COST_OF_REF);
-            }
+            forgetUse(node.fieldDescription);
         }
-        else if (node.id == currentDeclaration)
+    }
+
+    void process(Function::FunctionTypeBase, const AstNode &)
+    {
+    }
+
+    // The IDs of the variables that have lost their last use since this was last called.
+    std::vector<unsigned int> takeUnusedVariables()
+    {
+        std::vector<unsigned int> unused;
+        unused.swap(m_unusedVariables);
+        return unused;
+    }
+
+    bool isUnused(const PMMLDocument::ConstFieldDescriptionPtr & field) const
+    {
+        auto variable = static_cast<const VariableInfoMap &>(m_map).find(field);
+        return variable != m_map.end() && variable->second.usedNTimes == 0;
+    }
+private:
+    void forgetUse(const PMMLDocument::ConstFieldDescriptionPtr & field)
+    {
+        auto variable = m_map.find(field);
+        if (variable != m_map.end() && variable->second.usedNTimes > 0 && --variable->second.usedNTimes == 0)
         {
-            auto found = m_map.find(node.fieldDescription);
-            if (found != m_map.end())
-            {
-                int extraCost = currentCost - COST_OF_REF;
-                // Work out if we are better off without this variable.
-                // Subtract one from each count to make up for that we would be removing at one reference for every inlining
-                if (found->second.usedNTimes == 0 || extraCost * int(found->second.usedNTimes - 1) <= m_priceOfVariable)
-                {
-                    m_replacements.emplace(node.content, std::make_pair(node.children.front(), extraCost));
-                    m_killedAnything = true;
-                    return RESPONSE_KILL_NODE_AND_CONTINUE;
-                }
-            }
+            m_unusedVariables.push_back(field->id);
         }
-        return RESPONSE_CONTINUE;
     }
-    bool hasKilledAnything() const { return m_killedAnything; }
 };
 
-// This removes code that will either never be executed, or if executed, will not change the outcome.
-class RemoveDeadCodeVisitor
+// Empty blocks at the end of an if chain do nothing, so they are removed along with their conditions.
+// This returns false if nothing useful is left in the if chain at all, in which case it can be removed as a whole.
+static bool cullEmptyBranches(AstNode & node, UseTracker & uses, bool & changed)
 {
-    const VariableInfoMap & m_map;
-    bool m_killedAnything;
-    struct StackValue
+    // Look through the procedural bits to see if the last final clauses are empty (even nubered children are blocks)
+    // Useless crap can be removed from the end, but not the beginning
+    size_t lastUsefulProceduralBit = 0;
+    for (size_t i = 0; i < node.children.size(); i += 2)
     {
-        Function::FunctionType type;
-        Analyser::TrivialValue triv;
-    };
-    std::vector<StackValue> m_stack;
-public:
-    RemoveDeadCodeVisitor(const VariableInfoMap & map) :
-        m_map(map),
-        m_killedAnything(false)
-    {}
-    
-    void enterNode(Analyser::AnalyserContext &, AstNode & node, size_t)
+        AstNode & child = node.children[i];
+        if (child.function().functionType != Function::BLOCK ||
+            !child.children.empty())
+        {
+            lastUsefulProceduralBit = i + 2;
+        }
+    }
+
+    if (lastUsefulProceduralBit == 0)
     {
-        StackValue newValue = {node.function().functionType, Analyser::RUNTIME_EVALUATION_NEEDED};
-        m_stack.push_back(newValue);
+        return false;
     }
-    
-    VisitorResponse exitNode(Analyser::AnalyserContext & ctx, AstNode & node, size_t counter)
+
+    // Otherwise, cull to the last non-empty block
+    if (lastUsefulProceduralBit < node.children.size())
+    {
+        changed = true;
+        for (size_t i = lastUsefulProceduralBit; i < node.children.size(); ++i)
+        {
+            uses.forget(node.children[i]);
+        }
+        node.children.erase(node.children.begin() + lastUsefulProceduralBit, node.children.end());
+    }
+    return true;
+}
+
+// A number in a constant, as Lua would read it. Lua 5.3 keeps integers apart from other numbers, so they are kept apart here,
+// and only those small enough to be exact as doubles are used.
+struct FoldedNumber
+{
+    double value;
+    bool isInteger;
+};
+
+static const double MAX_EXACT_INTEGER = 9007199254740992.0;
+
+static bool getNumber(const AstNode & node, FoldedNumber & number)
+{
+    if (node.function().functionType != Function::CONSTANT || node.type != PMMLDocument::TYPE_NUMBER ||
+        node.coercedType != PMMLDocument::TYPE_NUMBER || node.content.empty())
+    {
+        return false;
+    }
+    // Only plain decimal numbers, not hex or things like math.pi.
+    const char * text = node.content.c_str();
+    if (strspn(text, "0123456789+-.eE") != node.content.size())
+    {
+        return false;
+    }
+    char * end;
+    number.value = strtod(text, &end);
+    if (*end != '\0' || !std::isfinite(number.value))
+    {
+        return false;
+    }
+    number.isInteger = strcspn(text, ".eE") == node.content.size();
+    return !number.isInteger || std::fabs(number.value) <= MAX_EXACT_INTEGER;
+}
+
+static bool isExactNumber(const FoldedNumber & number)
+{
+    return number.isInteger ? std::fabs(number.value) <= MAX_EXACT_INTEGER : std::isfinite(number.value);
+}
+
+// This turns node, which must be a number, into a constant. Numbers that aren't integers are written as the shortest
+// thing that reads back as the same double, with a decimal point so that Lua 5.3 doesn't read them as integers.
+static void setNumber(AstNode & node, const FoldedNumber & number)
+{
+    std::ostringstream stream;
+    if (number.isInteger)
+    {
+        stream << static_cast<long long>(number.value);
+    }
+    else
+    {
+        for (int precision = 15; precision <= 17; ++precision)
+        {
+            stream.str(std::string());
+            stream.precision(precision);
+            stream << number.value;
+            if (strtod(stream.str().c_str(), nullptr) == number.value)
+            {
+                break;
+            }
+        }
+        if (stream.str().find_first_of(".e") == std::string::npos)
+        {
+            stream << ".0";
+        }
+    }
+    node.pFunction = &AstBuilder::CONSTANT_DEF;
+    node.children.clear();
+    node.content = stream.str();
+    node.fieldDescription.reset();
+}
+
+// Whether writing node out twice is cheaper than calling pow on it, as it is for the differences that radial basis
+// functions square. Each node that is looked at is taken out of budget.
+static bool isCheapToRepeat(const AstNode & node, int & budget)
+{
+    if (--budget < 0)
+    {
+        return false;
+    }
+    const auto & names = Function::functionTable.names;
+    switch (node.function().functionType)
+    {
+        case Function::CONSTANT:
+            return true;
+        case Function::FIELD_REF:
+            return node.children.empty();
+        case Function::OPERATOR:
+            if (&node.function() != &names.plus && &node.function() != &names.minus && &node.function() != &names.times)
+            {
+                return false;
+            }
+            // Fall through
+        case Function::UNARY_OPERATOR:
+        case Function::DEFAULT_MACRO:
+            for (const AstNode & child : node.children)
+            {
+                if (!isCheapToRepeat(child, budget))
+                {
+                    return false;
+                }
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+// This works out arithmetic on constants while converting, and replaces some arithmetic with cheaper arithmetic. Only
+// things that give exactly the same result in Lua are done, so operations aren't reordered, constants are only divided by
+// if their reciprocal is exact, and functions that might be worked out differently by another maths library are left alone.
+class ConstantFolder
+{
+    enum Operation
+    {
+        ADD,
+        SUBTRACT,
+        MULTIPLY,
+        DIVIDE
+    };
+
+    static bool apply(Operation operation, const FoldedNumber & a, const FoldedNumber & b, FoldedNumber & result)
+    {
+        switch (operation)
+        {
+            case ADD:
+                result.value = a.value + b.value;
+                break;
+            case SUBTRACT:
+                result.value = a.value - b.value;
+                break;
+            case MULTIPLY:
+                result.value = a.value * b.value;
+                break;
+            case DIVIDE:
+                result.value = a.value / b.value;
+                break;
+        }
+        // Division always gives a float in Lua 5.3.
+        result.isInteger = a.isInteger && b.isInteger && operation != DIVIDE;
+        return isExactNumber(result);
+    }
+
+    static bool isIdentity(Operation operation, const AstNode & node)
+    {
+        FoldedNumber number;
+        if (!getNumber(node, number) || !number.isInteger)
+        {
+            return false;
+        }
+        return number.value == (operation == MULTIPLY ? 1 : 0);
+    }
+
+    // Replacing an operator with one of its arguments is only safe if nothing needs converting on the way.
+    static bool canBeReplacedBy(const AstNode & node, const AstNode & child)
+    {
+        return child.type == child.coercedType && child.type == node.type;
+    }
+
+    static void replaceWith(AstNode & node, AstNode & child)
+    {
+        const PMMLDocument::FieldType coercedType = node.coercedType;
+        AstNode replacement = std::move(child);
+        node = std::move(replacement);
+        node.coercedType = coercedType;
+    }
+
+    // Operators are written as a chain, like a - b - c, and Lua works them out from the left. So constants at the start of
+    // the chain can be worked out, but others can't be without changing the rounding.
+    void foldChain(AstNode & node, Operation operation)
+    {
+        FoldedNumber first;
+        FoldedNumber next;
+        while (node.children.size() > 1 && getNumber(node.children[0], first) && getNumber(node.children[1], next) &&
+               apply(operation, first, next, first))
+        {
+            setNumber(node.children[0], first);
+            node.children.erase(node.children.begin() + 1);
+        }
+
+        // Like x * 1 or x - 0. The first argument of a subtraction is never left out. Adding 0 is kept, as it turns -0 into 0.
+        if (operation == MULTIPLY || operation == SUBTRACT)
+        {
+            auto isIdentityHere = [operation](const AstNode & child)
+            {
+                return isIdentity(operation, child);
+            };
+            const AstNode::Children::iterator from = node.children.begin() + (operation == SUBTRACT ? 1 : 0);
+            const size_t nIdentities = size_t(std::count_if(from, node.children.end(), isIdentityHere));
+            const size_t nKept = node.children.size() - nIdentities;
+            bool canRemove = nIdentities > 0 && nKept > 0;
+            if (canRemove && nKept == 1)
+            {
+                // Then the operator is replaced by what is left.
+                const AstNode & left = operation == SUBTRACT ? node.children.front() : *std::find_if_not(from, node.children.end(), isIdentityHere);
+                canRemove = canBeReplacedBy(node, left);
+            }
+            if (canRemove)
+            {
+                node.children.erase(std::remove_if(from, node.children.end(), isIdentityHere), node.children.end());
+            }
+        }
+
+        if (node.children.size() == 1 && canBeReplacedBy(node, node.children.front()))
+        {
+            replaceWith(node, node.children.front());
+        }
+    }
+public:
+    // This only looks at expressions, so it doesn't need the assertions that AstTraverser keeps, and walks the tree itself,
+    // which is a lot quicker. Each node is folded after its children.
+    void run(AstNode & root)
+    {
+        std::vector<std::pair<AstNode *, size_t>> toFold;
+        toFold.emplace_back(&root, 0);
+        while (!toFold.empty())
+        {
+            AstNode & node = *toFold.back().first;
+            const size_t next = toFold.back().second;
+            if (next < node.children.size())
+            {
+                toFold.back().second++;
+                toFold.emplace_back(&node.children[next], 0);
+                continue;
+            }
+            toFold.pop_back();
+            if (node.type == PMMLDocument::TYPE_NUMBER && node.coercedType == PMMLDocument::TYPE_NUMBER)
+            {
+                Function::dispatchFunctionType<void>(*this, node.function().functionType, node);
+            }
+        }
+    }
+
+    void process(Function::Operator, AstNode & node)
+    {
+        const auto & names = Function::functionTable.names;
+        const Function::Definition * function = &node.function();
+        if (function == &names.plus || function == &names.sum)
+        {
+            foldChain(node, ADD);
+        }
+        else if (function == &names.minus)
+        {
+            foldChain(node, SUBTRACT);
+        }
+        else if (function == &names.times || function == &names.product)
+        {
+            foldChain(node, MULTIPLY);
+        }
+        else if (function == &names.divide && node.children.size() == 2)
+        {
+            foldChain(node, DIVIDE);
+            FoldedNumber divisor;
+            int exponent;
+            // Dividing by a power of two is the same as multiplying by its reciprocal, which is exact.
+            if (node.children.size() == 2 && getNumber(node.children[1], divisor) && divisor.value != 0 &&
+                std::frexp(divisor.value, &exponent) == (divisor.value > 0 ? 0.5 : -0.5) &&
+                apply(DIVIDE, FoldedNumber{1, false}, divisor, divisor))
+            {
+                node.pFunction = &names.times;
+                setNumber(node.children[1], divisor);
+            }
+        }
+        else if (function == &names.pow && node.children.size() == 2)
+        {
+            FoldedNumber exponent;
+            FoldedNumber base;
+            int budget = 4;
+            if (!getNumber(node.children[1], exponent) || exponent.value != 2)
+            {
+                return;
+            }
+            if (getNumber(node.children[0], base))
+            {
+                // pow always gives a float in Lua 5.3.
+                base.value *= base.value;
+                base.isInteger = false;
+                if (isExactNumber(base))
+                {
+                    setNumber(node, base);
+                }
+            }
+            else if (isCheapToRepeat(node.children[0], budget))
+            {
+                node.pFunction = &names.times;
+                node.children[1] = node.children[0];
+            }
+        }
+    }
+
+    void process(Function::UnaryOperator, AstNode & node)
+    {
+        if (&node.function() != &Function::unaryMinus || node.children.size() != 1)
+        {
+            return;
+        }
+        AstNode & child = node.children.front();
+        FoldedNumber number;
+        if (getNumber(child, number))
+        {
+            number.value = -number.value;
+            setNumber(node, number);
+        }
+        // Like - - x
+        else if (&child.function() == &Function::unaryMinus && child.children.size() == 1 && canBeReplacedBy(node, child) &&
+                 canBeReplacedBy(node, child.children.front()))
+        {
+            replaceWith(node, child.children.front());
+        }
+    }
+
+    void process(Function::Functionlike, AstNode & node)
+    {
+        const auto & names = Function::functionTable.names;
+        const Function::Definition * function = &node.function();
+        std::vector<FoldedNumber> arguments(node.children.size());
+        for (size_t i = 0; i < node.children.size(); ++i)
+        {
+            if (!getNumber(node.children[i], arguments[i]))
+            {
+                return;
+            }
+        }
+        if (arguments.empty())
+        {
+            return;
+        }
+
+        FoldedNumber result = arguments.front();
+        if (function == &names.abs)
+        {
+            result.value = std::fabs(result.value);
+        }
+        else if (function == &names.floor || function == &names.ceil)
+        {
+            // Lua 5.3 gives back an integer for these.
+            result.value = function == &names.floor ? std::floor(result.value) : std::ceil(result.value);
+            result.isInteger = true;
+        }
+        else if (function == &Function::sqrtFunction)
+        {
+            // Square roots are always rounded correctly, so they are the same everywhere.
+            result.value = std::sqrt(result.value);
+            result.isInteger = false;
+        }
+        else if (function == &names.min || function == &names.max)
+        {
+            // Lua gives back the first argument that is smallest or largest, whether it is an integer or not.
+            for (const FoldedNumber & argument : arguments)
+            {
+                if (function == &names.min ? argument.value < result.value : argument.value > result.value)
+                {
+                    result = argument;
+                }
+            }
+        }
+        else
+        {
+            return;
+        }
+        if (isExactNumber(result))
+        {
+            setNumber(node, result);
+        }
+    }
+
+    void process(Function::FunctionTypeBase, AstNode &)
+    {
+    }
+};
+
+// This automatically inlines not-particularly-useful variables into the expression that generated it. It only works for SSA and SSA-like variables.
+class InlineVariableVisitor
+{
+    VariableInfoMap & m_map;
+    std::unordered_map<std::string, std::pair<AstNode, int>> m_replacements;
+    bool m_killedAnything;
+    unsigned int currentDeclaration;
+    int currentCost;
+    // This is how many instructions it is willing to bloat by in order remove a variable.
+    int m_priceOfVariable = 5;
+    static constexpr int COST_OF_REF = 1;
+    void clearCurrentDeclaration() { currentDeclaration = std::numeric_limits<unsigned int>::max(); }
+public:
+    InlineVariableVisitor(VariableInfoMap & map, int variablePrice) :
+        m_map(map),
+        m_killedAnything(false),
+        m_priceOfVariable(variablePrice)
+    {
+        clearCurrentDeclaration();
+    }
+    
+    void enterNode(Analyser::AnalyserContext &, AstNode & node, size_t counter)
+    {
+        switch (node.function().functionType)
+        {
+            case Function::DECLARATION:
+                if (!isSpecialVar(node.fieldDescription.get()) && node.children.size() == 1)
+                {
+                    auto value = m_map.find(node.fieldDescription);
+                    if (value->second.lastSet == counter)
+                    {
+                        // If this is an ordinary assignment and the variable is not re-assigned later, it is a candidate for inlining
+                        // Mark it and start counting the cost
+                        currentCost = 0;
+                        currentDeclaration = node.id;
+                    }
+                }
+                else
+                {
+                    currentCost += 1;
+                }
+                break;
+            case Function::FIELD_REF:
+                {
+                    auto found = m_map.find(node.fieldDescription);
+                    // If this field is set again after this, anything referring to it cannot be inlined
+                    if (found != m_map.end() && found->second.lastSet > counter)
+                    {
+                        clearCurrentDeclaration();
+                    }
+                    currentCost += COST_OF_REF;
+                }
+                break;
+                
+            case Function::FUNCTIONLIKE:
+                currentCost += 4;
+                break;
+                
+            case Function::CONSTANT:
+                currentCost += 1;
+                break;
+                
+            default:
+                currentCost += 1;
+        }
+    }
+    
+    VisitorResponse exitNode(Analyser::AnalyserContext &, AstNode & node, size_t)
+    {
+        if (node.function().functionType == Function::FIELD_REF)
+        {
+            // Rewrite already-repaced variable in field refs.
+            auto found = m_replacements.find(node.content);
+            if (found != m_replacements.end())
+            {
+                // Maintain the coerced type from where it is applied.
+                const PMMLDocument::FieldType oldType = node.coercedType;
+                node = found->second.first;
+                node.coercedType = oldType;
+                // Apply additional cost of the substitution back to this node.
+                currentCost += (found->second.second - COST_OF_REF);
+            }
+        }
+        else if (node.id == currentDeclaration)
+        {
+            auto found = m_map.find(node.fieldDescription);
+            if (found != m_map.end())
+            {
+                int extraCost = currentCost - COST_OF_REF;
+                // Work out if we are better off without this variable.
+                // Subtract one from each count to make up for that we would be removing at one reference for every inlining
+                if (found->second.usedNTimes == 0 || extraCost * int(found->second.usedNTimes - 1) <= m_priceOfVariable)
+                {
+                    // The declaration is about to be removed, so its value can be moved rather than copied.
+                    m_replacements.emplace(node.content, std::make_pair(std::move(node.children.front()), extraCost));
+                    m_killedAnything = true;
+                    return RESPONSE_KILL_NODE_AND_CONTINUE;
+                }
+            }
+        }
+        return RESPONSE_CONTINUE;
+    }
+    bool hasKilledAnything() const { return m_killedAnything; }
+};
+
+// Whether working out a node, leaving aside its children, has no effect other than giving its value.
+static bool isPureNode(const AstNode & node)
+{
+    switch (node.function().functionType)
+    {
+        case Function::BLOCK:
+        case Function::DECLARATION:
+        case Function::ASSIGNMENT:
+        case Function::IF_CHAIN:
+        case Function::MAKE_TUPLE:
+        case Function::LAMBDA:
+        case Function::RUN_LAMBDA:
+        case Function::RETURN_STATEMENT:
+        case Function::UNSUPPORTED:
+            return false;
+        case Function::FUNCTIONLIKE:
+            // Functions without a value, like table.insert, are only there to change their arguments.
+            return node.function().outputType != PMMLDocument::TYPE_VOID;
+        default:
+            return true;
+    }
+}
+
+// This adds every variable that an expression reads to variables.
+static void gatherVariables(const AstNode & node, std::vector<const PMMLDocument::FieldDescription *> & variables)
+{
+    std::vector<const AstNode *> pending(1, &node);
+    while (!pending.empty())
+    {
+        const AstNode & next = *pending.back();
+        pending.pop_back();
+        if (next.fieldDescription != nullptr)
+        {
+            variables.push_back(next.fieldDescription.get());
+        }
+        for (const AstNode & child : next.children)
+        {
+            pending.push_back(&child);
+        }
+    }
+}
+
+// This records where each variable is declared, or set, or has anything done to it that could change it, by the counter
+// of a walk over the tree, so that it can tell whether an expression would give the same value somewhere else.
+class FieldChanges
+{
+    // Indexed by field ID.
+    std::vector<std::vector<size_t>> m_changes;
+public:
+    void note(const PMMLDocument::FieldDescription & field, size_t counter)
+    {
+        if (field.id >= m_changes.size())
+        {
+            m_changes.resize(field.id + 1);
+        }
+        m_changes[field.id].push_back(counter);
+    }
+
+    size_t timesChanged(const PMMLDocument::FieldDescription & field) const
+    {
+        return field.id < m_changes.size() ? m_changes[field.id].size() : 0;
+    }
+
+    bool isChangedBetween(const PMMLDocument::FieldDescription & field, size_t first, size_t last) const
+    {
+        if (field.id >= m_changes.size())
+        {
+            return false;
+        }
+        const std::vector<size_t> & changes = m_changes[field.id];
+        auto found = std::lower_bound(changes.begin(), changes.end(), first);
+        return found != changes.end() && *found <= last;
+    }
+};
+
+// Some expressions are in the tree more than once, such as a predicate that a tree tests again to see if it was missing, or
+// a transformation that each segment of a model brings in for itself. Where one of them is always worked out first, and
+// nothing it reads can change before the others, the others can read it from a variable instead. That is the inliner in
+// reverse, so only expressions that the inliner wouldn't put straight back are shared.
+class ExpressionSharer
+{
+    // This is what a new variable is worth, which is what the inliner would bloat by to remove one when it is short of them.
+    static const size_t PRICE_OF_VARIABLE = 5;
+    // Expressions cheaper than this aren't worth looking at.
+    static const size_t MIN_COST = 3;
+    static const size_t NO_STATEMENT = std::numeric_limits<size_t>::max();
+
+    struct Block
+    {
+        AstNode * node;
+        size_t enter;
+        size_t exit;
+    };
+
+    struct Statement
+    {
+        size_t block;
+        size_t index;
+        size_t enter;
+    };
+
+    struct Occurrence
+    {
+        AstNode * node;
+        size_t enter;
+        size_t exit;
+        size_t hash;
+        size_t cost;
+        // The statement that always works this out whenever it is run, if there is one.
+        size_t statement;
+        // Whether this is all that a variable is declared as.
+        bool declared;
+    };
+
+    struct Frame
+    {
+        AstNode * node;
+        size_t nextChild;
+        size_t enter;
+        size_t hash;
+        size_t cost;
+        bool pure;
+        bool inLambda;
+        size_t statement;
+        size_t block;
+    };
+
+    struct Plan
+    {
+        size_t anchor;
+        std::vector<size_t> uses;
+        // A variable that the anchor is already declared into, if there is one.
+        PMMLDocument::ConstFieldDescriptionPtr existing;
+    };
+
+    struct Insertion
+    {
+        size_t block;
+        size_t index;
+        AstNode declaration;
+    };
+
+    std::vector<Block> m_blocks;
+    std::vector<Statement> m_statements;
+    std::vector<Occurrence> m_occurrences;
+    FieldChanges m_changes;
+    std::unordered_set<std::string> m_takenNames;
+    unsigned int m_nextID = 0;
+    unsigned int m_nextNodeID = 0;
+    size_t m_nextName = 1;
+
+    static size_t combineHash(size_t seed, size_t value)
+    {
+        return seed ^ (value + 0x9e3779b9 + (seed << 6) + (seed >> 2));
+    }
+
+    // Whether the child of a node is always worked out when the node is, as opposed to only some of the time.
+    static bool isAlwaysEvaluated(const AstNode & node, size_t child)
+    {
+        switch (node.function().functionType)
+        {
+            case Function::IF_CHAIN:
+                // The first condition comes after its body.
+                return child == 1;
+            case Function::DECLARATION:
+            case Function::ASSIGNMENT:
+            case Function::BOOLEAN_AND:
+            case Function::BOOLEAN_OR:
+            case Function::TERNARY_MACRO:
+            case Function::BOUND_MACRO:
+            case Function::SURROGATE_MACRO:
+            case Function::DEFAULT_MACRO:
+            case Function::THRESHOLD_MACRO:
+                return child == 0;
+            case Function::LAMBDA:
+                return false;
+            default:
+                return true;
+        }
+    }
+
+    static bool isSameExpression(const AstNode & a, const AstNode & b)
+    {
+        std::vector<std::pair<const AstNode *, const AstNode *>> pending(1, std::make_pair(&a, &b));
+        while (!pending.empty())
+        {
+            const AstNode & left = *pending.back().first;
+            const AstNode & right = *pending.back().second;
+            pending.pop_back();
+            if (left.pFunction != right.pFunction || left.type != right.type || left.fieldDescription != right.fieldDescription ||
+                left.children.size() != right.children.size() || left.content != right.content)
+            {
+                return false;
+            }
+            for (size_t i = 0; i < left.children.size(); ++i)
+            {
+                if (left.children[i].coercedType != right.children[i].coercedType)
+                {
+                    return false;
+                }
+                pending.emplace_back(&left.children[i], &right.children[i]);
+            }
+        }
+        return true;
+    }
+
+    void enter(std::vector<Frame> & stack, AstNode & node, size_t counter, size_t statement, bool inLambda)
+    {
+        const Function::Definition & function = node.function();
+        m_nextNodeID = std::max(m_nextNodeID, node.id + 1);
+        size_t hash = combineHash(std::hash<const void *>()(&function), node.type);
+        if (node.fieldDescription == nullptr)
+        {
+            if (!node.content.empty())
+            {
+                hash = combineHash(hash, std::hash<std::string>()(node.content));
+            }
+        }
+        else
+        {
+            const PMMLDocument::FieldDescription & field = *node.fieldDescription;
+            hash = combineHash(hash, std::hash<const void *>()(&field));
+            m_nextID = std::max(m_nextID, field.id + 1);
+            if (field.luaName.compare(0, 6, "shared") == 0)
+            {
+                m_takenNames.insert(field.luaName);
+            }
+            if (function.functionType == Function::DECLARATION || function.functionType == Function::ASSIGNMENT)
+            {
+                m_changes.note(field, counter);
+            }
+        }
+        if (function.functionType == Function::FUNCTIONLIKE && function.outputType == PMMLDocument::TYPE_VOID)
+        {
+            for (const AstNode & child : node.children)
+            {
+                if (child.fieldDescription != nullptr)
+                {
+                    m_changes.note(*child.fieldDescription, counter);
+                }
+            }
+        }
+
+        size_t block = NO_STATEMENT;
+        if (function.functionType == Function::BLOCK && !inLambda)
+        {
+            block = m_blocks.size();
+            m_blocks.push_back(Block{&node, counter, counter});
+        }
+        stack.push_back(Frame{&node, 0, counter, hash, function.functionType == Function::FUNCTIONLIKE ? 4u : 1u,
+            isPureNode(node), inLambda || function.functionType == Function::LAMBDA, statement, block});
+    }
+
+    void exit(std::vector<Frame> & stack, size_t lastCounter)
+    {
+        const Frame frame = stack.back();
+        stack.pop_back();
+        AstNode & node = *frame.node;
+        if (frame.block != NO_STATEMENT)
+        {
+            m_blocks[frame.block].exit = lastCounter;
+        }
+        if (frame.pure && !frame.inLambda && frame.cost >= MIN_COST &&
+            (node.type == PMMLDocument::TYPE_NUMBER || node.type == PMMLDocument::TYPE_STRING || node.type == PMMLDocument::TYPE_BOOL))
+        {
+            const bool declared = !stack.empty() && stack.back().nextChild == 1 &&
+                stack.back().node->function().functionType == Function::DECLARATION;
+            m_occurrences.push_back(Occurrence{&node, frame.enter, lastCounter, frame.hash, frame.cost, frame.statement, declared});
+        }
+        if (!stack.empty())
+        {
+            Frame & parent = stack.back();
+            parent.hash = combineHash(parent.hash, combineHash(frame.hash, node.coercedType));
+            parent.cost += frame.cost;
+            parent.pure = parent.pure && frame.pure;
+        }
+    }
+
+    void walk(AstNode & root)
+    {
+        std::vector<Frame> stack;
+        size_t counter = 0;
+        enter(stack, root, counter++, NO_STATEMENT, false);
+        while (!stack.empty())
+        {
+            Frame & frame = stack.back();
+            AstNode & node = *frame.node;
+            if (frame.nextChild == node.children.size())
+            {
+                exit(stack, counter - 1);
+                continue;
+            }
+            const size_t index = frame.nextChild++;
+            size_t statement = NO_STATEMENT;
+            if (frame.block != NO_STATEMENT)
+            {
+                statement = m_statements.size();
+                m_statements.push_back(Statement{frame.block, index, counter});
+            }
+            else if (frame.statement != NO_STATEMENT && isAlwaysEvaluated(node, index))
+            {
+                statement = frame.statement;
+            }
+            const bool inLambda = frame.inLambda;
+            // This may move the frame.
+            enter(stack, node.children[index], counter++, statement, inLambda);
+        }
+    }
+
+    // This works out where each repeated expression can be shared from, and what it can be shared with.
+    void findPlans(const std::vector<size_t> & members, std::vector<Plan> & plans) const
+    {
+        std::vector<const PMMLDocument::FieldDescription *> variables;
+        gatherVariables(*m_occurrences[members.front()].node, variables);
+        for (size_t i = 0; i < members.size();)
+        {
+            const Occurrence & anchor = m_occurrences[members[i]];
+            if (anchor.statement == NO_STATEMENT)
+            {
+                i++;
+                continue;
+            }
+            const Statement & statement = m_statements[anchor.statement];
+            const AstNode & statementNode = m_blocks[statement.block].node->children[statement.index];
+            Plan plan;
+            plan.anchor = members[i];
+            // If the anchor is all of a declaration, that variable already holds it.
+            if (statementNode.function().functionType == Function::DECLARATION && &statementNode.children.front() == anchor.node &&
+                anchor.node->coercedType == anchor.node->type && statementNode.fieldDescription->field.dataType == anchor.node->type &&
+                !isSpecialVar(statementNode.fieldDescription.get()))
+            {
+                plan.existing = statementNode.fieldDescription;
+            }
+            size_t next = i + 1;
+            for (; next < members.size(); ++next)
+            {
+                const Occurrence & use = m_occurrences[members[next]];
+                if (use.enter > m_blocks[statement.block].exit ||
+                    std::any_of(variables.begin(), variables.end(), [&](const PMMLDocument::FieldDescription * variable)
+                    {
+                        return m_changes.isChangedBetween(*variable, statement.enter, use.enter);
+                    }) ||
+                    (plan.existing != nullptr && m_changes.isChangedBetween(*plan.existing, statement.enter + 1, use.enter)))
+                {
+                    break;
+                }
+                plan.uses.push_back(members[next]);
+            }
+            if (plan.uses.empty())
+            {
+                i++;
+            }
+            else
+            {
+                plans.push_back(std::move(plan));
+                i = next;
+            }
+        }
+    }
+
+    PMMLDocument::ConstFieldDescriptionPtr makeVariable(PMMLDocument::FieldType type)
+    {
+        std::string name;
+        do
+        {
+            name = "shared_" + std::to_string(m_nextName++);
+        }
+        while (m_takenNames.count(name));
+        return std::make_shared<PMMLDocument::FieldDescription>(type, PMMLDocument::ORIGIN_TEMPORARY, PMMLDocument::OPTYPE_INVALID, name, m_nextID++);
+    }
+
+    static void replaceWithVariable(AstNode & node, const PMMLDocument::ConstFieldDescriptionPtr & variable)
+    {
+        AstNode reference(node.id, AstBuilder::FIELD_DEF, variable, AstNode::Children());
+        reference.coercedType = node.coercedType;
+        node = std::move(reference);
+    }
+public:
+    // This returns true if anything was shared. At most maxNewVariables are added.
+    bool run(AstNode & node, size_t maxNewVariables)
+    {
+        walk(node);
+
+        // Group everything that looks the same, in the order it is run.
+        std::vector<std::tuple<size_t, size_t, size_t>> order;
+        order.reserve(m_occurrences.size());
+        for (size_t i = 0; i < m_occurrences.size(); ++i)
+        {
+            order.emplace_back(m_occurrences[i].hash, m_occurrences[i].enter, i);
+        }
+        std::sort(order.begin(), order.end());
+        std::vector<Plan> plans;
+        std::vector<std::vector<size_t>> same;
+        for (size_t begin = 0; begin < order.size();)
+        {
+            size_t end = begin + 1;
+            while (end < order.size() && std::get<0>(order[end]) == std::get<0>(order[begin]))
+            {
+                end++;
+            }
+            // Most repeats are too cheap to share unless a variable already holds one of them, so they aren't looked at.
+            const Occurrence & first = m_occurrences[std::get<2>(order[begin])];
+            if (end - begin < 2 || ((first.cost - 1) * (end - begin - 1) <= PRICE_OF_VARIABLE &&
+                std::none_of(order.begin() + begin, order.begin() + end, [this](const std::tuple<size_t, size_t, size_t> & entry)
+                {
+                    return m_occurrences[std::get<2>(entry)].declared;
+                })))
+            {
+                begin = end;
+                continue;
+            }
+            // Different expressions can have the same hash, so they are sorted into those that are really the same.
+            same.clear();
+            for (size_t i = begin; i < end; ++i)
+            {
+                const size_t occurrence = std::get<2>(order[i]);
+                const AstNode & expression = *m_occurrences[occurrence].node;
+                auto found = std::find_if(same.begin(), same.end(), [&](const std::vector<size_t> & members)
+                {
+                    return isSameExpression(*m_occurrences[members.front()].node, expression);
+                });
+                if (found == same.end())
+                {
+                    same.emplace_back(1, occurrence);
+                }
+                else
+                {
+                    found->push_back(occurrence);
+                }
+            }
+            for (const std::vector<size_t> & members : same)
+            {
+                if (members.size() > 1)
+                {
+                    findPlans(members, plans);
+                }
+            }
+            begin = end;
+        }
+
+        // The most expensive are shared first. Anything inside what has been shared already is gone, and nothing can
+        // contain something that has been shared already, as it would have to be more expensive. The hashes depend on where
+        // things are in memory, so those that cost the same go in the order they are run, for the names to be the same
+        // every time.
+        std::sort(plans.begin(), plans.end(), [this](const Plan & a, const Plan & b)
+        {
+            const Occurrence & left = m_occurrences[a.anchor];
+            const Occurrence & right = m_occurrences[b.anchor];
+            return left.cost != right.cost ? left.cost > right.cost : left.enter < right.enter;
+        });
+        std::map<size_t, size_t> replaced;
+        auto isReplaced = [&](size_t occurrence)
+        {
+            auto found = replaced.upper_bound(m_occurrences[occurrence].enter);
+            return found != replaced.begin() && m_occurrences[occurrence].enter <= (--found)->second;
+        };
+        std::vector<Insertion> insertions;
+        bool sharedAnything = false;
+        for (Plan & plan : plans)
+        {
+            if (isReplaced(plan.anchor))
+            {
+                continue;
+            }
+            plan.uses.erase(std::remove_if(plan.uses.begin(), plan.uses.end(), isReplaced), plan.uses.end());
+            const Occurrence & anchor = m_occurrences[plan.anchor];
+            PMMLDocument::ConstFieldDescriptionPtr variable = plan.existing;
+            if (variable == nullptr)
+            {
+                if (maxNewVariables == 0 || (anchor.cost - 1) * plan.uses.size() <= PRICE_OF_VARIABLE)
+                {
+                    continue;
+                }
+                maxNewVariables--;
+                variable = makeVariable(anchor.node->type);
+                // The value is worked out just before the statement that first needs it.
+                AstNode declaration(m_nextNodeID++, AstBuilder::DECLARATION_DEF, variable, AstNode::Children());
+                declaration.children.push_back(std::move(*anchor.node));
+                declaration.children.back().coercedType = anchor.node->type;
+                const Statement & statement = m_statements[anchor.statement];
+                insertions.push_back(Insertion{statement.block, statement.index, std::move(declaration)});
+                replaceWithVariable(*anchor.node, variable);
+                replaced.emplace(anchor.enter, anchor.exit);
+            }
+            else if (plan.uses.empty())
+            {
+                continue;
+            }
+            for (size_t use : plan.uses)
+            {
+                replaceWithVariable(*m_occurrences[use].node, variable);
+                replaced.emplace(m_occurrences[use].enter, m_occurrences[use].exit);
+            }
+            sharedAnything = true;
+        }
+
+        // Blocks that come later can be inside earlier ones, so they are done first, so that no block moves before its turn.
+        std::stable_sort(insertions.begin(), insertions.end(), [](const Insertion & a, const Insertion & b)
+        {
+            return a.block != b.block ? a.block > b.block : a.index < b.index;
+        });
+        for (auto first = insertions.begin(); first != insertions.end();)
+        {
+            auto last = first;
+            AstNode::Children & statements = m_blocks[first->block].node->children;
+            AstNode::Children merged;
+            merged.reserve(statements.size() + 1);
+            for (size_t i = 0; i < statements.size(); ++i)
+            {
+                for (; last != insertions.end() && last->block == first->block && last->index == i; ++last)
+                {
+                    merged.push_back(std::move(last->declaration));
+                }
+                merged.push_back(std::move(statements[i]));
+            }
+            statements.swap(merged);
+            first = last;
+        }
+        return sharedAnything;
+    }
+};
+
+// Derived fields are declared at the top of the model they belong to, though often only some paths through it read them,
+// such as a field that a tree only tests under one of its nodes. Where every use of a variable is in some of the bodies of
+// an if chain, but not all of them, it is declared in each of those bodies instead, so that the other paths never work it
+// out. From there it goes on down the same way, as far as it can.
+class DeclarationSinker
+{
+    // Each copy of a declaration makes the script bigger, so it isn't split up more than this.
+    static const size_t MAX_COPIES = 4;
+    static const size_t NONE = std::numeric_limits<size_t>::max();
+
+    // Where the children of blocks and if chains start are kept together, from first.
+    struct Block
+    {
+        AstNode * node;
+        size_t enter;
+        size_t first;
+    };
+
+    struct Chain
+    {
+        AstNode * node;
+        size_t enter;
+        size_t first;
+    };
+
+    struct Use
+    {
+        size_t counter;
+        AstNode * node;
+    };
+
+    struct Candidate
+    {
+        size_t block;
+        size_t index;
+        size_t enter;
+    };
+
+    struct Frame
+    {
+        AstNode * node;
+        size_t nextChild;
+        size_t enter;
+        bool pure;
+        bool inLambda;
+        size_t block;
+        size_t chain;
+    };
+
+    // Somewhere the uses in [firstUse, endUse) all are. That is either a block, or a body of an if chain that isn't one.
+    struct Scope
+    {
+        size_t block;
+        size_t chain;
+        size_t child;
+        size_t firstUse;
+        size_t endUse;
+        // Where a copy declared here would be worked out, which is before the statement at index for a block.
+        size_t index;
+        size_t start;
+    };
+
+    struct Insertion
+    {
+        size_t container;
+        size_t index;
+        AstNode declaration;
+    };
+
+    std::vector<Block> m_blocks;
+    // Both of these are in the order they start in.
+    std::vector<Chain> m_chains;
+    // Where each child of a block or if chain starts, and for children of if chains, which block it is, if it is one.
+    std::vector<size_t> m_starts;
+    std::vector<size_t> m_childBlocks;
+    std::vector<Candidate> m_candidates;
+    // These are indexed by field ID, and only kept for variables that might be moved, which are all declared before they
+    // are used.
+    std::vector<std::vector<Use>> m_uses;
+    std::vector<bool> m_isCandidate;
+    std::vector<bool> m_captured;
+    FieldChanges m_changes;
+    std::unordered_set<std::string> m_takenNames;
+    unsigned int m_nextID = 0;
+    unsigned int m_nextNodeID = 0;
+
+    void noteUse(const PMMLDocument::FieldDescription & field, size_t counter, AstNode & node, bool inLambda)
+    {
+        if (field.id >= m_isCandidate.size() || !m_isCandidate[field.id])
+        {
+            return;
+        }
+        m_uses[field.id].push_back(Use{counter, &node});
+        if (inLambda)
+        {
+            m_captured[field.id] = true;
+        }
+    }
+
+    void enter(std::vector<Frame> & stack, AstNode & node, size_t counter, bool inLambda)
+    {
+        const Function::Definition & function = node.function();
+        m_nextNodeID = std::max(m_nextNodeID, node.id + 1);
+        if (node.fieldDescription != nullptr)
+        {
+            const PMMLDocument::FieldDescription & field = *node.fieldDescription;
+            m_nextID = std::max(m_nextID, field.id + 1);
+            if (function.functionType == Function::DECLARATION || function.functionType == Function::ASSIGNMENT)
+            {
+                m_changes.note(field, counter);
+            }
+            else
+            {
+                noteUse(field, counter, node, inLambda);
+            }
+        }
+        if (function.functionType == Function::FUNCTIONLIKE && function.outputType == PMMLDocument::TYPE_VOID)
+        {
+            for (const AstNode & child : node.children)
+            {
+                if (child.fieldDescription != nullptr)
+                {
+                    m_changes.note(*child.fieldDescription, counter);
+                }
+            }
+        }
+
+        size_t block = NONE;
+        size_t chain = NONE;
+        if (!inLambda && (function.functionType == Function::BLOCK || function.functionType == Function::IF_CHAIN))
+        {
+            const size_t first = m_starts.size();
+            m_starts.resize(first + node.children.size());
+            m_childBlocks.resize(first + node.children.size(), size_t(NONE));
+            if (function.functionType == Function::BLOCK)
+            {
+                block = m_blocks.size();
+                m_blocks.push_back(Block{&node, counter, first});
+            }
+            else
+            {
+                chain = m_chains.size();
+                m_chains.push_back(Chain{&node, counter, first});
+            }
+        }
+        stack.push_back(Frame{&node, 0, counter, true, inLambda || function.functionType == Function::LAMBDA, block, chain});
+    }
+
+    void exit(std::vector<Frame> & stack)
+    {
+        const Frame frame = stack.back();
+        stack.pop_back();
+        if (stack.empty())
+        {
+            return;
+        }
+        Frame & parent = stack.back();
+        AstNode & node = *frame.node;
+        // Declarations of ordinary variables as something that only gives a value, straight into a block, might be moved.
+        if (parent.block != NONE && frame.pure && node.function().functionType == Function::DECLARATION && node.children.size() == 1 &&
+            !isSpecialVar(node.fieldDescription.get()) && node.fieldDescription->field.dataType != PMMLDocument::TYPE_LAMBDA)
+        {
+            const unsigned int id = node.fieldDescription->id;
+            if (id >= m_isCandidate.size())
+            {
+                m_isCandidate.resize(id + 1, false);
+                m_uses.resize(id + 1);
+                m_captured.resize(id + 1, false);
+            }
+            m_isCandidate[id] = true;
+            m_candidates.push_back(Candidate{parent.block, parent.nextChild - 1, frame.enter});
+        }
+        parent.pure = parent.pure && frame.pure && isPureNode(node);
+    }
+
+    void walk(AstNode & root)
+    {
+        std::vector<Frame> stack;
+        size_t counter = 0;
+        enter(stack, root, counter++, false);
+        while (!stack.empty())
+        {
+            Frame & frame = stack.back();
+            AstNode & node = *frame.node;
+            if (frame.nextChild == node.children.size())
+            {
+                exit(stack);
+                continue;
+            }
+            const size_t index = frame.nextChild++;
+            size_t child = NONE;
+            if (frame.block != NONE)
+            {
+                child = m_blocks[frame.block].first + index;
+            }
+            else if (frame.chain != NONE)
+            {
+                child = m_chains[frame.chain].first + index;
+            }
+            const size_t blocksBefore = m_blocks.size();
+            // This may move the frame.
+            enter(stack, node.children[index], counter, frame.inLambda);
+            if (child != NONE)
+            {
+                m_starts[child] = counter;
+                if (m_blocks.size() != blocksBefore)
+                {
+                    m_childBlocks[child] = blocksBefore;
+                }
+            }
+            counter++;
+        }
+    }
+
+    // This is which of the children from first the counter is in.
+    size_t childAt(size_t first, const AstNode & node, size_t counter) const
+    {
+        auto begin = m_starts.begin() + first;
+        return size_t(std::upper_bound(begin, begin + node.children.size(), counter) - begin) - 1;
+    }
+
+    // If the uses in scope are all in the bodies of the if chain, but not in all of its paths, this gives a scope for each
+    // body that has any of them.
+    bool split(const std::vector<Use> & uses, const Scope & scope, size_t chainIndex, std::vector<Scope> & parts) const
+    {
+        const Chain & chain = m_chains[chainIndex];
+        const size_t children = chain.node->children.size();
+        // There is one more path than there are bodies when there is no else.
+        const size_t paths = children / 2 + 1;
+        for (size_t first = scope.firstUse; first < scope.endUse;)
+        {
+            const size_t child = childAt(chain.first, *chain.node, uses[first].counter);
+            // Odd children are conditions.
+            if (child % 2 == 1 || parts.size() + 1 == paths)
+            {
+                return false;
+            }
+            size_t end = first + 1;
+            while (end < scope.endUse && childAt(chain.first, *chain.node, uses[end].counter) == child)
+            {
+                end++;
+            }
+            const size_t block = m_childBlocks[chain.first + child];
+            if (block == NONE)
+            {
+                parts.push_back(Scope{NONE, chainIndex, child, first, end, 0, m_starts[chain.first + child]});
+            }
+            else
+            {
+                parts.push_back(Scope{block, NONE, 0, first, end, 0, 0});
+            }
+            first = end;
+        }
+        return true;
+    }
+
+    // This finds where the uses in scope can be split up further, if anywhere. It returns false if they can't be.
+    bool descend(const std::vector<Use> & uses, Scope & scope, std::vector<Scope> & parts) const
+    {
+        if (scope.block != NONE)
+        {
+            const Block & block = m_blocks[scope.block];
+            scope.index = childAt(block.first, *block.node, uses[scope.firstUse].counter);
+            scope.start = m_starts[block.first + scope.index];
+            if (childAt(block.first, *block.node, uses[scope.endUse - 1].counter) != scope.index)
+            {
+                return false;
+            }
+        }
+        // The statement is an if chain if one starts where it does.
+        auto chain = std::lower_bound(m_chains.begin(), m_chains.end(), scope.start, [](const Chain & c, size_t start)
+        {
+            return c.enter < start;
+        });
+        // If chains that give a value aren't statements, and their bodies can't have declarations put in them.
+        return chain != m_chains.end() && chain->enter == scope.start && chain->node->coercedType == chain->node->type &&
+            split(uses, scope, size_t(chain - m_chains.begin()), parts);
+    }
+
+    void findTakenNames(const AstNode & root)
+    {
+        std::vector<const AstNode *> pending(1, &root);
+        while (!pending.empty())
+        {
+            const AstNode & next = *pending.back();
+            pending.pop_back();
+            if (next.fieldDescription != nullptr)
+            {
+                m_takenNames.insert(next.fieldDescription->luaName);
+            }
+            for (const AstNode & child : next.children)
+            {
+                pending.push_back(&child);
+            }
+        }
+    }
+
+    PMMLDocument::ConstFieldDescriptionPtr copyVariable(const AstNode & root, const PMMLDocument::FieldDescription & original)
+    {
+        if (m_takenNames.empty())
+        {
+            findTakenNames(root);
+        }
+        std::string name;
+        for (size_t suffix = 2; !m_takenNames.insert(name = original.luaName + "_" + std::to_string(suffix)).second; ++suffix)
+        {
+        }
+        return std::make_shared<PMMLDocument::FieldDescription>(original.field, original.origin, name, m_nextID++);
+    }
+
+    // Every node in a copy needs an ID of its own.
+    void renumber(AstNode & node)
+    {
+        std::vector<AstNode *> pending(1, &node);
+        while (!pending.empty())
+        {
+            AstNode & next = *pending.back();
+            pending.pop_back();
+            next.id = m_nextNodeID++;
+            for (AstNode & child : next.children)
+            {
+                pending.push_back(&child);
+            }
+        }
+    }
+
+    static size_t containerEnter(const std::vector<Block> & blocks, const std::vector<Chain> & chains, const Insertion & insertion)
+    {
+        return insertion.container < blocks.size() ? blocks[insertion.container].enter : chains[insertion.container - blocks.size()].enter;
+    }
+public:
+    // This returns true if any declaration was moved. At most maxNewVariables are added for the copies.
+    bool run(AstNode & root, size_t maxNewVariables)
+    {
+        walk(root);
+
+        std::vector<Insertion> insertions;
+        std::vector<std::pair<size_t, size_t>> removals;
+        std::vector<bool> moved(m_uses.size(), false);
+        std::vector<const PMMLDocument::FieldDescription *> variables;
+        std::vector<Scope> scopes;
+        std::vector<Scope> pending;
+        std::vector<Scope> parts;
+        for (const Candidate & candidate : m_candidates)
+        {
+            AstNode & declaration = m_blocks[candidate.block].node->children[candidate.index];
+            const PMMLDocument::FieldDescription & field = *declaration.fieldDescription;
+            if (m_uses[field.id].empty() || m_captured[field.id] || m_changes.timesChanged(field) != 1)
+            {
+                continue;
+            }
+            const std::vector<Use> & uses = m_uses[field.id];
+
+            // Go down for as long as the uses are all in some bodies of one if chain.
+            scopes.clear();
+            pending.assign(1, Scope{candidate.block, NONE, 0, 0, uses.size(), 0, 0});
+            bool isSplit = false;
+            while (!pending.empty())
+            {
+                Scope scope = pending.back();
+                pending.pop_back();
+                parts.clear();
+                if (descend(uses, scope, parts) && scopes.size() + pending.size() + parts.size() <= MAX_COPIES)
+                {
+                    isSplit = true;
+                    pending.insert(pending.end(), parts.rbegin(), parts.rend());
+                }
+                else
+                {
+                    scopes.push_back(scope);
+                }
+            }
+            if (!isSplit || scopes.size() - 1 > maxNewVariables)
+            {
+                continue;
+            }
+            // Everything it reads has to have the same value where it is moved to, and still be where it was declared.
+            variables.clear();
+            gatherVariables(declaration.children.front(), variables);
+            if (std::any_of(variables.begin(), variables.end(), [&](const PMMLDocument::FieldDescription * variable)
+                {
+                    return (variable->id < moved.size() && moved[variable->id]) ||
+                        std::any_of(scopes.begin(), scopes.end(), [&](const Scope & scope)
+                        {
+                            return m_changes.isChangedBetween(*variable, candidate.enter + 1, scope.start - 1);
+                        });
+                }))
+            {
+                continue;
+            }
+
+            moved[field.id] = true;
+            maxNewVariables -= scopes.size() - 1;
+            for (size_t i = 0; i < scopes.size(); ++i)
+            {
+                const Scope & scope = scopes[i];
+                AstNode copy(declaration);
+                if (i > 0)
+                {
+                    renumber(copy);
+                    copy.fieldDescription = copyVariable(root, field);
+                    copy.content = copy.fieldDescription->luaName;
+                    for (size_t use = scope.firstUse; use < scope.endUse; ++use)
+                    {
+                        uses[use].node->fieldDescription = copy.fieldDescription;
+                        uses[use].node->content = copy.content;
+                    }
+                }
+                if (scope.block != NONE)
+                {
+                    insertions.push_back(Insertion{scope.block, scope.index, std::move(copy)});
+                }
+                else
+                {
+                    insertions.push_back(Insertion{m_blocks.size() + scope.chain, scope.child, std::move(copy)});
+                }
+            }
+            removals.emplace_back(candidate.block, candidate.index);
+        }
+        if (removals.empty())
+        {
+            return false;
+        }
+
+        // Removals go in with the insertions, as nothing. Anything inside a block or an if chain has to be changed before the
+        // block or chain is, as that moves what is in it.
+        for (const std::pair<size_t, size_t> & removal : removals)
+        {
+            insertions.push_back(Insertion{removal.first, removal.second, AstNode(AstNode::invalidNode)});
+        }
+        std::stable_sort(insertions.begin(), insertions.end(), [this](const Insertion & a, const Insertion & b)
+        {
+            const size_t left = containerEnter(m_blocks, m_chains, a);
+            const size_t right = containerEnter(m_blocks, m_chains, b);
+            return left != right ? left > right : a.index < b.index;
+        });
+        for (auto first = insertions.begin(); first != insertions.end();)
+        {
+            auto last = first;
+            if (first->container >= m_blocks.size())
+            {
+                // A body that isn't a block becomes one, for the declaration to go in.
+                AstNode & body = m_chains[first->container - m_blocks.size()].node->children[first->index];
+                AstNode::Children statements;
+                statements.push_back(std::move(first->declaration));
+                statements.push_back(std::move(body));
+                body = AstNode(m_nextNodeID++, AstBuilder::BLOCK_DEF, statements.back().type, std::string(), std::move(statements));
+                first++;
+                continue;
+            }
+            AstNode::Children & statements = m_blocks[first->container].node->children;
+            AstNode::Children merged;
+            merged.reserve(statements.size() + 1);
+            for (size_t i = 0; i < statements.size(); ++i)
+            {
+                bool removed = false;
+                for (; last != insertions.end() && last->container == first->container && last->index == i; ++last)
+                {
+                    if (last->declaration == AstNode::invalidNode)
+                    {
+                        removed = true;
+                    }
+                    else
+                    {
+                        merged.push_back(std::move(last->declaration));
+                    }
+                }
+                if (!removed)
+                {
+                    merged.push_back(std::move(statements[i]));
+                }
+            }
+            statements.swap(merged);
+            first = last;
+        }
+        return true;
+    }
+};
+
+// This removes code that will either never be executed, or if executed, will not change the outcome.
+class RemoveDeadCodeVisitor
+{
+    const VariableInfoMap & m_map;
+    UseTracker & m_uses;
+    bool m_killedAnything;
+    bool m_madeBlock;
+    struct StackValue
+    {
+        Function::FunctionType type;
+        Analyser::TrivialValue triv;
+    };
+    std::vector<StackValue> m_stack;
+public:
+    RemoveDeadCodeVisitor(const VariableInfoMap & map, UseTracker & uses) :
+        m_map(map),
+        m_uses(uses),
+        m_killedAnything(false),
+        m_madeBlock(false)
+    {}
+    
+    void enterNode(Analyser::AnalyserContext &, AstNode & node, size_t)
+    {
+        StackValue newValue = {node.function().functionType, Analyser::RUNTIME_EVALUATION_NEEDED};
+        m_stack.push_back(newValue);
+    }
+    
+    VisitorResponse exitNode(Analyser::AnalyserContext & ctx, AstNode & node, size_t counter)
     {
         Analyser::TrivialValue triv = m_stack.back().triv;
         m_stack.pop_back();
         // Constants can never be simplified further.
         if (node.function().functionType == Function::CONSTANT)
         {
-            return RESPONSE_CONTINUE;
+            return RESPONSE_CONTINUE;
+        }
+        
+        if (triv == Analyser::RUNTIME_EVALUATION_NEEDED)
+        {
+            // We haven't been marked as trivial from below, check the node itself
+            triv = ctx.checkIfTrivial(node);
+        }
+        
+        // Now the top of the stack is the parent, which is what we want.
+        if (triv != Analyser::RUNTIME_EVALUATION_NEEDED)
+        {
+            m_killedAnything = true;
+            if (!m_stack.empty())
+            {
+                const Function::FunctionType type = m_stack.back().type;
+                // And/or clauses can remove single values or can recursively remove themselves.
+                if (type == Function::BOOLEAN_AND ||
+                    type == Function::BOOLEAN_OR)
+                {
+                    // Propagate up true for OR and false for AND
+                    if ((triv == Analyser::ALWAYS_FALSE) == (type == Function::BOOLEAN_AND))
+                    {
+                        m_stack.back().triv = triv;
+                    }
+                    m_uses.forget(node);
+                    return RESPONSE_KILL_NODE_AND_CONTINUE;
+                }
+            }
+            
+            // Replace with a boolean const at least.
+            m_uses.forget(node);
+            node.simplifyTrivialValue(triv);
+            return RESPONSE_CONTINUE;
+        }
+        
+        return Function::dispatchFunctionType<VisitorResponse>(*this, node.function().functionType, ctx, node, counter);
+    }
+    bool hasKilledAnything() const { return m_killedAnything; }
+    // Whether anything was replaced with a block, which may need flattening into the block around it.
+    bool hasMadeBlock() const { return m_madeBlock; }
+
+    // This replaces a node with one of its children, dropping the rest.
+    void replaceWithChild(AstNode & node, size_t index)
+    {
+        for (size_t i = 0; i < node.children.size(); ++i)
+        {
+            if (i != index)
+            {
+                m_uses.forget(node.children[i]);
+            }
+        }
+        AstNode child = std::move(node.children[index]);
+        node = std::move(child);
+        m_killedAnything = true;
+        m_madeBlock = m_madeBlock || node.function().functionType == Function::BLOCK;
+    }
+    
+    VisitorResponse process(Function::IfChain, Analyser::AnalyserContext & ctx, AstNode & node, size_t)
+    {
+        // If nothing is useful, kill the whole stupid node.
+        if (!cullEmptyBranches(node, m_uses, m_killedAnything))
+        {
+            m_killedAnything = true;
+            m_uses.forget(node);
+            return RESPONSE_KILL_NODE_AND_CONTINUE;
+        }
+        
+        // This second pass will find trivial predicates in the ifChain (odd numbered children are predicates)
+        Analyser::NonNoneAssertionStackGuard ifChainAssertions(ctx);
+        for (size_t i = 1; i < node.children.size(); )
+        {
+            AstNode & child = node.children[i];
+            Analyser::TrivialValue triv = ctx.checkIfTrivial(child);
+            if (triv == Analyser::ALWAYS_TRUE)
+            {
+                // If a predicate is always true, remove it and and all following content. Its content becomes the else clause.
+                for (size_t j = i; j < node.children.size(); ++j)
+                {
+                    m_uses.forget(node.children[j]);
+                }
+                node.children.erase(node.children.begin() + i, node.children.end());
+                m_killedAnything = true;
+            }
+            else if (triv == Analyser::ALWAYS_FALSE)
+            {
+                // If a predicate is always false, remove it and it's corresponding block
+                m_uses.forget(node.children[i - 1]);
+                m_uses.forget(node.children[i]);
+                node.children.erase(node.children.begin() + i - 1, node.children.begin() + i + 1);
+                m_killedAnything = true;
+            }
+            else
+            {
+                ifChainAssertions.addAssertionsForCheck(child, Analyser::ASSUME_FALSE);
+                i += 2;
+            }
+        }
+        
+        // If an if chain now only has an else clause (because everything else had been culled, or it had nothing else to begin with)
+        // just remove it and pop everything up. This helps for later optimisation passes.
+        if (node.children.size() == 1)
+        {
+            replaceWithChild(node, 0);
+        }
+        return RESPONSE_CONTINUE;
+    }
+    
+    // This checks if a value is used after where it was last set, if not, it can be culled
+    VisitorResponse process(Function::DeclartionOrAssignment, Analyser::AnalyserContext &, AstNode & node, size_t counter)
+    {
+        auto variable = m_map.find(node.fieldDescription);
+        if (variable != m_map.end())
+        {
+            if (counter >= variable->second.lastUsed && !isSpecialVar(node.fieldDescription.get()))
+            {
+                m_killedAnything = true;
+                m_uses.forget(node);
+                return RESPONSE_KILL_NODE_AND_CONTINUE;
+            }
+        }
+        return RESPONSE_CONTINUE;
+    }
+    
+    // This checks to see if a ternary's predicate can be known in advance
+    VisitorResponse process(Function::TernaryMacro, Analyser::AnalyserContext & ctx, AstNode & node, size_t)
+    {
+        Analyser::TrivialValue triv = ctx.checkIfTrivial(node.children[0]);
+        if (triv == Analyser::ALWAYS_TRUE)
+        {
+            replaceWithChild(node, 1);
+        }
+        else if (triv == Analyser::ALWAYS_FALSE && node.function().functionType == Function::TERNARY_MACRO)
+        {
+            replaceWithChild(node, 2);
+        }
+        return RESPONSE_CONTINUE;
+    }
+    
+    VisitorResponse process(Function::BoundMacro, Analyser::AnalyserContext & ctx, AstNode & node, size_t counter)
+    {
+        return process(Function::TernaryMacro(), ctx, node, counter);
+    }
+    
+    // This tells if a default statement's alternative value can ever be used.
+    VisitorResponse process(Function::DefaultMacro, Analyser::AnalyserContext & ctx, AstNode & node, size_t)
+    {
+        if (!ctx.mightBeMissing(node.children[0]))
+        {
+            replaceWithChild(node, 0);
+        }
+        return RESPONSE_CONTINUE;
+    }
+    
+    // Catch all default
+    VisitorResponse process(Function::FunctionTypeBase, Analyser::AnalyserContext &, AstNode &, size_t)
+    {
+        return RESPONSE_CONTINUE;
+    }
+};
+
+// Removing dead code often removes the last use of a variable, at which point its declaration and assignments are dead too.
+// Finding those with another pass of RemoveDeadCodeVisitor only removes one level of them at a time, each level being a
+// pass over the whole tree. Instead, this works through the variables that have lost all their uses, going backwards from
+// the end of the tree so that whatever was only used in something it removes is removed when it is reached.
+class RemoveUnusedVariables
+{
+    UseTracker & m_uses;
+    // By field ID, whether a declaration or assignment of a variable has been kept because it was still used.
+    std::vector<bool> m_kept;
+    bool m_removedAnything = false;
+
+    // A node that is being gone through, whose children are gone through from the last to the first.
+    struct SweepFrame
+    {
+        AstNode * node;
+        // The child that was gone through last, or one past the last child at first.
+        size_t next;
+        // The first child that is gone through.
+        size_t first;
+        // For a block, which of its statements can be removed.
+        std::vector<bool> removable;
+    };
+
+    // This starts going through node. It returns true if node is a statement that can be removed, and doesn't need going
+    // through at all.
+    bool startSweep(AstNode & node, std::vector<SweepFrame> & stack)
+    {
+        size_t first = 0;
+        switch (node.function().functionType)
+        {
+            case Function::DECLARATION:
+            case Function::ASSIGNMENT:
+                if (!isSpecialVar(node.fieldDescription.get()) && m_uses.isUnused(node.fieldDescription))
+                {
+                    return true;
+                }
+                if (node.fieldDescription->id >= m_kept.size())
+                {
+                    m_kept.resize(node.fieldDescription->id + 1, false);
+                }
+                m_kept[node.fieldDescription->id] = true;
+                break;
+
+            case Function::LAMBDA:
+                // Only the body of a lambda is gone through.
+                first = node.children.empty() ? 0 : node.children.size() - 1;
+                break;
+
+            default:
+                break;
+        }
+        stack.push_back(SweepFrame{&node, node.children.size(), first, std::vector<bool>()});
+        if (node.function().functionType == Function::BLOCK)
+        {
+            stack.back().removable.resize(node.children.size(), false);
+        }
+        return false;
+    }
+
+    // This removes a statement of the node of frame, which is the child that was gone through last.
+    void removeStatement(SweepFrame & frame)
+    {
+        AstNode & child = frame.node->children[frame.next];
+        switch (frame.node->function().functionType)
+        {
+            case Function::BLOCK:
+                m_uses.forget(child);
+                frame.removable[frame.next] = true;
+                break;
+
+            case Function::IF_CHAIN:
+                // As in AstTraverser, removing a statement from an if chain leaves an empty block in its place.
+                m_uses.forget(child);
+                child.pFunction = &AstBuilder::BLOCK_DEF;
+                child.children.clear();
+                m_removedAnything = true;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    // Once all of the children of the node of frame have been gone through, this tidies it up. It returns true if the
+    // node is a statement that can be removed.
+    bool finishSweep(SweepFrame & frame)
+    {
+        AstNode & node = *frame.node;
+        switch (node.function().functionType)
+        {
+            case Function::BLOCK:
+                if (std::find(frame.removable.begin(), frame.removable.end(), true) != frame.removable.end())
+                {
+                    m_removedAnything = true;
+                    size_t kept = 0;
+                    for (size_t i = 0; i < node.children.size(); ++i)
+                    {
+                        if (!frame.removable[i])
+                        {
+                            if (kept != i)
+                            {
+                                node.children[kept] = std::move(node.children[i]);
+                            }
+                            kept++;
+                        }
+                    }
+                    node.children.erase(node.children.begin() + kept, node.children.end());
+                }
+                return false;
+
+            case Function::IF_CHAIN:
+                return !cullEmptyBranches(node, m_uses, m_removedAnything);
+
+            default:
+                return false;
+        }
+    }
+
+    // Like the rest of the optimiser, this goes through trees of any depth without recursing. The root itself is never
+    // removed.
+    void sweep(AstNode & root)
+    {
+        std::vector<SweepFrame> stack;
+        if (startSweep(root, stack))
+        {
+            return;
+        }
+        while (!stack.empty())
+        {
+            SweepFrame & frame = stack.back();
+            if (frame.next > frame.first)
+            {
+                frame.next--;
+                if (startSweep(frame.node->children[frame.next], stack))
+                {
+                    removeStatement(stack.back());
+                }
+                continue;
+            }
+            const bool removable = finishSweep(frame);
+            stack.pop_back();
+            if (removable && !stack.empty())
+            {
+                removeStatement(stack.back());
+            }
+        }
+    }
+public:
+    explicit RemoveUnusedVariables(UseTracker & uses) :
+        m_uses(uses)
+    {}
+
+    // This returns true if anything was removed.
+    bool run(AstNode & node)
+    {
+        std::vector<unsigned int> unused = m_uses.takeUnusedVariables();
+        while (!unused.empty())
+        {
+            m_kept.clear();
+            sweep(node);
+            unused = m_uses.takeUnusedVariables();
+            // Only go again if a variable that was passed over as still used has since lost its last use.
+            if (std::none_of(unused.begin(), unused.end(), [this](unsigned int id){ return id < m_kept.size() && m_kept[id]; }))
+            {
+                break;
+            }
+        }
+        return m_removedAnything;
+    }
+};
+
+// This step is between the dead-code removal step and the variable aliasing step.
+// Since variable aliasing only works within a block, it is advantagious to make the blocks as large as possible.
+// This visitor rolls blocks into super-blocks so that variables can be re-used more efficiently.
+class FlatternNodesVisitor
+{
+public:
+    void enterNode(Analyser::AnalyserContext &, AstNode &, size_t)
+    {
+    }
+    VisitorResponse exitNode(Analyser::AnalyserContext &, AstNode & node, size_t)
+    {
+        if (node.function().functionType != Function::BLOCK)
+        {
+            return RESPONSE_CONTINUE;
+        }
+        
+        bool foundBlock = false;
+        for (const AstNode & child : node.children)
+        {
+            if (child.function().functionType == Function::BLOCK)
+            {
+                foundBlock = true;
+            }
+        }
+        
+        if (!foundBlock)
+        {
+            return RESPONSE_CONTINUE;
+        }
+        
+        // Flattern any blocks included into a single block. This will help the optimiser.
+        std::vector<AstNode> flattenedChildren;
+        flattenedChildren.reserve(node.children.size() + 1);
+        for (AstNode & child : node.children)
+        {
+            if (child.function().functionType == Function::BLOCK)
+            {
+                std::move(child.children.begin(), child.children.end(), std::back_inserter(flattenedChildren));
+            }
+            else
+            {
+                flattenedChildren.push_back(std::move(child));
+            }
+        }
+        
+        node.children.swap(flattenedChildren);
+        return RESPONSE_CONTINUE;
+    }
+};
+
+
+// Aliasing allows LuaOutputter to choose an existing variable that isn't being used to store another variable, so fewer
+// variables need to be overflowed. It is not done by modifying the tree, to keep it in relaxed Single Static Assignment form
+// and to allow null assertions to work properly.
+// This is a linear scan over where each variable is live, from where it is declared to where it is last used or set, in the
+// order the tree is gone through. Each variable takes the local of one that is no longer needed if there is one, or else a
+// new one, which lasts until the end of the block it is declared in, where Lua frees it. The main function, each section and
+// each lambda have locals of their own. Once they are all known, wherever a function would have more than maxLocals at
+// once, the least used are overflowed, so that the most used stay locals.
+class VariableAllocator
+{
+    static const size_t NONE = std::numeric_limits<size_t>::max();
+
+    // A local, which is the variable that is declared with it, and the variables aliased to that.
+    struct Slot
+    {
+        PMMLDocument::ConstFieldDescriptionPtr owner;
+        size_t uses;
+        size_t opened;
+        size_t closed;
+        // Unmovable variables, parameters and the like always stay locals.
+        bool overflowable;
+        bool overflowed;
+    };
+
+    typedef std::pair<size_t, size_t> CounterAndSlot;
+    struct LuaFunction
+    {
+        std::vector<size_t> slots;
+        // Slots that are free to be reused, the most recently freed last.
+        std::vector<size_t> free;
+        // Slots that are being used, by the counter they are free from.
+        std::priority_queue<CounterAndSlot, std::vector<CounterAndSlot>, std::greater<CounterAndSlot>> busy;
+    };
+
+    const VariableInfoMap & m_map;
+    const size_t m_maxLocals;
+    std::vector<Slot> m_slots;
+    std::vector<LuaFunction> m_functions;
+    std::vector<size_t> m_openFunctions;
+    // The slots declared in each block that is open.
+    std::vector<std::vector<size_t>> m_openBlocks;
+    std::vector<const AstNode *> m_path;
+    size_t m_counter = 0;
+
+    size_t addSlot(const PMMLDocument::ConstFieldDescriptionPtr & owner, size_t uses, size_t counter, bool overflowable)
+    {
+        m_slots.push_back(Slot{owner, uses, counter, NONE, overflowable, false});
+        m_functions[m_openFunctions.back()].slots.push_back(m_slots.size() - 1);
+        m_openBlocks.back().push_back(m_slots.size() - 1);
+        return m_slots.size() - 1;
+    }
+
+    // Each body of an if chain is a block of its own in Lua.
+    static bool isBody(const AstNode * parent, const AstNode & node)
+    {
+        return parent != nullptr && parent->function().functionType == Function::IF_CHAIN && (&node - parent->children.data()) % 2 == 0;
+    }
+
+    void closeBlock()
+    {
+        for (size_t slot : m_openBlocks.back())
+        {
+            m_slots[slot].closed = m_counter;
+        }
+        m_openBlocks.pop_back();
+    }
+
+    void openFunction()
+    {
+        m_openFunctions.push_back(m_functions.size());
+        m_functions.emplace_back();
+        m_openBlocks.emplace_back();
+    }
+
+    void closeFunction()
+    {
+        closeBlock();
+        LuaFunction & function = m_functions[m_openFunctions.back()];
+        function.free = std::vector<size_t>();
+        function.busy = decltype(function.busy)();
+        m_openFunctions.pop_back();
+    }
+
+    void declare(const AstNode & node, size_t counter)
+    {
+        auto variable = m_map.find(node.fieldDescription);
+        if (variable == m_map.end())
+        {
+            addSlot(node.fieldDescription, 0, counter, false);
+            return;
         }
-        
-        if (triv == Analyser::RUNTIME_EVALUATION_NEEDED)
+        const VariableInfo & info = variable->second;
+        if (info.unmovable || info.redeclared)
         {
-            // We haven't been marked as trivial from below, check the node itself
-            triv = ctx.checkIfTrivial(node);
+            // This is used in a lambda, which holds on to it, so it keeps its own local. A variable that is declared more
+            // than once keeps its own too, as an alias would be taken by all of its declarations, not only this one.
+            addSlot(node.fieldDescription, info.usedNTimes, counter, !info.unmovable);
+            return;
         }
-        
-        // Now the top of the stack is the parent, which is what we want.
-        if (triv != Analyser::RUNTIME_EVALUATION_NEEDED)
+        LuaFunction & function = m_functions[m_openFunctions.back()];
+        // End variable usage in preference to starting the next. An instruction may re-assign a variable at the same time as it uses it.
+        while (!function.busy.empty() && function.busy.top().first <= counter)
         {
-            m_killedAnything = true;
-            if (!m_stack.empty())
+            function.free.push_back(function.busy.top().second);
+            function.busy.pop();
+        }
+        // Slots of blocks that have finished are gone.
+        while (!function.free.empty() && m_slots[function.free.back()].closed != NONE)
+        {
+            function.free.pop_back();
+        }
+
+        size_t slot;
+        if (!function.free.empty())
+        {
+            // Re-use variables in a LIFO way, this leads to more readable code.
+            slot = function.free.back();
+            function.free.pop_back();
+            m_slots[slot].uses += info.usedNTimes;
+            aliases.emplace(node.fieldDescription, m_slots[slot].owner);
+        }
+        else
+        {
+            slot = addSlot(node.fieldDescription, info.usedNTimes, counter, true);
+        }
+        function.busy.emplace(std::max(std::max(info.lastUsed, info.lastSet), counter), slot);
+    }
+public:
+    LuaOutputter::AliasedVariables aliases;
+
+    VariableAllocator(const VariableInfoMap & map, size_t maxLocals) :
+        m_map(map),
+        m_maxLocals(maxLocals)
+    {
+        openFunction();
+        // Inputs are passed in to the main function, so they are there from the start, and can't be reused.
+        for (auto iter = map.begin(); iter != map.end(); ++iter)
+        {
+            if (iter->second.firstDeclared == 0)
             {
-                const Function::FunctionType type = m_stack.back().type;
-                // And/or clauses can remove single values or can recursively remove themselves.
-                if (type == Function::BOOLEAN_AND ||
-                    type == Function::BOOLEAN_OR)
+                addSlot(iter->first, iter->second.usedNTimes, 0, !iter->second.unmovable);
+            }
+        }
+    }
+
+    void enterNode(Analyser::AnalyserContext &, AstNode & node, size_t counter)
+    {
+        m_counter = std::max(m_counter, counter);
+        const AstNode * parent = m_path.empty() ? nullptr : m_path.back();
+        m_path.push_back(&node);
+        if (node.function().functionType == Function::LAMBDA)
+        {
+            openFunction();
+            for (size_t i = 0; i + 1 < node.children.size(); ++i)
+            {
+                addSlot(node.children[i].fieldDescription, 0, counter, false);
+            }
+        }
+        else if (isBody(parent, node))
+        {
+            m_openBlocks.emplace_back();
+        }
+        if (node.function().functionType == Function::DECLARATION)
+        {
+            declare(node, counter);
+        }
+    }
+
+    VisitorResponse exitNode(Analyser::AnalyserContext &, AstNode & node, size_t)
+    {
+        m_path.pop_back();
+        const AstNode * parent = m_path.empty() ? nullptr : m_path.back();
+        if (node.function().functionType == Function::LAMBDA)
+        {
+            closeFunction();
+        }
+        else if (isBody(parent, node))
+        {
+            closeBlock();
+        }
+        return RESPONSE_CONTINUE;
+    }
+
+    // Once the tree has been gone through, this is the most locals that any function needs at once, before anything is
+    // overflowed.
+    size_t peakLocals() const
+    {
+        size_t peak = 0;
+        for (const LuaFunction & function : m_functions)
+        {
+            std::vector<size_t> closings;
+            closings.reserve(function.slots.size());
+            for (size_t slot : function.slots)
+            {
+                closings.push_back(m_slots[slot].closed);
+            }
+            std::sort(closings.begin(), closings.end());
+            auto closing = closings.begin();
+            size_t locals = 0;
+            for (size_t slot : function.slots)
+            {
+                for (; closing != closings.end() && *closing < m_slots[slot].opened; ++closing)
                 {
-                    // Propagate up true for OR and false for AND
-                    if ((triv == Analyser::ALWAYS_FALSE) == (type == Function::BOOLEAN_AND))
+                    locals--;
+                }
+                locals++;
+                peak = std::max(peak, locals);
+            }
+        }
+        return peak;
+    }
+
+    // Once the tree has been gone through, this chooses what to overflow, and returns the variables that own the slots that
+    // are, indexed by field ID. It is empty if nothing needs to be.
+    std::vector<bool> overflow()
+    {
+        std::vector<bool> overflowVariables;
+        for (const LuaFunction & function : m_functions)
+        {
+            std::vector<size_t> byClosing(function.slots);
+            std::stable_sort(byClosing.begin(), byClosing.end(), [this](size_t a, size_t b)
+            {
+                return m_slots[a].closed < m_slots[b].closed;
+            });
+            auto closing = byClosing.begin();
+            size_t locals = 0;
+            // The locals that could be overflowed, least used first. Ties are broken on the order they are declared in, so
+            // that the same model always overflows the same variables.
+            std::set<CounterAndSlot> candidates;
+            // Slots are added to a function in the order they are opened.
+            for (size_t slot : function.slots)
+            {
+                for (; closing != byClosing.end() && m_slots[*closing].closed < m_slots[slot].opened; ++closing)
+                {
+                    if (!m_slots[*closing].overflowed)
                     {
-                        m_stack.back().triv = triv;
+                        locals--;
+                        candidates.erase(CounterAndSlot(m_slots[*closing].uses, *closing));
                     }
-                    return RESPONSE_KILL_NODE_AND_CONTINUE;
+                }
+                locals++;
+                if (m_slots[slot].overflowable)
+                {
+                    candidates.emplace(m_slots[slot].uses, slot);
+                }
+                if (locals > m_maxLocals && !candidates.empty())
+                {
+                    const size_t overflowed = candidates.begin()->second;
+                    candidates.erase(candidates.begin());
+                    m_slots[overflowed].overflowed = true;
+                    locals--;
+                    const unsigned int id = m_slots[overflowed].owner->id;
+                    if (id >= overflowVariables.size())
+                    {
+                        overflowVariables.resize(id + 1, false);
+                    }
+                    overflowVariables[id] = true;
                 }
             }
-            
-            // Replace with a boolean const at least.
-            node.simplifyTrivialValue(triv);
-            return RESPONSE_CONTINUE;
         }
-        
-        return Function::dispatchFunctionType<VisitorResponse>(*this, node.function().functionType, ctx, node, counter);
+        return overflowVariables;
+    }
+};
+
+// This traverses the tree giving places in the overflow array to variables who have been booted out of the global space.
+// It allocates them start to finish for readability (of output) and performance reasons
+class OverflowAssignmentVisitor
+{
+    // This is indexed by field ID.
+    const std::vector<bool> & m_overflowVariables;
+    int m_counter;
+public:
+    OverflowAssignmentVisitor(Analyser::AnalyserContext &, const std::vector<bool> & overflowVariables, int counter) :
+        m_overflowVariables(overflowVariables),
+        m_counter(counter)
+    {
+    }
+    void enterNode(Analyser::AnalyserContext &, AstNode & node, size_t)
+    {
+        if (node.function().functionType == Function::DECLARATION)
+        {
+            if (node.fieldDescription->id < m_overflowVariables.size() && m_overflowVariables[node.fieldDescription->id])
+            {
+                node.fieldDescription->overflowAssignment = m_counter++;
+            }
+        }
+    }
+    VisitorResponse exitNode(Analyser::AnalyserContext &, AstNode &, size_t)
+    {
+        return RESPONSE_CONTINUE;
+    }
+    size_t counter() const { return m_counter; }
+};
+
+// This is a last ditch effort to make sure that we can fit in the space.
+// The locals that VariableAllocator couldn't fit into their functions are stored in an array, which is passed in to the
+// main function, and this gives each of them its place there.
+size_t setupOverflow(Analyser::AnalyserContext & ctx, AstNode & node, const VariableInfoMap & map, const std::vector<bool> & overflowVariables)
+{
+    // Inputs are effectively at counter=0, at the very beginning of the document. They are numbered in order of field ID.
+    std::vector<PMMLDocument::ConstFieldDescriptionPtr> overflowInputs;
+    for (auto iter = map.begin(); iter != map.end(); ++iter)
+    {
+        if (iter->second.firstDeclared == 0 && iter->first->id < overflowVariables.size() && overflowVariables[iter->first->id])
+        {
+            overflowInputs.push_back(iter->first);
+        }
+    }
+    std::sort(overflowInputs.begin(), overflowInputs.end(), [](const PMMLDocument::ConstFieldDescriptionPtr & a, const PMMLDocument::ConstFieldDescriptionPtr & b)
+    {
+        return a->id < b->id;
+    });
+    
+    int counter = 1;
+    for (const auto & input : overflowInputs)
+    {
+        input->overflowAssignment = counter++;
+    }
+    
+    OverflowAssignmentVisitor assigner(ctx, overflowVariables, counter);
+    traverseTree<false>(ctx, node, assigner);
+    return assigner.counter();
+}
+
+// Sections are run as statements, so they have no value. Each is found by its content in the table of sections, which is
+// its field.
+static constexpr Function::Definition RunSection =
+{
+    nullptr,
+    Function::RUN_LAMBDA,
+    PMMLDocument::TYPE_VOID,
+    LuaOutputter::PRECEDENCE_TOP, Function::NEVER_MISSING
+};
+
+// A section gives back whatever it changes that is used after it.
+static constexpr Function::Definition ReturnFromSection =
+{
+    nullptr,
+    Function::RETURN_STATEMENT,
+    PMMLDocument::TYPE_VOID,
+    LuaOutputter::PRECEDENCE_TOP, Function::NEVER_MISSING
+};
+
+// Lua only allows a function so many locals and constants, and the biggest models need more than that. So when a script
+// would have to overflow its variables, or is too big to be one function, runs of the statements of the outermost block are
+// moved into sections: functions of their own, which are defined once, before the main function, and called where the
+// statements were. A section is passed everything it uses from before it, and returns what it changes of that which is
+// used after it. Anything it declares that is used after it is declared before it instead, so that it stays in the main
+// function, and is passed in and returned in the same way.
+class FunctionSplitter
+{
+    static const size_t NONE = std::numeric_limits<size_t>::max();
+    // Lua 5.1 has 250 registers for the locals of a function and the values it is working with. Calling a section takes one
+    // for the section and one for each argument, on top of the locals of the main function.
+    static const size_t MAX_REGISTERS = 250;
+    // Sections are kept well within the constants and jumps one function can have, and a script is split up for its size
+    // alone once it is a few sections long.
+    static const size_t MAX_SECTION_NODES = 1 << 16;
+    static const size_t MAX_FUNCTION_NODES = 1 << 18;
+
+    // A variable that a statement uses, but doesn't declare.
+    struct Reference
+    {
+        unsigned int id;
+        // The statement it was declared in, or NONE for inputs and the like.
+        size_t declaredIn;
+        // Whether the statement gives it a new value, rather than only using the one it has.
+        bool sets;
+    };
+
+    struct Statement
+    {
+        size_t nodes = 0;
+        size_t firstReference = 0;
+        size_t endReference = 0;
+        size_t firstDeclared = 0;
+        size_t endDeclared = 0;
+        // The variable the statement declares, if it is a declaration.
+        const PMMLDocument::FieldDescription * declares = nullptr;
+    };
+
+    struct Section
+    {
+        size_t begin;
+        size_t end;
+    };
+
+    // What the section being built so far needs.
+    struct Budget
+    {
+        size_t begin;
+        size_t declarations = 0;
+        size_t escaping = 0;
+        size_t parameters = 0;
+        size_t results = 0;
+        size_t nodes = 0;
+
+        explicit Budget(size_t b) : begin(b) {}
+    };
+
+    std::vector<Statement> m_statements;
+    std::vector<Reference> m_references;
+    std::vector<unsigned int> m_declared;
+    size_t m_nodes = 0;
+    unsigned int m_nextID = 0;
+    unsigned int m_nextNodeID = 0;
+    // These are indexed by field ID.
+    std::vector<PMMLDocument::ConstFieldDescriptionPtr> m_fields;
+    std::vector<size_t> m_declaredIn;
+    std::vector<size_t> m_lastUsed;
+    std::vector<size_t> m_referencedIn;
+    std::vector<size_t> m_referenceAt;
+    // Variables used in a lambda, which holds on to them.
+    std::vector<bool> m_captured;
+    // Which section, or budget, last counted each variable, and whether it sets it.
+    std::vector<size_t> m_countedBy;
+    std::vector<bool> m_setInSection;
+    size_t m_stamp = 0;
+    // For each statement, how many declarations of the budget being worked out are last used in it.
+    std::vector<size_t> m_escapesUntil;
+    std::vector<size_t> m_touched;
+    // The table that the sections are kept in.
+    PMMLDocument::ConstFieldDescriptionPtr m_sections;
+
+    void track(const PMMLDocument::ConstFieldDescriptionPtr & field)
+    {
+        const unsigned int id = field->id;
+        if (id >= m_fields.size())
+        {
+            m_fields.resize(id + 1);
+            m_declaredIn.resize(id + 1, size_t(NONE));
+            m_lastUsed.resize(id + 1, 0);
+            m_referencedIn.resize(id + 1, size_t(NONE));
+            m_referenceAt.resize(id + 1, 0);
+            m_captured.resize(id + 1, false);
+            m_countedBy.resize(id + 1, 0);
+            m_setInSection.resize(id + 1, false);
+        }
+        m_fields[id] = field;
+        m_nextID = std::max(m_nextID, id + 1);
+    }
+
+    void note(const AstNode & node, size_t statement, bool inLambda)
+    {
+        track(node.fieldDescription);
+        const unsigned int id = node.fieldDescription->id;
+        m_lastUsed[id] = statement;
+        if (inLambda)
+        {
+            m_captured[id] = true;
+        }
+        if (node.function().functionType == Function::DECLARATION)
+        {
+            m_declaredIn[id] = statement;
+            m_declared.push_back(id);
+            return;
+        }
+        // Changing what is in a table, or calling a function, can be done as well through a copy passed in. Only a new value
+        // has to be returned.
+        const bool sets = node.function().functionType == Function::ASSIGNMENT && node.children.size() == 1;
+        if (m_referencedIn[id] != statement)
+        {
+            m_referencedIn[id] = statement;
+            m_referenceAt[id] = m_references.size();
+            m_references.push_back(Reference{id, NONE, sets});
+        }
+        else if (sets)
+        {
+            m_references[m_referenceAt[id]].sets = true;
+        }
+    }
+
+    void analyse(const AstNode & block)
+    {
+        m_statements.resize(block.children.size());
+        // Each node is kept with whether it is in a lambda.
+        std::vector<std::pair<const AstNode *, bool>> pending;
+        for (size_t i = 0; i < block.children.size(); ++i)
+        {
+            Statement & statement = m_statements[i];
+            const AstNode & child = block.children[i];
+            if (child.function().functionType == Function::DECLARATION)
+            {
+                statement.declares = child.fieldDescription.get();
+            }
+            statement.firstReference = m_references.size();
+            statement.firstDeclared = m_declared.size();
+            pending.emplace_back(&child, false);
+            while (!pending.empty())
+            {
+                const AstNode & node = *pending.back().first;
+                const bool inLambda = pending.back().second || node.function().functionType == Function::LAMBDA;
+                pending.pop_back();
+                statement.nodes++;
+                m_nextNodeID = std::max(m_nextNodeID, node.id + 1);
+                size_t body = 0;
+                if (node.function().functionType == Function::LAMBDA)
+                {
+                    // The parameters of a lambda are its own, so they are declared by the statement it is in.
+                    for (; body + 1 < node.children.size(); ++body)
+                    {
+                        track(node.children[body].fieldDescription);
+                        m_declaredIn[node.children[body].fieldDescription->id] = i;
+                    }
+                }
+                else if (node.fieldDescription != nullptr)
+                {
+                    note(node, i, inLambda);
+                }
+                for (size_t j = node.children.size(); j > body; --j)
+                {
+                    pending.emplace_back(&node.children[j - 1], inLambda);
+                }
+            }
+            // What a statement does with its own variables is nothing to do with any other statement.
+            size_t kept = statement.firstReference;
+            for (size_t j = statement.firstReference; j < m_references.size(); ++j)
+            {
+                Reference reference = m_references[j];
+                if (m_declaredIn[reference.id] != i)
+                {
+                    reference.declaredIn = m_declaredIn[reference.id];
+                    m_references[kept++] = reference;
+                }
+            }
+            m_references.resize(kept);
+            statement.endReference = kept;
+            statement.endDeclared = m_declared.size();
+            m_nodes += statement.nodes;
+        }
+    }
+
+    bool escapes(size_t statement, size_t end) const
+    {
+        const PMMLDocument::FieldDescription * declares = m_statements[statement].declares;
+        return declares != nullptr && m_lastUsed[declares->id] >= end;
+    }
+
+    void startBudget()
+    {
+        m_stamp++;
+        for (size_t statement : m_touched)
+        {
+            m_escapesUntil[statement] = 0;
+        }
+        m_touched.clear();
+    }
+
+    // This adds statement i to the section that budget is for, unless it would take the section over the limits of a function.
+    bool add(Budget & budget, size_t i, size_t maxLocals, size_t maxParameters)
+    {
+        const Statement & statement = m_statements[i];
+        size_t parameters = budget.parameters;
+        size_t results = budget.results;
+        for (size_t j = statement.firstReference; j < statement.endReference; ++j)
+        {
+            const Reference & reference = m_references[j];
+            if (reference.declaredIn != NONE && reference.declaredIn >= budget.begin)
+            {
+                continue;
+            }
+            // A lambda would go on seeing the old value of a variable that a section set.
+            if (reference.sets && m_captured[reference.id])
+            {
+                return false;
+            }
+            if (m_countedBy[reference.id] != m_stamp)
+            {
+                parameters++;
+                if (reference.sets)
+                {
+                    results++;
+                }
+            }
+            else if (reference.sets && !m_setInSection[reference.id])
+            {
+                results++;
+            }
+        }
+        // Declarations of the section that are last used by this statement no longer escape it.
+        size_t escaping = budget.escaping - m_escapesUntil[i];
+        const bool escaped = escapes(i, i + 1);
+        if (escaped)
+        {
+            escaping++;
+        }
+        // Escaping declarations are passed in rather than declared, so the locals are the same either way.
+        const size_t declarations = budget.declarations + statement.endDeclared - statement.firstDeclared;
+        const size_t locals = parameters + declarations;
+        if (parameters + escaping > maxParameters || locals + results + escaping > maxLocals ||
+            budget.nodes + statement.nodes > MAX_SECTION_NODES)
+        {
+            return false;
+        }
+
+        for (size_t j = statement.firstReference; j < statement.endReference; ++j)
+        {
+            const Reference & reference = m_references[j];
+            if (reference.declaredIn == NONE || reference.declaredIn < budget.begin)
+            {
+                if (m_countedBy[reference.id] != m_stamp)
+                {
+                    m_countedBy[reference.id] = m_stamp;
+                    m_setInSection[reference.id] = false;
+                }
+                m_setInSection[reference.id] = m_setInSection[reference.id] || reference.sets;
+            }
+        }
+        if (escaped)
+        {
+            const size_t lastUsed = m_lastUsed[statement.declares->id];
+            m_escapesUntil[lastUsed]++;
+            m_touched.push_back(lastUsed);
+        }
+        budget.declarations = declarations;
+        budget.escaping = escaping;
+        budget.parameters = parameters;
+        budget.results = results;
+        budget.nodes += statement.nodes;
+        return true;
+    }
+
+    // This finishes the section of statements begin to end, if it is worth having.
+    void finish(std::vector<Section> & sections, size_t begin, size_t end, bool forSize) const
+    {
+        // Declarations at the start of it that are used after it may as well stay in the main function as they are.
+        Section section = {begin, end};
+        while (section.begin < end && escapes(section.begin, end))
+        {
+            section.begin++;
+        }
+        size_t locals = 0;
+        for (size_t i = section.begin; i < end; ++i)
+        {
+            locals += m_statements[i].endDeclared - m_statements[i].firstDeclared - (escapes(i, end) ? 1 : 0);
+        }
+        if (section.begin < end && (locals > 0 || forSize))
+        {
+            sections.push_back(section);
+        }
+    }
+
+    std::vector<Section> partition(const AstNode & block, size_t maxLocals, size_t maxParameters, bool forSize)
+    {
+        std::vector<Section> sections;
+        m_escapesUntil.assign(block.children.size(), 0);
+        size_t begin = 0;
+        while (begin < block.children.size())
+        {
+            startBudget();
+            Budget budget(begin);
+            size_t end = begin;
+            while (end < block.children.size() && block.children[end].function().functionType != Function::RETURN_STATEMENT &&
+                   add(budget, end, maxLocals, maxParameters))
+            {
+                end++;
+            }
+            // Anything that doesn't fit in a section on its own stays in the main function.
+            if (end == begin)
+            {
+                begin++;
+                continue;
+            }
+            // Declarations at the end of it that are used after it would have to be passed back to the main function, so they
+            // start the next section instead, where they may be used up.
+            size_t kept = end;
+            while (kept > begin && escapes(kept - 1, kept))
+            {
+                kept--;
+            }
+            if (kept > begin)
+            {
+                end = kept;
+            }
+            finish(sections, begin, end, forSize);
+            begin = end;
+        }
+        return sections;
     }
-    bool hasKilledAnything() const { return m_killedAnything; }
-    
-    VisitorResponse process(Function::IfChain, Analyser::AnalyserContext & ctx, AstNode & node, size_t)
+
+    // This turns the statements of section into one statement calling it, which goes on the end of statements, after
+    // declarations of whatever it must leave in the main function. It is the index-th section of the table.
+    void makeSection(AstNode & block, const Section & section, size_t index, AstNode::Children & statements)
     {
-        // Look through the procedural bits to see if the last final clauses are empty (even nubered children are blocks)
-        // Useless crap can be removed from the end, but not the beginning
-        size_t lastUsefulProceduralBit = 0;
-        for (size_t i = 0; i < node.children.size(); i += 2)
+        // What the section uses from before it is passed to it, in the order it is first used, followed by what it declares
+        // that is used after it.
+        m_stamp++;
+        std::vector<unsigned int> passed;
+        for (size_t i = section.begin; i < section.end; ++i)
         {
-            AstNode & child = node.children[i];
-            if (child.function().functionType != Function::BLOCK ||
-                !child.children.empty())
+            const Statement & statement = m_statements[i];
+            for (size_t j = statement.firstReference; j < statement.endReference; ++j)
             {
-                lastUsefulProceduralBit = i + 2;
+                const Reference & reference = m_references[j];
+                if (reference.declaredIn != NONE && reference.declaredIn >= section.begin)
+                {
+                    continue;
+                }
+                if (m_countedBy[reference.id] != m_stamp)
+                {
+                    m_countedBy[reference.id] = m_stamp;
+                    m_setInSection[reference.id] = false;
+                    passed.push_back(reference.id);
+                }
+                m_setInSection[reference.id] = m_setInSection[reference.id] || reference.sets;
             }
         }
-        
-        // If nothing is useful, kill the whole stupid node.
-        if (lastUsefulProceduralBit == 0)
-        {
-            m_killedAnything = true;
-            return RESPONSE_KILL_NODE_AND_CONTINUE;
-        }
-        
-        // Otherwise, cull to the last non-empty block
-        if (lastUsefulProceduralBit < node.children.size())
+        for (size_t i = section.begin; i < section.end; ++i)
         {
-            m_killedAnything = true;
-            node.children.erase(node.children.begin() + lastUsefulProceduralBit, node.children.end());
+            if (escapes(i, section.end))
+            {
+                const unsigned int id = m_statements[i].declares->id;
+                m_countedBy[id] = m_stamp;
+                m_setInSection[id] = true;
+                passed.push_back(id);
+            }
         }
-        
-        // This second pass will find trivial predicates in the ifChain (odd numbered children are predicates)
-        Analyser::NonNoneAssertionStackGuard ifChainAssertions(ctx);
-        for (size_t i = 1; i < node.children.size(); )
+
+        AstNode::Children arguments;
+        AstNode::Children parameters;
+        AstNode::Children results;
+        std::vector<PMMLDocument::ConstFieldDescriptionPtr> renamed(m_fields.size());
+        for (unsigned int id : passed)
         {
-            AstNode & child = node.children[i];
-            Analyser::TrivialValue triv = ctx.checkIfTrivial(child);
-            if (triv == Analyser::ALWAYS_TRUE)
+            const PMMLDocument::ConstFieldDescriptionPtr & original = m_fields[id];
+            renamed[id] = std::make_shared<PMMLDocument::FieldDescription>(original->field, PMMLDocument::ORIGIN_PARAMETER, original->luaName, m_nextID++);
+            arguments.emplace_back(m_nextNodeID++, AstBuilder::FIELD_DEF, original, AstNode::Children());
+            parameters.emplace_back(m_nextNodeID++, AstBuilder::FIELD_DEF, renamed[id], AstNode::Children());
+            if (m_setInSection[id] && m_lastUsed[id] >= section.end)
             {
-                // If a predicate is always true, remove it and and all following content. Its content becomes the else clause.
-                node.children.erase(node.children.begin() + i, node.children.end());
-                m_killedAnything = true;
+                results.emplace_back(m_nextNodeID++, AstBuilder::FIELD_DEF, renamed[id], AstNode::Children());
             }
-            else if (triv == Analyser::ALWAYS_FALSE)
+        }
+
+        AstNode::Children body;
+        std::vector<AstNode *> pending;
+        for (size_t i = section.begin; i < section.end; ++i)
+        {
+            AstNode & statement = block.children[i];
+            if (escapes(i, section.end))
             {
-                // If a predicate is always false, remove it and it's corresponding block
-                node.children.erase(node.children.begin() + i - 1, node.children.begin() + i + 1);
-                m_killedAnything = true;
+                statements.emplace_back(m_nextNodeID++, AstBuilder::DECLARATION_DEF, statement.fieldDescription, AstNode::Children());
+                if (statement.children.empty())
+                {
+                    continue;
+                }
+                AstNode assignment(statement.id, AstBuilder::ASSIGNMENT_DEF, statement.fieldDescription, std::move(statement.children));
+                statement = std::move(assignment);
             }
-            else
+            pending.push_back(&statement);
+            while (!pending.empty())
             {
-                ifChainAssertions.addAssertionsForCheck(child, Analyser::ASSUME_FALSE);
-                i += 2;
+                AstNode & node = *pending.back();
+                pending.pop_back();
+                if (node.fieldDescription != nullptr && node.fieldDescription->id < renamed.size() && renamed[node.fieldDescription->id])
+                {
+                    node.fieldDescription = renamed[node.fieldDescription->id];
+                }
+                for (AstNode & child : node.children)
+                {
+                    pending.push_back(&child);
+                }
             }
+            body.push_back(std::move(statement));
         }
-        
-        // If an if chain now only has an else clause (because everything else had been culled, or it had nothing else to begin with)
-        // just remove it and pop everything up. This helps for later optimisation passes.
-        if (node.children.size() == 1)
+        if (!results.empty())
         {
-            AstNode child = std::move(node.children[0]);
-            node = std::move(child);
-            m_killedAnything = true;
+            body.emplace_back(m_nextNodeID++, ReturnFromSection, PMMLDocument::TYPE_VOID, std::string(), std::move(results));
         }
-        return RESPONSE_CONTINUE;
+
+        parameters.emplace_back(m_nextNodeID++, AstBuilder::BLOCK_DEF, PMMLDocument::TYPE_VOID, std::string(), std::move(body));
+        arguments.emplace_back(m_nextNodeID++, AstBuilder::LAMBDA_DEF, PMMLDocument::TYPE_VOID, std::string(), std::move(parameters));
+        statements.emplace_back(m_nextNodeID++, RunSection, PMMLDocument::TYPE_VOID, std::to_string(index), std::move(arguments));
+        statements.back().fieldDescription = m_sections;
     }
-    
-    // This checks if a value is used after where it was last set, if not, it can be culled
-    VisitorResponse process(Function::DeclartionOrAssignment, Analyser::AnalyserContext &, AstNode & node, size_t counter)
+
+    // The table of sections is named so as not to hide any variable of the script.
+    void nameSections()
     {
-        auto variable = m_map.find(node.fieldDescription);
-        if (variable != m_map.end())
+        std::unordered_set<std::string> names;
+        for (const PMMLDocument::ConstFieldDescriptionPtr & field : m_fields)
         {
-            if (counter >= variable->second.lastUsed && !isSpecialVar(node.fieldDescription.get()))
+            if (field)
             {
-                m_killedAnything = true;
-                return RESPONSE_KILL_NODE_AND_CONTINUE;
+                names.insert(field->luaName);
             }
         }
-        return RESPONSE_CONTINUE;
+        std::string name = "sections";
+        for (size_t suffix = 1; names.count(name); ++suffix)
+        {
+            name = "sections_" + std::to_string(suffix);
+        }
+        m_sections = std::make_shared<PMMLDocument::FieldDescription>(PMMLDocument::TYPE_TABLE, PMMLDocument::ORIGIN_SPECIAL, PMMLDocument::OPTYPE_INVALID,
+                                                                       name, m_nextID++);
     }
-    
-    // This checks to see if a ternary's predicate can be known in advance
-    VisitorResponse process(Function::TernaryMacro, Analyser::AnalyserContext & ctx, AstNode & node, size_t)
+public:
+    // This splits up block if it needs to be, given that a function can have maxVariables locals, and that it would
+    // otherwise overflow if overflowing is true. Returns whether it did.
+    bool split(AstNode & block, size_t maxVariables, bool overflowing)
     {
-        Analyser::TrivialValue triv = ctx.checkIfTrivial(node.children[0]);
-        if (triv == Analyser::ALWAYS_TRUE)
+        if (block.function().functionType != Function::BLOCK || maxVariables + 1 >= MAX_REGISTERS)
         {
-            AstNode child = std::move(node.children[1]);
-            node = child;
-            m_killedAnything = true;
+            return false;
         }
-        else if (triv == Analyser::ALWAYS_FALSE && node.function().functionType == Function::TERNARY_MACRO)
+        analyse(block);
+        const bool forSize = m_nodes > MAX_FUNCTION_NODES;
+        if (!overflowing && !forSize)
         {
-            AstNode child = std::move(node.children[2]);
-            node = child;
-            m_killedAnything = true;
+            return false;
         }
-        return RESPONSE_CONTINUE;
-    }
-    
-    VisitorResponse process(Function::BoundMacro, Analyser::AnalyserContext & ctx, AstNode & node, size_t counter)
-    {
-        return process(Function::TernaryMacro(), ctx, node, counter);
-    }
-    
-    // This tells if a default statement's alternative value can ever be used.
-    VisitorResponse process(Function::DefaultMacro, Analyser::AnalyserContext & ctx, AstNode & node, size_t)
-    {
-        if (!ctx.mightBeMissing(node.children[0]))
+        // As in the main function, the overflow table and one more are left spare.
+        const size_t maxLocals = maxVariables - 2;
+        const size_t maxParameters = std::min(maxLocals, MAX_REGISTERS - maxVariables - 1);
+        const std::vector<Section> sections = partition(block, maxLocals, maxParameters, forSize);
+        if (sections.empty())
         {
-            AstNode child = std::move(node.children[0]);
-            node = std::move(child);
-            m_killedAnything = true;
+            return false;
         }
-        return RESPONSE_CONTINUE;
-    }
-    
-    // Catch all default
-    VisitorResponse process(Function::FunctionTypeBase, Analyser::AnalyserContext &, AstNode &, size_t)
-    {
-        return RESPONSE_CONTINUE;
+
+        nameSections();
+        AstNode::Children statements;
+        size_t next = 0;
+        for (const Section & section : sections)
+        {
+            std::move(block.children.begin() + next, block.children.begin() + section.begin, std::back_inserter(statements));
+            makeSection(block, section, &section - sections.data() + 1, statements);
+            next = section.end;
+        }
+        std::move(block.children.begin() + next, block.children.end(), std::back_inserter(statements));
+        block.children = std::move(statements);
+        return true;
     }
 };
 
-// This step is between the dead-code removal step and the variable aliasing step.
-// Since variable aliasing only works within a block, it is advantagious to make the blocks as large as possible.
-// This visitor rolls blocks into super-blocks so that variables can be re-used more efficiently.
-class FlatternNodesVisitor
+// After flattening, most of a big model is one long block of statements, and most variables are only used in a short stretch
+// of it, such as one segment of a MiningModel. So the block is split into regions which are cleaned up on their own, at the
+// same time as each other, leaving less for the passes over the whole tree to do.
+struct Region
 {
-public:
-    void enterNode(Analyser::AnalyserContext &, AstNode &, size_t)
-    {
-    }
-    VisitorResponse exitNode(Analyser::AnalyserContext &, AstNode & node, size_t)
+    size_t begin;
+    size_t end;
+    size_t nodes;
+    // Variables declared in the region that are still used after it.
+    std::vector<unsigned int> escaping;
+};
+
+// Each region has its own overheads, so regions are at least this many nodes, and there are at most this many.
+static const size_t MIN_REGION_NODES = 1 << 14;
+static const size_t MAX_REGIONS = 256;
+
+// This finds, for each statement of a block, how many nodes it has and the last statement each variable is used in.
+static void noteUses(const AstNode & node, size_t statement, std::vector<size_t> & lastUsed, size_t & nodes)
+{
+    std::vector<const AstNode *> pending(1, &node);
+    while (!pending.empty())
     {
-        if (node.function().functionType != Function::BLOCK)
-        {
-            return RESPONSE_CONTINUE;
-        }
-        
-        bool foundBlock = false;
-        for (const AstNode & child : node.children)
+        const AstNode & next = *pending.back();
+        pending.pop_back();
+        nodes++;
+        if (next.fieldDescription != nullptr)
         {
-            if (child.function().functionType == Function::BLOCK)
+            if (next.fieldDescription->id >= lastUsed.size())
             {
-                foundBlock = true;
+                lastUsed.resize(next.fieldDescription->id + 1, 0);
             }
+            lastUsed[next.fieldDescription->id] = statement;
         }
-        
-        if (!foundBlock)
+        for (const AstNode & child : next.children)
         {
-            return RESPONSE_CONTINUE;
+            pending.push_back(&child);
         }
-        
-        // Flattern any blocks included into a single block. This will help the optimiser.
-        std::vector<AstNode> flattenedChildren;
-        flattenedChildren.reserve(node.children.size() + 1);
-        for (AstNode & child : node.children)
+    }
+}
+
+// The regions are split where no variable is used on both sides, except for ones used so widely that they would hold regions
+// together, such as what a MiningModel adds each segment's result to. Those are left alone within each region.
+static std::vector<Region> findRegions(const AstNode & block)
+{
+    const size_t count = block.children.size();
+    std::vector<size_t> lastUsed;
+    // The number of nodes before each statement.
+    std::vector<size_t> nodesBefore(count + 1, 0);
+    for (size_t i = 0; i < count; ++i)
+    {
+        nodesBefore[i + 1] = nodesBefore[i];
+        noteUses(block.children[i], i, lastUsed, nodesBefore[i + 1]);
+    }
+    const size_t regionNodes = std::max(MIN_REGION_NODES, nodesBefore[count] / MAX_REGIONS);
+
+    // How many variables are used both before and after each statement starts.
+    std::vector<int> crossing(count + 1, 0);
+    for (size_t i = 0; i < count; ++i)
+    {
+        const AstNode & child = block.children[i];
+        if (child.function().functionType == Function::DECLARATION)
         {
-            if (child.function().functionType == Function::BLOCK)
+            const size_t last = lastUsed[child.fieldDescription->id];
+            if (nodesBefore[last + 1] - nodesBefore[i] <= regionNodes)
             {
-                std::move(child.children.begin(), child.children.end(), std::back_inserter(flattenedChildren));
+                crossing[i + 1]++;
+                crossing[last + 1]--;
             }
-            else
+        }
+    }
+
+    std::vector<Region> regions;
+    size_t begin = 0;
+    int crossingHere = 0;
+    for (size_t i = 1; i <= count; ++i)
+    {
+        crossingHere += crossing[i];
+        if (i == count || (nodesBefore[i] - nodesBefore[begin] >= regionNodes && crossingHere == 0))
+        {
+            Region region = {begin, i, nodesBefore[i] - nodesBefore[begin], {}};
+            for (size_t j = begin; j < i; ++j)
             {
-                flattenedChildren.push_back(std::move(child));
+                const AstNode & child = block.children[j];
+                if (child.function().functionType == Function::DECLARATION && lastUsed[child.fieldDescription->id] >= i)
+                {
+                    region.escaping.push_back(child.fieldDescription->id);
+                }
             }
+            regions.push_back(std::move(region));
+            begin = i;
         }
-        
-        node.children.swap(flattenedChildren);
-        return RESPONSE_CONTINUE;
     }
-};
+    return regions;
+}
 
+// This removes anything not a temp from map, before it is given to VariableAllocator. Unmovable variables are left in, as
+// they still take up locals, even though they can't be reused.
+static void keepAllocatable(VariableInfoMap & map)
+{
+    map.eraseIf([](const VariableInfoMap::value_type & entry)
+    {
+        return entry.first->origin == PMMLDocument::ORIGIN_PARAMETER ||
+            entry.first->origin == PMMLDocument::ORIGIN_SPECIAL;
+    });
+}
 
-// Aliasing allows LuaOutputter to choose an existing variable that isn't being used to store another variable
-// It means less variables need to be overflowed.
-// It is not done by modifying to keep it in relaxed Single Static Assignment form and to allow null assertions to work properly.
-class SetupAliasVisitor
+// Variables that are never needed at the same time share a local, so this is how many variables the script is really
+// short of room for, rather than how many there are altogether. It is only worth going through the tree to find out when
+// there are more variables than there is room for.
+static size_t countLiveVariables(Analyser::AnalyserContext & context, AstNode & node, const VariableInfoMap & map, size_t maxVariables)
 {
-    VariableInfoMap & m_map;
-public:
-    LuaOutputter::AliasedVariables m_aliasMap;
-    SetupAliasVisitor(VariableInfoMap & map) :
-        m_map(map)
-    {}
-    void enterNode(Analyser::AnalyserContext &, AstNode & node, size_t)
+    if (map.size() <= maxVariables)
     {
-        if (node.function().functionType != Function::BLOCK)
+        return map.size();
+    }
+    VariableInfoMap allocatable(map);
+    keepAllocatable(allocatable);
+    VariableAllocator allocator(allocatable, maxVariables);
+    traverseTree<false>(context, node, allocator);
+    return allocator.peakLocals();
+}
+
+// This removes dead code and inlines variables until there's nothing left to do. If region is given, node is a block made
+// of the statements of that region, which could be used anywhere else in the tree, so nothing is assumed about what else
+// is going on around it.
+static void removeDeadCodeAndInline(Analyser::AnalyserContext & context, AstNode & node, VariableInfoMap & map, size_t maxVariables, const Region * region)
+{
+    // Blocks only need flattening when removing dead code has replaced something with a block.
+    bool needsFlattening = false;
+    // Constants are worked out before anything is inlined, and again after, as inlining brings more of them together.
+    bool needsFolding = true;
+    bool mightSink = region == nullptr;
+    bool sharedExpressions = false;
+    for (;;)
+    {
+        if (needsFlattening)
         {
-            return;
+            FlatternNodesVisitor flattenNode;
+            traverseTree<false>(context, node, flattenNode);
+            needsFlattening = false;
         }
-        std::vector<SortedVariableInfoReference> usageStart;
-        std::vector<SortedVariableInfoReference> usageEnd;
-        
-        for (const AstNode & child : node.children)
+        if (needsFolding)
         {
-            if (child.function().functionType == Function::DECLARATION)
+            ConstantFolder folder;
+            folder.run(node);
+            needsFolding = false;
+        }
+
+        BuildVariableInfoMapVisitor seeker(map, context, region != nullptr);
+        traverseTree<false>(context, node, seeker);
+        if (region != nullptr)
+        {
+            // Anything from outside the region may be used after it, and anything escaping it is as good as being set again.
+            const size_t endOfRegion = std::numeric_limits<size_t>::max();
+            for (auto & variable : map)
             {
-                auto iter = m_map.find(child.fieldDescription);
-                if (iter != m_map.end())
+                if (variable.second.firstDeclared == COUNT_UNINITIALIZED)
+                {
+                    variable.second.used(endOfRegion, false);
+                }
+                else if (std::find(region->escaping.begin(), region->escaping.end(), variable.first->id) != region->escaping.end())
                 {
-                    usageStart.emplace_back(iter->second.firstDeclared, iter);
-                    usageEnd.emplace_back(iter->second.lastUsed, iter);
+                    variable.second.used(endOfRegion, false);
+                    variable.second.assign(endOfRegion);
                 }
             }
         }
-        std::sort(usageStart.begin(), usageStart.end());
-        std::sort(usageEnd.begin(), usageEnd.end());
-        
-        std::vector<SortedVariableInfoReference>::iterator usageStartIter = usageStart.begin();
-        std::vector<SortedVariableInfoReference>::iterator usageEndIter = usageEnd.begin();
-        
-        // Re-use variable in a LIFO way, this leads to more readable code.
-        std::vector<VariableInfoMap::iterator> spaceVarStack;
-        while (usageStartIter != usageStart.end() && usageEndIter != usageEnd.end())
+
+        // Cut out code that is not needed.
+        UseTracker uses(map);
+        RemoveDeadCodeVisitor reaper(map, uses);
+        traverseTree<true>(context, node, reaper);
+        if (reaper.hasKilledAnything())
         {
-            // End variable usage in preference to start the next. An instruction may re-assign a variable at the same time as it uses it.
-            if (usageEndIter->sortKey <= usageStartIter->sortKey)
+            // Variables left unused by that can go straight away.
+            RemoveUnusedVariables sweeper(uses);
+            sweeper.run(node);
+            // Removing dead code leads to other opportunities to remove dead code, however, counters will
+            // have changed, so we need to rescan
+            needsFlattening = reaper.hasMadeBlock();
+            continue;
+        }
+
+        // Take variables and replace them opportunistically with their constituant expressions.
+        // Inline much more aggressively if we're running short of variables. Regions can't tell, so they never do.
+        const size_t liveVariables = region == nullptr ? countLiveVariables(context, node, map, maxVariables) : 0;
+        InlineVariableVisitor gatherer(map, liveVariables > maxVariables ? 5 : 1);
+        traverseTree<false>(context, node, gatherer);
+        // Regions leave checking whether that led to anything else to the passes over the whole tree, which have to look anyway.
+        if (!gatherer.hasKilledAnything() || region != nullptr)
+        {
+            // Once that is done, declarations are moved into the branches that use them, which goes round again, as a copy
+            // in a branch may be used few enough times there to inline. Then expressions that are worked out more than once
+            // are shared, which goes round again to inline any variables that were only copies of others. Regions can't make
+            // variables, as they don't know what is taken.
+            const size_t spareVariables = liveVariables + 2 < maxVariables ? maxVariables - 2 - liveVariables : 0;
+            if (mightSink)
             {
-                spaceVarStack.push_back(usageEndIter->infoMapReference);
-                ++usageEndIter;
+                DeclarationSinker sinker;
+                mightSink = sinker.run(node, spareVariables);
+                if (mightSink)
+                {
+                    continue;
+                }
             }
-            else
+            if (region == nullptr && !sharedExpressions)
             {
-                if (!spaceVarStack.empty())
-                {
-                    VariableInfoMap::iterator aliasedFrom = usageStartIter->infoMapReference;
-                    VariableInfoMap::iterator aliasedTo = spaceVarStack.back();
-                    VariableInfo & myInfo = aliasedFrom->second;
-                    VariableInfo & aliasedToInfo = aliasedTo->second;
-                    spaceVarStack.pop_back();
-                    
-                    // Correct the map, now that we're using this variable to store two.
-                    // Variables may be still overflowed after they are aliased.
-                    aliasedToInfo.usedNTimes += myInfo.usedNTimes;
-                    aliasedToInfo.lastUsed = myInfo.lastUsed;
-                    
-                    m_aliasMap.emplace(aliasedFrom->first, aliasedTo->first);
-                    
-                    // Change the end of usage for this variable to the one that it is now aliasing.
-                    auto range = std::equal_range(usageEnd.begin(), usageEnd.end(), SortedVariableInfoReference(myInfo.lastUsed, aliasedFrom));
-                    for (auto rangeIter = range.first; rangeIter != range.second; ++rangeIter)
-                    {
-                        if (rangeIter->infoMapReference == aliasedFrom)
-                        {
-                            rangeIter->infoMapReference = aliasedTo;
-                        }
-                    }
+                sharedExpressions = true;
+                ExpressionSharer sharer;
+                if (sharer.run(node, spareVariables))
+                {
+                    continue;
                 }
-                ++usageStartIter;
             }
+            break;
         }
+        // Inlining nodes may also give an opportunity to perform further optimisation
+        needsFolding = true;
     }
-    VisitorResponse exitNode(Analyser::AnalyserContext &, AstNode &, size_t)
-    {
-        return RESPONSE_CONTINUE;
-    }
-};
+}
 
-// This traverses the tree giving places in the overflow array to variables who have been booted out of the global space.
-// It allocates them start to finish for readability (of output) and performance reasons
-class OverflowAssignmentVisitor
+static void removeDeadCodeInRegions(AstNode & node)
 {
-    const std::unordered_set<std::shared_ptr<const PMMLDocument::FieldDescription>> & m_overflowVariables;
-    int m_counter;
-public:
-    OverflowAssignmentVisitor(Analyser::AnalyserContext &, const std::unordered_set<std::shared_ptr<const PMMLDocument::FieldDescription>> & overflowVariables, int counter) :
-        m_overflowVariables(overflowVariables),
-        m_counter(counter)
+    if (node.function().functionType != Function::BLOCK)
     {
+        return;
     }
-    void enterNode(Analyser::AnalyserContext &, AstNode & node, size_t)
+    const std::vector<Region> regions = findRegions(node);
+    // This is no help if most of the work would be in one region, as is the case for a single big tree, as everything still
+    // has to be gone over again afterwards.
+    size_t nodes = 0;
+    size_t largest = 0;
+    for (const Region & region : regions)
     {
-        if (node.function().functionType == Function::DECLARATION)
-        {
-            if (m_overflowVariables.count(node.fieldDescription) > 0)
-            {
-                node.fieldDescription->overflowAssignment = m_counter++;
-            }
-        }
+        nodes += region.nodes;
+        largest = std::max(largest, region.nodes);
     }
-    VisitorResponse exitNode(Analyser::AnalyserContext &, AstNode &, size_t)
+    if (largest > nodes / 2)
     {
-        return RESPONSE_CONTINUE;
+        return;
     }
-    size_t counter() const { return m_counter; }
-};
 
-// This is a last ditch effort to make sure that we can fit in the space.
-// It creates an array as a local variable and stores all the locals that won't fit into the frame in there.
-size_t setupOverflow(Analyser::AnalyserContext & ctx, AstNode & node, VariableInfoMap & map, const size_t maxTempVars)
-{
-    std::vector<SortedVariableInfoReference> referencesToNames;
-    referencesToNames.reserve(map.size());
-    for (auto iter = map.begin(); iter != map.end(); ++iter)
+    std::vector<AstNode> blocks;
+    blocks.reserve(regions.size());
+    for (const Region & region : regions)
     {
-        referencesToNames.emplace_back(iter->second.usedNTimes, iter);
+        AstNode::Children statements;
+        std::move(node.children.begin() + region.begin, node.children.begin() + region.end, std::back_inserter(statements));
+        // Blocks are never removed from the top, so the block can have the same ID as what it came from.
+        blocks.emplace_back(node.id, AstBuilder::BLOCK_DEF, node.type, std::string(), std::move(statements));
     }
-    
-    std::sort(referencesToNames.begin(), referencesToNames.end());
-    
-    std::unordered_set<std::shared_ptr<const PMMLDocument::FieldDescription>> overflowVariables;
-    size_t currentTempVars = map.size();
-    // Add a temp var for the overflow array to live
-    currentTempVars++;
-    // Iterate from least-used to most-used
-    for (auto iter = referencesToNames.cbegin(); iter != referencesToNames.cend() && currentTempVars > maxTempVars; ++iter)
+    Parallel::forEachInOrder(regions.size(), [&](size_t i)
     {
-        overflowVariables.insert(iter->infoMapReference->first);
-        currentTempVars--;
-    }
-    
-    int counter = 1;
-    // Inputs are effectively at counter=0, at the very beginning of the document
-    for (auto iter = map.begin(); iter != map.end(); ++iter)
+        Analyser::AnalyserContext context;
+        VariableInfoMap map;
+        removeDeadCodeAndInline(context, blocks[i], map, 0, &regions[i]);
+    },
+    [](size_t)
     {
-        if (iter->second.firstDeclared == 0 && overflowVariables.count(iter->first) > 0)
-        {
-            iter->first->overflowAssignment = counter++;
-        }
+        return true;
+    });
+
+    node.children.clear();
+    for (AstNode & block : blocks)
+    {
+        std::move(block.children.begin(), block.children.end(), std::back_inserter(node.children));
     }
-    
-    OverflowAssignmentVisitor assigner(ctx, overflowVariables, counter);
-    traverseTree<false>(ctx, node, assigner);
-    return assigner.counter();
+}
+
+// This sets up aliases for the variables in map, and works out which need to be overflowed, returning them indexed by field ID.
+static std::vector<bool> allocateVariables(Analyser::AnalyserContext & context, AstNode & node, VariableInfoMap & map, size_t maxVariables,
+                                           LuaOutputter::AliasedVariables & aliases)
+{
+    keepAllocatable(map);
+
+    // 1 special variable, output must be left in place, as well as the overflow array, so they are deducted from the max allowed.
+    VariableAllocator allocator(map, maxVariables - 2);
+    traverseTree<false>(context, node, allocator);
+    aliases = std::move(allocator.aliases);
+    return allocator.overflow();
 }
 
 void PMMLDocument::optimiseAST(AstNode & node, LuaOutputter & outputter)
 {
     Analyser::AnalyserContext context;
-top:
+    VariableInfoMap map;
     // This is an important step before aliasing. Flatten nested blocks into single blocks. This means block structure will better reflect the structure
     // of the outputted code, as the aliaser will not work between blocks for fear of messing up scope.
     FlatternNodesVisitor flattenNode;
     traverseTree<false>(context, node, flattenNode);
-    
-    VariableInfoMap map;
-    BuildVariableInfoMapVisitor seeker(map, context);
-    traverseTree<false>(context, node, seeker);
 
-    // Cut out code that is not needed.
-    RemoveDeadCodeVisitor reaper(map);
-    traverseTree<true>(context, node, reaper);
-    if (reaper.hasKilledAnything())
-    {
-        // Removing dead code leads to other opportunities to remove dead code, however, counters will
-        // have changed, so we need to rescan
-        goto top;
-    }
-
-    // Take variables and replace them opportunistically with their constituant expressions.
-    // Inline much more aggressively if we're running short of variables.
-    InlineVariableVisitor gatherer(map, map.size() > outputter.getMaxVariables() ? 5 : 1);
-    traverseTree<false>(context, node, gatherer);
-    if (gatherer.hasKilledAnything())
-    {
-        // Inlining nodes may also give an opportunity to perform further optimisation
-        goto top;
-    }
+    removeDeadCodeInRegions(node);
+    removeDeadCodeAndInline(context, node, map, outputter.getMaxVariables(), nullptr);
 
     // This next phase, instead of semantically altering the AST, configures the LuaOutputter
-    // Remove anything unmovable or not a temp.
-    size_t unmovableVars = 0;
-    for (auto iter = map.begin(); iter != map.end();)
+    const size_t maxVariables = outputter.getMaxVariables();
+    LuaOutputter::AliasedVariables aliases;
+    std::vector<bool> overflowVariables = allocateVariables(context, node, map, maxVariables, aliases);
+    // Without a limit, as for C, there is no need to split anything up.
+    if (maxVariables != std::numeric_limits<size_t>::max())
     {
-        if (iter->first->origin == PMMLDocument::ORIGIN_PARAMETER ||
-            iter->first->origin == PMMLDocument::ORIGIN_SPECIAL)
-        {
-            map.erase(iter++);
-        }
-        else if (iter->second.unmovable)
+        FunctionSplitter splitter;
+        if (splitter.split(node, maxVariables, !overflowVariables.empty()))
         {
-            unmovableVars++;
-            map.erase(iter++);
+            BuildVariableInfoMapVisitor buildMap(map, context);
+            traverseTree<false>(context, node, buildMap);
+            aliases.clear();
+            overflowVariables = allocateVariables(context, node, map, maxVariables, aliases);
         }
-        else
-        {
-            ++iter;
-        }
-    }
-
-    
-    SetupAliasVisitor setupAlias(map);
-    traverseTree<false>(context, node, setupAlias);
-    // Don't bother overflowing variables that have already been aliased.
-    for (const auto & alias : setupAlias.m_aliasMap)
-    {
-        map.erase(alias.first);
     }
-    // 1 special variable, output must be left in place, as well as anything "unmovable", so they are deducted from the max allowed.
-    const size_t maxTempVars = outputter.getMaxVariables() - 2 - unmovableVars;
-    if (map.size() > maxTempVars)
+    if (!overflowVariables.empty())
     {
-        outputter.setOverflowedVariables(setupOverflow(context, node, map, maxTempVars));
+        outputter.setOverflowedVariables(setupOverflow(context, node, map, overflowVariables));
     }
     
-    outputter.setAliasedVariables(std::move(setupAlias.m_aliasMap));
+    outputter.setAliasedVariables(std::move(aliases));
 }
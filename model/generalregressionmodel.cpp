@@ -22,6 +22,7 @@
 #include "ast.hpp"
 #include "regressionmodel.hpp"
 #include "transformation.hpp"
+#include "native/linearmodel.hpp"
 
 static std::unordered_set<std::string>
 readPredictorSet(const tinyxml2::XMLElement * list)
@@ -314,6 +315,16 @@ bool GeneralRegressionModel::parse(AstBuilder & builder, const tinyxml2::XMLElem
                 RegressionModel::normalizeTable(builder, linkFunction, false);
                 builder.declare(config.outputValueName, AstBuilder::HAS_INITIAL_VALUE);
                 ++blockSize;
+
+                // The same prediction can also be computed natively, if asked for. This is in addition to the generated code.
+                if (builder.context().capturesNativeModels())
+                {
+                    auto model = std::make_shared<LinearModel::Model>();
+                    if (LinearModel::flattenGeneralRegressionModel(builder.context(), node, *model))
+                    {
+                        builder.context().addLinearModel(config.outputValueName, model);
+                    }
+                }
             }
         }
         else
@@ -20,7 +20,13 @@
 #include "conversioncontext.hpp"
 #include "output.hpp"
 #include "analyser.hpp"
+#include "parallel.hpp"
+#include "segmentcache.hpp"
+#include "streameddocument.hpp"
+#include "native/treeensemble.hpp"
 #include <algorithm>
+#include <functional>
+#include <memory>
 
 namespace MiningModel
 {
@@ -212,17 +218,22 @@ namespace MiningModel
         for (const tinyxml2::XMLElement * segment = segmentation->FirstChildElement("Segment");
              segment != nullptr; segment = segment->NextSiblingElement("Segment"))
         {
-            const tinyxml2::XMLElement * predicate = PMMLDocument::skipExtensions(segment->FirstChildElement());
+            PMMLDocument::LoadedSegment loadedSegment(builder, segment);
+            if (loadedSegment.get() == nullptr)
+            {
+                return false;
+            }
+            const tinyxml2::XMLElement * predicate = PMMLDocument::skipExtensions(loadedSegment.get()->FirstChildElement());
             if (predicate == nullptr)
             {
-                builder.parsingError("Empty segment", segment->GetLineNum());
+                builder.parsingError("Empty segment", loadedSegment.get()->GetLineNum());
                 return false;
             }
             
             const tinyxml2::XMLElement * model = PMMLDocument::skipExtensions(predicate->NextSiblingElement());
             if (model == nullptr)
             {
-                builder.parsingError("Segment has no model", segment->GetLineNum());
+                builder.parsingError("Segment has no model", loadedSegment.get()->GetLineNum());
                 return false;
             }
             
@@ -283,17 +294,22 @@ namespace MiningModel
         for (const tinyxml2::XMLElement * segment = segmentation->FirstChildElement("Segment");
              segment != nullptr; segment = segment->NextSiblingElement("Segment"))
         {
-            const tinyxml2::XMLElement * predicate = PMMLDocument::skipExtensions(segment->FirstChildElement());
+            PMMLDocument::LoadedSegment loadedSegment(builder, segment);
+            if (loadedSegment.get() == nullptr)
+            {
+                return false;
+            }
+            const tinyxml2::XMLElement * predicate = PMMLDocument::skipExtensions(loadedSegment.get()->FirstChildElement());
             if (predicate == nullptr)
             {
-                builder.parsingError("Empty segment", segment->GetLineNum());
+                builder.parsingError("Empty segment", loadedSegment.get()->GetLineNum());
                 return false;
             }
             
             const tinyxml2::XMLElement * model = PMMLDocument::skipExtensions(predicate->NextSiblingElement());
             if (model == nullptr)
             {
-                builder.parsingError("Segment has no model", segment->GetLineNum());
+                builder.parsingError("Segment has no model", loadedSegment.get()->GetLineNum());
                 return false;
             }
             
@@ -359,104 +375,412 @@ namespace MiningModel
         return 0;
     }
 
-    // This handles all other multiple model methods for regression models.
-    bool doRegressionSegments(AstBuilder & builder, PMMLDocument::ConstFieldDescriptionPtr outputValueName, PMMLDocument::FieldType outputType,
-                              PMMLDocument::ConstFieldDescriptionPtr countName, const tinyxml2::XMLElement * segmentation, const MultipleModelMethod modelMethod,
-                              double & constCount)
+    // This parses one segment, pushing one node. constCount is added to for each segment that always counts.
+    typedef std::function<bool(AstBuilder & builder, const tinyxml2::XMLElement * segment, double & constCount)> SegmentParser;
+    // This is shown the index'th segment once it has been loaded, before it is parsed or taken from the segment cache. It is
+    // called on whichever thread parses the segment, with that segment's fork of the builder.
+    typedef std::function<void(const AstBuilder & builder, const tinyxml2::XMLElement * segment, size_t index)> SegmentVisitor;
+
+    // Where each segment only contributes to an accumulator, segments are parsed on a pool of worker threads, each into its own
+    // fork of builder. These are joined back in segment order, so the result is the same as if they were parsed one by one.
+    // If there is a segment cache, segments that it has are copied from it rather than parsed, see SegmentCache.
+    bool parseIndependentSegments(AstBuilder & builder, const tinyxml2::XMLElement * segmentation, const SegmentParser & parseSegment,
+                                  size_t & count, double & constCount, const SegmentVisitor & visitSegment = nullptr)
     {
-        ASSERT_AST_BUILDER_ONE_NEW_NODE(builder);
-        size_t blockSize = 0;
+        std::vector<const tinyxml2::XMLElement *> segments;
         for (const tinyxml2::XMLElement * segment = segmentation->FirstChildElement("Segment");
              segment != nullptr; segment = segment->NextSiblingElement("Segment"))
         {
-            ASSERT_AST_BUILDER_ONE_NEW_NODE(builder);
-            const tinyxml2::XMLElement * predicate = PMMLDocument::skipExtensions(segment->FirstChildElement());
-            if (predicate == nullptr)
+            segments.push_back(segment);
+        }
+
+        // Forks don't have the fields by ID that a cached segment needs to find its fields, so nested Segmentations, which
+        // are parsed in a fork, aren't cached.
+        PMMLDocument::SegmentCache * cache = builder.context().segmentCache();
+        uint64_t documentHash = 0;
+        std::vector<PMMLDocument::ConstFieldDescriptionPtr> fieldsByID;
+        if (cache != nullptr && builder.context().fieldsByID() != nullptr && PMMLDocument::SegmentCache::hashDocument(segmentation, documentHash))
+        {
+            fieldsByID = *builder.context().fieldsByID();
+        }
+        else
+        {
+            cache = nullptr;
+        }
+
+        // Forks are taken from a snapshot, as builder changes each time a segment is joined.
+        const AstBuilder snapshot = builder.fork();
+        std::vector<std::unique_ptr<AstBuilder>> forks(segments.size());
+        std::vector<uint8_t> succeeded(segments.size(), false);
+        std::vector<double> constCounts(segments.size(), 0);
+        return Parallel::forEachInOrder(segments.size(), [&](size_t i)
+        {
+            forks[i].reset(new AstBuilder(snapshot.fork()));
+            // A streamed segment is only held in memory while it is parsed.
+            PMMLDocument::LoadedSegment loadedSegment(*forks[i], segments[i]);
+            if (loadedSegment.get() == nullptr)
             {
-                builder.parsingError("Empty segment", segment->GetLineNum());
-                return false;
+                return;
             }
-            
-            const tinyxml2::XMLElement * model = PMMLDocument::skipExtensions(predicate->NextSiblingElement());
-            if (model == nullptr)
+            if (visitSegment)
             {
-                builder.parsingError("Segment has no model", segment->GetLineNum());
-                return false;
+                visitSegment(*forks[i], loadedSegment.get(), i);
+            }
+            PMMLDocument::SegmentCache::Key key{};
+            if (cache != nullptr)
+            {
+                key = PMMLDocument::SegmentCache::makeKey(documentHash, loadedSegment.get(), snapshot.context().capturesNativeModels());
+                std::shared_ptr<const PMMLDocument::SegmentCache::Segment> cached = cache->find(key);
+                PMMLDocument::ForkFieldMap fields(&fieldsByID);
+                AstBuilder copied;
+                if (cached != nullptr && cached->converted.forkedID() == snapshot.forkedID() && cached->converted.copyFork(copied, fields))
+                {
+                    *forks[i] = std::move(copied);
+                    constCounts[i] = cached->constCount;
+                    succeeded[i] = true;
+                    return;
+                }
             }
+            succeeded[i] = parseSegment(*forks[i], loadedSegment.get(), constCounts[i]);
+            if (cache != nullptr && succeeded[i])
+            {
+                // The cache keeps a copy, as joining the fork changes its fields.
+                auto converted = std::make_shared<PMMLDocument::SegmentCache::Segment>();
+                PMMLDocument::ForkFieldMap fields(nullptr);
+                if (forks[i]->copyFork(converted->converted, fields))
+                {
+                    converted->constCount = constCounts[i];
+                    cache->insert(key, std::move(converted));
+                }
+            }
+        },
+        [&](size_t i)
+        {
+            builder.join(*forks[i]);
+            forks[i].reset();
+            constCount += constCounts[i];
+            count++;
+            return succeeded[i] != 0;
+        });
+    }
+
+    // This parses a single segment for doRegressionSegments.
+    bool parseRegressionSegment(AstBuilder & builder, const tinyxml2::XMLElement * segment, PMMLDocument::ConstFieldDescriptionPtr outputValueName,
+                                PMMLDocument::FieldType outputType, PMMLDocument::ConstFieldDescriptionPtr countName, const MultipleModelMethod modelMethod,
+                                double & constCount)
+    {
+        ASSERT_AST_BUILDER_ONE_NEW_NODE(builder);
+        const tinyxml2::XMLElement * predicate = PMMLDocument::skipExtensions(segment->FirstChildElement());
+        if (predicate == nullptr)
+        {
+            builder.parsingError("Empty segment", segment->GetLineNum());
+            return false;
+        }
+        
+        const tinyxml2::XMLElement * model = PMMLDocument::skipExtensions(predicate->NextSiblingElement());
+        if (model == nullptr)
+        {
+            builder.parsingError("Segment has no model", segment->GetLineNum());
+            return false;
+        }
 
-            const tinyxml2::XMLAttribute * weightAttr = segment->FindAttribute("weight");
-            const char * weight = weightAttr == nullptr ? "1" : weightAttr->Value();
+        const tinyxml2::XMLAttribute * weightAttr = segment->FindAttribute("weight");
+        const char * weight = weightAttr == nullptr ? "1" : weightAttr->Value();
 
-            PMMLDocument::ModelConfig subModelConfig;
-            subModelConfig.outputValueName = builder.context().createVariable(outputType, "model_output");
-            subModelConfig.outputType = outputType;
-            subModelConfig.function = PMMLDocument::FUNCTION_REGRESSION;
+        PMMLDocument::ModelConfig subModelConfig;
+        subModelConfig.outputValueName = builder.context().createVariable(outputType, "model_output");
+        subModelConfig.outputType = outputType;
+        subModelConfig.function = PMMLDocument::FUNCTION_REGRESSION;
+        if (!PMMLDocument::parseModel(builder, model, subModelConfig))
+        {
+            return false;
+        }
+        size_t innerBlockSize = 1;
+        
+        if (modelMethod == SUM ||
+            modelMethod == WEIGHTEDAVERAGE ||
+            modelMethod == AVERAGE)
+        {
+            // outputValueName = (outputValueName or 0) + (tempVariable or 0)
+            builder.field(outputValueName);
+            builder.defaultValue("0");
+            builder.field(subModelConfig.outputValueName);
+            if (modelMethod == WEIGHTEDAVERAGE)
+            {
+                // * weight
+                builder.constant(weight, outputType);
+                builder.function(Function::functionTable.names.times, 2);
+            }
+            builder.defaultValue("0"); // Applying default value to tempVariable
+            builder.function(Function::functionTable.names.plus, 2);
+            builder.assign(outputValueName);
+            innerBlockSize++;
+        }
+        else if (modelMethod == MEDIAN)
+        {
+            builder.field(outputValueName);
+            builder.field(subModelConfig.outputValueName);
+            builder.function(Function::insertToTableDef, 2);
+            innerBlockSize++;
+        }
+        else if (modelMethod == MAX)
+        {
+            builder.field(outputValueName);
+            builder.defaultValue("0");
+            builder.field(subModelConfig.outputValueName);
+            builder.defaultValue("0");
+            builder.function(Function::functionTable.names.max, 2);
+            builder.assign(outputValueName);
+            innerBlockSize++;
+        }
+        
+        if (!Predicate::parse(builder, predicate))
+        {
+            return false;
+        }
+        
+        AstNode predicateNode = builder.popNode();
+        
+        innerBlockSize += addCountBit(builder, predicateNode, modelMethod, countName, weight, constCount);
+        
+        if (innerBlockSize != 1)
+        {
+            builder.block(innerBlockSize);
+        }
+        
+        // Add predicate back
+        builder.pushNode(std::move(predicateNode));
+        builder.ifChain(2); // A body and a predicate
+        return true;
+    }
+    
+    // If every segment is a simple tree, the result can also be computed natively, in addition to the generated code. Each
+    // segment is flattened by whichever thread loads it to be parsed, so this costs no extra reading of the document.
+    class NativeTrees
+    {
+        std::vector<TreeEnsemble::Ensemble> m_trees;
+        // Not a vector<bool>, as each of these is written by a different thread.
+        std::vector<uint8_t> m_flattened;
+        const bool m_useWeights;
+    public:
+        NativeTrees(const tinyxml2::XMLElement * segmentation, bool useWeights) :
+            m_useWeights(useWeights)
+        {
+            for (const tinyxml2::XMLElement * segment = segmentation->FirstChildElement("Segment");
+                 segment != nullptr; segment = segment->NextSiblingElement("Segment"))
+            {
+                m_trees.emplace_back();
+            }
+            m_flattened.resize(m_trees.size(), false);
+        }
+
+        void flatten(const PMMLDocument::ConversionContext & context, const tinyxml2::XMLElement * segment, size_t index)
+        {
+            m_flattened[index] = TreeEnsemble::flattenSegment(context, segment, m_useWeights, m_trees[index]);
+        }
+
+        void addTo(PMMLDocument::ConversionContext & context, const PMMLDocument::ConstFieldDescriptionPtr & output, bool average) const
+        {
+            auto ensemble = std::make_shared<TreeEnsemble::Ensemble>();
+            if (std::find(m_flattened.begin(), m_flattened.end(), false) == m_flattened.end() &&
+                TreeEnsemble::combine(m_trees, average, *ensemble))
+            {
+                context.addTreeEnsemble(output, ensemble);
+            }
+        }
+    };
+
+    // This handles all other multiple model methods for regression models. If nativeTrees is set, each segment is flattened
+    // into it as well.
+    bool doRegressionSegments(AstBuilder & builder, PMMLDocument::ConstFieldDescriptionPtr outputValueName, PMMLDocument::FieldType outputType,
+                              PMMLDocument::ConstFieldDescriptionPtr countName, const tinyxml2::XMLElement * segmentation, const MultipleModelMethod modelMethod,
+                              double & constCount, NativeTrees * nativeTrees = nullptr)
+    {
+        ASSERT_AST_BUILDER_ONE_NEW_NODE(builder);
+        size_t blockSize = 0;
+        auto parseSegment = [&](AstBuilder & segmentBuilder, const tinyxml2::XMLElement * segment, double & segmentConstCount)
+        {
+            return parseRegressionSegment(segmentBuilder, segment, outputValueName, outputType, countName, modelMethod, segmentConstCount);
+        };
+        SegmentVisitor visitSegment;
+        if (nativeTrees != nullptr)
+        {
+            visitSegment = [nativeTrees](const AstBuilder & segmentBuilder, const tinyxml2::XMLElement * segment, size_t index)
+            {
+                nativeTrees->flatten(segmentBuilder.context(), segment, index);
+            };
+        }
+        
+        if (!parseIndependentSegments(builder, segmentation, parseSegment, blockSize, constCount, visitSegment))
+        {
+            return false;
+        }
+        
+        builder.block(blockSize);
+        
+        return true;
+    }
+    
+    // This parses a single segment for doClassificationSegments.
+    bool parseClassificationSegment(AstBuilder & builder, const tinyxml2::XMLElement * segment, const PMMLDocument::ModelConfig & config,
+                                    PMMLDocument::ConstFieldDescriptionPtr countVariable, const MultipleModelMethod modelMethod, double & constCount)
+    {
+        ASSERT_AST_BUILDER_ONE_NEW_NODE(builder);
+        const tinyxml2::XMLElement * predicate = PMMLDocument::skipExtensions(segment->FirstChildElement());
+        if (predicate == nullptr)
+        {
+            builder.parsingError("Empty segment", segment->GetLineNum());
+            return false;
+        }
+        
+        const tinyxml2::XMLElement * model = PMMLDocument::skipExtensions(predicate->NextSiblingElement());
+        if (model == nullptr)
+        {
+            builder.parsingError("Segment has no model", segment->GetLineNum());
+            return false;
+        }
+
+        const tinyxml2::XMLAttribute * weightAttr = segment->FindAttribute("weight");
+        const char * weight = weightAttr == nullptr ? "1" : weightAttr->Value();
+
+        PMMLDocument::ScopedVariableDefinitionStackGuard variableScope(builder.context());
+        
+        PMMLDocument::ModelConfig subModelConfig;
+        subModelConfig.outputType = config.outputType;
+        subModelConfig.function = PMMLDocument::FUNCTION_CLASSIFICATION;
+
+        size_t blockSize = 0;
+        
+        if (modelMethod == WEIGHTEDAVERAGE ||
+            modelMethod == AVERAGE)
+        {
+            auto tempVariable = PMMLDocument::buildProbabilityOutputMap(builder.context(), "results", PMMLDocument::TYPE_NUMBER, config.targetField->field.values);
+            
+            subModelConfig.probabilityValueName = tempVariable;
             if (!PMMLDocument::parseModel(builder, model, subModelConfig))
             {
                 return false;
             }
-            size_t innerBlockSize = 1;
+            blockSize++;
             
-            if (modelMethod == SUM ||
-                modelMethod == WEIGHTEDAVERAGE ||
-                modelMethod == AVERAGE)
+            blockSize += sumProbabilitiesFromSubModel(builder, config.probabilityValueName, subModelConfig.probabilityValueName, modelMethod == WEIGHTEDAVERAGE ? weight : nullptr);
+            blockSize += sumProbabilitiesFromSubModel(builder, config.confidenceValues, subModelConfig.confidenceValues, modelMethod == WEIGHTEDAVERAGE ? weight : nullptr);
+        }
+        else if (modelMethod == MAX)
+        {
+            subModelConfig.bestProbabilityValueName = builder.context().createVariable(PMMLDocument::TYPE_NUMBER, "best_prob");
+            subModelConfig.probabilityValueName = PMMLDocument::buildProbabilityOutputMap(builder.context(), "results", PMMLDocument::TYPE_NUMBER, config.targetField->field.values);
+            if (config.outputValueName)
             {
-                // outputValueName = (outputValueName or 0) + (tempVariable or 0)
-                builder.field(outputValueName);
-                builder.defaultValue("0");
-                builder.field(subModelConfig.outputValueName);
-                if (modelMethod == WEIGHTEDAVERAGE)
-                {
-                    // * weight
-                    builder.constant(weight, outputType);
-                    builder.function(Function::functionTable.names.times, 2);
-                }
-                builder.defaultValue("0"); // Applying default value to tempVariable
-                builder.function(Function::functionTable.names.plus, 2);
-                builder.assign(outputValueName);
-                innerBlockSize++;
+                subModelConfig.outputValueName = builder.context().createVariable(config.outputValueName->field.dataType, "value");
             }
-            else if (modelMethod == MEDIAN)
+            
+            if (!PMMLDocument::parseModel(builder, model, subModelConfig))
             {
-                builder.field(outputValueName);
-                builder.field(subModelConfig.outputValueName);
-                builder.function(Function::insertToTableDef, 2);
-                innerBlockSize++;
+                return false;
             }
-            else if (modelMethod == MAX)
+            
+            blockSize++;
+            
+            size_t ltBlockSize = copyResultsFromSubModel(builder, config, subModelConfig);
+            
+            // Set the count of contributing scores to 1
+            builder.constant(1);
+            builder.assign(countVariable);
+            ltBlockSize++;
+            
+            builder.block(ltBlockSize);
+            
+            // Condition for this (currentBest < this)
+            builder.field(config.bestProbabilityValueName);
+            builder.field(subModelConfig.bestProbabilityValueName);
+            builder.function(Function::functionTable.names.lessThan, 2);
+            
+            size_t eqBlockSize = sumProbabilitiesFromSubModel(builder, config.probabilityValueName, subModelConfig.probabilityValueName, nullptr) +
+                sumProbabilitiesFromSubModel(builder, config.confidenceValues, subModelConfig.confidenceValues, nullptr);
+            
+            // Add together the number of variables that have contributed
+            // count = count + 1
+            builder.field(countVariable);
+            builder.constant(1);
+            builder.function(Function::functionTable.names.plus, 2);
+            builder.assign(countVariable);
+            eqBlockSize++;
+            builder.block(eqBlockSize);
+            
+            // Condition for this (currentBest == this)
+            builder.field(config.bestProbabilityValueName);
+            builder.field(subModelConfig.bestProbabilityValueName);
+            builder.function(Function::functionTable.names.equal, 2);
+            
+            if (subModelConfig.outputValueName)
             {
-                builder.field(outputValueName);
-                builder.defaultValue("0");
+                builder.field(config.outputValueName);
                 builder.field(subModelConfig.outputValueName);
-                builder.defaultValue("0");
-                builder.function(Function::functionTable.names.max, 2);
-                builder.assign(outputValueName);
-                innerBlockSize++;
+                builder.function(Function::functionTable.names.equal, 2);
+                builder.function(Function::functionTable.names.fnAnd, 2);
             }
             
-            if (!Predicate::parse(builder, predicate))
-            {
-                return false;
-            }
+            builder.ifChain(4);
             
-            AstNode predicateNode = builder.popNode();
             
-            innerBlockSize += addCountBit(builder, predicateNode, modelMethod, countName, weight, constCount);
+            blockSize++;
+        }
+        else if (modelMethod == MAJORITYVOTE || modelMethod == WEIGHTEDMAJORITYVOTE)
+        {
+            auto tempVariable = builder.context().createVariable(PMMLDocument::TYPE_NUMBER, "results");
             
-            if (innerBlockSize != 1)
+            subModelConfig.outputValueName = tempVariable;
+            if (!PMMLDocument::parseModel(builder, model, subModelConfig))
             {
-                builder.block(innerBlockSize);
+                return false;
             }
+            blockSize++;
             
-            // Add predicate back
-            builder.pushNode(std::move(predicateNode));
-            builder.ifChain(2); // A body and a predicate
+            // Increment the corresponding category score
+            for (const auto & pair : config.probabilityValueName)
+            {
+                // if notmissing(field) then
+                //    outputs[field] = outputs[field] + 1
+                builder.field(pair.second);
+                builder.defaultValue("0");
+                
+                if (modelMethod == MAJORITYVOTE)
+                {
+                    builder.constant(1);
+                }
+                else
+                {
+                    builder.constant(weight, PMMLDocument::TYPE_NUMBER);
+                }
+                builder.function(Function::functionTable.names.plus, 2);
+                builder.assign(pair.second);
+                
+                builder.field(tempVariable);
+                builder.constant(pair.first,  config.targetField->field.dataType);
+                builder.function(Function::functionTable.names.equal, 2);
+            }
+                
+            builder.ifChain(config.probabilityValueName.size() * 2); // 1 for body, 1 for predicate
             
             blockSize++;
         }
         
+        
+        if (!Predicate::parse(builder, predicate))
+        {
+            return false;
+        }
+        
+        AstNode predicateNode = builder.popNode();
+        blockSize += addCountBit(builder, predicateNode, modelMethod, countVariable, weight, constCount);
+        
         builder.block(blockSize);
         
+        // Add predicate back
+        builder.pushNode(std::move(predicateNode));
+        
+        builder.ifChain(2);
         return true;
     }
     
@@ -494,167 +818,14 @@ namespace MiningModel
         outerBlockSize += setupAccumulatorsForProbabilities(builder, config, modelMethod);
         
         double constCount = 0;
+        auto parseSegment = [&](AstBuilder & segmentBuilder, const tinyxml2::XMLElement * segment, double & segmentConstCount)
+        {
+            return parseClassificationSegment(segmentBuilder, segment, config, countVariable, modelMethod, segmentConstCount);
+        };
         
-        
-        for (const tinyxml2::XMLElement * segment = segmentation->FirstChildElement("Segment");
-             segment != nullptr; segment = segment->NextSiblingElement("Segment"))
+        if (!parseIndependentSegments(builder, segmentation, parseSegment, outerBlockSize, constCount))
         {
-            const tinyxml2::XMLElement * predicate = PMMLDocument::skipExtensions(segment->FirstChildElement());
-            if (predicate == nullptr)
-            {
-                builder.parsingError("Empty segment", segment->GetLineNum());
-                return false;
-            }
-            
-            const tinyxml2::XMLElement * model = PMMLDocument::skipExtensions(predicate->NextSiblingElement());
-            if (model == nullptr)
-            {
-                builder.parsingError("Segment has no model", segment->GetLineNum());
-                return false;
-            }
-
-            const tinyxml2::XMLAttribute * weightAttr = segment->FindAttribute("weight");
-            const char * weight = weightAttr == nullptr ? "1" : weightAttr->Value();
-
-            PMMLDocument::ScopedVariableDefinitionStackGuard variableScope(builder.context());
-            
-            PMMLDocument::ModelConfig subModelConfig;
-            subModelConfig.outputType = config.outputType;
-            subModelConfig.function = PMMLDocument::FUNCTION_CLASSIFICATION;
-
-            size_t blockSize = 0;
-            
-            if (modelMethod == WEIGHTEDAVERAGE ||
-                modelMethod == AVERAGE)
-            {
-                auto tempVariable = PMMLDocument::buildProbabilityOutputMap(builder.context(), "results", PMMLDocument::TYPE_NUMBER, config.targetField->field.values);
-                
-                subModelConfig.probabilityValueName = tempVariable;
-                if (!PMMLDocument::parseModel(builder, model, subModelConfig))
-                {
-                    return false;
-                }
-                blockSize++;
-                
-                blockSize += sumProbabilitiesFromSubModel(builder, config.probabilityValueName, subModelConfig.probabilityValueName, modelMethod == WEIGHTEDAVERAGE ? weight : nullptr);
-                blockSize += sumProbabilitiesFromSubModel(builder, config.confidenceValues, subModelConfig.confidenceValues, modelMethod == WEIGHTEDAVERAGE ? weight : nullptr);
-            }
-            else if (modelMethod == MAX)
-            {
-                subModelConfig.bestProbabilityValueName = builder.context().createVariable(PMMLDocument::TYPE_NUMBER, "best_prob");
-                subModelConfig.probabilityValueName = PMMLDocument::buildProbabilityOutputMap(builder.context(), "results", PMMLDocument::TYPE_NUMBER, config.targetField->field.values);
-                if (config.outputValueName)
-                {
-                    subModelConfig.outputValueName = builder.context().createVariable(config.outputValueName->field.dataType, "value");
-                }
-                
-                if (!PMMLDocument::parseModel(builder, model, subModelConfig))
-                {
-                    return false;
-                }
-                
-                blockSize++;
-                
-                size_t ltBlockSize = copyResultsFromSubModel(builder, config, subModelConfig);
-                
-                // Set the count of contributing scores to 1
-                builder.constant(1);
-                builder.assign(countVariable);
-                ltBlockSize++;
-                
-                builder.block(ltBlockSize);
-                
-                // Condition for this (currentBest < this)
-                builder.field(config.bestProbabilityValueName);
-                builder.field(subModelConfig.bestProbabilityValueName);
-                builder.function(Function::functionTable.names.lessThan, 2);
-                
-                size_t eqBlockSize = sumProbabilitiesFromSubModel(builder, config.probabilityValueName, subModelConfig.probabilityValueName, nullptr) +
-                    sumProbabilitiesFromSubModel(builder, config.confidenceValues, subModelConfig.confidenceValues, nullptr);
-                
-                // Add together the number of variables that have contributed
-                // count = count + 1
-                builder.field(countVariable);
-                builder.constant(1);
-                builder.function(Function::functionTable.names.plus, 2);
-                builder.assign(countVariable);
-                eqBlockSize++;
-                builder.block(eqBlockSize);
-                
-                // Condition for this (currentBest == this)
-                builder.field(config.bestProbabilityValueName);
-                builder.field(subModelConfig.bestProbabilityValueName);
-                builder.function(Function::functionTable.names.equal, 2);
-                
-                if (subModelConfig.outputValueName)
-                {
-                    builder.field(config.outputValueName);
-                    builder.field(subModelConfig.outputValueName);
-                    builder.function(Function::functionTable.names.equal, 2);
-                    builder.function(Function::functionTable.names.fnAnd, 2);
-                }
-                
-                builder.ifChain(4);
-                
-                
-                blockSize++;
-            }
-            else if (modelMethod == MAJORITYVOTE || modelMethod == WEIGHTEDMAJORITYVOTE)
-            {
-                auto tempVariable = builder.context().createVariable(PMMLDocument::TYPE_NUMBER, "results");
-                
-                subModelConfig.outputValueName = tempVariable;
-                if (!PMMLDocument::parseModel(builder, model, subModelConfig))
-                {
-                    return false;
-                }
-                blockSize++;
-                
-                // Increment the corresponding category score
-                for (const auto & pair : config.probabilityValueName)
-                {
-                    // if notmissing(field) then
-                    //    outputs[field] = outputs[field] + 1
-                    builder.field(pair.second);
-                    builder.defaultValue("0");
-                    
-                    if (modelMethod == MAJORITYVOTE)
-                    {
-                        builder.constant(1);
-                    }
-                    else
-                    {
-                        builder.constant(weight, PMMLDocument::TYPE_NUMBER);
-                    }
-                    builder.function(Function::functionTable.names.plus, 2);
-                    builder.assign(pair.second);
-                    
-                    builder.field(tempVariable);
-                    builder.constant(pair.first,  config.targetField->field.dataType);
-                    builder.function(Function::functionTable.names.equal, 2);
-                }
-                    
-                builder.ifChain(config.probabilityValueName.size() * 2); // 1 for body, 1 for predicate
-                
-                blockSize++;
-            }
-            
-            
-            if (!Predicate::parse(builder, predicate))
-            {
-                return false;
-            }
-            
-            AstNode predicateNode = builder.popNode();
-            blockSize += addCountBit(builder, predicateNode, modelMethod, countVariable, weight, constCount);
-            
-            builder.block(blockSize);
-            
-            // Add predicate back
-            builder.pushNode(std::move(predicateNode));
-            
-            builder.ifChain(2);
-            outerBlockSize++;
+            return false;
         }
     
         if (modelMethod != MAX)
@@ -690,6 +861,14 @@ namespace MiningModel
                          const char * method, const tinyxml2::XMLElement * segmentation)
     {
         const MultipleModelMethod modelMethod = getMiningModelFromString(method);
+        // Targets would rescale the output after a native ensemble has written it.
+        std::unique_ptr<NativeTrees> nativeTrees;
+        if (builder.context().capturesNativeModels() && config.outputValueName && node->FirstChildElement("Targets") == nullptr &&
+            (modelMethod == SUM || modelMethod == AVERAGE || modelMethod == WEIGHTEDAVERAGE))
+        {
+            nativeTrees.reset(new NativeTrees(segmentation, modelMethod == WEIGHTEDAVERAGE));
+        }
+
         switch(modelMethod)
         {
             case INVALID:
@@ -710,10 +889,15 @@ namespace MiningModel
                 builder.declare(countVariable, AstBuilder::HAS_INITIAL_VALUE);
             
                 double constCount = 0;
-                if (!doRegressionSegments(builder, accumVariable, config.outputType, countVariable, segmentation, modelMethod, constCount))
+                if (!doRegressionSegments(builder, accumVariable, config.outputType, countVariable, segmentation, modelMethod, constCount,
+                                          nativeTrees.get()))
                 {
                     return false;
                 }
+                if (nativeTrees)
+                {
+                    nativeTrees->addTo(builder.context(), config.outputValueName, true);
+                }
                 
                 builder.field(accumVariable);
                 builder.field(countVariable);
@@ -779,10 +963,15 @@ namespace MiningModel
                 builder.constant(0);
                 builder.declare(config.outputValueName, AstBuilder::HAS_INITIAL_VALUE);
                 double constCount = 0;
-                if (!doRegressionSegments(builder, config.outputValueName, config.outputType, nullptr, segmentation, modelMethod, constCount))
+                if (!doRegressionSegments(builder, config.outputValueName, config.outputType, nullptr, segmentation, modelMethod, constCount,
+                                          nativeTrees.get()))
                 {
                     return false;
                 }
+                if (nativeTrees)
+                {
+                    nativeTrees->addTo(builder.context(), config.outputValueName, false);
+                }
                 builder.block(2);
                 return true;
             }
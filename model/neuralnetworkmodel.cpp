@@ -19,6 +19,7 @@
 #include "ast.hpp"
 #include "luaconverter/luaoutputter.hpp"
 #include "transformation.hpp"
+#include "native/neuralnetwork.hpp"
 #include <algorithm>
 #include <cmath>
 #include <stdlib.h>
@@ -27,26 +28,7 @@ namespace NeuralNetworkModel
 {
 namespace
 {
-    // These two lists must be kept in sync and ascii ordered (the first two elements are capitalised in the spec).
-    enum ActivationFunction
-    {
-        ACTIVATION_ELLIOTT,
-        ACTIVATION_GAUSS,
-        ACTIVATION_ARCTAN,
-        ACTIVATION_COSINE,
-        ACTIVATION_EXPONENTIAL,
-        ACTIVATION_IDENTITY,
-        ACTIVATION_LOGISTIC,
-        ACTIVATION_RADIAL_BASIS,
-        ACTIVATION_RECIPROCAL,
-        ACTIVATION_RECTIFIER,
-        ACTIVATION_SINE,
-        ACTIVATION_SQUARE,
-        ACTIVATION_TANH,
-        ACTIVATION_THRESHOLD,
-        ACTIVATION_INVALID
-    };
-    
+    // These must be kept in sync with the enums in the header. Activation functions are ascii ordered (the first two elements are capitalised in the spec).
     const char * const ACTIVATION_FUNCTION_NAME[]
     {
         "Elliott",
@@ -65,14 +47,6 @@ namespace
         "threshold"
     };
     
-    enum NormalizationMethod
-    {
-        NORMALIZATION_METHOD_NONE,
-        NORMALIZATION_METHOD_SIMPLEMAX,
-        NORMALIZATION_METHOD_SOFTMAX,
-        NORMALIZATION_METHOD_INVALID
-    };
-    
     const char * const NORMALIZATION_METHOD_NAME[] =
     {
         "none",
@@ -202,7 +176,7 @@ namespace
     
     struct NeuralNetParseState
     {
-        NeuralNetParseState(PMMLDocument::ConversionContext &,
+        NeuralNetParseState(PMMLDocument::ConversionContext & context,
                             ActivationFunction activationFunction, NormalizationMethod normalizationMethod,
                             double threshold, double altitude, double width) :
             defaultActivationFunction(activationFunction),
@@ -210,7 +184,8 @@ namespace
             defaultThreshold(threshold),
             defaultAltitude(altitude),
             defaultWidth(width),
-            blockSize(0)
+            blockSize(0),
+            network(context.capturesNativeModels() ? std::make_shared<NeuralNetwork::Network>() : nullptr)
         {}
         const ActivationFunction defaultActivationFunction;
         const NormalizationMethod defaultNormalizationMethod;
@@ -220,6 +195,84 @@ namespace
         
         std::unordered_map<std::string, PMMLDocument::ConstFieldDescriptionPtr> nodeIDToVariableMap;
         size_t blockSize;
+
+        // The same network as dense matrices, or null if it cannot be represented that way or wasn't asked for.
+        std::shared_ptr<NeuralNetwork::Network> network;
+        // The layer (0 for inputs) and position within it of every node in network.
+        std::unordered_map<std::string, std::pair<size_t, uint32_t>> nodeIDToNativeIndex;
+        std::unordered_map<std::string, uint32_t> featureIndexes;
+
+        // Only raw numeric inputs can be passed to the native network as doubles.
+        bool captureFeature(AstBuilder & builder, const char * name, uint32_t & out)
+        {
+            const PMMLDocument::MiningField * miningField = name ? builder.context().getMiningField(name) : nullptr;
+            if (miningField == nullptr || miningField->hasReplacementValue ||
+                miningField->outlierTreatment != PMMLDocument::OUTLIER_TREATMENT_AS_IS ||
+                miningField->variable->origin != PMMLDocument::ORIGIN_DATA_DICTIONARY ||
+                miningField->variable->field.dataType != PMMLDocument::TYPE_NUMBER)
+            {
+                return false;
+            }
+
+            auto inserted = featureIndexes.emplace(name, static_cast<uint32_t>(network->features.size()));
+            if (inserted.second)
+            {
+                network->features.push_back(miningField->variable);
+            }
+            out = inserted.first->second;
+            return true;
+        }
+
+        // This reads the same things as Transformation::parseNormContinuousBody, or in the case of a FieldRef, just mapMissingTo.
+        bool captureNorm(AstBuilder & builder, const tinyxml2::XMLElement * transform, Transformation::NormContinuousMode mode, NeuralNetwork::LinearNorm & norm)
+        {
+            if (const char * mapMissingTo = transform->Attribute(Transformation::mapMissingToAttr(builder)))
+            {
+                char * endp;
+                norm.mapMissingTo = strtod(mapMissingTo, &endp);
+                if (*endp != '\0')
+                {
+                    return false;
+                }
+            }
+
+            if (strcmp(transform->Name(), "NormContinuous") != 0)
+            {
+                return true;
+            }
+
+            if (const char * outliers = transform->Attribute("outliers"))
+            {
+                norm.outliers = PMMLDocument::outlierTreatmentFromString(outliers);
+            }
+            for (const tinyxml2::XMLElement * linearNorm = transform->FirstChildElement("LinearNorm"); linearNorm; linearNorm = linearNorm->NextSiblingElement("LinearNorm"))
+            {
+                double orig;
+                double normal;
+                if (linearNorm->QueryDoubleAttribute("orig", &orig) || linearNorm->QueryDoubleAttribute("norm", &normal))
+                {
+                    return false;
+                }
+                norm.origins.push_back(mode == Transformation::NORMALIZE ? orig : normal);
+                norm.normals.push_back(mode == Transformation::NORMALIZE ? normal : orig);
+            }
+            return norm.outliers != PMMLDocument::OUTLIER_TREATMENT_INVALID && norm.origins.size() >= 2;
+        }
+
+        void captureInput(AstBuilder & builder, const tinyxml2::XMLElement * expression, const char * idString)
+        {
+            NeuralNetwork::Input input;
+            if (network == nullptr ||
+                (strcmp(expression->Name(), "FieldRef") != 0 && strcmp(expression->Name(), "NormContinuous") != 0) ||
+                !captureFeature(builder, expression->Attribute("field"), input.feature) ||
+                !captureNorm(builder, expression, Transformation::NORMALIZE, input.norm))
+            {
+                network.reset();
+                return;
+            }
+            nodeIDToNativeIndex.emplace(idString, std::make_pair(0, static_cast<uint32_t>(network->inputs.size())));
+            network->inputs.push_back(std::move(input));
+        }
     
         bool parseNeuralInputs(AstBuilder & builder, const tinyxml2::XMLElement * neuralInputs)
         {
@@ -266,6 +319,7 @@ namespace
                     builder.parsingError("Duplicate node ID: at %i\n", idString, neuralInput->GetLineNum());
                     return false;
                 }
+                captureInput(builder, expression, idString);
             }
             return true;
         }
@@ -312,11 +366,22 @@ namespace
                 builder.parsingError("invalid width value", neuralLayer->GetLineNum());
             }
             
+            // This layer as a dense matrix, with one row of weights per neuron. Radial basis isn't a matrix multiply.
+            const size_t nativeLayer = network ? network->layers.size() + 1 : 0;
+            const size_t nativeInputCount = !network ? 0 : network->layers.empty() ? network->inputs.size() : network->layers.back().bias.size();
+            std::vector<double> nativeWeights;
+            std::vector<double> nativeBias;
+            if (activationFunction == ACTIVATION_RADIAL_BASIS)
+            {
+                network.reset();
+            }
+
             std::unordered_set<PMMLDocument::ConstFieldDescriptionPtr> thisLayerVars;
             for (const tinyxml2::XMLElement * neuron = neuralLayer->FirstChildElement("Neuron"); neuron; neuron = neuron->NextSiblingElement("Neuron"))
             {
                 size_t terms = 0;
                 double bias = 0;
+                nativeWeights.resize(nativeWeights.size() + nativeInputCount, 0.0);
                 tinyxml2::XMLError retval = neuron->QueryDoubleAttribute("bias", &bias);
                 if (retval == tinyxml2::XML_SUCCESS)
                 {
@@ -382,6 +447,20 @@ namespace
                         return false;
                     }
                     
+                    if (network)
+                    {
+                        // Only connections from the layer immediately before this one fit in the matrix.
+                        auto nativeFound = nodeIDToNativeIndex.find(from);
+                        if (nativeFound == nodeIDToNativeIndex.end() || nativeFound->second.first + 1 != nativeLayer)
+                        {
+                            network.reset();
+                        }
+                        else if (weightAsDouble != 0)
+                        {
+                            nativeWeights[nativeBias.size() * nativeInputCount + nativeFound->second.second] += weightAsDouble;
+                        }
+                    }
+                    
                     if (activationFunction != ACTIVATION_RADIAL_BASIS)
                     {
                         // value[from] * weight
@@ -445,6 +524,31 @@ namespace
                     return false;
                 }
                 thisLayerVars.insert(thisVariable);
+                if (network)
+                {
+                    nodeIDToNativeIndex.emplace(idString, std::make_pair(nativeLayer, static_cast<uint32_t>(nativeBias.size())));
+                    nativeBias.push_back(bias);
+                }
+            }
+            
+            if (network)
+            {
+                // Transpose the weights, so that a row of them is everything connected from one node in the previous layer.
+                NeuralNetwork::Layer layer;
+                layer.inputCount = nativeInputCount;
+                layer.weight.resize(nativeWeights.size());
+                for (size_t to = 0; to < nativeBias.size(); ++to)
+                {
+                    for (size_t from = 0; from < nativeInputCount; ++from)
+                    {
+                        layer.weight[from * nativeBias.size() + to] = nativeWeights[to * nativeInputCount + from];
+                    }
+                }
+                layer.bias = std::move(nativeBias);
+                layer.activationFunction = activationFunction;
+                layer.normalizationMethod = normalizationMethod;
+                layer.threshold = threshold;
+                network->layers.push_back(std::move(layer));
             }
             
             // Apply normalization to the layer.
@@ -479,6 +583,29 @@ namespace
         }
         
         
+        // Outputs of the native network must come from the final layer.
+        void captureOutput(AstBuilder & builder, const char * outputNeuron, const tinyxml2::XMLElement * normContinuous,
+                           const PMMLDocument::ConstFieldDescriptionPtr & field)
+        {
+            if (network == nullptr)
+            {
+                return;
+            }
+            auto found = nodeIDToNativeIndex.find(outputNeuron);
+            NeuralNetwork::Output output;
+            if (network->layers.empty() || found == nodeIDToNativeIndex.end() || found->second.first != network->layers.size() ||
+                (normContinuous && !captureNorm(builder, normContinuous, Transformation::DENORMALIZE, output.norm)))
+            {
+                network.reset();
+                return;
+            }
+            // The neuron is never missing, so mapMissingTo doesn't apply.
+            output.norm.mapMissingTo = std::numeric_limits<double>::quiet_NaN();
+            output.neuron = found->second.second;
+            output.field = field;
+            network->outputs.push_back(std::move(output));
+        }
+        
         bool parseNeuralOutputs(AstBuilder & builder, std::vector<std::string> & values, PMMLDocument::ModelConfig & config, const tinyxml2::XMLElement * neuralOutputs)
         {
             PMMLDocument::ProbabilitiesOutputMap & probsOutputName = config.probabilityValueName;
@@ -532,6 +659,7 @@ namespace
                     
                     builder.declare(config.outputValueName, AstBuilder::HAS_INITIAL_VALUE);
                     blockSize++;
+                    captureOutput(builder, outputNeuron, transform, config.outputValueName);
                 }
                 else if (expressionType == Transformation::EXPRESSION_FIELD_REF)
                 {
@@ -544,6 +672,7 @@ namespace
                     builder.field(found->second);
                     builder.declare(config.outputValueName, AstBuilder::HAS_INITIAL_VALUE);
                     blockSize++;
+                    captureOutput(builder, outputNeuron, nullptr, config.outputValueName);
                 }
                 else if (expressionType == Transformation::EXPRESSION_NORM_DISCRETE)
                 {
@@ -565,6 +694,7 @@ namespace
                     auto categoryOutput = PMMLDocument::getOrAddCategoryInOutputMap(builder.context(), probsOutputName, "probabilities", config.outputType, value);
                     builder.declare(categoryOutput, AstBuilder::HAS_INITIAL_VALUE);
                     blockSize++;
+                    captureOutput(builder, outputNeuron, nullptr, categoryOutput);
                 }
                 else
                 {
@@ -663,6 +793,13 @@ bool NeuralNetworkModel::parse(AstBuilder & builder, const tinyxml2::XMLElement
         return false;
     }
     
+    // The same outputs can also be computed natively, if asked for. This is in addition to the generated code. Targets would
+    // rescale the output after it has been written.
+    if (parseState.network && !parseState.network->outputs.empty() && node->FirstChildElement("Targets") == nullptr)
+    {
+        builder.context().addNeuralNetwork(parseState.network);
+    }
+    
     builder.block(parseState.blockSize);
     
     return true;
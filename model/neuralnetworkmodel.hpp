@@ -23,6 +23,34 @@
 
 namespace NeuralNetworkModel
 {
+    // The names of these are in neuralnetworkmodel.cpp, and must be kept in sync and ascii ordered.
+    enum ActivationFunction
+    {
+        ACTIVATION_ELLIOTT,
+        ACTIVATION_GAUSS,
+        ACTIVATION_ARCTAN,
+        ACTIVATION_COSINE,
+        ACTIVATION_EXPONENTIAL,
+        ACTIVATION_IDENTITY,
+        ACTIVATION_LOGISTIC,
+        ACTIVATION_RADIAL_BASIS,
+        ACTIVATION_RECIPROCAL,
+        ACTIVATION_RECTIFIER,
+        ACTIVATION_SINE,
+        ACTIVATION_SQUARE,
+        ACTIVATION_TANH,
+        ACTIVATION_THRESHOLD,
+        ACTIVATION_INVALID
+    };
+
+    enum NormalizationMethod
+    {
+        NORMALIZATION_METHOD_NONE,
+        NORMALIZATION_METHOD_SIMPLEMAX,
+        NORMALIZATION_METHOD_SOFTMAX,
+        NORMALIZATION_METHOD_INVALID
+    };
+
     bool parse(AstBuilder & builder, const tinyxml2::XMLElement * node, PMMLDocument::ModelConfig & config);
 }
 
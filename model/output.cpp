@@ -22,39 +22,50 @@
 #include "document.hpp"
 #include "transformation.hpp"
 #include <algorithm>
+#include <vector>
 
 namespace
 {
-void collectOutputs(const tinyxml2::XMLElement * element, PMMLDocument::DataFieldVector & names)
+// This goes through the elements under root in document order, keeping its own stack of them so that deep trees are fine.
+void collectOutputs(const tinyxml2::XMLElement * root, PMMLDocument::DataFieldVector & names)
 {
-    if (const tinyxml2::XMLElement * outputs = element->FirstChildElement("Output"))
+    std::vector<const tinyxml2::XMLElement *> toVisit(1, root);
+    while (!toVisit.empty())
     {
-        for (const tinyxml2::XMLElement * iterator = outputs->FirstChildElement("OutputField");
-             iterator; iterator = iterator->NextSiblingElement("OutputField"))
+        const tinyxml2::XMLElement * element = toVisit.back();
+        toVisit.pop_back();
+        if (const tinyxml2::XMLElement * outputs = element->FirstChildElement("Output"))
         {
-            // Note, this first pass doesn't care about errors... they will be silently ignored
-            if (const char * name = iterator->Attribute("name"))
+            for (const tinyxml2::XMLElement * iterator = outputs->FirstChildElement("OutputField");
+                 iterator; iterator = iterator->NextSiblingElement("OutputField"))
             {
-                PMMLDocument::FieldType fieldType = PMMLDocument::TYPE_INVALID;
-                if (const char * type = iterator->Attribute("dataType"))
+                // Note, this first pass doesn't care about errors... they will be silently ignored
+                if (const char * name = iterator->Attribute("name"))
                 {
-                    fieldType = PMMLDocument::dataTypeFromString(type);
-                }
-                PMMLDocument::OpType opType = PMMLDocument::OPTYPE_INVALID;
-                if (const char * type = iterator->Attribute("optype"))
-                {
-                    opType = PMMLDocument::optypeFromString(type);
+                    PMMLDocument::FieldType fieldType = PMMLDocument::TYPE_INVALID;
+                    if (const char * type = iterator->Attribute("dataType"))
+                    {
+                        fieldType = PMMLDocument::dataTypeFromString(type);
+                    }
+                    PMMLDocument::OpType opType = PMMLDocument::OPTYPE_INVALID;
+                    if (const char * type = iterator->Attribute("optype"))
+                    {
+                        opType = PMMLDocument::optypeFromString(type);
+                    }
+                    PMMLDocument::DataField dataField = {fieldType, opType};
+                    names.emplace_back(name, dataField);
                 }
-                PMMLDocument::DataField dataField = {fieldType, opType};
-                names.emplace_back(name, dataField);
             }
         }
-    }
 
-    for (const tinyxml2::XMLElement * iterator = PMMLDocument::skipExtensions(element->FirstChildElement());
-         iterator; iterator = PMMLDocument::skipExtensions(iterator->NextSiblingElement()))
-    {
-        collectOutputs(iterator, names);
+        // The children are visited in order, so they go on in reverse.
+        const size_t firstChild = toVisit.size();
+        for (const tinyxml2::XMLElement * iterator = PMMLDocument::skipExtensions(element->FirstChildElement());
+             iterator; iterator = PMMLDocument::skipExtensions(iterator->NextSiblingElement()))
+        {
+            toVisit.push_back(iterator);
+        }
+        std::reverse(toVisit.begin() + firstChild, toVisit.end());
     }
 }
 }
@@ -23,11 +23,11 @@
 #include "function.hpp"
 #include <algorithm>
 #include <assert.h>
+#include <cstdint>
 
 namespace PMMLDocument
 {
     extern const char* PMML_INFINITY;
-    extern bool hasInfinityValue;
 }
 
 namespace
@@ -105,7 +105,7 @@ namespace
             
             if (strcmp(value, PMMLDocument::PMML_INFINITY) == 0)
             {
-                PMMLDocument::hasInfinityValue = true;
+                builder.context().setHasInfinityValue();
             }
 
             builder.constant(value, builder.topNode().coercedType);
@@ -268,9 +268,18 @@ bool Predicate::parse(AstBuilder & builder, const tinyxml2::XMLElement * node)
     return false;
 }
 
+namespace
+{
+    // The same as isspace in the C locale, but without a call per character. Arrays can hold millions of elements.
+    inline bool isArraySpace(char c)
+    {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+}
+
 void PMMLArrayIterator::getNext()
 {
-    m_upto = std::find_if_not(m_upto, m_endPtr, isspace);
+    m_upto = std::find_if_not(m_upto, m_endPtr, isArraySpace);
     if (m_upto == m_endPtr)
     {
         m_stringStart = m_upto;
@@ -291,10 +300,12 @@ void PMMLArrayIterator::getNext()
     }
     else
     {
-        m_upto = std::find_if(m_upto + 1, m_endPtr, isspace);
+        m_upto = std::find_if(m_upto + 1, m_endPtr, isArraySpace);
     }
 }
-PMMLArrayIterator::PMMLArrayIterator(const char * content) : m_endPtr(content + strlen(content)), m_upto(content), m_hasUnterminatedQuote(false)
+// Empty elements have no text at all.
+PMMLArrayIterator::PMMLArrayIterator(const char * content) : m_endPtr(content ? content + strlen(content) : nullptr), m_upto(content ? content : m_endPtr),
+    m_hasUnterminatedQuote(false)
 {
     getNext();
 }
@@ -314,3 +325,65 @@ PMMLArrayIterator PMMLArrayIterator::operator++(int)
     return oldVal;
 }
 
+bool PMMLArrayIterator::asNumber(double & value) const
+{
+    // Most numbers are plain decimals with few enough digits that the value can be worked out exactly with one
+    // multiplication or division, as both the digits and the power of ten fit in a double. Anything else is left to strtod.
+    static const double POWERS_OF_TEN[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18,
+                                           1e19, 1e20, 1e21, 1e22};
+    const uint64_t MAX_EXACT_MANTISSA = uint64_t(1) << 53;
+    const char * upto = m_stringStart;
+    const bool negative = upto != m_upto && *upto == '-';
+    if (upto != m_upto && (*upto == '-' || *upto == '+'))
+    {
+        upto++;
+    }
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool hasDigits = false;
+    bool exact = true;
+    bool seenPoint = false;
+    for (; upto != m_upto; ++upto)
+    {
+        if (*upto >= '0' && *upto <= '9')
+        {
+            hasDigits = true;
+            exact = exact && mantissa <= (MAX_EXACT_MANTISSA - 9) / 10;
+            mantissa = mantissa * 10 + uint64_t(*upto - '0');
+            exponent -= seenPoint;
+        }
+        else if (*upto == '.' && !seenPoint)
+        {
+            seenPoint = true;
+        }
+        else
+        {
+            break;
+        }
+    }
+    if (upto != m_upto && (*upto == 'e' || *upto == 'E') && m_upto - upto > 1)
+    {
+        const bool negativeExponent = upto[1] == '-';
+        upto += upto[1] == '-' || upto[1] == '+' ? 2 : 1;
+        const char * exponentStart = upto;
+        int written = 0;
+        for (; upto != m_upto && *upto >= '0' && *upto <= '9' && written < 100; ++upto)
+        {
+            written = written * 10 + (*upto - '0');
+        }
+        exponent += negativeExponent ? -written : written;
+        exact = exact && upto != exponentStart;
+    }
+    if (hasDigits && exact && upto == m_upto && exponent >= -22 && exponent <= 22)
+    {
+        value = exponent < 0 ? double(mantissa) / POWERS_OF_TEN[-exponent] : double(mantissa) * POWERS_OF_TEN[exponent];
+        value = negative ? -value : value;
+        return true;
+    }
+
+    // Every element is followed by a space, a quote or the end of the text, none of which can be part of a number, so
+    // strtod stops at the end of the element without needing a terminated copy of it.
+    char * end;
+    value = strtod(m_stringStart, &end);
+    return m_stringStart != m_upto && end == m_upto;
+}
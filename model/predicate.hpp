@@ -45,6 +45,8 @@ public:
     bool hasUnterminatedQuote() const { return m_hasUnterminatedQuote; }
     const char * stringStart() const { return m_stringStart; }
     const char * stringEnd() const { return m_upto; }
+    // This reads the current element as a number where it lies, without copying it. Returns false if it isn't one.
+    bool asNumber(double & value) const;
 };
 
 namespace Predicate
@@ -18,6 +18,7 @@
 #include "regressionmodel.hpp"
 #include "ast.hpp"
 #include "conversioncontext.hpp"
+#include "native/linearmodel.hpp"
 #include <algorithm>
 
 
@@ -414,6 +415,16 @@ bool RegressionModel::parse(AstBuilder & builder, const tinyxml2::XMLElement * n
             }
             normalizeTable(builder, normMethod, false);
             builder.declare(config.outputValueName, AstBuilder::HAS_INITIAL_VALUE);
+
+            // The same prediction can also be computed natively, if asked for. This is in addition to the generated code.
+            if (builder.context().capturesNativeModels())
+            {
+                auto model = std::make_shared<LinearModel::Model>();
+                if (LinearModel::flattenRegressionModel(builder.context(), node, *model))
+                {
+                    builder.context().addLinearModel(config.outputValueName, model);
+                }
+            }
         }
         else
         {
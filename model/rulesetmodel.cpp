@@ -140,10 +140,10 @@ bool RulesetModel::parse(AstBuilder & builder, const tinyxml2::XMLElement * node
     }
     
     size_t ifChainSize = 0;
-    for (const Rule & rule : rules)
+    for (Rule & rule : rules)
     {
-        builder.pushNode(rule.value);
-        builder.pushNode(rule.predicate);
+        builder.pushNode(std::move(rule.value));
+        builder.pushNode(std::move(rule.predicate));
         ifChainSize += 2;
     }
     
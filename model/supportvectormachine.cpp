@@ -20,10 +20,34 @@
 #include "predicate.hpp"
 #include "transformation.hpp"
 #include "regressionmodel.hpp"
+#include <algorithm>
+#include <assert.h>
 #include <vector>
 
-// Note: the value is a string to prevent converting to and from double and losing precision
-typedef std::unordered_map<size_t, std::string> SupportVector;
+// Note: the value is kept as the text it was written as, to prevent converting to and from double and losing precision.
+// The text is in the document, so it is only valid while the model is being parsed. A streamed segment is freed as soon as
+// it has been parsed.
+struct SupportVectorElement
+{
+    size_t index;
+    const char * value;
+    size_t length;
+};
+// The non-zero elements of a vector, in order of index. In debug builds each thread counts those it has alive, so that
+// SupportVectorMachine::parse can check that none are kept once the model has been parsed.
+struct SupportVector : std::vector<SupportVectorElement>
+{
+#ifndef NDEBUG
+    static thread_local size_t liveCount;
+    SupportVector() { ++liveCount; }
+    SupportVector(const SupportVector & other) : std::vector<SupportVectorElement>(other) { ++liveCount; }
+    SupportVector & operator=(const SupportVector &) = default;
+    ~SupportVector() { --liveCount; }
+#endif
+};
+#ifndef NDEBUG
+thread_local size_t SupportVector::liveCount = 0;
+#endif
 
 class SVMKernel
 {
@@ -39,10 +63,10 @@ public:
     void apply(AstBuilder & builder, const std::vector<AstNode> & fields, const SupportVector & vector) const final
     {
         size_t toSum = 0;
-        for (SupportVector::const_iterator iter = vector.begin(); iter != vector.end(); ++iter)
+        for (const SupportVectorElement & element : vector)
         {
-            builder.pushNode(fields[iter->first]);
-            builder.constant(iter->second, PMMLDocument::TYPE_NUMBER);
+            builder.pushNode(fields[element.index]);
+            builder.constant(element.value, element.length, PMMLDocument::TYPE_NUMBER);
             builder.function(Function::functionTable.names.times, 2);
             toSum++;
         }
@@ -88,10 +112,10 @@ public:
             toSum++;
         }
         
-        for (SupportVector::const_iterator iter = vector.begin(); iter != vector.end(); ++iter)
+        for (const SupportVectorElement & element : vector)
         {
-            builder.pushNode(fields[iter->first]);
-            builder.constant(iter->second, PMMLDocument::TYPE_NUMBER);
+            builder.pushNode(fields[element.index]);
+            builder.constant(element.value, element.length, PMMLDocument::TYPE_NUMBER);
             builder.function(Function::functionTable.names.times, 2);
             toSum++;
         }
@@ -128,14 +152,15 @@ public:
     {
         size_t toSum = 0;
         size_t vectorIndex = 0;
+        SupportVector::const_iterator element = vector.begin();
         // This is a little bit different from other basis functions in that elements of 0 cannot be ignored
         for (std::vector<AstNode>::const_iterator iter = fields.begin(); iter != fields.end(); ++iter, vectorIndex++)
         {
             builder.pushNode(*iter);
-            auto foundElement = vector.find(vectorIndex);
-            if (foundElement != vector.end())
+            if (element != vector.end() && element->index == vectorIndex)
             {
-                builder.constant(foundElement->second, PMMLDocument::TYPE_NUMBER);
+                builder.constant(element->value, element->length, PMMLDocument::TYPE_NUMBER);
+                ++element;
             }
             else
             {
@@ -192,10 +217,10 @@ public:
             toSum++;
         }
         
-        for (SupportVector::const_iterator iter = vector.begin(); iter != vector.end(); ++iter)
+        for (const SupportVectorElement & element : vector)
         {
-            builder.pushNode(fields[iter->first]);
-            builder.constant(iter->second, PMMLDocument::TYPE_NUMBER);
+            builder.pushNode(fields[element.index]);
+            builder.constant(element.value, element.length, PMMLDocument::TYPE_NUMBER);
             builder.function(Function::functionTable.names.times, 2);
             toSum++;
         }
@@ -236,17 +261,16 @@ bool readVectorInstances(AstBuilder & builder, std::unordered_map<std::string, S
             size_t index = 0;
             for (PMMLArrayIterator iterator(array->GetText()); iterator.isValid(); ++iterator, ++index)
             {
-                char * end;
-                std::string thisString(iterator.stringStart(), iterator.stringEnd() - iterator.stringStart());
-                double value = strtod(thisString.c_str(), &end);
-                if (*end != '\0')
+                double value;
+                if (!iterator.asNumber(value))
                 {
+                    std::string thisString(iterator.stringStart(), iterator.stringEnd() - iterator.stringStart());
                     builder.parsingError("Error parsing number: %s", thisString.c_str(), vectorInstance->GetLineNum());
                     return false;
                 }
                 if (value != 0)
                 {
-                    newVector[index] = thisString;
+                    newVector.push_back(SupportVectorElement{index, iterator.stringStart(), size_t(iterator.stringEnd() - iterator.stringStart())});
                 }
             }
         }
@@ -296,20 +320,31 @@ bool readVectorInstances(AstBuilder & builder, std::unordered_map<std::string, S
             PMMLArrayIterator iterator(entries->GetText());
             for (; iterator.isValid() && indexIterator != indexVector.end(); ++iterator, ++indexIterator)
             {
-                char * end;
-                std::string thisString(iterator.stringStart(), iterator.stringEnd() - iterator.stringStart());
-                double value = strtod(thisString.c_str(), &end);
-                if (*end != '\0')
+                double value;
+                if (!iterator.asNumber(value))
                 {
+                    std::string thisString(iterator.stringStart(), iterator.stringEnd() - iterator.stringStart());
                     builder.parsingError("Error parsing number: %s", thisString.c_str(), vectorInstance->GetLineNum());
                     return false;
                 }
                 if (value != 0)
                 {
-                    newVector[*indexIterator] = thisString;
+                    newVector.push_back(SupportVectorElement{*indexIterator, iterator.stringStart(), size_t(iterator.stringEnd() - iterator.stringStart())});
                 }
             }
             
+            // Indices may come in any order. Where one is repeated, the last value given for it is used.
+            std::stable_sort(newVector.begin(), newVector.end(), [](const SupportVectorElement & a, const SupportVectorElement & b) { return a.index < b.index; });
+            SupportVector::iterator kept = newVector.begin();
+            for (SupportVector::const_iterator element = newVector.begin(); element != newVector.end(); ++element)
+            {
+                if (element + 1 == newVector.end() || (element + 1)->index != element->index)
+                {
+                    *kept++ = *element;
+                }
+            }
+            newVector.erase(kept, newVector.end());
+            
             if (indexIterator != indexVector.end())
             {
                 builder.parsingError("Not enough values for space array", sparseArray->GetLineNum());
@@ -683,9 +718,8 @@ bool parseWithKernel(AstBuilder & builder, const tinyxml2::XMLElement * node, co
     }
 }
 
-bool SupportVectorMachine::parse(AstBuilder & builder, const tinyxml2::XMLElement * node, PMMLDocument::ModelConfig & config)
+bool parseAnyKernel(AstBuilder & builder, const tinyxml2::XMLElement * node, PMMLDocument::ModelConfig & config)
 {
-    ASSERT_AST_BUILDER_ONE_NEW_NODE(builder);
     if (node->FirstChildElement("LinearKernelType"))
     {
         LinearKernel kernel;
@@ -725,3 +759,11 @@ bool SupportVectorMachine::parse(AstBuilder & builder, const tinyxml2::XMLElemen
     }
 }
 
+bool SupportVectorMachine::parse(AstBuilder & builder, const tinyxml2::XMLElement * node, PMMLDocument::ModelConfig & config)
+{
+    ASSERT_AST_BUILDER_ONE_NEW_NODE(builder);
+    const bool parsed = parseAnyKernel(builder, node, config);
+    // The values of support vectors point into the document, which may be freed once this returns.
+    assert(SupportVector::liveCount == 0);
+    return parsed;
+}
@@ -78,13 +78,13 @@ namespace
         }
         return true;
     }
-    
+}
+
     // sklearn models do not understand mapMissingTo... we use the default value here.
     const char * mapMissingToAttr(const AstBuilder & builder)
     {
         return builder.context().getApplication() == "JPMML-SkLearn" ? "defaultValue" : "mapMissingTo";
     }
-}
 
     // This tells you what a value is from the type name
     ExpressionType getExpressionTypeFromString(const char * name)
@@ -1362,11 +1362,12 @@ namespace
                 builder.function(Function::functionTable.names.fnAnd, nodes);
             }
             // Put the function back in place (after the predicate, if there is one)
-            builder.pushNode(myFunction);
+            const PMMLDocument::FieldType functionType = myFunction.type;
+            builder.pushNode(std::move(myFunction));
             if (nodes > 0)
             {
                 // If there is a predicate, build a ternary to switch between this and the replacement
-                builder.constant(mapMissingTo, myFunction.type);
+                builder.constant(mapMissingTo, functionType);
                 builder.function(Function::functionTable.names.ternary, 3);
             }
         }
@@ -1464,45 +1465,48 @@ bool Transformation::parseTransformationDictionary(AstBuilder & builder, const t
 
 // Transformations in the TransformationDictionary are just definitions. They need to be included into each model according to that model's mining schema.
 // This is particularly important if a mining schema (for instance) sets a default value or bounds.
+// Expressions can be nested very deeply, so this keeps its own stack of where it is up to in each node, rather than recursing.
 bool importElement(AstBuilder & builder, const AstNode & source)
 {
-    if (source.function().functionType == Function::FIELD_REF)
-    {
-        // References to fields need to be resolved to follow the mining schema.
-        if (const PMMLDocument::MiningField * fieldDefinition = builder.context().getMiningField(source.content))
-        {
-            builder.field(fieldDefinition);
-        }
-        else
-        {
-            // If this cannot be expressed in terms of the mining schema, it isn't an error. The derived field simply will not be available for this model.
-            // This is quite expected as there is no way of saying which derived fields you actually need in this model.
-            // If someone tries to use that derived field inside this model, it will cause an error.
-            return false;
-        }
-    }
-    else
+    const size_t startingStackSize = builder.stackSize();
+    // Each node that is being copied in, and how many of its children have been copied in so far.
+    std::vector<std::pair<const AstNode *, size_t>> toImport(1, std::make_pair(&source, size_t(0)));
+    while (!toImport.empty())
     {
-        // Otherwise, it's something algebraic, so this will recurse to deep-copy in this operation (with field references fixed).
-        int traversed = 0;
-        for (auto & child : source.children)
+        const AstNode & node = *toImport.back().first;
+        if (node.function().functionType == Function::FIELD_REF)
         {
-            if (importElement(builder, child))
+            // References to fields need to be resolved to follow the mining schema.
+            if (const PMMLDocument::MiningField * fieldDefinition = builder.context().getMiningField(node.content))
             {
-                traversed++;
+                builder.field(fieldDefinition);
             }
             else
             {
+                // If this cannot be expressed in terms of the mining schema, it isn't an error. The derived field simply will not be available for this model.
+                // This is quite expected as there is no way of saying which derived fields you actually need in this model.
+                // If someone tries to use that derived field inside this model, it will cause an error.
                 // One misstep and it needs to roll itself back. This does not always indicate an error, just that the transformation is unavailable in this model.
-                while(traversed-- > 0)
+                while (builder.stackSize() > startingStackSize)
                 {
                     builder.popNode();
                 }
                 return false;
             }
+            toImport.pop_back();
+        }
+        else if (toImport.back().second < node.children.size())
+        {
+            // Otherwise, it's something algebraic, so this will deep-copy in this operation (with field references fixed), children first.
+            const AstNode & child = node.children[toImport.back().second++];
+            toImport.emplace_back(&child, 0);
+        }
+        else
+        {
+            // This copies the node in.
+            builder.customNode(node.function(), node.type, node.content, node.children.size());
+            toImport.pop_back();
         }
-        // This copies the node in.
-        builder.customNode(source.function(), source.type, source.content, traversed);
     }
     return true;
 }
@@ -83,6 +83,8 @@ namespace Transformation
         DENORMALIZE
     };
     bool parseNormContinuousBody(AstBuilder & builder, const tinyxml2::XMLElement * node, AstNode field, NormContinuousMode mode);
+    // The name of the attribute that holds the replacement for missing values in FieldRef and NormContinuous
+    const char * mapMissingToAttr(const AstBuilder & builder);
 }
 
 #endif /* transformation_hpp */
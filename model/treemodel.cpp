@@ -69,198 +69,222 @@ namespace
         TreeConfig(PMMLDocument::ModelConfig & c) : config(c) {}
     };
     
-    bool parseTreeNode(AstBuilder & builder, const tinyxml2::XMLElement * node, TreeConfig & config)
+    // parseTreeNode keeps one of these for each Node from the root down to the one it is parsing.
+    struct TreeNodeState
     {
-        ASSERT_AST_BUILDER_ONE_NEW_NODE(builder);
-        const tinyxml2::XMLElement * firstChildNode = node->FirstChildElement("Node");
+        const tinyxml2::XMLElement * node;
+        const char * defaultChildID;
+        bool foundDefaultChild = false;
+        size_t ifChainSize = 0;
+        std::vector<AstNode> savedPredicatesForNotFound;
+        // The child that is being parsed, or will be next. While its body is being parsed, its predicate is held here.
+        const tinyxml2::XMLElement * childNode;
+        bool parsingChild = false;
+        bool isDefaultChild = false;
+        AstNode predicateNode = AstNode::invalidNode;
+
+        TreeNodeState(const tinyxml2::XMLElement * n, const tinyxml2::XMLElement * firstChildNode) :
+            node(n),
+            defaultChildID(n->Attribute("defaultChild")),
+            childNode(firstChildNode)
+        {
+        }
+    };
+
+    // This parses the predicate of state.childNode, and anything that goes in the if-chain before its body.
+    bool startTreeNodeChild(AstBuilder & builder, TreeNodeState & state, TreeConfig & config)
+    {
+        const tinyxml2::XMLElement * childNode = state.childNode;
+        const char * thisID = childNode->Attribute("id");
+        state.isDefaultChild = config.missingValueStrategy == MVS_DEFAULTCHILD && state.defaultChildID && thisID && strcmp(thisID, state.defaultChildID) == 0;
         
-        if (firstChildNode == nullptr)
+        const tinyxml2::XMLElement * predicate = PMMLDocument::skipExtensions(childNode->FirstChildElement());
+        if (predicate == nullptr)
         {
-            // Leaf node.
-            return TreeModel::writeScore(builder, node, config.config, config.totalNumberOfRecords);
+            builder.parsingError("Tree node without predicate", childNode->GetLineNum());
+            return false;
         }
         
-        const char * defaultChildID = node->Attribute("defaultChild");
-        bool foundDefaultChild = false;
+        if (!Predicate::parse(builder, predicate))
+        {
+            return false;
+        }
         
-        size_t ifChainSize = 0;
-
-        std::vector<AstNode> savedPredicatesForNotFound;
-        for (const tinyxml2::XMLElement * childNode = firstChildNode; childNode; childNode = childNode->NextSiblingElement("Node"))
+        state.predicateNode = builder.popNode();
+        
+        if (config.missingValueStrategy == MVS_LASTPREDICTION ||
+            config.missingValueStrategy == MVS_NULLPREDICTION)
         {
-            const char * thisID = childNode->Attribute("id");
-            bool isDefaultChild = config.missingValueStrategy == MVS_DEFAULTCHILD && defaultChildID && thisID && strcmp(thisID, defaultChildID) == 0;
-            
-            const tinyxml2::XMLElement * predicate = PMMLDocument::skipExtensions(childNode->FirstChildElement());
-            if (predicate == nullptr)
+            // If last prediction, we will output the value of THIS node in the null value clause
+            if (config.missingValueStrategy == MVS_LASTPREDICTION)
             {
-                builder.parsingError("Tree node without predicate", childNode->GetLineNum());
-                return false;
+                if (!TreeModel::writeScore(builder, state.node, config.config, config.totalNumberOfRecords))
+                {
+                    return false;
+                }
             }
-            
-            if (!Predicate::parse(builder, predicate))
+            else // missingValueStrategy == MVS_NULLPREDICTION
             {
-                return false;
+                // Instead of explicitly setting anything to null... just add an empty block to the if-chain
+                builder.block(0);
             }
+            builder.pushNode(state.predicateNode);
+            builder.function(Function::functionTable.names.isMissing, 1);
+            state.ifChainSize += 2; // One for the body, one for the predicate.
+        }
+        return true;
+    }
+
+    // Once the body of state.childNode has been parsed, this adds it to the if-chain along with its predicate.
+    void finishTreeNodeChild(AstBuilder & builder, TreeNodeState & state, TreeConfig & config)
+    {
+        const tinyxml2::XMLElement * childNode = state.childNode;
+        const bool isDefaultChild = state.isDefaultChild;
+        AstNode & predicateNode = state.predicateNode;
+        std::vector<AstNode> & savedPredicatesForNotFound = state.savedPredicatesForNotFound;
+
+        // Add a penalty clause.
+        if (config.missingValuePenalty && (predicateNode.function().functionType == Function::SURROGATE_MACRO || isDefaultChild))
+        {
+            // Multiply by the penalty
+            builder.field(config.totalMissingValuePenalty);
+            builder.constant(config.missingValuePenalty, PMMLDocument::TYPE_NUMBER);
+            builder.function(Function::functionTable.names.times, 2);
+            builder.assign(config.totalMissingValuePenalty);
             
-            AstNode predicateNode = builder.popNode();
+            // Predicate
+            size_t numThingsToGoWrong = 0;
+            // This could be a surrogate where the first thing is unknown
+            if (predicateNode.function().functionType == Function::SURROGATE_MACRO)
+            {
+                builder.pushNode(predicateNode.children[0]);
+                builder.function(Function::functionTable.names.isMissing, 1);
+                numThingsToGoWrong++;
+            }
             
-            if (config.missingValueStrategy == MVS_LASTPREDICTION ||
-                config.missingValueStrategy == MVS_NULLPREDICTION)
+            if (isDefaultChild)
             {
-                // If last prediction, we will output the value of THIS node in the null value clause
-                if (config.missingValueStrategy == MVS_LASTPREDICTION)
-                {
-                    if (!TreeModel::writeScore(builder, node, config.config, config.totalNumberOfRecords))
-                    {
-                        return false;
-                    }
-                }
-                else // missingValueStrategy == MVS_NULLPREDICTION
+                // Something before this could have been missing
+                for (const AstNode & savedPredicateNode : savedPredicatesForNotFound)
                 {
-                    // Instead of explicitly setting anything to null... just add an empty block to the if-chain
-                    builder.block(0);
+                    builder.pushNode(savedPredicateNode);
+                    builder.function(Function::functionTable.names.isMissing, 1);
                 }
+                
+                // Or this node itself could be missing or false (indicating something after was missing)
                 builder.pushNode(predicateNode);
-                builder.function(Function::functionTable.names.isMissing, 1);
-                ifChainSize += 2; // One for the body, one for the predicate.
-            }
-
-            // Add body.
-            if (!parseTreeNode(builder, childNode, config))
-            {
-                return false;
+                builder.defaultValue("false");
+                builder.function(Function::functionTable.names.fnNot, 1);
+                numThingsToGoWrong += savedPredicatesForNotFound.size() + 1;
             }
             
-            // Add a penalty clause.
-            if (config.missingValuePenalty && (predicateNode.function().functionType == Function::SURROGATE_MACRO || isDefaultChild))
+            builder.function(Function::functionTable.names.fnOr, numThingsToGoWrong);
+            builder.ifChain(2);
+            
+            // Stick it after the body
+            builder.block(2);
+        }
+        
+        // Add predicate. Only keep a copy if it is needed for the conditions of later children.
+        const bool savePredicate = config.missingValueStrategy == MVS_AGGREGATENODES ||
+                                   config.missingValueStrategy == MVS_WEIGHTEDCONFIDENCE ||
+                                   (config.missingValueStrategy == MVS_DEFAULTCHILD && !isDefaultChild && !state.foundDefaultChild);
+        if (savePredicate)
+        {
+            builder.pushNode(predicateNode);
+        }
+        else
+        {
+            builder.pushNode(std::move(predicateNode));
+        }
+        state.ifChainSize += 2;  // One for the body, one for the predicate.
+        
+        // These types evaluate all missing branches
+        if (config.missingValueStrategy == MVS_AGGREGATENODES ||
+            config.missingValueStrategy == MVS_WEIGHTEDCONFIDENCE)
+        {
+            builder.defaultValue("true");
+            // We may need to put an inverse condition after, so save a copy
+            savedPredicatesForNotFound.push_back(std::move(predicateNode));
+            // These modes use seperate if statements, not a chain
+            builder.ifChain(2);
+            state.ifChainSize--; // It's now just one node per condition
+        }
+        else if (config.missingValueStrategy == MVS_DEFAULTCHILD)
+        {
+            if (isDefaultChild)
             {
-                // Multiply by the penalty
-                builder.field(config.totalMissingValuePenalty);
-                builder.constant(config.missingValuePenalty, PMMLDocument::TYPE_NUMBER);
-                builder.function(Function::functionTable.names.times, 2);
-                builder.assign(config.totalMissingValuePenalty);
+                state.foundDefaultChild = true;
                 
-                // Predicate
-                size_t numThingsToGoWrong = 0;
-                // This could be a surrogate where the first thing is unknown
-                if (predicateNode.function().functionType == Function::SURROGATE_MACRO)
+                // Default child handles the case if its own predicate is unknown
+                builder.defaultValue("true");
+
+                // Or if any previous conditions are missing
+                for (const AstNode & savedPredicateNode : savedPredicatesForNotFound)
                 {
-                    builder.pushNode(predicateNode.children[0]);
+                    builder.pushNode(savedPredicateNode);
                     builder.function(Function::functionTable.names.isMissing, 1);
-                    numThingsToGoWrong++;
                 }
                 
-                if (isDefaultChild)
+                size_t trailingThings = 0;
+                // As well as future conditions... with the caveat that if a branch WAS taken, it doesn't matter if anything beyond it is unknown
+                // build something like isMissing(conditionB) or (not conditionB and (isMissing(conditionC) or not conditionC))... etc.
+                for (const tinyxml2::XMLElement * nextChildNode = childNode->NextSiblingElement("Node"); nextChildNode; nextChildNode = nextChildNode->NextSiblingElement("Node"))
                 {
-                    // Something before this could have been missing
-                    for (const AstNode & savedPredicateNode : savedPredicatesForNotFound)
+                    const tinyxml2::XMLElement * nextPredicate = PMMLDocument::skipExtensions(childNode->FirstChildElement());
+                    if (Predicate::parse(builder, nextPredicate))
                     {
-                        builder.pushNode(savedPredicateNode);
+                        AstNode nextPredicateNode = builder.topNode();
                         builder.function(Function::functionTable.names.isMissing, 1);
+                        builder.pushNode(std::move(nextPredicateNode));
+                        builder.defaultValue("false");
+                        builder.function(Function::functionTable.names.fnNot, 1);
+                        ++trailingThings;
                     }
-                    
-                    // Or this node itself could be missing or false (indicating something after was missing)
-                    builder.pushNode(predicateNode);
-                    builder.defaultValue("false");
-                    builder.function(Function::functionTable.names.fnNot, 1);
-                    numThingsToGoWrong += savedPredicatesForNotFound.size() + 1;
                 }
                 
-                builder.function(Function::functionTable.names.fnOr, numThingsToGoWrong);
-                builder.ifChain(2);
+                // There will be a trailing not(condition) at the end... kill it
+                if (trailingThings > 0)
+                {
+                    builder.popNode();
+                }
                 
-                // Stick it after the body
-                builder.block(2);
-            }
-            
-            // Add predicate
-            builder.pushNode(predicateNode);
-            ifChainSize += 2;  // One for the body, one for the predicate.
-            
-            // These types evaluate all missing branches
-            if (config.missingValueStrategy == MVS_AGGREGATENODES ||
-                config.missingValueStrategy == MVS_WEIGHTEDCONFIDENCE)
-            {
-                builder.defaultValue("true");
-                // We may need to put an inverse condition after, so save a copy
-                savedPredicatesForNotFound.push_back(predicateNode);
-                // These modes use seperate if statements, not a chain
-                builder.ifChain(2);
-                ifChainSize--; // It's now just one node per condition
+                while (trailingThings > 1)
+                {
+                    builder.function(Function::functionTable.names.fnOr, 2);
+                    trailingThings--;
+                    if (trailingThings > 1)
+                        builder.function(Function::functionTable.names.fnAnd, 2);
+                }
+                
+                // Build the final or statement. The condition itself is true, or anything before it is unknown, or anything after it is unknown.
+                builder.function(Function::functionTable.names.fnOr, 1 + savedPredicatesForNotFound.size() + trailingThings);
             }
-            else if (config.missingValueStrategy == MVS_DEFAULTCHILD)
+            else if (!state.foundDefaultChild)
             {
-                if (isDefaultChild)
+                // Before the default child, we need to make sure we don't automatically drop into any other conditions
+                if (!savedPredicatesForNotFound.empty())
                 {
-                    foundDefaultChild = true;
-                    
-                    // Default child handles the case if its own predicate is unknown
-                    builder.defaultValue("true");
-
-                    // Or if any previous conditions are missing
                     for (const AstNode & savedPredicateNode : savedPredicatesForNotFound)
                     {
                         builder.pushNode(savedPredicateNode);
-                        builder.function(Function::functionTable.names.isMissing, 1);
-                    }
-                    
-                    size_t trailingThings = 0;
-                    // As well as future conditions... with the caveat that if a branch WAS taken, it doesn't matter if anything beyond it is unknown
-                    // build something like isMissing(conditionB) or (not conditionB and (isMissing(conditionC) or not conditionC))... etc.
-                    for (const tinyxml2::XMLElement * nextChildNode = childNode->NextSiblingElement("Node"); nextChildNode; nextChildNode = nextChildNode->NextSiblingElement("Node"))
-                    {
-                        const tinyxml2::XMLElement * nextPredicate = PMMLDocument::skipExtensions(childNode->FirstChildElement());
-                        if (Predicate::parse(builder, nextPredicate))
-                        {
-                            AstNode nextPredicateNode = builder.topNode();
-                            builder.function(Function::functionTable.names.isMissing, 1);
-                            builder.pushNode(nextPredicateNode);
-                            builder.defaultValue("false");
-                            builder.function(Function::functionTable.names.fnNot, 1);
-                            ++trailingThings;
-                        }
-                    }
-                    
-                    // There will be a trailing not(condition) at the end... kill it
-                    if (trailingThings > 0)
-                    {
-                        builder.popNode();
-                    }
-                    
-                    while (trailingThings > 1)
-                    {
-                        builder.function(Function::functionTable.names.fnOr, 2);
-                        trailingThings--;
-                        if (trailingThings > 1)
-                            builder.function(Function::functionTable.names.fnAnd, 2);
-                    }
-                    
-                    // Build the final or statement. The condition itself is true, or anything before it is unknown, or anything after it is unknown.
-                    builder.function(Function::functionTable.names.fnOr, 1 + savedPredicatesForNotFound.size() + trailingThings);
-                }
-                else if (!foundDefaultChild)
-                {
-                    // Before the default child, we need to make sure we don't automatically drop into any other conditions
-                    if (!savedPredicatesForNotFound.empty())
-                    {
-                        for (const AstNode & savedPredicateNode : savedPredicatesForNotFound)
-                        {
-                            builder.pushNode(savedPredicateNode);
-                            builder.function(Function::functionTable.names.isNotMissing, 1);
-                        }
-                        builder.function(Function::functionTable.names.fnAnd, savedPredicatesForNotFound.size() + 1);
+                        builder.function(Function::functionTable.names.isNotMissing, 1);
                     }
-                    // Save it for the predecate for NOT FOUND
-                    savedPredicatesForNotFound.push_back(predicateNode);
+                    builder.function(Function::functionTable.names.fnAnd, savedPredicatesForNotFound.size() + 1);
                 }
+                // Save it for the predecate for NOT FOUND
+                savedPredicatesForNotFound.push_back(std::move(predicateNode));
             }
-            
         }
+    }
 
+    // Once every child of state.node has been added, this finishes off its if-chain.
+    bool finishTreeNode(AstBuilder & builder, TreeNodeState & state, TreeConfig & config)
+    {
+        size_t ifChainSize = state.ifChainSize;
         if (config.returnLastPrediction)
         {
-            if (!TreeModel::writeScore(builder, node, config.config, config.totalNumberOfRecords))
+            if (!TreeModel::writeScore(builder, state.node, config.config, config.totalNumberOfRecords))
             {
                 return false;
             }
@@ -270,11 +294,12 @@ namespace
             if (config.missingValueStrategy == MVS_AGGREGATENODES ||
                 config.missingValueStrategy == MVS_WEIGHTEDCONFIDENCE)
             {
-                for (const AstNode & savedPredicateNode : savedPredicatesForNotFound)
+                // This is the last use of them, so they can be moved.
+                for (AstNode & savedPredicateNode : state.savedPredicatesForNotFound)
                 {
-                    builder.pushNode(savedPredicateNode);
+                    builder.pushNode(std::move(savedPredicateNode));
                 }
-                builder.function(Function::functionTable.names.fnOr, savedPredicatesForNotFound.size());
+                builder.function(Function::functionTable.names.fnOr, state.savedPredicatesForNotFound.size());
                 builder.function(Function::functionTable.names.fnNot, 1);
                 builder.ifChain(2);
             }
@@ -292,6 +317,63 @@ namespace
         }
         return true;
     }
+
+    // Trees can be thousands of levels deep, so rather than recursing for the body of each child, this keeps the state of
+    // every Node from node down to the one being parsed.
+    bool parseTreeNode(AstBuilder & builder, const tinyxml2::XMLElement * node, TreeConfig & config)
+    {
+        ASSERT_AST_BUILDER_ONE_NEW_NODE(builder);
+        std::vector<TreeNodeState> parents;
+        const tinyxml2::XMLElement * next = node;
+        for (;;)
+        {
+            const tinyxml2::XMLElement * firstChildNode = next->FirstChildElement("Node");
+            if (firstChildNode == nullptr)
+            {
+                // Leaf node.
+                if (!TreeModel::writeScore(builder, next, config.config, config.totalNumberOfRecords))
+                {
+                    return false;
+                }
+            }
+            else
+            {
+                parents.emplace_back(next, firstChildNode);
+            }
+
+            // Finish off each Node that has no children left, until there's a child to parse the body of.
+            for (;;)
+            {
+                if (parents.empty())
+                {
+                    return true;
+                }
+                TreeNodeState & state = parents.back();
+                if (state.parsingChild)
+                {
+                    finishTreeNodeChild(builder, state, config);
+                    state.parsingChild = false;
+                    state.childNode = state.childNode->NextSiblingElement("Node");
+                }
+                if (state.childNode == nullptr)
+                {
+                    if (!finishTreeNode(builder, state, config))
+                    {
+                        return false;
+                    }
+                    parents.pop_back();
+                    continue;
+                }
+                if (!startTreeNodeChild(builder, state, config))
+                {
+                    return false;
+                }
+                state.parsingChild = true;
+                next = state.childNode;
+                break;
+            }
+        }
+    }
     
     void assignOrIncrement(AstBuilder & builder, PMMLDocument::ConstFieldDescriptionPtr field, bool doIncrement)
     {
@@ -0,0 +1,438 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "linearmodel.hpp"
+#include "conversioncontext.hpp"
+#include "document.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace
+{
+    // The link function is applied to this many rows at a time, while their linear predictors are still in cache.
+    const size_t BLOCK_SIZE = 256;
+
+    // The dot product is split into this many independent sums, so that it can be done with vector instructions without
+    // relying on the compiler reordering floating point additions.
+    const size_t LANES = 4;
+
+    // This is the same as the erf approximation that the generated code uses for stdNormalCDF (see writeErfGuts)
+    const double MAGIC_VALUE_FOR_ERF = 0.147;
+
+    struct Term
+    {
+        double coefficient;
+        std::vector<std::pair<PMMLDocument::ConstFieldDescriptionPtr, double>> factors;
+        bool missingIsZero;
+    };
+
+    // Only raw numeric inputs can be passed straight through as doubles.
+    bool findFeature(const PMMLDocument::ConversionContext & context, const char * name, PMMLDocument::ConstFieldDescriptionPtr & out)
+    {
+        if (name == nullptr)
+        {
+            return false;
+        }
+        const PMMLDocument::MiningField * miningField = context.getMiningField(name);
+        if (miningField == nullptr || miningField->hasReplacementValue ||
+            miningField->outlierTreatment != PMMLDocument::OUTLIER_TREATMENT_AS_IS ||
+            miningField->variable->origin != PMMLDocument::ORIGIN_DATA_DICTIONARY ||
+            miningField->variable->field.dataType != PMMLDocument::TYPE_NUMBER)
+        {
+            return false;
+        }
+        out = miningField->variable;
+        return true;
+    }
+
+    bool isRegression(const tinyxml2::XMLElement * node)
+    {
+        const char * functionName = node->Attribute("functionName");
+        // Targets would rescale the output after it has been written.
+        return functionName != nullptr && strcmp(functionName, "regression") == 0 && node->FirstChildElement("Targets") == nullptr;
+    }
+
+    // This lays out the terms in the model. Terms that are just a coefficient times a column go into the dense coefficient
+    // vector, and so their columns come first.
+    void assemble(const std::vector<Term> & terms, LinearModel::Model & model)
+    {
+        std::unordered_map<const PMMLDocument::FieldDescription *, uint32_t> columns;
+        auto column = [&model, &columns](const PMMLDocument::ConstFieldDescriptionPtr & field)
+        {
+            auto inserted = columns.emplace(field.get(), static_cast<uint32_t>(model.features.size()));
+            if (inserted.second)
+            {
+                model.features.push_back(field);
+            }
+            return inserted.first->second;
+        };
+
+        for (const Term & term : terms)
+        {
+            if (term.factors.size() == 1 && term.factors.front().second == 1 && term.missingIsZero == model.linearMissingIsZero)
+            {
+                const uint32_t index = column(term.factors.front().first);
+                model.coefficient.resize(model.features.size(), 0.0);
+                model.coefficient[index] += term.coefficient;
+            }
+        }
+
+        model.termStart.push_back(0);
+        for (const Term & term : terms)
+        {
+            if (term.factors.empty())
+            {
+                model.intercept += term.coefficient;
+            }
+            else if (term.factors.size() != 1 || term.factors.front().second != 1 || term.missingIsZero != model.linearMissingIsZero)
+            {
+                for (const auto & factor : term.factors)
+                {
+                    model.factorFeature.push_back(column(factor.first));
+                    model.factorExponent.push_back(factor.second);
+                }
+                model.termCoefficient.push_back(term.coefficient);
+                model.termMissingIsZero.push_back(term.missingIsZero);
+                model.termStart.push_back(static_cast<uint32_t>(model.factorFeature.size()));
+            }
+        }
+    }
+
+    template<bool missingIsZero>
+    double dotProduct(const double * coefficient, const double * values, size_t count)
+    {
+        double lanes[LANES] = {};
+        size_t i = 0;
+        for (; i + LANES <= count; i += LANES)
+        {
+            for (size_t lane = 0; lane < LANES; ++lane)
+            {
+                const double value = values[i + lane];
+                lanes[lane] += coefficient[i + lane] * ((missingIsZero && std::isnan(value)) ? 0.0 : value);
+            }
+        }
+
+        double sum = 0;
+        for (; i < count; ++i)
+        {
+            const double value = values[i];
+            sum += coefficient[i] * ((missingIsZero && std::isnan(value)) ? 0.0 : value);
+        }
+        for (size_t lane = 0; lane < LANES; ++lane)
+        {
+            sum += lanes[lane];
+        }
+        return sum;
+    }
+
+    // This is the native version of RegressionModel::normalizeTable, applied to a whole block at once.
+    void applyLink(RegressionModel::RegressionNormalizationMethod link, double * values, size_t count)
+    {
+        switch (link)
+        {
+            case RegressionModel::METHOD_CAUCHIT:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = std::atan(values[i]) * (1 / M_PI) + 0.5;
+                }
+                break;
+
+            case RegressionModel::METHOD_CLOGLOG:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = 1 - std::exp(-std::exp(values[i]));
+                }
+                break;
+
+            case RegressionModel::METHOD_LOGC:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = 1 - std::exp(values[i]);
+                }
+                break;
+
+            case RegressionModel::METHOD_EXP:
+            case RegressionModel::METHOD_LOG:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = std::exp(values[i]);
+                }
+                break;
+
+            case RegressionModel::METHOD_SOFTMAX:
+            case RegressionModel::METHOD_LOGIT:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = 1 / (std::exp(-values[i]) + 1);
+                }
+                break;
+
+            case RegressionModel::METHOD_LOGLOG:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = std::exp(-std::exp(-values[i]));
+                }
+                break;
+
+            case RegressionModel::METHOD_PROBIT:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    const double x = values[i] / std::sqrt(2.0);
+                    const double ax2 = MAGIC_VALUE_FOR_ERF * x * x;
+                    const double erfValue = std::sqrt(1 - std::exp(-(x * x) * (M_2_PI * 2 + ax2) / (1 + ax2)));
+                    values[i] = ((x < 0 ? -erfValue : erfValue) + 1) * 0.5;
+                }
+                break;
+
+            case RegressionModel::METHOD_NONE:
+            case RegressionModel::METHOD_IDENTITY:
+            case RegressionModel::METHOD_SIMPLEMAX:
+            case RegressionModel::METHOD_INVALID:
+                break;
+        }
+    }
+
+    // The same as readPredictorSet in generalregressionmodel.cpp
+    std::unordered_set<std::string> readPredictorSet(const tinyxml2::XMLElement * list)
+    {
+        std::unordered_set<std::string> predictorSet;
+        for (const tinyxml2::XMLElement * element = list ? list->FirstChildElement("Predictor") : nullptr;
+             element != nullptr; element = element->NextSiblingElement("Predictor"))
+        {
+            if (const char * name = element->Attribute("name"))
+            {
+                predictorSet.insert(name);
+            }
+        }
+        return predictorSet;
+    }
+
+    // The same as findPCellForTarget in generalregressionmodel.cpp, for PCells without a target category.
+    const tinyxml2::XMLElement * findCommonPCell(const tinyxml2::XMLElement * element)
+    {
+        while (element && element->Attribute("targetCategory"))
+        {
+            element = element->NextSiblingElement("PCell");
+        }
+        return element;
+    }
+}
+
+// This mirrors parseRegressionTable in regressionmodel.cpp
+bool LinearModel::flattenRegressionModel(const PMMLDocument::ConversionContext & context, const tinyxml2::XMLElement * node, Model & model)
+{
+    model = Model();
+    if (!isRegression(node))
+    {
+        return false;
+    }
+
+    if (const char * methodName = node->Attribute("normalizationMethod"))
+    {
+        model.link = RegressionModel::getRegressionNormalizationMethodFromString(methodName);
+        if (model.link == RegressionModel::METHOD_INVALID)
+        {
+            return false;
+        }
+    }
+
+    const tinyxml2::XMLElement * table = node->FirstChildElement("RegressionTable");
+    std::vector<Term> terms;
+    double intercept;
+    if (table == nullptr || table->QueryDoubleAttribute("intercept", &intercept))
+    {
+        return false;
+    }
+    terms.push_back(Term{intercept, {}, true});
+
+    for (const tinyxml2::XMLElement * element = PMMLDocument::skipExtensions(table->FirstChildElement());
+         element; element = PMMLDocument::skipExtensions(element->NextSiblingElement()))
+    {
+        double coefficient;
+        if (element->QueryDoubleAttribute("coefficient", &coefficient))
+        {
+            return false;
+        }
+
+        if (coefficient == 0)
+        {
+            // The generated code leaves these out, so a missing value in one doesn't matter.
+        }
+        else if (strcmp(element->Name(), "NumericPredictor") == 0)
+        {
+            Term term{coefficient, {}, true};
+            double exponent;
+            if (element->QueryDoubleAttribute("exponent", &exponent))
+            {
+                exponent = 1;
+            }
+            PMMLDocument::ConstFieldDescriptionPtr field;
+            if (!findFeature(context, element->Attribute("name"), field))
+            {
+                return false;
+            }
+            term.factors.emplace_back(field, exponent);
+            terms.push_back(std::move(term));
+        }
+        else if (strcmp(element->Name(), "PredictorTerm") == 0)
+        {
+            Term term{coefficient, {}, false};
+            for (const tinyxml2::XMLElement * fieldRef = element->FirstChildElement("FieldRef");
+                 fieldRef; fieldRef = fieldRef->NextSiblingElement("FieldRef"))
+            {
+                PMMLDocument::ConstFieldDescriptionPtr field;
+                if (!findFeature(context, fieldRef->Attribute("field"), field))
+                {
+                    return false;
+                }
+                term.factors.emplace_back(field, 1);
+            }
+            // A term with neither fields nor a coefficient is left out.
+            if (!term.factors.empty() || coefficient != 1)
+            {
+                terms.push_back(std::move(term));
+            }
+        }
+        else
+        {
+            // CategoricalPredictor compares against string values.
+            return false;
+        }
+    }
+
+    assemble(terms, model);
+    return true;
+}
+
+// This mirrors GeneralRegressionModel::parse, where each parameter is the product of its covariates.
+bool LinearModel::flattenGeneralRegressionModel(const PMMLDocument::ConversionContext & context, const tinyxml2::XMLElement * node, Model & model)
+{
+    model = Model();
+    model.linearMissingIsZero = false;
+    if (!isRegression(node))
+    {
+        return false;
+    }
+
+    if (const char * linkFunction = node->Attribute("linkFunction"))
+    {
+        model.link = RegressionModel::getRegressionNormalizationMethodFromString(linkFunction);
+        if (model.link == RegressionModel::METHOD_INVALID)
+        {
+            return false;
+        }
+    }
+
+    std::unordered_map<std::string, std::vector<std::pair<PMMLDocument::ConstFieldDescriptionPtr, double>>> parameters;
+    if (const tinyxml2::XMLElement * parameterList = node->FirstChildElement("ParameterList"))
+    {
+        for (const tinyxml2::XMLElement * element = parameterList->FirstChildElement("Parameter");
+             element != nullptr; element = element->NextSiblingElement("Parameter"))
+        {
+            if (const char * name = element->Attribute("name"))
+            {
+                parameters[name];
+            }
+        }
+    }
+
+    if (const tinyxml2::XMLElement * ppMatrix = node->FirstChildElement("PPMatrix"))
+    {
+        const std::unordered_set<std::string> factors = readPredictorSet(node->FirstChildElement("FactorList"));
+        const std::unordered_set<std::string> covariates = readPredictorSet(node->FirstChildElement("CovariateList"));
+        for (const tinyxml2::XMLElement * element = ppMatrix->FirstChildElement("PPCell");
+             element != nullptr; element = element->NextSiblingElement("PPCell"))
+        {
+            const char * parameterName = element->Attribute("parameterName");
+            const char * predictorName = element->Attribute("predictorName");
+            auto parameter = parameters.find(parameterName ? parameterName : "");
+            // Factors compare against category values, so only covariates can be captured.
+            PMMLDocument::ConstFieldDescriptionPtr field;
+            if (parameter == parameters.end() || predictorName == nullptr || factors.count(predictorName) != 0 ||
+                covariates.count(predictorName) == 0 ||
+                !findFeature(context, predictorName, field))
+            {
+                return false;
+            }
+            parameter->second.emplace_back(field, 1);
+        }
+    }
+
+    const tinyxml2::XMLElement * pMatrix = node->FirstChildElement("ParamMatrix");
+    const tinyxml2::XMLElement * element = pMatrix ? findCommonPCell(pMatrix->FirstChildElement("PCell")) : nullptr;
+    if (element == nullptr)
+    {
+        // Nothing would be written.
+        return false;
+    }
+
+    std::vector<Term> terms;
+    for (; element; element = findCommonPCell(element->NextSiblingElement("PCell")))
+    {
+        const char * parameterName = element->Attribute("parameterName");
+        auto parameter = parameters.find(parameterName ? parameterName : "");
+        double beta;
+        if (parameter == parameters.end() || element->QueryDoubleAttribute("beta", &beta))
+        {
+            return false;
+        }
+        // A parameter with no covariates is an intercept.
+        terms.push_back(Term{beta, parameter->second, false});
+    }
+
+    assemble(terms, model);
+    return true;
+}
+
+void LinearModel::evaluate(const Model & model, const double * rows, size_t rowCount, double * results)
+{
+    const size_t stride = model.features.size();
+    const size_t linearCount = model.coefficient.size();
+    const double * coefficient = model.coefficient.data();
+
+    for (size_t blockStart = 0; blockStart < rowCount; blockStart += BLOCK_SIZE)
+    {
+        const size_t blockEnd = std::min(rowCount, blockStart + BLOCK_SIZE);
+        for (size_t row = blockStart; row < blockEnd; ++row)
+        {
+            const double * values = rows + row * stride;
+            double sum = model.intercept + (model.linearMissingIsZero ? dotProduct<true>(coefficient, values, linearCount) :
+                                                                        dotProduct<false>(coefficient, values, linearCount));
+
+            for (size_t term = 0; term < model.termCoefficient.size(); ++term)
+            {
+                double product = model.termCoefficient[term];
+                for (uint32_t factor = model.termStart[term]; factor < model.termStart[term + 1]; ++factor)
+                {
+                    double value = values[model.factorFeature[factor]];
+                    if (model.termMissingIsZero[term] && std::isnan(value))
+                    {
+                        value = 0;
+                    }
+                    const double exponent = model.factorExponent[factor];
+                    product *= exponent == 1 ? value : std::pow(value, exponent);
+                }
+                sum += product;
+            }
+            results[row] = sum;
+        }
+
+        applyLink(model.link, results + blockStart, blockEnd - blockStart);
+    }
+}
@@ -0,0 +1,67 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  This is a native batch scorer for regression functions of RegressionModel and GeneralRegressionModel. The coefficients of
+//  plain numeric predictors are laid out as a dense vector over the leading columns of each row, so the linear predictor is
+//  mostly a dot product, followed by the same link function that RegressionModel::normalizeTable would add.
+//
+//  As with tree ensembles, this is opportunistic. Categorical predictors, factors, transformed inputs and classification
+//  are left to the generated code.
+
+#ifndef linearmodel_hpp
+#define linearmodel_hpp
+
+#include <cstdint>
+#include <vector>
+#include "pmmldocumentdefs.hpp"
+#include "model/regressionmodel.hpp"
+#include "tinyxml2.h"
+
+namespace LinearModel
+{
+    struct Model
+    {
+        // The fields that make up each column of a row. The first coefficient.size() of them are used linearly.
+        std::vector<PMMLDocument::ConstFieldDescriptionPtr> features;
+
+        // The linear predictor is intercept + coefficient . (the leading columns of the row) + the sum of the terms.
+        double intercept = 0;
+        std::vector<double> coefficient;
+        // If true, missing values in the leading columns count as zero, otherwise they make the prediction missing.
+        bool linearMissingIsZero = true;
+
+        // One entry per term, which is termCoefficient times the product of the factors from termStart[i] to termStart[i + 1].
+        // termStart has one extra entry at the end.
+        std::vector<double> termCoefficient;
+        std::vector<uint32_t> termStart;
+        std::vector<uint8_t> termMissingIsZero;
+
+        // One entry per factor, which is a column raised to a power.
+        std::vector<uint32_t> factorFeature;
+        std::vector<double> factorExponent;
+
+        RegressionModel::RegressionNormalizationMethod link = RegressionModel::METHOD_NONE;
+    };
+
+    // These attempt to capture a model with a regression function. The fields referenced are looked up in context, so this
+    // must be done with the mining schema of the model in effect. Returns false if the model cannot be captured.
+    bool flattenRegressionModel(const PMMLDocument::ConversionContext & context, const tinyxml2::XMLElement * node, Model & model);
+    bool flattenGeneralRegressionModel(const PMMLDocument::ConversionContext & context, const tinyxml2::XMLElement * node, Model & model);
+
+    // Scores rowCount rows, each of which is features.size() doubles (NaN for missing values). One result is written per row,
+    // NaN if the prediction is missing.
+    void evaluate(const Model & model, const double * rows, size_t rowCount, double * results);
+}
+
+#endif /* linearmodel_hpp */
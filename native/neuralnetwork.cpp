@@ -0,0 +1,291 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "neuralnetwork.hpp"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    // Rows are pushed through the network this many at a time, so that each block of a weight matrix is loaded into cache
+    // once per block of rows, rather than once per row.
+    const size_t BLOCK_ROWS = 16;
+
+    // Neurons in a layer are computed this many at a time, so that the activations being accumulated stay in cache.
+    const size_t NEURON_TILE = 256;
+
+    // This multiplies the activations of the previous layer (rowCount x inputCount) with the weights of this layer, adding
+    // it to output (rowCount x neuronCount). Each connection adds a multiple of a contiguous row of weights to a contiguous
+    // row of output, which the compiler can vectorise without reordering any additions.
+    void multiply(const NeuralNetwork::Layer & layer, const double * input, double * output, size_t rowCount)
+    {
+        const size_t inputCount = layer.inputCount;
+        const size_t neuronCount = layer.bias.size();
+        for (size_t tileStart = 0; tileStart < neuronCount; tileStart += NEURON_TILE)
+        {
+            const size_t tileEnd = std::min(neuronCount, tileStart + NEURON_TILE);
+            for (size_t from = 0; from < inputCount; ++from)
+            {
+                const double * weight = layer.weight.data() + from * neuronCount;
+                for (size_t row = 0; row < rowCount; ++row)
+                {
+                    const double activation = input[row * inputCount + from];
+                    double * sum = output + row * neuronCount;
+                    if (std::isfinite(activation))
+                    {
+                        for (size_t to = tileStart; to < tileEnd; ++to)
+                        {
+                            sum[to] += activation * weight[to];
+                        }
+                    }
+                    else
+                    {
+                        // Missing connections are stored as zero weights, and infinity times zero would be NaN.
+                        for (size_t to = tileStart; to < tileEnd; ++to)
+                        {
+                            if (weight[to] != 0)
+                            {
+                                sum[to] += activation * weight[to];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // This is the native version of applyActivationFunction in neuralnetworkmodel.cpp
+    void activate(NeuralNetworkModel::ActivationFunction activationFunction, double threshold, double * values, size_t count)
+    {
+        switch (activationFunction)
+        {
+            case NeuralNetworkModel::ACTIVATION_ELLIOTT:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = values[i] / (1 + std::fabs(values[i]));
+                }
+                break;
+            case NeuralNetworkModel::ACTIVATION_GAUSS:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = std::exp(-(values[i] * values[i]));
+                }
+                break;
+            case NeuralNetworkModel::ACTIVATION_ARCTAN:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = std::atan(values[i]) / M_PI * 2;
+                }
+                break;
+            case NeuralNetworkModel::ACTIVATION_COSINE:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = std::cos(values[i]);
+                }
+                break;
+            case NeuralNetworkModel::ACTIVATION_EXPONENTIAL:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = std::exp(values[i]);
+                }
+                break;
+            case NeuralNetworkModel::ACTIVATION_LOGISTIC:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = 1 / (std::exp(-values[i]) + 1);
+                }
+                break;
+            case NeuralNetworkModel::ACTIVATION_RECIPROCAL:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = 1 / values[i];
+                }
+                break;
+            case NeuralNetworkModel::ACTIVATION_RECTIFIER:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = std::max(values[i], 0.0);
+                }
+                break;
+            case NeuralNetworkModel::ACTIVATION_SINE:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = std::sin(values[i]);
+                }
+                break;
+            case NeuralNetworkModel::ACTIVATION_SQUARE:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = values[i] * values[i];
+                }
+                break;
+            case NeuralNetworkModel::ACTIVATION_TANH:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = std::tanh(values[i]);
+                }
+                break;
+            case NeuralNetworkModel::ACTIVATION_THRESHOLD:
+                for (size_t i = 0; i < count; ++i)
+                {
+                    values[i] = values[i] > threshold ? 1 : 0;
+                }
+                break;
+            case NeuralNetworkModel::ACTIVATION_IDENTITY:
+            case NeuralNetworkModel::ACTIVATION_RADIAL_BASIS:
+            case NeuralNetworkModel::ACTIVATION_INVALID:
+                // Radial basis layers are never captured.
+                break;
+        }
+    }
+
+    void normalizeLayer(const NeuralNetwork::Layer & layer, double * values, size_t rowCount)
+    {
+        const size_t neuronCount = layer.bias.size();
+        if (layer.normalizationMethod == NeuralNetworkModel::NORMALIZATION_METHOD_SOFTMAX)
+        {
+            for (size_t i = 0; i < rowCount * neuronCount; ++i)
+            {
+                values[i] = std::exp(values[i]);
+            }
+        }
+
+        if (layer.normalizationMethod != NeuralNetworkModel::NORMALIZATION_METHOD_NONE)
+        {
+            for (size_t row = 0; row < rowCount; ++row)
+            {
+                double * rowValues = values + row * neuronCount;
+                double sum = 0;
+                for (size_t neuron = 0; neuron < neuronCount; ++neuron)
+                {
+                    sum += rowValues[neuron];
+                }
+                // Like the generated code, multiply by the reciprocal of the sum.
+                const double factor = 1 / sum;
+                for (size_t neuron = 0; neuron < neuronCount; ++neuron)
+                {
+                    rowValues[neuron] *= factor;
+                }
+            }
+        }
+    }
+}
+
+// This follows the search tree built by buildNormTable in transformation.cpp, so values on a boundary go the same way.
+double NeuralNetwork::normalize(const LinearNorm & norm, double value)
+{
+    if (std::isnan(value))
+    {
+        return norm.mapMissingTo;
+    }
+
+    const std::vector<double> & origins = norm.origins;
+    const std::vector<double> & normals = norm.normals;
+    if (origins.empty())
+    {
+        return value;
+    }
+
+    // Indexes start at 1, the same as buildNormTable.
+    size_t bottom = 1;
+    size_t top = origins.size();
+    if (norm.outliers == PMMLDocument::OUTLIER_TREATMENT_AS_EXTREME_VALUES)
+    {
+        bottom = 0;
+        top = origins.size() + 1;
+    }
+    else if (norm.outliers == PMMLDocument::OUTLIER_TREATMENT_AS_MISSING_VALUES && !(value >= origins.front() && value <= origins.back()))
+    {
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+
+    while (top - bottom > 1)
+    {
+        const size_t cutoff = bottom + (top - bottom) / 2;
+        if (value < origins[cutoff - 1])
+        {
+            top = cutoff;
+        }
+        else
+        {
+            bottom = cutoff;
+        }
+    }
+
+    if (top == 1)
+    {
+        return normals[top - 1];
+    }
+    else if (bottom == origins.size())
+    {
+        return normals[bottom - 1];
+    }
+    const double gradient = (normals[top - 1] - normals[bottom - 1]) / (origins[top - 1] - origins[bottom - 1]);
+    return (value - origins[bottom - 1]) * gradient + normals[bottom - 1];
+}
+
+void NeuralNetwork::evaluate(const Network & network, const double * rows, size_t rowCount, double * results)
+{
+    const size_t stride = network.features.size();
+    size_t widest = network.inputs.size();
+    for (const Layer & layer : network.layers)
+    {
+        widest = std::max(widest, layer.bias.size());
+    }
+
+    // The activations of the layer being read, and the one being written.
+    std::vector<double> current(BLOCK_ROWS * widest);
+    std::vector<double> next(BLOCK_ROWS * widest);
+
+    for (size_t blockStart = 0; blockStart < rowCount; blockStart += BLOCK_ROWS)
+    {
+        const size_t blockRows = std::min(rowCount - blockStart, BLOCK_ROWS);
+        size_t width = network.inputs.size();
+        for (size_t row = 0; row < blockRows; ++row)
+        {
+            const double * values = rows + (blockStart + row) * stride;
+            for (size_t input = 0; input < width; ++input)
+            {
+                // The generated code defaults missing inputs to zero.
+                const double value = normalize(network.inputs[input].norm, values[network.inputs[input].feature]);
+                current[row * width + input] = std::isnan(value) ? 0 : value;
+            }
+        }
+
+        for (const Layer & layer : network.layers)
+        {
+            const size_t neuronCount = layer.bias.size();
+            for (size_t row = 0; row < blockRows; ++row)
+            {
+                std::copy(layer.bias.begin(), layer.bias.end(), next.begin() + row * neuronCount);
+            }
+            multiply(layer, current.data(), next.data(), blockRows);
+            activate(layer.activationFunction, layer.threshold, next.data(), blockRows * neuronCount);
+            normalizeLayer(layer, next.data(), blockRows);
+            current.swap(next);
+            width = neuronCount;
+        }
+
+        for (size_t row = 0; row < blockRows; ++row)
+        {
+            double * rowResults = results + (blockStart + row) * network.outputs.size();
+            for (size_t output = 0; output < network.outputs.size(); ++output)
+            {
+                const Output & thisOutput = network.outputs[output];
+                rowResults[output] = normalize(thisOutput.norm, current[row * width + thisOutput.neuron]);
+            }
+        }
+    }
+}
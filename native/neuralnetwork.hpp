@@ -0,0 +1,86 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  This is a native scorer for feed forward neural networks. While NeuralNetworkModel::parse builds a declaration for every
+//  neuron, it can also capture each NeuralLayer as a dense weight matrix, so that whole blocks of rows can be pushed through
+//  a layer at a time with a cache blocked matrix multiply. This is only done if the context asks for native models, see
+//  createNativeModel in basicexport.hpp for scoring them in process.
+//
+//  Only networks where each layer is connected to the one before it, with plain numeric inputs, are captured.
+
+#ifndef neuralnetwork_hpp
+#define neuralnetwork_hpp
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "pmmldocumentdefs.hpp"
+#include "model/neuralnetworkmodel.hpp"
+
+namespace NeuralNetwork
+{
+    // A NormContinuous as a piecewise linear function, or the identity if origins is empty.
+    struct LinearNorm
+    {
+        std::vector<double> origins;
+        std::vector<double> normals;
+        PMMLDocument::OutlierTreatment outliers = PMMLDocument::OUTLIER_TREATMENT_AS_IS;
+        // Used if the value being normalized is missing.
+        double mapMissingTo = std::numeric_limits<double>::quiet_NaN();
+    };
+
+    // This applies norm to value in the same way as the code generated by Transformation::parseNormContinuousBody.
+    double normalize(const LinearNorm & norm, double value);
+
+    struct Input
+    {
+        uint32_t feature;
+        LinearNorm norm;
+    };
+
+    struct Layer
+    {
+        // The number of neurons in the layer before this, or the number of inputs.
+        size_t inputCount = 0;
+        // Transposed, so that weight[from * bias.size() + to] is the weight of the connection between two neurons.
+        std::vector<double> weight;
+        std::vector<double> bias;
+        NeuralNetworkModel::ActivationFunction activationFunction = NeuralNetworkModel::ACTIVATION_IDENTITY;
+        NeuralNetworkModel::NormalizationMethod normalizationMethod = NeuralNetworkModel::NORMALIZATION_METHOD_NONE;
+        double threshold = 0;
+    };
+
+    struct Output
+    {
+        // The neuron in the final layer, and what it is written to.
+        uint32_t neuron;
+        LinearNorm norm;
+        PMMLDocument::ConstFieldDescriptionPtr field;
+    };
+
+    struct Network
+    {
+        // The fields that make up each column of a row.
+        std::vector<PMMLDocument::ConstFieldDescriptionPtr> features;
+        std::vector<Input> inputs;
+        std::vector<Layer> layers;
+        std::vector<Output> outputs;
+    };
+
+    // Scores rowCount rows, each of which is features.size() doubles (NaN for missing values). Each row writes outputs.size()
+    // results, NaN where the output is missing.
+    void evaluate(const Network & network, const double * rows, size_t rowCount, double * results);
+}
+
+#endif /* neuralnetwork_hpp */
@@ -0,0 +1,508 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "treeensemble.hpp"
+#include "conversioncontext.hpp"
+#include "document.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <unordered_map>
+
+namespace
+{
+    // Rows are scored in blocks of this many, so that each tree is applied to a whole block while it is in cache.
+    const size_t BLOCK_SIZE = 64;
+
+    // The subset of TreeModel missing value strategies that can be represented by a missing child.
+    enum MissingValueStrategy
+    {
+        MVS_NONE,
+        MVS_DEFAULTCHILD,
+        MVS_LASTPREDICTION,
+        MVS_NULLPREDICTION
+    };
+
+    bool parseNumber(const char * string, double & out)
+    {
+        if (string == nullptr || *string == '\0')
+        {
+            return false;
+        }
+        char * end;
+        out = strtod(string, &end);
+        return *end == '\0';
+    }
+
+    // Attributes of a MiningField that change the value of an input before the model sees it.
+    bool miningSchemaIsPlain(const tinyxml2::XMLElement * miningSchema)
+    {
+        for (const tinyxml2::XMLElement * iter = miningSchema ? miningSchema->FirstChildElement("MiningField") : nullptr;
+             iter; iter = iter->NextSiblingElement("MiningField"))
+        {
+            const char * outliers = iter->Attribute("outliers");
+            if (iter->Attribute("missingValueReplacement") || (outliers && strcmp(outliers, "asIs") != 0))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    class Flattener
+    {
+        const PMMLDocument::ConversionContext & m_context;
+        TreeEnsemble::Ensemble & m_ensemble;
+        std::unordered_map<std::string, uint32_t> m_featureIndexes;
+        MissingValueStrategy m_missingValueStrategy = MVS_NONE;
+        bool m_returnLastPrediction = false;
+
+        TreeEnsemble::ChildReference leaf(double value)
+        {
+            m_ensemble.leafValue.push_back(value);
+            return ~static_cast<TreeEnsemble::ChildReference>(m_ensemble.leafValue.size() - 1);
+        }
+
+        bool score(const tinyxml2::XMLElement * node, TreeEnsemble::ChildReference & out);
+        bool findFeature(const char * name, uint32_t & out);
+        bool addTest(const tinyxml2::XMLElement * predicate, TreeEnsemble::ChildReference ifTrue, const TreeEnsemble::ChildReference * ifMissing,
+                     TreeEnsemble::ChildReference & next);
+        bool flattenNode(const tinyxml2::XMLElement * node, TreeEnsemble::ChildReference & out);
+    public:
+        Flattener(const PMMLDocument::ConversionContext & context, TreeEnsemble::Ensemble & ensemble) :
+            m_context(context),
+            m_ensemble(ensemble)
+        {}
+        bool flattenTree(const tinyxml2::XMLElement * treeModel, TreeEnsemble::ChildReference & out);
+    };
+
+    // This makes a leaf with the score of node, or no prediction if it has none.
+    bool Flattener::score(const tinyxml2::XMLElement * node, TreeEnsemble::ChildReference & out)
+    {
+        double value = std::numeric_limits<double>::quiet_NaN();
+        if (const char * scoreString = node->Attribute("score"))
+        {
+            if (!parseNumber(scoreString, value))
+            {
+                return false;
+            }
+        }
+        else if (node->FirstChildElement("ScoreDistribution"))
+        {
+            // The generated code picks a category out of these, that doesn't make sense here.
+            return false;
+        }
+        out = leaf(value);
+        return true;
+    }
+
+    bool Flattener::findFeature(const char * name, uint32_t & out)
+    {
+        if (name == nullptr)
+        {
+            return false;
+        }
+
+        auto found = m_featureIndexes.find(name);
+        if (found != m_featureIndexes.end())
+        {
+            out = found->second;
+            return true;
+        }
+
+        // Only raw numeric inputs can be passed straight through as doubles.
+        const PMMLDocument::MiningField * miningField = m_context.getMiningField(name);
+        if (miningField == nullptr || miningField->hasReplacementValue ||
+            miningField->outlierTreatment != PMMLDocument::OUTLIER_TREATMENT_AS_IS ||
+            miningField->variable->origin != PMMLDocument::ORIGIN_DATA_DICTIONARY ||
+            miningField->variable->field.dataType != PMMLDocument::TYPE_NUMBER)
+        {
+            return false;
+        }
+
+        out = static_cast<uint32_t>(m_ensemble.features.size());
+        m_ensemble.features.push_back(miningField->variable);
+        m_featureIndexes.emplace(name, out);
+        return true;
+    }
+
+    // This puts a test for predicate in front of next. If the predicate is true, ifTrue is taken. If its field is missing,
+    // ifMissing is taken, or if that is null, the predicate is treated as false.
+    bool Flattener::addTest(const tinyxml2::XMLElement * predicate, TreeEnsemble::ChildReference ifTrue, const TreeEnsemble::ChildReference * ifMissing,
+                            TreeEnsemble::ChildReference & next)
+    {
+        const char * type = predicate->Name();
+        if (strcmp(type, "True") == 0)
+        {
+            next = ifTrue;
+            return true;
+        }
+        else if (strcmp(type, "False") == 0)
+        {
+            return true;
+        }
+        else if (strcmp(type, "SimplePredicate") != 0)
+        {
+            return false;
+        }
+
+        const char * operatorAttr = predicate->Attribute("operator");
+        uint32_t feature;
+        if (operatorAttr == nullptr || !findFeature(predicate->Attribute("field"), feature))
+        {
+            return false;
+        }
+
+        // Everything is expressed as (value < threshold) and/or (value == threshold), with the children swapped where
+        // the operator is the inverse of that.
+        double threshold = 0;
+        uint8_t comparison;
+        bool inverse = false;
+        TreeEnsemble::ChildReference missing = ifMissing ? *ifMissing : next;
+        if (strcmp(operatorAttr, "isMissing") == 0)
+        {
+            comparison = 0;
+            missing = ifTrue;
+        }
+        else if (strcmp(operatorAttr, "isNotMissing") == 0)
+        {
+            comparison = TreeEnsemble::COMPARE_LESS | TreeEnsemble::COMPARE_EQUAL;
+            threshold = std::numeric_limits<double>::infinity();
+            missing = next;
+        }
+        else
+        {
+            if (!parseNumber(predicate->Attribute("value"), threshold))
+            {
+                return false;
+            }
+
+            if (strcmp(operatorAttr, "lessThan") == 0)
+            {
+                comparison = TreeEnsemble::COMPARE_LESS;
+            }
+            else if (strcmp(operatorAttr, "lessOrEqual") == 0)
+            {
+                comparison = TreeEnsemble::COMPARE_LESS | TreeEnsemble::COMPARE_EQUAL;
+            }
+            else if (strcmp(operatorAttr, "equal") == 0)
+            {
+                comparison = TreeEnsemble::COMPARE_EQUAL;
+            }
+            else if (strcmp(operatorAttr, "greaterOrEqual") == 0)
+            {
+                comparison = TreeEnsemble::COMPARE_LESS;
+                inverse = true;
+            }
+            else if (strcmp(operatorAttr, "greaterThan") == 0)
+            {
+                comparison = TreeEnsemble::COMPARE_LESS | TreeEnsemble::COMPARE_EQUAL;
+                inverse = true;
+            }
+            else if (strcmp(operatorAttr, "notEqual") == 0)
+            {
+                comparison = TreeEnsemble::COMPARE_EQUAL;
+                inverse = true;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        m_ensemble.feature.push_back(feature);
+        m_ensemble.threshold.push_back(threshold);
+        m_ensemble.comparison.push_back(comparison);
+        m_ensemble.trueChild.push_back(inverse ? next : ifTrue);
+        m_ensemble.falseChild.push_back(inverse ? ifTrue : next);
+        m_ensemble.missingChild.push_back(missing);
+        next = static_cast<TreeEnsemble::ChildReference>(m_ensemble.feature.size() - 1);
+        return true;
+    }
+
+    // This mirrors parseTreeNode in treemodel.cpp, turning the if-chain of child nodes into a chain of tests.
+    bool Flattener::flattenNode(const tinyxml2::XMLElement * node, TreeEnsemble::ChildReference & out)
+    {
+        const tinyxml2::XMLElement * firstChildNode = node->FirstChildElement("Node");
+        if (firstChildNode == nullptr)
+        {
+            // Leaf node.
+            return score(node, out);
+        }
+
+        const char * defaultChildID = node->Attribute("defaultChild");
+        std::vector<const tinyxml2::XMLElement *> predicates;
+        std::vector<TreeEnsemble::ChildReference> bodies;
+        size_t defaultChildIndex = std::numeric_limits<size_t>::max();
+
+        for (const tinyxml2::XMLElement * childNode = firstChildNode; childNode; childNode = childNode->NextSiblingElement("Node"))
+        {
+            const tinyxml2::XMLElement * predicate = PMMLDocument::skipExtensions(childNode->FirstChildElement());
+            TreeEnsemble::ChildReference body;
+            if (predicate == nullptr || !flattenNode(childNode, body))
+            {
+                return false;
+            }
+
+            const char * thisID = childNode->Attribute("id");
+            if (m_missingValueStrategy == MVS_DEFAULTCHILD && defaultChildID && thisID && strcmp(thisID, defaultChildID) == 0)
+            {
+                defaultChildIndex = predicates.size();
+            }
+            predicates.push_back(predicate);
+            bodies.push_back(body);
+        }
+
+        TreeEnsemble::ChildReference next;
+        if (m_returnLastPrediction)
+        {
+            if (!score(node, next))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            next = leaf(std::numeric_limits<double>::quiet_NaN());
+        }
+
+        // Where to go if a predicate is missing. Nodes after a default child treat missing as false, the same as parseTreeNode.
+        TreeEnsemble::ChildReference ifMissing = next;
+        size_t missingApplies = predicates.size();
+        if (m_missingValueStrategy == MVS_LASTPREDICTION)
+        {
+            if (!score(node, ifMissing))
+            {
+                return false;
+            }
+        }
+        else if (m_missingValueStrategy == MVS_NULLPREDICTION)
+        {
+            ifMissing = leaf(std::numeric_limits<double>::quiet_NaN());
+        }
+        else if (m_missingValueStrategy == MVS_DEFAULTCHILD && defaultChildIndex < predicates.size())
+        {
+            // The generated code only handles missing values in a single node after the default child.
+            if (predicates.size() - defaultChildIndex > 2)
+            {
+                return false;
+            }
+            ifMissing = bodies[defaultChildIndex];
+            missingApplies = defaultChildIndex + 1;
+        }
+        else if (m_missingValueStrategy == MVS_NONE)
+        {
+            missingApplies = 0;
+        }
+
+        // Build the chain back to front, so each test knows where to go if it fails.
+        for (size_t i = predicates.size(); i-- > 0;)
+        {
+            if (!addTest(predicates[i], bodies[i], i < missingApplies ? &ifMissing : nullptr, next))
+            {
+                return false;
+            }
+        }
+        out = next;
+        return true;
+    }
+
+    bool Flattener::flattenTree(const tinyxml2::XMLElement * treeModel, TreeEnsemble::ChildReference & out)
+    {
+        const char * functionName = treeModel->Attribute("functionName");
+        if (functionName == nullptr || strcmp(functionName, "regression") != 0 ||
+            treeModel->FirstChildElement("LocalTransformations") || treeModel->FirstChildElement("Targets") ||
+            treeModel->FirstChildElement("Output") || treeModel->Attribute("missingValuePenalty") ||
+            !miningSchemaIsPlain(treeModel->FirstChildElement("MiningSchema")))
+        {
+            return false;
+        }
+
+        m_missingValueStrategy = MVS_NONE;
+        if (const char * mvs = treeModel->Attribute("missingValueStrategy"))
+        {
+            if (strcmp(mvs, "defaultChild") == 0)
+            {
+                m_missingValueStrategy = MVS_DEFAULTCHILD;
+            }
+            else if (strcmp(mvs, "lastPrediction") == 0)
+            {
+                m_missingValueStrategy = MVS_LASTPREDICTION;
+            }
+            else if (strcmp(mvs, "nullPrediction") == 0)
+            {
+                m_missingValueStrategy = MVS_NULLPREDICTION;
+            }
+            else if (strcmp(mvs, "none") != 0)
+            {
+                // aggregateNodes and weightedConfidence evaluate several branches at once.
+                return false;
+            }
+        }
+
+        m_returnLastPrediction = false;
+        if (const char * ntc = treeModel->Attribute("noTrueChildStrategy"))
+        {
+            m_returnLastPrediction = strcmp(ntc, "returnLastPrediction") == 0;
+        }
+
+        // The top level node is a child of the model, so treat the model as the root of the tree.
+        return flattenNode(treeModel, out);
+    }
+}
+
+bool TreeEnsemble::flattenSegment(const PMMLDocument::ConversionContext & context, const tinyxml2::XMLElement * segment, bool useWeights,
+                                  Ensemble & tree)
+{
+    tree = Ensemble();
+    // Every tree has to be used unconditionally.
+    const tinyxml2::XMLElement * predicate = PMMLDocument::skipExtensions(segment->FirstChildElement());
+    if (predicate == nullptr || strcmp(predicate->Name(), "True") != 0)
+    {
+        return false;
+    }
+
+    const tinyxml2::XMLElement * model = PMMLDocument::skipExtensions(predicate->NextSiblingElement());
+    if (model == nullptr || strcmp(model->Name(), "TreeModel") != 0)
+    {
+        return false;
+    }
+
+    double weight = 1;
+    if (useWeights && segment->Attribute("weight") && !parseNumber(segment->Attribute("weight"), weight))
+    {
+        return false;
+    }
+
+    Flattener flattener(context, tree);
+    ChildReference root;
+    if (!flattener.flattenTree(model, root))
+    {
+        return false;
+    }
+    tree.root.push_back(root);
+    tree.weight.push_back(weight);
+    return true;
+}
+
+bool TreeEnsemble::combine(const std::vector<Ensemble> & trees, bool average, Ensemble & ensemble)
+{
+    ensemble = Ensemble();
+    std::unordered_map<const PMMLDocument::FieldDescription *, uint32_t> featureIndexes;
+    std::vector<uint32_t> features;
+    double totalWeight = 0;
+    for (const Ensemble & tree : trees)
+    {
+        // Each tree numbers its own features, and its own nodes and leaves from 0.
+        features.clear();
+        for (const auto & field : tree.features)
+        {
+            auto inserted = featureIndexes.emplace(field.get(), static_cast<uint32_t>(ensemble.features.size()));
+            if (inserted.second)
+            {
+                ensemble.features.push_back(field);
+            }
+            features.push_back(inserted.first->second);
+        }
+        const ChildReference nodeOffset = static_cast<ChildReference>(ensemble.feature.size());
+        const ChildReference leafOffset = static_cast<ChildReference>(ensemble.leafValue.size());
+        auto relocate = [nodeOffset, leafOffset](ChildReference child)
+        {
+            return child >= 0 ? child + nodeOffset : ~(~child + leafOffset);
+        };
+
+        for (uint32_t feature : tree.feature)
+        {
+            ensemble.feature.push_back(features[feature]);
+        }
+        ensemble.threshold.insert(ensemble.threshold.end(), tree.threshold.begin(), tree.threshold.end());
+        ensemble.comparison.insert(ensemble.comparison.end(), tree.comparison.begin(), tree.comparison.end());
+        std::transform(tree.trueChild.begin(), tree.trueChild.end(), std::back_inserter(ensemble.trueChild), relocate);
+        std::transform(tree.falseChild.begin(), tree.falseChild.end(), std::back_inserter(ensemble.falseChild), relocate);
+        std::transform(tree.missingChild.begin(), tree.missingChild.end(), std::back_inserter(ensemble.missingChild), relocate);
+        ensemble.leafValue.insert(ensemble.leafValue.end(), tree.leafValue.begin(), tree.leafValue.end());
+        std::transform(tree.root.begin(), tree.root.end(), std::back_inserter(ensemble.root), relocate);
+        ensemble.weight.insert(ensemble.weight.end(), tree.weight.begin(), tree.weight.end());
+        for (double weight : tree.weight)
+        {
+            totalWeight += weight;
+        }
+    }
+
+    if (ensemble.root.empty())
+    {
+        return false;
+    }
+
+    ensemble.divisor = average ? totalWeight : 1;
+    return true;
+}
+
+void TreeEnsemble::evaluate(const Ensemble & ensemble, const double * rows, size_t rowCount, double * results)
+{
+    const size_t stride = ensemble.features.size();
+    const uint32_t * feature = ensemble.feature.data();
+    const double * threshold = ensemble.threshold.data();
+    const uint8_t * comparison = ensemble.comparison.data();
+    const ChildReference * trueChild = ensemble.trueChild.data();
+    const ChildReference * falseChild = ensemble.falseChild.data();
+    const ChildReference * missingChild = ensemble.missingChild.data();
+    const double * leafValue = ensemble.leafValue.data();
+
+    for (size_t blockStart = 0; blockStart < rowCount; blockStart += BLOCK_SIZE)
+    {
+        const size_t blockEnd = std::min(rowCount, blockStart + BLOCK_SIZE);
+        std::fill(results + blockStart, results + blockEnd, 0.0);
+
+        for (size_t tree = 0; tree < ensemble.root.size(); ++tree)
+        {
+            const ChildReference root = ensemble.root[tree];
+            const double weight = ensemble.weight[tree];
+            for (size_t row = blockStart; row < blockEnd; ++row)
+            {
+                const double * values = rows + row * stride;
+                ChildReference upto = root;
+                while (upto >= 0)
+                {
+                    // Evaluate both sides and select, rather than branching on the comparison type.
+                    const double value = values[feature[upto]];
+                    const uint8_t compare = comparison[upto];
+                    const bool result = (((compare & COMPARE_LESS) != 0) & (value < threshold[upto])) |
+                                        (((compare & COMPARE_EQUAL) != 0) & (value == threshold[upto]));
+                    const ChildReference taken = result ? trueChild[upto] : falseChild[upto];
+                    upto = std::isnan(value) ? missingChild[upto] : taken;
+                }
+
+                // Like the generated code, a tree without a prediction contributes nothing.
+                const double score = leafValue[~upto];
+                if (!std::isnan(score))
+                {
+                    results[row] += score * weight;
+                }
+            }
+        }
+
+        if (ensemble.divisor != 1)
+        {
+            for (size_t row = blockStart; row < blockEnd; ++row)
+            {
+                results[row] /= ensemble.divisor;
+            }
+        }
+    }
+}
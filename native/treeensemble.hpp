@@ -0,0 +1,82 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+//  This is a native scorer for regression ensembles of tree models (e.g. gradient boosted trees). Rather than going through
+//  generated code, the trees are flattened into a struct-of-arrays layout and evaluated over blocks of rows, which keeps each
+//  tree in cache while it is applied to many rows.
+//
+//  Flattening is opportunistic: anything that the flattened form cannot represent exactly (non numeric fields, compound
+//  predicates, transformations, record count based missing value strategies etc.) is left to the generated code.
+
+#ifndef treeensemble_hpp
+#define treeensemble_hpp
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "pmmldocumentdefs.hpp"
+#include "tinyxml2.h"
+
+namespace TreeEnsemble
+{
+    // Bits describing what a test node checks its feature against its threshold for
+    enum Comparison
+    {
+        COMPARE_LESS = 1,
+        COMPARE_EQUAL = 2
+    };
+
+    // A child reference is either the index of a test node, or if negative, ~index of a leaf value.
+    typedef int32_t ChildReference;
+
+    struct Ensemble
+    {
+        // The fields that make up each column of a row.
+        std::vector<PMMLDocument::ConstFieldDescriptionPtr> features;
+
+        // One entry per test node. The next node is trueChild if the comparison holds, falseChild if not and missingChild
+        // if the feature is missing (NaN)
+        std::vector<uint32_t> feature;
+        std::vector<double> threshold;
+        std::vector<uint8_t> comparison;
+        std::vector<ChildReference> trueChild;
+        std::vector<ChildReference> falseChild;
+        std::vector<ChildReference> missingChild;
+
+        // Scores of leaves, NaN for a leaf with no prediction.
+        std::vector<double> leafValue;
+
+        // One entry per tree
+        std::vector<ChildReference> root;
+        std::vector<double> weight;
+
+        // The weighted sum of tree results is divided by this (the sum of weights for averages, 1 for sums)
+        double divisor = 1;
+    };
+
+    // This attempts to flatten the TreeModel of a Segment into tree, an ensemble of its own. The fields referenced are looked up
+    // in context, so this must be done with the mining schema of the parent MiningModel in effect. Returns false if the segment
+    // cannot be flattened. Segments are flattened one at a time as they are loaded, so that each is only read once even if
+    // the document is being streamed.
+    bool flattenSegment(const PMMLDocument::ConversionContext & context, const tinyxml2::XMLElement * segment, bool useWeights,
+                        Ensemble & tree);
+
+    // This joins trees, in order, into ensemble. Returns false if there are none.
+    bool combine(const std::vector<Ensemble> & trees, bool average, Ensemble & ensemble);
+
+    // Scores rowCount rows, each of which is features.size() doubles (NaN for missing values). One result is written per row.
+    void evaluate(const Ensemble & ensemble, const double * rows, size_t rowCount, double * results);
+}
+
+#endif /* treeensemble_hpp */
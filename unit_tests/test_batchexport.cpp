@@ -0,0 +1,144 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "Cuti.h"
+
+#include "app/batchexport.hpp"
+#include "app/modeloutput.hpp"
+#include "app/optimisedmodel.hpp"
+#include "luaconverter/luaoutputter.hpp"
+#include "testutils.hpp"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+using namespace TestUtils;
+
+TEST_CLASS (TestBatchExport)
+{
+    static std::string readFile(const std::string & path)
+    {
+        std::ifstream stream(path);
+        std::ostringstream contents;
+        contents << stream.rdbuf();
+        return contents.str();
+    }
+
+    static std::string convertOne(const std::string & path)
+    {
+        std::ostringstream stream;
+        LuaOutputter outputter(stream);
+        std::vector<PMMLExporter::ModelOutput> inputs;
+        std::vector<PMMLExporter::ModelOutput> outputs;
+        return PMMLExporter::createScript(path.c_str(), outputter, inputs, outputs) ? stream.str() : std::string();
+    }
+public:
+    void testConvertFiles()
+    {
+        char directory[] = "/tmp/pamplemousse_batchXXXXXX";
+        CPPUNIT_ASSERT(mkdtemp(directory) != nullptr);
+        const std::string outputDirectory = std::string(directory) + "/out";
+
+        const std::vector<std::string> sourceFiles = {
+            getPathToFile("MiningModelMajority.pmml"),
+            getPathToFile("DoesNotExist.pmml"),
+            getPathToFile("TreeMissingValue.pmml")
+        };
+        std::ostringstream summary;
+        // One file is missing, so the batch as a whole fails, but the others are still converted.
+        CPPUNIT_ASSERT(!PMMLExporter::convertFiles(sourceFiles, outputDirectory, 0, {}, {},
+                                                   PMMLExporter::Format::AS_MULTI_ARG, PMMLExporter::Format::AS_MULTI_ARG, summary));
+
+        const std::string majority = readFile(outputDirectory + "/MiningModelMajority.lua");
+        const std::string tree = readFile(outputDirectory + "/TreeMissingValue.lua");
+        CPPUNIT_ASSERT(!majority.empty());
+        CPPUNIT_ASSERT_EQUAL(convertOne(sourceFiles[0]), majority);
+        CPPUNIT_ASSERT_EQUAL(convertOne(sourceFiles[2]), tree);
+
+        // There is a line for each model, in the order that they were given, then a total.
+        std::istringstream lines(summary.str());
+        std::string line;
+        CPPUNIT_ASSERT(std::getline(lines, line));
+        CPPUNIT_ASSERT(line.find("MiningModelMajority.lua") != std::string::npos);
+        CPPUNIT_ASSERT(line.find(std::to_string(majority.size()) + " bytes") != std::string::npos);
+        CPPUNIT_ASSERT(std::getline(lines, line));
+        CPPUNIT_ASSERT(line.find("DoesNotExist.pmml: FAILED") != std::string::npos);
+        CPPUNIT_ASSERT(std::getline(lines, line));
+        CPPUNIT_ASSERT(line.find("TreeMissingValue.lua") != std::string::npos);
+        CPPUNIT_ASSERT(std::getline(lines, line));
+        CPPUNIT_ASSERT(line.find("Converted 2 of 3 models") == 0);
+
+        remove((outputDirectory + "/MiningModelMajority.lua").c_str());
+        remove((outputDirectory + "/TreeMissingValue.lua").c_str());
+        remove(outputDirectory.c_str());
+        remove(directory);
+    }
+
+    void testListModels()
+    {
+        std::vector<std::string> files;
+        CPPUNIT_ASSERT(PMMLExporter::listModels(getPathToFile(""), files));
+        // Only the PMML files, not the tests themselves.
+        CPPUNIT_ASSERT(!files.empty());
+        for (const std::string & file : files)
+        {
+            CPPUNIT_ASSERT(file.find(".pmml") == file.size() - 5);
+        }
+        CPPUNIT_ASSERT(std::is_sorted(files.begin(), files.end()));
+        CPPUNIT_ASSERT(!PMMLExporter::listModels(getPathToFile("DoesNotExist"), files));
+    }
+
+    void testSavedModels()
+    {
+        char directory[] = "/tmp/pamplemousse_batchXXXXXX";
+        CPPUNIT_ASSERT(mkdtemp(directory) != nullptr);
+        const std::string modelFile = std::string(directory) + "/Tree.model";
+        const std::string outputDirectory = std::string(directory) + "/out";
+        PMMLExporter::OptimisedModel model;
+        std::vector<PMMLExporter::ModelOutput> inputs;
+        std::vector<PMMLExporter::ModelOutput> outputs;
+        CPPUNIT_ASSERT(PMMLExporter::createOptimisedModel(getPathToFile("TreeMissingValue.pmml").c_str(), model, inputs, outputs));
+        CPPUNIT_ASSERT(model.save(modelFile.c_str()));
+
+        // Saved models are found along with the PMML, and are converted in whichever format is asked for.
+        std::vector<std::string> files;
+        CPPUNIT_ASSERT(PMMLExporter::listModels(directory, files));
+        CPPUNIT_ASSERT_EQUAL(size_t(1), files.size());
+        CPPUNIT_ASSERT_EQUAL(modelFile, files[0]);
+        std::ostringstream summary;
+        CPPUNIT_ASSERT(PMMLExporter::convertFiles(files, outputDirectory, LuaOutputter::OPTION_LOWERCASE, {}, {},
+                                                  PMMLExporter::Format::AS_TABLE, PMMLExporter::Format::AS_TABLE, summary));
+
+        std::ostringstream expected;
+        LuaOutputter outputter(expected, LuaOutputter::OPTION_LOWERCASE);
+        inputs.clear();
+        outputs.clear();
+        CPPUNIT_ASSERT(PMMLExporter::createScript(getPathToFile("TreeMissingValue.pmml").c_str(), outputter, inputs, outputs,
+                                                  PMMLExporter::Format::AS_TABLE, PMMLExporter::Format::AS_TABLE));
+        CPPUNIT_ASSERT_EQUAL(expected.str(), readFile(outputDirectory + "/Tree.lua"));
+
+        remove((outputDirectory + "/Tree.lua").c_str());
+        remove(outputDirectory.c_str());
+        remove(modelFile.c_str());
+        remove(directory);
+    }
+
+    CPPUNIT_TEST_SUITE(TestBatchExport);
+    CPPUNIT_TEST(testConvertFiles);
+    CPPUNIT_TEST(testListModels);
+    CPPUNIT_TEST(testSavedModels);
+    CPPUNIT_TEST_SUITE_END();
+};
@@ -0,0 +1,166 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "Cuti.h"
+
+#include "capi/pamplemousse.h"
+#include "testutils.hpp"
+#include <string>
+#include <thread>
+#include <vector>
+using namespace TestUtils;
+
+namespace
+{
+    const char * const REGRESSION_MODEL =
+        "<PMML version=\"4.3\"><Header/>"
+        "<DataDictionary numberOfFields=\"2\">"
+        "<DataField name=\"x\" optype=\"continuous\" dataType=\"double\"/>"
+        "<DataField name=\"y\" optype=\"continuous\" dataType=\"double\"/>"
+        "</DataDictionary>"
+        "<RegressionModel functionName=\"regression\">"
+        "<MiningSchema><MiningField name=\"x\"/><MiningField name=\"y\" usageType=\"target\"/></MiningSchema>"
+        "<RegressionTable intercept=\"1\"><NumericPredictor name=\"x\" coefficient=\"2\"/></RegressionTable>"
+        "</RegressionModel></PMML>";
+
+    const char * const INFINITY_MODEL =
+        "<PMML version=\"4.3\"><Header/>"
+        "<DataDictionary numberOfFields=\"2\">"
+        "<DataField name=\"x\" optype=\"continuous\" dataType=\"double\"/>"
+        "<DataField name=\"y\" optype=\"continuous\" dataType=\"double\"/>"
+        "</DataDictionary>"
+        "<TreeModel functionName=\"regression\">"
+        "<MiningSchema><MiningField name=\"x\"/><MiningField name=\"y\" usageType=\"target\"/></MiningSchema>"
+        "<Node score=\"0\"><True/>"
+        "<Node score=\"1\"><SimplePredicate field=\"x\" operator=\"lessThan\" value=\"Infinity\"/></Node>"
+        "<Node score=\"2\"><True/></Node>"
+        "</Node>"
+        "</TreeModel></PMML>";
+
+    // Converts pmml with the C interface, returning an empty string on failure.
+    std::string convert(const std::string & pmml, unsigned int options = 0)
+    {
+        char * script = nullptr;
+        size_t length = 0;
+        if (pamplemousse_convert(pmml.c_str(), pmml.size(), options, &script, &length, nullptr) != 0)
+        {
+            return std::string();
+        }
+        std::string out(script, length);
+        pamplemousse_free(script);
+        return out;
+    }
+}
+
+TEST_CLASS (TestCApi)
+{
+public:
+    void testConvert()
+    {
+        const std::string script = convert(REGRESSION_MODEL, PAMPLEMOUSSE_INPUT_TABLE | PAMPLEMOUSSE_OUTPUT_TABLE);
+        CPPUNIT_ASSERT(!script.empty());
+
+        lua_State * L = luaL_newstate();
+        luaL_openlibs(L);
+        CPPUNIT_ASSERT_EQUAL(0, luaL_dostring(L, script.c_str()));
+        lua_getglobal(L, "func");
+        lua_newtable(L);
+        lua_pushnumber(L, 3);
+        lua_setfield(L, -2, "x");
+        CPPUNIT_ASSERT_EQUAL(0, lua_pcall(L, 1, 1, 0));
+        double y = 0;
+        CPPUNIT_ASSERT(getValue(L, "y", y));
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(7, y, 1e-12);
+        lua_close(L);
+    }
+
+    void testErrors()
+    {
+        const std::string badXML = "<PMML version=\"4.3\"><Header/>";
+        char * script = nullptr;
+        size_t length = 0;
+        char * error = nullptr;
+        CPPUNIT_ASSERT(pamplemousse_convert(badXML.c_str(), badXML.size(), 0, &script, &length, &error) != 0);
+        CPPUNIT_ASSERT(script == nullptr);
+        CPPUNIT_ASSERT(error != nullptr);
+        pamplemousse_free(error);
+
+        // Not PMML at all.
+        const std::string notPMML = "<Nothing/>";
+        CPPUNIT_ASSERT(pamplemousse_convert(notPMML.c_str(), notPMML.size(), 0, &script, &length, &error) != 0);
+        CPPUNIT_ASSERT(script == nullptr);
+        CPPUNIT_ASSERT(error != nullptr);
+        pamplemousse_free(error);
+
+        // The errors in the model itself are returned from the call, not written to stderr.
+        std::string unknownField = REGRESSION_MODEL;
+        unknownField.replace(unknownField.find("NumericPredictor name=\"x\""), 25, "NumericPredictor name=\"z\"");
+        CPPUNIT_ASSERT(pamplemousse_convert(unknownField.c_str(), unknownField.size(), 0, &script, &length, &error) != 0);
+        CPPUNIT_ASSERT(script == nullptr);
+        CPPUNIT_ASSERT(error != nullptr);
+        CPPUNIT_ASSERT(std::string(error).find("Unknown field referenced in NumericPredictor (z)") != std::string::npos);
+        pamplemousse_free(error);
+    }
+
+    void testIndependentConversions()
+    {
+        // Infinity is only defined in the scripts that use it, regardless of what was converted before.
+        const std::string withInfinity = convert(INFINITY_MODEL);
+        const std::string withoutInfinity = convert(REGRESSION_MODEL);
+        CPPUNIT_ASSERT(withInfinity.find("math.huge") != std::string::npos);
+        CPPUNIT_ASSERT(withoutInfinity.find("math.huge") == std::string::npos);
+
+        // Converting the same model again gives exactly the same script.
+        CPPUNIT_ASSERT_EQUAL(withInfinity, convert(INFINITY_MODEL));
+    }
+
+    void testConcurrentConversions()
+    {
+        const std::string expected[] = { convert(REGRESSION_MODEL), convert(INFINITY_MODEL) };
+        const size_t threadCount = 8;
+        const size_t repeats = 20;
+        std::vector<size_t> failures(threadCount, 0);
+        std::vector<std::thread> threads;
+        for (size_t thread = 0; thread < threadCount; ++thread)
+        {
+            threads.emplace_back([&expected, &failures, thread, repeats]()
+            {
+                for (size_t i = 0; i < repeats; ++i)
+                {
+                    const size_t which = (thread + i) % 2;
+                    if (convert(which ? INFINITY_MODEL : REGRESSION_MODEL) != expected[which])
+                    {
+                        ++failures[thread];
+                    }
+                }
+            });
+        }
+        for (std::thread & thread : threads)
+        {
+            thread.join();
+        }
+        for (size_t failed : failures)
+        {
+            CPPUNIT_ASSERT_EQUAL(size_t(0), failed);
+        }
+    }
+
+    CPPUNIT_TEST_SUITE(TestCApi);
+    CPPUNIT_TEST(testConvert);
+    CPPUNIT_TEST(testErrors);
+    CPPUNIT_TEST(testIndependentConversions);
+    CPPUNIT_TEST(testConcurrentConversions);
+    CPPUNIT_TEST_SUITE_END();
+};
@@ -0,0 +1,110 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+#include "Cuti.h"
+
+#include "document.hpp"
+
+#include "testutils.hpp"
+using namespace TestUtils;
+
+#ifndef _WIN32
+
+TEST_CLASS (TestCConverter)
+{
+    static CValue number(double value)
+    {
+        return CValue{CValue::NUMBER, value, nullptr};
+    }
+    static CValue string(const char * value)
+    {
+        return CValue{CValue::STRING, 0, value};
+    }
+    static CValue missing()
+    {
+        return CValue{CValue::MISSING, 0, nullptr};
+    }
+public:
+    void testTreeMissingValue()
+    {
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.LoadFile(getPathToFile("TreeMissingValue.pmml").c_str()));
+        tinyxml2::XMLElement * model = document.RootElement()->FirstChildElement("TreeModel");
+        setupIDOutput(document, model);
+        char scratch[256];
+        CValue out;
+        
+        {
+            model->SetAttribute("missingValueStrategy", "lastPrediction");
+            CModel cModel;
+            CPPUNIT_ASSERT(makeCModel(cModel, document, {"outlook", "temperature", "humidity"}, {"id"}));
+            
+            const CValue sunny[] = {string("sunny"), missing(), missing()};
+            CPPUNIT_ASSERT_EQUAL(0, cModel.function(sunny, &out, scratch, sizeof(scratch)));
+            CPPUNIT_ASSERT_EQUAL(int(CValue::STRING), out.type);
+            CPPUNIT_ASSERT_EQUAL(std::string("2"), std::string(out.string));
+            
+            const CValue nothing[] = {missing(), missing(), missing()};
+            CPPUNIT_ASSERT_EQUAL(0, cModel.function(nothing, &out, scratch, sizeof(scratch)));
+            CPPUNIT_ASSERT_EQUAL(int(CValue::STRING), out.type);
+            CPPUNIT_ASSERT_EQUAL(std::string("1"), std::string(out.string));
+        }
+        
+        {
+            model->SetAttribute("missingValueStrategy", "nullPrediction");
+            CModel cModel;
+            CPPUNIT_ASSERT(makeCModel(cModel, document, {"outlook", "temperature", "humidity"}, {"id"}));
+            
+            const CValue sunny[] = {string("sunny"), missing(), missing()};
+            CPPUNIT_ASSERT_EQUAL(0, cModel.function(sunny, &out, scratch, sizeof(scratch)));
+            CPPUNIT_ASSERT_EQUAL(int(CValue::MISSING), out.type);
+        }
+        
+        {
+            model->SetAttribute("missingValueStrategy", "defaultChild");
+            CModel cModel;
+            CPPUNIT_ASSERT(makeCModel(cModel, document, {"outlook", "temperature", "humidity"}, {"id"}));
+            
+            const CValue hot[] = {missing(), number(40), number(70)};
+            CPPUNIT_ASSERT_EQUAL(0, cModel.function(hot, &out, scratch, sizeof(scratch)));
+            CPPUNIT_ASSERT_EQUAL(int(CValue::STRING), out.type);
+            CPPUNIT_ASSERT_EQUAL(std::string("4"), std::string(out.string));
+        }
+    }
+    
+    void testRegressionWeightedAverage()
+    {
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.LoadFile(getPathToFile("MiningModelRegressionAverage.pmml").c_str()));
+        CModel cModel;
+        CPPUNIT_ASSERT(makeCModel(cModel, document, {"petal_length", "petal_width", "sepal_width"}, {"PredictedSepalLength"}));
+        CValue out;
+        
+        const CValue first[] = {number(2.0), number(1.5), number(3)};
+        CPPUNIT_ASSERT_EQUAL(0, cModel.function(first, &out, nullptr, 0));
+        CPPUNIT_ASSERT_EQUAL(int(CValue::NUMBER), out.type);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(5.005660 * 0.25 + 6.413333 * 0.25 + 5.005660 * 0.5, out.number, 1e-12);
+        
+        const CValue second[] = {number(4.0), number(2.5), number(3)};
+        CPPUNIT_ASSERT_EQUAL(0, cModel.function(second, &out, nullptr, 0));
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(4.735000 * 0.25 + 6.768966 * 0.25 + 5.640000 * 0.5, out.number, 1e-12);
+    }
+    
+    CPPUNIT_TEST_SUITE(TestCConverter);
+    CPPUNIT_TEST(testTreeMissingValue);
+    CPPUNIT_TEST(testRegressionWeightedAverage);
+    CPPUNIT_TEST_SUITE_END();
+};
+
+#endif
@@ -0,0 +1,154 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "Cuti.h"
+
+#include "app/basicexport.hpp"
+#include "app/modeloutput.hpp"
+#include "luaconverter/chunkedbuffer.hpp"
+#include "luaconverter/luaoutputter.hpp"
+#include "testutils.hpp"
+#include <sstream>
+using namespace TestUtils;
+
+TEST_CLASS (TestChunkedBuffer)
+{
+    // A script long enough to take up many chunks, which sums 1 to count.
+    static std::string makeScript(int count)
+    {
+        std::ostringstream script;
+        script << "function func()\n  local x = 0\n";
+        for (int i = 1; i <= count; ++i)
+        {
+            script << "  x = x + " << i << "\n";
+        }
+        script << "  return x\nend\n";
+        return script.str();
+    }
+
+    static std::string readAll(const ChunkedBuffer & buffer)
+    {
+        std::ostringstream contents;
+        buffer.writeTo(contents);
+        return contents.str();
+    }
+public:
+    void testWriteAndRead()
+    {
+        ChunkedBuffer buffer;
+        std::ostream stream(&buffer);
+        CPPUNIT_ASSERT_EQUAL(size_t(0), buffer.size());
+        CPPUNIT_ASSERT_EQUAL(std::string(), readAll(buffer));
+
+        // Both single characters and large writes, which span more than one chunk.
+        const std::string script = makeScript(100000);
+        stream << script[0];
+        stream.write(script.data() + 1, script.size() - 1);
+        CPPUNIT_ASSERT_EQUAL(script.size(), buffer.size());
+        CPPUNIT_ASSERT_EQUAL(script, readAll(buffer));
+
+        size_t chunks = 0;
+        size_t size;
+        ChunkedBuffer::Reader reader(buffer);
+        while (reader.next(size) != nullptr)
+        {
+            chunks++;
+        }
+        CPPUNIT_ASSERT(chunks > 1);
+
+        // Reading it back line by line.
+        ChunkedBuffer::InputBuffer input(buffer);
+        std::istream lines(&input);
+        std::istringstream expectedLines(script);
+        std::string line;
+        std::string expected;
+        while (std::getline(expectedLines, expected))
+        {
+            CPPUNIT_ASSERT(std::getline(lines, line));
+            CPPUNIT_ASSERT_EQUAL(expected, line);
+        }
+        CPPUNIT_ASSERT(!std::getline(lines, line));
+    }
+
+    void testLuaLoad()
+    {
+        ChunkedBuffer buffer;
+        std::ostream stream(&buffer);
+        const int count = 50000;
+        stream << makeScript(count);
+
+        lua_State * L = luaL_newstate();
+        ChunkedBuffer::Reader reader(buffer);
+#if LUA_VERSION_NUM >= 502
+        CPPUNIT_ASSERT_EQUAL(0, lua_load(L, ChunkedBuffer::Reader::luaReader, &reader, "=model", nullptr));
+#else
+        CPPUNIT_ASSERT_EQUAL(0, lua_load(L, ChunkedBuffer::Reader::luaReader, &reader, "=model"));
+#endif
+        CPPUNIT_ASSERT_EQUAL(0, lua_pcall(L, 0, 0, 0));
+        lua_getglobal(L, "func");
+        CPPUNIT_ASSERT_EQUAL(0, lua_pcall(L, 0, 1, 0));
+        CPPUNIT_ASSERT_EQUAL(double(count) * (count + 1) / 2, lua_tonumber(L, -1));
+        lua_close(L);
+    }
+
+    void testConvertFromBuffer()
+    {
+        const std::string pmml =
+            "<PMML version=\"4.3\"><Header/>"
+            "<DataDictionary numberOfFields=\"2\">"
+            "<DataField name=\"x\" optype=\"continuous\" dataType=\"double\"/>"
+            "<DataField name=\"y\" optype=\"continuous\" dataType=\"double\"/>"
+            "</DataDictionary>"
+            "<RegressionModel functionName=\"regression\">"
+            "<MiningSchema><MiningField name=\"x\"/><MiningField name=\"y\" usageType=\"target\"/></MiningSchema>"
+            "<RegressionTable intercept=\"1\"><NumericPredictor name=\"x\" coefficient=\"2\"/></RegressionTable>"
+            "</RegressionModel></PMML>";
+
+        ChunkedBuffer buffer;
+        std::ostream stream(&buffer);
+        LuaOutputter outputter(stream);
+        std::vector<PMMLExporter::ModelOutput> inputs;
+        std::vector<PMMLExporter::ModelOutput> outputs;
+        CPPUNIT_ASSERT(PMMLExporter::createScriptFromBuffer(pmml.data(), pmml.size(), outputter, inputs, outputs));
+
+        lua_State * L = luaL_newstate();
+        luaL_openlibs(L);
+        ChunkedBuffer::Reader reader(buffer);
+#if LUA_VERSION_NUM >= 502
+        CPPUNIT_ASSERT_EQUAL(0, lua_load(L, ChunkedBuffer::Reader::luaReader, &reader, "=model", nullptr));
+#else
+        CPPUNIT_ASSERT_EQUAL(0, lua_load(L, ChunkedBuffer::Reader::luaReader, &reader, "=model"));
+#endif
+        CPPUNIT_ASSERT_EQUAL(0, lua_pcall(L, 0, 0, 0));
+        lua_getglobal(L, "func");
+        lua_pushnumber(L, 3);
+        CPPUNIT_ASSERT_EQUAL(0, lua_pcall(L, 1, 1, 0));
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(7, lua_tonumber(L, -1), 1e-12);
+        lua_close(L);
+
+        // Not PMML at all.
+        const std::string notXML = "<PMML";
+        ChunkedBuffer unused;
+        std::ostream unusedStream(&unused);
+        LuaOutputter unusedOutputter(unusedStream);
+        CPPUNIT_ASSERT(!PMMLExporter::createScriptFromBuffer(notXML.data(), notXML.size(), unusedOutputter, inputs, outputs));
+    }
+
+    CPPUNIT_TEST_SUITE(TestChunkedBuffer);
+    CPPUNIT_TEST(testWriteAndRead);
+    CPPUNIT_TEST(testLuaLoad);
+    CPPUNIT_TEST(testConvertFromBuffer);
+    CPPUNIT_TEST_SUITE_END();
+};
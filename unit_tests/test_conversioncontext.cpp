@@ -0,0 +1,78 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "Cuti.h"
+
+#include "conversioncontext.hpp"
+#include <string>
+
+TEST_CLASS (TestConversionContext)
+{
+public:
+    void testUniqueNames()
+    {
+        PMMLDocument::ConversionContext context;
+        CPPUNIT_ASSERT_EQUAL(std::string("x"), context.makeSaneAndUniqueVariable("x"));
+        CPPUNIT_ASSERT_EQUAL(std::string("x_1"), context.makeSaneAndUniqueVariable("x"));
+        // Numbers that are already taken are skipped over.
+        CPPUNIT_ASSERT_EQUAL(std::string("x_2"), context.makeSaneAndUniqueVariable("x_2"));
+        CPPUNIT_ASSERT_EQUAL(std::string("x_3"), context.makeSaneAndUniqueVariable("x"));
+        CPPUNIT_ASSERT_EQUAL(std::string("x_2_1"), context.makeSaneAndUniqueVariable("x.2"));
+
+        // Names are made into valid identifiers first.
+        CPPUNIT_ASSERT_EQUAL(std::string("_1a_b"), context.makeSaneAndUniqueVariable("1a b"));
+        CPPUNIT_ASSERT_EQUAL(std::string("_1a_b_1"), context.makeSaneAndUniqueVariable("1a-b"));
+
+        // Each name has its own numbering, which carries on past 9.
+        CPPUNIT_ASSERT_EQUAL(std::string("y"), context.makeSaneAndUniqueVariable("y"));
+        for (int i = 1; i <= 10000; ++i)
+        {
+            CPPUNIT_ASSERT_EQUAL("y_" + std::to_string(i), context.makeSaneAndUniqueVariable("y"));
+        }
+        CPPUNIT_ASSERT_EQUAL(std::string("x_4"), context.makeSaneAndUniqueVariable("x"));
+
+        // A fork carries on from where it was forked, without affecting the original.
+        PMMLDocument::ConversionContext forked = context.fork();
+        CPPUNIT_ASSERT_EQUAL(std::string("x_5"), forked.makeSaneAndUniqueVariable("x"));
+        CPPUNIT_ASSERT_EQUAL(std::string("x_5"), context.makeSaneAndUniqueVariable("x"));
+    }
+
+    void testScopedFields()
+    {
+        PMMLDocument::ConversionContext context;
+        const PMMLDocument::DataField dataField(PMMLDocument::TYPE_NUMBER, PMMLDocument::OPTYPE_CONTINUOUS);
+        PMMLDocument::ConstFieldDescriptionPtr outer = context.addUnscopedDataField("a", dataField, PMMLDocument::ORIGIN_DATA_DICTIONARY);
+        CPPUNIT_ASSERT(context.getFieldDescription("a") == outer);
+        CPPUNIT_ASSERT(context.getFieldDescription("b") == nullptr);
+
+        {
+            PMMLDocument::ScopedVariableDefinitionStackGuard scope(context);
+            PMMLDocument::ConstFieldDescriptionPtr inner = scope.addDataField("b", PMMLDocument::TYPE_NUMBER, PMMLDocument::ORIGIN_PARAMETER, PMMLDocument::OPTYPE_CONTINUOUS);
+            PMMLDocument::ConstFieldDescriptionPtr again = scope.addDataField("a", PMMLDocument::TYPE_NUMBER, PMMLDocument::ORIGIN_PARAMETER, PMMLDocument::OPTYPE_CONTINUOUS);
+            CPPUNIT_ASSERT(context.getFieldDescription("b") == inner);
+            CPPUNIT_ASSERT_EQUAL(std::string("a_1"), again->luaName);
+            // The first field declared with a name is the one that is found.
+            CPPUNIT_ASSERT(context.getFieldDescription("a") == outer);
+        }
+
+        CPPUNIT_ASSERT(context.getFieldDescription("a") == outer);
+        CPPUNIT_ASSERT(context.getFieldDescription("b") == nullptr);
+    }
+
+    CPPUNIT_TEST_SUITE(TestConversionContext);
+    CPPUNIT_TEST(testUniqueNames);
+    CPPUNIT_TEST(testScopedFields);
+    CPPUNIT_TEST_SUITE_END();
+};
@@ -32,6 +32,7 @@ extern "C"
 #include "luaconverter/luaconverter.hpp"
 #include "luaconverter/optimiser.hpp"
 #include "testutils.hpp"
+#include <cmath>
 
 TEST_CLASS (TestFunction)
 {
@@ -1035,7 +1036,249 @@ public:
         CPPUNIT_ASSERT(lua_isnumber(L, -1));
         CPPUNIT_ASSERT_DOUBLES_EQUAL(-1.959964, lua_tonumber(L, -1), 0.001);
     }
-    
+
+    void testConstantFolding()
+    {
+        lua_State * L = luaL_newstate();
+        luaL_openlibs(L);
+
+        {
+            tinyxml2::XMLDocument document;
+            document.Parse("<Apply function=\"*\">"
+                           "<Apply function=\"+\">"
+                           "<Constant dataType=\"double\">1.5</Constant>"
+                           "<Constant dataType=\"integer\">2</Constant>"
+                           "</Apply>"
+                           "<Apply function=\"sum\">"
+                           "<Constant dataType=\"integer\">0</Constant>"
+                           "<FieldRef field=\"number\"/>"
+                           "</Apply>"
+                           "</Apply>");
+            AstBuilder astBuilder;
+            DEFINE_NUMERIC_VARIABLE_INTO_SCOPE(astBuilder, number);
+
+            CPPUNIT_ASSERT(Transformation::parse(astBuilder, document.RootElement()));
+            parseIntoVM(astBuilder, "", L);
+            // 3.5 * (0 + number), as adding 0 turns -0 into 0.
+            const AstNode & folded = astBuilder.topNode();
+            CPPUNIT_ASSERT_EQUAL(size_t(2), folded.children.size());
+            CPPUNIT_ASSERT_EQUAL(std::string("3.5"), folded.children[0].content);
+            CPPUNIT_ASSERT_EQUAL(size_t(2), folded.children[1].children.size());
+        }
+
+        executeSimpleQuery(L, "number", 2.0);
+        CPPUNIT_ASSERT(lua_isnumber(L, -1));
+        CPPUNIT_ASSERT_EQUAL(7.0, lua_tonumber(L, -1));
+
+        executeSimpleQuery(L, "number", -0.0);
+        CPPUNIT_ASSERT(lua_isnumber(L, -1));
+        CPPUNIT_ASSERT(!std::signbit(lua_tonumber(L, -1)));
+
+        executeSimpleQuery(L, "number", nullptr);
+        CPPUNIT_ASSERT(lua_isnil(L, -1));
+
+        {
+            tinyxml2::XMLDocument document;
+            document.Parse("<Apply function=\"pow\">"
+                           "<FieldRef field=\"number\"/>"
+                           "<Constant dataType=\"integer\">2</Constant>"
+                           "</Apply>");
+            AstBuilder astBuilder;
+            DEFINE_NUMERIC_VARIABLE_INTO_SCOPE(astBuilder, number);
+
+            CPPUNIT_ASSERT(Transformation::parse(astBuilder, document.RootElement()));
+            parseIntoVM(astBuilder, "", L);
+            // number * number
+            CPPUNIT_ASSERT(&astBuilder.topNode().function() == &Function::functionTable.names.times);
+        }
+
+        executeSimpleQuery(L, "number", -3.0);
+        CPPUNIT_ASSERT(lua_isnumber(L, -1));
+        CPPUNIT_ASSERT_EQUAL(9.0, lua_tonumber(L, -1));
+
+        executeSimpleQuery(L, "number", nullptr);
+        CPPUNIT_ASSERT(lua_isnil(L, -1));
+
+        {
+            tinyxml2::XMLDocument document;
+            document.Parse("<Apply function=\"/\">"
+                           "<FieldRef field=\"number\"/>"
+                           "<Constant dataType=\"integer\">4</Constant>"
+                           "</Apply>");
+            AstBuilder astBuilder;
+            DEFINE_NUMERIC_VARIABLE_INTO_SCOPE(astBuilder, number);
+
+            CPPUNIT_ASSERT(Transformation::parse(astBuilder, document.RootElement()));
+            parseIntoVM(astBuilder, "", L);
+            // number * 0.25
+            const AstNode & folded = astBuilder.topNode();
+            CPPUNIT_ASSERT(&folded.function() == &Function::functionTable.names.times);
+            CPPUNIT_ASSERT_EQUAL(std::string("0.25"), folded.children[1].content);
+        }
+
+        executeSimpleQuery(L, "number", 10.0);
+        CPPUNIT_ASSERT(lua_isnumber(L, -1));
+        CPPUNIT_ASSERT_EQUAL(2.5, lua_tonumber(L, -1));
+
+        {
+            // Multiplying by the reciprocal of 3 wouldn't always give the same answer.
+            tinyxml2::XMLDocument document;
+            document.Parse("<Apply function=\"/\">"
+                           "<FieldRef field=\"number\"/>"
+                           "<Constant dataType=\"integer\">3</Constant>"
+                           "</Apply>");
+            AstBuilder astBuilder;
+            DEFINE_NUMERIC_VARIABLE_INTO_SCOPE(astBuilder, number);
+
+            CPPUNIT_ASSERT(Transformation::parse(astBuilder, document.RootElement()));
+            parseIntoVM(astBuilder, "", L);
+            CPPUNIT_ASSERT(&astBuilder.topNode().function() == &Function::functionTable.names.divide);
+        }
+
+        executeSimpleQuery(L, "number", 0.3);
+        CPPUNIT_ASSERT(lua_isnumber(L, -1));
+        CPPUNIT_ASSERT_EQUAL(0.3 / 3, lua_tonumber(L, -1));
+
+        {
+            // The base becomes -2, which must stay in brackets.
+            tinyxml2::XMLDocument document;
+            document.Parse("<Apply function=\"pow\">"
+                           "<Apply function=\"-\">"
+                           "<Constant dataType=\"integer\">0</Constant>"
+                           "<Constant dataType=\"integer\">2</Constant>"
+                           "</Apply>"
+                           "<FieldRef field=\"number\"/>"
+                           "</Apply>");
+            AstBuilder astBuilder;
+            DEFINE_NUMERIC_VARIABLE_INTO_SCOPE(astBuilder, number);
+
+            CPPUNIT_ASSERT(Transformation::parse(astBuilder, document.RootElement()));
+            parseIntoVM(astBuilder, "", L);
+            CPPUNIT_ASSERT_EQUAL(std::string("-2"), astBuilder.topNode().children[0].content);
+        }
+
+        executeSimpleQuery(L, "number", 2.0);
+        CPPUNIT_ASSERT(lua_isnumber(L, -1));
+        CPPUNIT_ASSERT_EQUAL(4.0, lua_tonumber(L, -1));
+
+        {
+            AstBuilder astBuilder;
+            DEFINE_NUMERIC_VARIABLE_INTO_SCOPE(astBuilder, number);
+            astBuilder.field(fieldFornumber);
+            astBuilder.function(Function::unaryMinus, 1);
+            astBuilder.function(Function::unaryMinus, 1);
+            parseIntoVM(astBuilder, "", L);
+            CPPUNIT_ASSERT_EQUAL(Function::FIELD_REF, astBuilder.topNode().function().functionType);
+        }
+
+        executeSimpleQuery(L, "number", 5.0);
+        CPPUNIT_ASSERT(lua_isnumber(L, -1));
+        CPPUNIT_ASSERT_EQUAL(5.0, lua_tonumber(L, -1));
+
+        lua_close(L);
+    }
+
+    void testUnusedDeclarations()
+    {
+        static constexpr Function::Definition returnStatement =
+        {
+            nullptr,
+            Function::RETURN_STATEMENT,
+            PMMLDocument::TYPE_VOID,
+            LuaOutputter::PRECEDENCE_TOP, Function::NEVER_MISSING
+        };
+
+        AstBuilder astBuilder;
+        DEFINE_NUMERIC_VARIABLE_INTO_SCOPE(astBuilder, number);
+        PMMLDocument::ConversionContext & context = astBuilder.context();
+        auto unused = context.createVariable(PMMLDocument::TYPE_NUMBER, "unused");
+        auto deadOnly = context.createVariable(PMMLDocument::TYPE_NUMBER, "deadOnly");
+        auto used = context.createVariable(PMMLDocument::TYPE_NUMBER, "used");
+        auto captured = context.createVariable(PMMLDocument::TYPE_NUMBER, "captured");
+        auto fn = context.createVariable(PMMLDocument::TYPE_LAMBDA, "fn");
+        auto parameter = context.createVariable(PMMLDocument::TYPE_NUMBER, "parameter", PMMLDocument::ORIGIN_PARAMETER);
+
+        // unused is only used by deadOnly, which is only used in a branch that is never taken.
+        astBuilder.field(fieldFornumber);
+        astBuilder.constant(1);
+        astBuilder.function(Function::functionTable.names.plus, 2);
+        astBuilder.declare(unused, AstBuilder::HAS_INITIAL_VALUE);
+        astBuilder.field(unused);
+        astBuilder.constant(3);
+        astBuilder.function(Function::functionTable.names.times, 2);
+        astBuilder.declare(deadOnly, AstBuilder::HAS_INITIAL_VALUE);
+
+        astBuilder.field(fieldFornumber);
+        astBuilder.constant(1);
+        astBuilder.function(Function::functionTable.names.minus, 2);
+        astBuilder.declare(used, AstBuilder::HAS_INITIAL_VALUE);
+
+        // captured is only used inside fn, often enough not to be inlined there.
+        astBuilder.field(fieldFornumber);
+        astBuilder.constant(2);
+        astBuilder.function(Function::functionTable.names.times, 2);
+        astBuilder.declare(captured, AstBuilder::HAS_INITIAL_VALUE);
+        astBuilder.field(parameter);
+        astBuilder.field(parameter);
+        astBuilder.field(captured);
+        astBuilder.function(Function::functionTable.names.times, 2);
+        astBuilder.field(captured);
+        astBuilder.function(Function::functionTable.names.plus, 2);
+        astBuilder.lambda(1);
+        astBuilder.declare(fn, AstBuilder::HAS_INITIAL_VALUE);
+
+        astBuilder.field(deadOnly);
+        astBuilder.function(returnStatement, 1);
+        astBuilder.block(1);
+        astBuilder.constant("false", PMMLDocument::TYPE_BOOL);
+        astBuilder.ifChain(2);
+
+        // return fn(used) + fn(used * used)
+        astBuilder.field(used);
+        astBuilder.field(fn);
+        astBuilder.function(Function::runLambda, 2);
+        astBuilder.field(used);
+        astBuilder.field(used);
+        astBuilder.function(Function::functionTable.names.times, 2);
+        astBuilder.field(fn);
+        astBuilder.function(Function::runLambda, 2);
+        astBuilder.function(Function::functionTable.names.plus, 2);
+        astBuilder.function(returnStatement, 1);
+        astBuilder.block(7);
+
+        AstNode node = astBuilder.popNode();
+        std::stringstream unusedStream;
+        LuaOutputter unusedOutputter(unusedStream);
+        PMMLDocument::optimiseAST(node, unusedOutputter);
+
+        std::stringstream script;
+        LuaOutputter outputter(script);
+        outputter.keyword("function test(number)").endline();
+        LuaConverter::convertAstToLua(node, outputter);
+        outputter.keyword("end").endline();
+        printf("%s\n", script.str().c_str());
+
+        // The dead branch goes, and with it everything that was only used there.
+        CPPUNIT_ASSERT(script.str().find(unused->luaName) == std::string::npos);
+        CPPUNIT_ASSERT(script.str().find(deadOnly->luaName) == std::string::npos);
+        CPPUNIT_ASSERT(script.str().find("local " + used->luaName) != std::string::npos);
+        CPPUNIT_ASSERT(script.str().find("local " + captured->luaName) != std::string::npos);
+
+        lua_State * L = luaL_newstate();
+        luaL_openlibs(L);
+        if (luaL_dostring(L, script.str().c_str()))
+        {
+            std::string message = lua_tostring(L, -1);
+            CPPUNIT_ASSERT_MESSAGE(message, false);
+        }
+        lua_getglobal(L, "test");
+        lua_pushnumber(L, 3);
+        CPPUNIT_ASSERT_EQUAL(0, lua_pcall(L, 1, 1, 0));
+        // used = 2, captured = 6, so (2 * 6 + 6) + (4 * 6 + 6)
+        CPPUNIT_ASSERT_EQUAL(48.0, lua_tonumber(L, -1));
+        lua_close(L);
+    }
+
     CPPUNIT_TEST_SUITE(TestFunction);
     CPPUNIT_TEST(testIf);
     CPPUNIT_TEST(testMissingAndDefault);
@@ -1044,6 +1287,8 @@ public:
     CPPUNIT_TEST(testConcat);
     CPPUNIT_TEST(testStringOps);
     CPPUNIT_TEST(testNumericOps);
+    CPPUNIT_TEST(testConstantFolding);
+    CPPUNIT_TEST(testUnusedDeclarations);
 
     CPPUNIT_TEST_SUITE_END();
 };
@@ -0,0 +1,225 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "Cuti.h"
+
+#include "document.hpp"
+#include "conversioncontext.hpp"
+#include "app/basicexport.hpp"
+#include "app/modeloutput.hpp"
+#include "app/nativemodel.hpp"
+#include "native/linearmodel.hpp"
+
+#include "testutils.hpp"
+#include <cmath>
+#include <limits>
+#include <map>
+#include <memory>
+using namespace TestUtils;
+
+namespace
+{
+    const char * const HEADER =
+        "<PMML version=\"4.3\"><Header/>"
+        "<DataDictionary numberOfFields=\"6\">"
+        "<DataField name=\"x1\" optype=\"continuous\" dataType=\"double\"/>"
+        "<DataField name=\"x2\" optype=\"continuous\" dataType=\"double\"/>"
+        "<DataField name=\"x3\" optype=\"continuous\" dataType=\"double\"/>"
+        "<DataField name=\"x4\" optype=\"continuous\" dataType=\"double\"/>"
+        "<DataField name=\"x5\" optype=\"continuous\" dataType=\"double\"/>"
+        "<DataField name=\"y\" optype=\"continuous\" dataType=\"double\"/>"
+        "</DataDictionary>";
+
+    const char * const MINING_SCHEMA =
+        "<MiningSchema><MiningField name=\"x1\"/><MiningField name=\"x2\"/><MiningField name=\"x3\"/>"
+        "<MiningField name=\"x4\"/><MiningField name=\"x5\"/><MiningField name=\"y\" usageType=\"target\"/></MiningSchema>";
+
+    std::string regressionModel(const char * normalizationMethod, const char * extraPredictor = "")
+    {
+        return std::string(HEADER) +
+            "<RegressionModel functionName=\"regression\" normalizationMethod=\"" + normalizationMethod + "\">" + MINING_SCHEMA +
+            "<RegressionTable intercept=\"0.5\">"
+            "<NumericPredictor name=\"x1\" coefficient=\"0.3\"/>"
+            "<NumericPredictor name=\"x2\" exponent=\"2\" coefficient=\"-0.2\"/>"
+            "<NumericPredictor name=\"x3\" coefficient=\"0.1\"/>"
+            "<NumericPredictor name=\"x4\" coefficient=\"-0.6\"/>"
+            "<NumericPredictor name=\"x5\" coefficient=\"0.05\"/>"
+            "<PredictorTerm coefficient=\"0.4\"><FieldRef field=\"x1\"/><FieldRef field=\"x3\"/></PredictorTerm>" +
+            extraPredictor +
+            "</RegressionTable></RegressionModel></PMML>";
+    }
+
+    std::string generalRegressionModel(const char * linkFunction)
+    {
+        return std::string(HEADER) +
+            "<GeneralRegressionModel modelType=\"generalizedLinear\" functionName=\"regression\" linkFunction=\"" + linkFunction + "\">" +
+            MINING_SCHEMA +
+            "<ParameterList><Parameter name=\"p0\"/><Parameter name=\"p1\"/><Parameter name=\"p2\"/><Parameter name=\"p3\"/></ParameterList>"
+            "<CovariateList><Predictor name=\"x1\"/><Predictor name=\"x2\"/><Predictor name=\"x3\"/></CovariateList>"
+            "<PPMatrix>"
+            "<PPCell value=\"1\" predictorName=\"x1\" parameterName=\"p1\"/>"
+            "<PPCell value=\"1\" predictorName=\"x2\" parameterName=\"p2\"/>"
+            "<PPCell value=\"1\" predictorName=\"x1\" parameterName=\"p3\"/>"
+            "<PPCell value=\"1\" predictorName=\"x3\" parameterName=\"p3\"/>"
+            "</PPMatrix>"
+            "<ParamMatrix>"
+            "<PCell parameterName=\"p0\" beta=\"0.2\"/>"
+            "<PCell parameterName=\"p1\" beta=\"0.7\"/>"
+            "<PCell parameterName=\"p2\" beta=\"-0.4\"/>"
+            "<PCell parameterName=\"p3\" beta=\"0.25\"/>"
+            "</ParamMatrix>"
+            "</GeneralRegressionModel></PMML>";
+    }
+}
+
+TEST_CLASS (TestLinearModel)
+{
+    // Converts the document natively, taking rows of x1 to x5 and scoring y.
+    static bool convert(const std::string & text, PMMLExporter::NativeModel & model)
+    {
+        tinyxml2::XMLDocument document;
+        if (document.Parse(text.c_str()) != tinyxml2::XML_SUCCESS)
+        {
+            return false;
+        }
+        std::vector<PMMLExporter::ModelOutput> inputs = {{"x1", "x1"}, {"x2", "x2"}, {"x3", "x3"}, {"x4", "x4"}, {"x5", "x5"}};
+        std::vector<PMMLExporter::ModelOutput> outputs = {{"y", "y"}};
+        std::string errors;
+        return PMMLExporter::createNativeModel(document, model, inputs, outputs, std::make_shared<PMMLExporter::ErrorCollector>(errors));
+    }
+
+    // Scores one row, anything not mentioned is missing.
+    static double score(const PMMLExporter::NativeModel & model, const std::map<std::string, double> & row)
+    {
+        std::vector<double> values;
+        for (const char * input : {"x1", "x2", "x3", "x4", "x5"})
+        {
+            auto found = row.find(input);
+            values.push_back(found != row.end() ? found->second : std::numeric_limits<double>::quiet_NaN());
+        }
+        double result;
+        model.score(values.data(), 1, &result);
+        return result;
+    }
+public:
+    void testRegressionModel()
+    {
+        {
+            tinyxml2::XMLDocument document;
+            CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.Parse(regressionModel("none").c_str()));
+            AstBuilder builder;
+            builder.context().setCaptureNativeModels(true);
+            CPPUNIT_ASSERT(PMMLDocument::convertPMML(builder, document.RootElement()));
+            const PMMLDocument::LinearModels & models = builder.context().getLinearModels();
+            CPPUNIT_ASSERT_EQUAL(size_t(1), models.size());
+            // The plain predictors make up the dense part, x2 squared and x1 * x3 are done separately.
+            CPPUNIT_ASSERT_EQUAL(size_t(4), models.front().second->coefficient.size());
+            CPPUNIT_ASSERT_EQUAL(size_t(2), models.front().second->termCoefficient.size());
+        }
+
+        PMMLExporter::NativeModel model;
+        CPPUNIT_ASSERT(convert(regressionModel("none"), model));
+        const std::map<std::string, double> row = {{"x1", 1.5}, {"x2", -2}, {"x3", 0.25}, {"x4", 3}, {"x5", 10}};
+        const double expected = 0.5 + 0.3 * 1.5 - 0.2 * 4 + 0.1 * 0.25 - 0.6 * 3 + 0.05 * 10 + 0.4 * 1.5 * 0.25;
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(expected, score(model, row), 1e-12);
+
+        // Missing numeric predictors count as zero, but a missing field in a PredictorTerm makes the whole thing missing.
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(0.5 + 0.3 * 1.5 + 0.1 * 0.25 + 0.4 * 1.5 * 0.25, score(model, {{"x1", 1.5}, {"x3", 0.25}}), 1e-12);
+        CPPUNIT_ASSERT(std::isnan(score(model, {{"x1", 1.5}, {"x2", -2}})));
+
+        // Enough rows to span more than one block.
+        std::vector<double> rows;
+        for (size_t i = 0; i < 3000; ++i)
+        {
+            rows.insert(rows.end(), {1.5, -2, 0.25, 3, 10});
+        }
+        std::vector<double> results(3000);
+        model.score(rows.data(), results.size(), results.data());
+        for (double result : results)
+        {
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expected, result, 1e-12);
+        }
+    }
+
+    void testNotCapturedUnlessAsked()
+    {
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.Parse(regressionModel("none").c_str()));
+        AstBuilder builder;
+        CPPUNIT_ASSERT(PMMLDocument::convertPMML(builder, document.RootElement()));
+        CPPUNIT_ASSERT(builder.context().getLinearModels().empty());
+    }
+
+    void testNormalizationMethods()
+    {
+        const std::map<std::string, double> row = {{"x1", 1.5}, {"x2", -2}, {"x3", 0.25}, {"x4", 0.5}, {"x5", 10}};
+        const double y = 0.5 + 0.3 * 1.5 - 0.2 * 4 + 0.1 * 0.25 - 0.6 * 0.5 + 0.05 * 10 + 0.4 * 1.5 * 0.25;
+        const std::pair<const char *, double> methods[] =
+        {
+            {"logit", 1 / (1 + exp(-y))},
+            {"softmax", 1 / (1 + exp(-y))},
+            {"exp", exp(y)},
+            {"logc", 1 - exp(y)},
+            {"cauchit", 0.5 + atan(y) / M_PI},
+            {"cloglog", 1 - exp(-exp(y))},
+            {"loglog", exp(-exp(-y))},
+            {"probit", 0.5 * (1 + erf(y / sqrt(2.0)))}
+        };
+        for (const auto & method : methods)
+        {
+            PMMLExporter::NativeModel model;
+            CPPUNIT_ASSERT(convert(regressionModel(method.first), model));
+            // probit uses the same approximation of erf as the generated code.
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(method.second, score(model, row), 1e-3);
+        }
+    }
+
+    void testGeneralRegressionModel()
+    {
+        PMMLExporter::NativeModel model;
+        CPPUNIT_ASSERT(convert(generalRegressionModel("logit"), model));
+
+        const double y = 0.2 + 0.7 * 1.5 - 0.4 * -2 + 0.25 * 1.5 * 0.25;
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(1 / (1 + exp(-y)), score(model, {{"x1", 1.5}, {"x2", -2}, {"x3", 0.25}}), 1e-12);
+
+        // Unlike RegressionModel, any missing covariate makes the prediction missing.
+        CPPUNIT_ASSERT(std::isnan(score(model, {{"x1", 1.5}, {"x3", 0.25}})));
+    }
+
+    void testNotFlattened()
+    {
+        {
+            PMMLExporter::NativeModel model;
+            CPPUNIT_ASSERT(!convert(regressionModel("none", "<CategoricalPredictor name=\"x4\" value=\"3\" coefficient=\"2\"/>"), model));
+        }
+
+        // A replacement value changes the input before the model sees it.
+        {
+            std::string text = regressionModel("none");
+            const std::string field = "<MiningField name=\"x1\"/>";
+            text.replace(text.find(field), field.size(), "<MiningField name=\"x1\" missingValueReplacement=\"1\"/>");
+            PMMLExporter::NativeModel model;
+            CPPUNIT_ASSERT(!convert(text, model));
+        }
+    }
+
+    CPPUNIT_TEST_SUITE(TestLinearModel);
+    CPPUNIT_TEST(testRegressionModel);
+    CPPUNIT_TEST(testNotCapturedUnlessAsked);
+    CPPUNIT_TEST(testNormalizationMethods);
+    CPPUNIT_TEST(testGeneralRegressionModel);
+    CPPUNIT_TEST(testNotFlattened);
+    CPPUNIT_TEST_SUITE_END();
+};
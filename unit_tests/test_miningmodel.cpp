@@ -18,13 +18,42 @@
 #include "Cuti.h"
 
 #include "document.hpp"
+#include "app/basicexport.hpp"
+#include "app/modeloutput.hpp"
+#include "luaconverter/luaoutputter.hpp"
+#include "parallel.hpp"
 
 #include "testutils.hpp"
 #include <math.h>
+#include <fstream>
+#include <sstream>
+#include <string.h>
 using namespace TestUtils;
 
 TEST_CLASS (TestMiningModel)
 {
+    // Converts the file with the given number of threads, returning an empty string on failure.
+    static std::string convertWithThreads(const char * file, size_t threads)
+    {
+        tinyxml2::XMLDocument document;
+        if (document.LoadFile(getPathToFile(file).c_str()) != tinyxml2::XML_SUCCESS)
+        {
+            return std::string();
+        }
+        return convertWithThreads(document, threads);
+    }
+
+    static std::string convertWithThreads(const tinyxml2::XMLDocument & document, size_t threads)
+    {
+        Parallel::setThreadCount(threads);
+        std::ostringstream stream;
+        LuaOutputter outputter(stream);
+        std::vector<PMMLExporter::ModelOutput> inputs;
+        std::vector<PMMLExporter::ModelOutput> outputs;
+        const bool converted = PMMLExporter::createScript(document, outputter, inputs, outputs);
+        Parallel::setThreadCount(0);
+        return converted ? stream.str() : std::string();
+    }
 public:
     void testClassificationMajorityVote()
     {
@@ -371,6 +400,213 @@ public:
         CPPUNIT_ASSERT_EQUAL(6.768966, predictedSepalLength);
     }
     
+    void testParallelSegments()
+    {
+        // Segments parsed on separate threads are joined in order, so the script is the same however many threads there are.
+        const char * const files[] = { "MiningModelMajority.pmml", "MiningModelRegressionAverage.pmml" };
+        for (const char * file : files)
+        {
+            const std::string sequential = convertWithThreads(file, 1);
+            CPPUNIT_ASSERT(!sequential.empty());
+            CPPUNIT_ASSERT_EQUAL(sequential, convertWithThreads(file, 4));
+            CPPUNIT_ASSERT_EQUAL(sequential, convertWithThreads(file, 4));
+        }
+    }
+    
+    void testManySegments()
+    {
+        // Enough copies of the segments that the optimiser splits them up into regions, and the script is written in parts.
+        const int copies = 500;
+        std::ifstream source(getPathToFile("MiningModelRegressionAverage.pmml"));
+        std::ostringstream contents;
+        contents << source.rdbuf();
+        std::string pmml = contents.str();
+        const size_t begin = pmml.find("<Segment ");
+        const size_t end = pmml.rfind("</Segment>") + strlen("</Segment>");
+        CPPUNIT_ASSERT(begin != std::string::npos && end > begin);
+        const std::string segments = pmml.substr(begin, end - begin);
+        for (int i = 1; i < copies; ++i)
+        {
+            pmml.insert(end, segments);
+        }
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.Parse(pmml.data(), pmml.size()));
+        document.RootElement()->FirstChildElement("MiningModel")->FirstChildElement("Segmentation")->SetAttribute("multipleModelMethod", "sum");
+
+        const std::string sequential = convertWithThreads(document, 1);
+        CPPUNIT_ASSERT(!sequential.empty());
+        CPPUNIT_ASSERT_EQUAL(sequential, convertWithThreads(document, 4));
+
+        lua_State * L = makeState(document);
+        double predictedSepalLength;
+        CPPUNIT_ASSERT(executeModel(L, "petal_length", 2.0, "petal_width", 1.5, "sepal_width", 3));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "PredictedSepalLength", predictedSepalLength));
+        CPPUNIT_ASSERT_DOUBLES_EQUAL((5.005660 + 6.413333 + 5.005660) * copies, predictedSepalLength, 1e-6);
+
+        CPPUNIT_ASSERT(executeModel(L, "petal_length", 4.0, "petal_width", 2.5, "sepal_width", 3));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "PredictedSepalLength", predictedSepalLength));
+        CPPUNIT_ASSERT_DOUBLES_EQUAL((4.735000  + 6.768966 + 5.640000) * copies, predictedSepalLength, 1e-6);
+    }
+    
+    void testReuseLocals()
+    {
+        // Each segment declares its score under its predicate, which is more variables than one Lua function can have
+        // locals, but no two are needed at once, so they share locals rather than being split up or overflowing.
+        const int count = 250;
+        std::ostringstream pmml;
+        pmml << "<PMML version=\"4.3\"><Header/><DataDictionary numberOfFields=\"2\">"
+                "<DataField name=\"x\" optype=\"continuous\" dataType=\"double\"/>"
+                "<DataField name=\"y\" optype=\"continuous\" dataType=\"double\"/>"
+                "</DataDictionary><MiningModel functionName=\"regression\">"
+                "<MiningSchema><MiningField name=\"x\"/><MiningField name=\"y\" usageType=\"target\"/></MiningSchema>"
+                "<Segmentation multipleModelMethod=\"sum\">";
+        for (int i = 0; i < count; ++i)
+        {
+            pmml << "<Segment id=\"" << i << "\"><SimplePredicate field=\"x\" operator=\"greaterThan\" value=\"" << i % 10 << "\"/>"
+                    "<TreeModel functionName=\"regression\"><MiningSchema><MiningField name=\"x\"/></MiningSchema>"
+                    "<Node score=\"0\"><True/>"
+                    "<Node score=\"" << i << "\"><SimplePredicate field=\"x\" operator=\"lessThan\" value=\"" << i * 7 % 13 << "\"/></Node>"
+                    "<Node score=\"1\"><True/></Node>"
+                    "</Node></TreeModel></Segment>";
+        }
+        pmml << "</Segmentation></MiningModel></PMML>";
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.Parse(pmml.str().c_str()));
+
+        const std::string script = convertWithThreads(document, 1);
+        CPPUNIT_ASSERT(script.find("(function(") == std::string::npos);
+        CPPUNIT_ASSERT(script.find("overflow") == std::string::npos);
+
+        lua_State * L = makeState(document);
+        CPPUNIT_ASSERT(L != nullptr);
+        double prediction;
+        CPPUNIT_ASSERT(executeModel(L, "x", 5.0));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "y", prediction));
+        CPPUNIT_ASSERT_EQUAL(8232.0, prediction);
+        CPPUNIT_ASSERT(executeModel(L, "x", 12.0));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "y", prediction));
+        CPPUNIT_ASSERT_EQUAL(250.0, prediction);
+        lua_close(L);
+    }
+
+    void testShareWithManyVariables()
+    {
+        // There are more variables than locals allowed here, but only a few are needed at once, so there is still room for
+        // each segment to work out its first predicate once, rather than again to check if it was missing.
+        const int count = 30;
+        std::ostringstream pmml;
+        pmml << "<PMML version=\"4.3\"><Header/><DataDictionary numberOfFields=\"3\">"
+                "<DataField name=\"x\" optype=\"continuous\" dataType=\"double\"/>"
+                "<DataField name=\"z\" optype=\"continuous\" dataType=\"double\"/>"
+                "<DataField name=\"y\" optype=\"continuous\" dataType=\"double\"/>"
+                "</DataDictionary><MiningModel functionName=\"regression\">"
+                "<MiningSchema><MiningField name=\"x\"/><MiningField name=\"z\"/><MiningField name=\"y\" usageType=\"target\"/></MiningSchema>"
+                "<Segmentation multipleModelMethod=\"sum\">";
+        for (int i = 0; i < count; ++i)
+        {
+            pmml << "<Segment id=\"" << i << "\"><True/><TreeModel functionName=\"regression\" missingValueStrategy=\"defaultChild\">"
+                    "<MiningSchema><MiningField name=\"x\"/><MiningField name=\"z\"/></MiningSchema>"
+                    "<Node score=\"0\" defaultChild=\"n2\"><True/>"
+                    "<Node id=\"n1\" score=\"" << i << "\"><CompoundPredicate booleanOperator=\"and\">"
+                    "<SimplePredicate field=\"x\" operator=\"lessThan\" value=\"" << i << "\"/>"
+                    "<SimplePredicate field=\"z\" operator=\"lessThan\" value=\"5\"/></CompoundPredicate></Node>"
+                    "<Node id=\"n2\" score=\"1\"><SimplePredicate field=\"z\" operator=\"greaterThan\" value=\"" << i << "\"/></Node>"
+                    "</Node></TreeModel></Segment>";
+        }
+        pmml << "</Segmentation></MiningModel></PMML>";
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.Parse(pmml.str().c_str()));
+
+        std::ostringstream stream;
+        LuaOutputter outputter(stream);
+        outputter.setMaxVariables(20);
+        std::vector<PMMLExporter::ModelOutput> inputs;
+        std::vector<PMMLExporter::ModelOutput> outputs;
+        CPPUNIT_ASSERT(PMMLExporter::createScript(document, outputter, inputs, outputs));
+        CPPUNIT_ASSERT(stream.str().find("local shared_") != std::string::npos);
+
+        lua_State * L = makeState(document);
+        CPPUNIT_ASSERT(L != nullptr);
+        double prediction;
+        // Segments 11 to 29 take their first child, and 0 to 2 their second.
+        CPPUNIT_ASSERT(executeModel(L, "x", 10.5, "z", 3.0));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "y", prediction));
+        CPPUNIT_ASSERT_EQUAL(383.0, prediction);
+        lua_pop(L, 1);
+        // Every first child is unknown, so every segment takes its default child.
+        CPPUNIT_ASSERT(executeModel(L, "x", nullptr, "z", 3.0));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "y", prediction));
+        CPPUNIT_ASSERT_EQUAL(30.0, prediction);
+        lua_close(L);
+    }
+
+    void testSplitIntoSections()
+    {
+        // Segments 6 and 7 reuse the derived fields of segments 0 and 1, so those are live all the way through. With the
+        // fields of any other segment, that is too many for the locals allowed here, so the segments in between are run in
+        // sections of their own.
+        const int count = 8;
+        std::ostringstream pmml;
+        pmml << "<PMML version=\"4.3\"><Header/><DataDictionary numberOfFields=\"2\">"
+                "<DataField name=\"x\" optype=\"continuous\" dataType=\"double\"/>"
+                "<DataField name=\"y\" optype=\"continuous\" dataType=\"double\"/>"
+                "</DataDictionary><MiningModel functionName=\"regression\">"
+                "<MiningSchema><MiningField name=\"x\"/><MiningField name=\"y\" usageType=\"target\"/></MiningSchema>"
+                "<Segmentation multipleModelMethod=\"sum\">";
+        for (int i = 0; i < count; ++i)
+        {
+            pmml << "<Segment id=\"" << i << "\"><True/><RegressionModel functionName=\"regression\">"
+                    "<MiningSchema><MiningField name=\"x\"/></MiningSchema><LocalTransformations>";
+            for (int j = 0; j < 6; ++j)
+            {
+                pmml << "<DerivedField name=\"d" << i << "_" << j << "\" optype=\"continuous\" dataType=\"double\">"
+                        "<Apply function=\"exp\"><Apply function=\"*\"><FieldRef field=\"x\"/>"
+                        "<Constant>" << i % 6 * 6 + j + 1 << "</Constant></Apply></Apply></DerivedField>";
+            }
+            pmml << "</LocalTransformations><RegressionTable intercept=\"" << i << "\">";
+            for (int j = 0; j < 6; ++j)
+            {
+                pmml << "<NumericPredictor name=\"d" << i << "_" << j << "\" coefficient=\"" << j + 1 << "\"/>"
+                        "<NumericPredictor name=\"d" << i << "_" << j << "\" exponent=\"2\" coefficient=\"0.5\"/>";
+            }
+            pmml << "</RegressionTable></RegressionModel></Segment>";
+        }
+        pmml << "</Segmentation></MiningModel></PMML>";
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.Parse(pmml.str().c_str()));
+
+        std::ostringstream stream;
+        LuaOutputter outputter(stream);
+        outputter.setMaxVariables(20);
+        std::vector<PMMLExporter::ModelOutput> inputs;
+        std::vector<PMMLExporter::ModelOutput> outputs;
+        CPPUNIT_ASSERT(PMMLExporter::createScript(document, outputter, inputs, outputs));
+        const std::string script = stream.str();
+        CPPUNIT_ASSERT(script.find("sections [1] = function(") != std::string::npos);
+        CPPUNIT_ASSERT(script.find("overflow") == std::string::npos);
+
+        const double x = 0.1;
+        double expected = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            expected += i;
+            for (int j = 0; j < 6; ++j)
+            {
+                const double value = exp(x * (i % 6 * 6 + j + 1));
+                expected += value * (j + 1) + value * value * 0.5;
+            }
+        }
+
+        lua_State * L = luaL_newstate();
+        luaL_openlibs(L);
+        CPPUNIT_ASSERT_EQUAL(0, luaL_dostring(L, script.c_str()));
+        lua_getglobal(L, "func");
+        lua_pushnumber(L, x);
+        CPPUNIT_ASSERT_EQUAL(0, lua_pcall(L, 1, 1, 0));
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(expected, lua_tonumber(L, -1), expected * 1e-12);
+        lua_close(L);
+    }
+
     CPPUNIT_TEST_SUITE(TestMiningModel);
     CPPUNIT_TEST(testClassificationMajorityVote);
     CPPUNIT_TEST(testClassificationWeightedMajorityVote);
@@ -383,5 +619,10 @@ public:
     CPPUNIT_TEST(testRegressionMedian);
     CPPUNIT_TEST(testRegressionSum);
     CPPUNIT_TEST(testRegressionMax);
+    CPPUNIT_TEST(testParallelSegments);
+    CPPUNIT_TEST(testManySegments);
+    CPPUNIT_TEST(testReuseLocals);
+    CPPUNIT_TEST(testShareWithManyVariables);
+    CPPUNIT_TEST(testSplitIntoSections);
     CPPUNIT_TEST_SUITE_END();
 };
@@ -0,0 +1,234 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "Cuti.h"
+
+#include "document.hpp"
+#include "conversioncontext.hpp"
+#include "app/basicexport.hpp"
+#include "app/modeloutput.hpp"
+#include "app/nativemodel.hpp"
+#include "native/neuralnetwork.hpp"
+
+#include "testutils.hpp"
+#include <cmath>
+#include <limits>
+#include <map>
+#include <memory>
+using namespace TestUtils;
+
+namespace
+{
+    const char * const HEADER =
+        "<PMML version=\"4.3\"><Header/>"
+        "<DataDictionary numberOfFields=\"3\">"
+        "<DataField name=\"x1\" optype=\"continuous\" dataType=\"double\"/>"
+        "<DataField name=\"x2\" optype=\"continuous\" dataType=\"double\"/>"
+        "<DataField name=\"y\" optype=\"continuous\" dataType=\"double\"/>"
+        "</DataDictionary>";
+
+    // Two inputs, two hidden neurons and one output neuron. x2 is normalized from 0..10 to 0..1, as is y.
+    std::string regressionNetwork(const char * hiddenLayer, const char * outputConnection = "<Con from=\"h1\" weight=\"0.5\"/>")
+    {
+        return std::string(HEADER) +
+            "<NeuralNetwork functionName=\"regression\" activationFunction=\"logistic\">"
+            "<MiningSchema><MiningField name=\"x1\"/><MiningField name=\"x2\"/><MiningField name=\"y\" usageType=\"target\"/></MiningSchema>"
+            "<NeuralInputs>"
+            "<NeuralInput id=\"i1\"><DerivedField optype=\"continuous\" dataType=\"double\"><FieldRef field=\"x1\"/></DerivedField></NeuralInput>"
+            "<NeuralInput id=\"i2\"><DerivedField optype=\"continuous\" dataType=\"double\">"
+            "<NormContinuous field=\"x2\"><LinearNorm orig=\"0\" norm=\"0\"/><LinearNorm orig=\"10\" norm=\"1\"/></NormContinuous>"
+            "</DerivedField></NeuralInput>"
+            "</NeuralInputs>" +
+            hiddenLayer +
+            "<NeuralLayer activationFunction=\"identity\">"
+            "<Neuron id=\"o1\" bias=\"0.1\">" + outputConnection + "<Con from=\"h2\" weight=\"-1.5\"/></Neuron>"
+            "</NeuralLayer>"
+            "<NeuralOutputs><NeuralOutput outputNeuron=\"o1\"><DerivedField optype=\"continuous\" dataType=\"double\">"
+            "<NormContinuous field=\"y\"><LinearNorm orig=\"0\" norm=\"0\"/><LinearNorm orig=\"10\" norm=\"1\"/></NormContinuous>"
+            "</DerivedField></NeuralOutput></NeuralOutputs>"
+            "</NeuralNetwork></PMML>";
+    }
+
+    const char * const HIDDEN_LAYER =
+        "<NeuralLayer>"
+        "<Neuron id=\"h1\" bias=\"-0.2\"><Con from=\"i1\" weight=\"0.8\"/><Con from=\"i2\" weight=\"1.2\"/></Neuron>"
+        "<Neuron id=\"h2\" bias=\"0.3\"><Con from=\"i2\" weight=\"-0.7\"/></Neuron>"
+        "</NeuralLayer>";
+
+    const char * const CLASSIFICATION_NETWORK =
+        "<PMML version=\"4.3\"><Header/>"
+        "<DataDictionary numberOfFields=\"3\">"
+        "<DataField name=\"x1\" optype=\"continuous\" dataType=\"double\"/>"
+        "<DataField name=\"x2\" optype=\"continuous\" dataType=\"double\"/>"
+        "<DataField name=\"y\" optype=\"categorical\" dataType=\"string\"><Value value=\"a\"/><Value value=\"b\"/></DataField>"
+        "</DataDictionary>"
+        "<NeuralNetwork functionName=\"classification\" activationFunction=\"tanh\">"
+        "<MiningSchema><MiningField name=\"x1\"/><MiningField name=\"x2\"/><MiningField name=\"y\" usageType=\"target\"/></MiningSchema>"
+        "<NeuralInputs>"
+        "<NeuralInput id=\"i1\"><DerivedField optype=\"continuous\" dataType=\"double\"><FieldRef field=\"x1\"/></DerivedField></NeuralInput>"
+        "<NeuralInput id=\"i2\"><DerivedField optype=\"continuous\" dataType=\"double\"><FieldRef field=\"x2\"/></DerivedField></NeuralInput>"
+        "</NeuralInputs>"
+        "<NeuralLayer activationFunction=\"identity\" normalizationMethod=\"softmax\">"
+        "<Neuron id=\"o1\" bias=\"0.5\"><Con from=\"i1\" weight=\"1\"/><Con from=\"i2\" weight=\"-2\"/></Neuron>"
+        "<Neuron id=\"o2\"><Con from=\"i1\" weight=\"-0.5\"/><Con from=\"i2\" weight=\"0.25\"/></Neuron>"
+        "</NeuralLayer>"
+        "<NeuralOutputs>"
+        "<NeuralOutput outputNeuron=\"o1\"><DerivedField optype=\"categorical\" dataType=\"string\"><NormDiscrete field=\"y\" value=\"a\"/></DerivedField></NeuralOutput>"
+        "<NeuralOutput outputNeuron=\"o2\"><DerivedField optype=\"categorical\" dataType=\"string\"><NormDiscrete field=\"y\" value=\"b\"/></DerivedField></NeuralOutput>"
+        "</NeuralOutputs>"
+        "</NeuralNetwork></PMML>";
+
+    double logistic(double value)
+    {
+        return 1 / (1 + exp(-value));
+    }
+
+    // What regressionNetwork(HIDDEN_LAYER) should give, with missing inputs counting as zero.
+    double expectedRegression(double x1, double x2)
+    {
+        const double h1 = logistic(-0.2 + 0.8 * x1 + 1.2 * (x2 / 10));
+        const double h2 = logistic(0.3 - 0.7 * (x2 / 10));
+        return (0.1 + 0.5 * h1 - 1.5 * h2) * 10;
+    }
+}
+
+TEST_CLASS (TestNeuralNetwork)
+{
+    // Converts the document with native models captured, setting network to the native version of it, if there is one.
+    static bool convert(AstBuilder & builder, const std::string & text, const NeuralNetwork::Network *& network)
+    {
+        tinyxml2::XMLDocument document;
+        builder.context().setCaptureNativeModels(true);
+        if (document.Parse(text.c_str()) != tinyxml2::XML_SUCCESS || !PMMLDocument::convertPMML(builder, document.RootElement()))
+        {
+            return false;
+        }
+        const PMMLDocument::NeuralNetworks & networks = builder.context().getNeuralNetworks();
+        network = networks.size() == 1 ? networks.front().get() : nullptr;
+        return true;
+    }
+
+    // Converts the document natively, taking rows of x1 and x2 and scoring y.
+    static bool convert(const std::string & text, PMMLExporter::NativeModel & model)
+    {
+        tinyxml2::XMLDocument document;
+        if (document.Parse(text.c_str()) != tinyxml2::XML_SUCCESS)
+        {
+            return false;
+        }
+        std::vector<PMMLExporter::ModelOutput> inputs = {{"x1", "x1"}, {"x2", "x2"}};
+        std::vector<PMMLExporter::ModelOutput> outputs = {{"y", "y"}};
+        std::string errors;
+        return PMMLExporter::createNativeModel(document, model, inputs, outputs, std::make_shared<PMMLExporter::ErrorCollector>(errors));
+    }
+public:
+    void testRegression()
+    {
+        {
+            AstBuilder builder;
+            const NeuralNetwork::Network * network;
+            CPPUNIT_ASSERT(convert(builder, regressionNetwork(HIDDEN_LAYER), network));
+            CPPUNIT_ASSERT(network != nullptr);
+            CPPUNIT_ASSERT_EQUAL(size_t(2), network->inputs.size());
+            CPPUNIT_ASSERT_EQUAL(size_t(2), network->layers.size());
+            CPPUNIT_ASSERT_EQUAL(size_t(1), network->outputs.size());
+        }
+
+        PMMLExporter::NativeModel model;
+        CPPUNIT_ASSERT(convert(regressionNetwork(HIDDEN_LAYER), model));
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        const double rows[] = {0.5, 4, -3, 25, nan, 4};
+        double results[3];
+        model.score(rows, 3, results);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(expectedRegression(0.5, 4), results[0], 1e-12);
+        // Normalization extrapolates past the ends of the LinearNorms.
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(expectedRegression(-3, 25), results[1], 1e-12);
+        // A missing input is zero.
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(expectedRegression(0, 4), results[2], 1e-12);
+    }
+
+    void testBlocks()
+    {
+        PMMLExporter::NativeModel model;
+        CPPUNIT_ASSERT(convert(regressionNetwork(HIDDEN_LAYER), model));
+
+        // Enough rows to span several blocks, with a partial one at the end.
+        const size_t count = 2101;
+        std::vector<double> rows;
+        for (size_t i = 0; i < count; ++i)
+        {
+            rows.insert(rows.end(), {1.25, 7});
+        }
+        std::vector<double> results(count);
+        model.score(rows.data(), count, results.data());
+        for (double result : results)
+        {
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(expectedRegression(1.25, 7), result, 1e-12);
+        }
+    }
+
+    void testClassification()
+    {
+        AstBuilder builder;
+        const NeuralNetwork::Network * network;
+        CPPUNIT_ASSERT(convert(builder, CLASSIFICATION_NETWORK, network));
+        CPPUNIT_ASSERT(network != nullptr);
+        CPPUNIT_ASSERT_EQUAL(size_t(2), network->outputs.size());
+
+        // Inputs are in the order that the network first uses them.
+        const double rows[] = {0.4, 0.1};
+        double results[2];
+        NeuralNetwork::evaluate(*network, rows, 1, results);
+        const double a = exp(0.5 + 0.4 - 2 * 0.1);
+        const double b = exp(-0.5 * 0.4 + 0.25 * 0.1);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(a / (a + b), results[0], 1e-12);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(b / (a + b), results[1], 1e-12);
+    }
+
+    void testNotCaptured()
+    {
+        // Only when asked for.
+        {
+            tinyxml2::XMLDocument document;
+            CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.Parse(regressionNetwork(HIDDEN_LAYER).c_str()));
+            AstBuilder builder;
+            CPPUNIT_ASSERT(PMMLDocument::convertPMML(builder, document.RootElement()));
+            CPPUNIT_ASSERT(builder.context().getNeuralNetworks().empty());
+        }
+
+        // The output layer is connected straight to an input.
+        {
+            PMMLExporter::NativeModel model;
+            CPPUNIT_ASSERT(!convert(regressionNetwork(HIDDEN_LAYER, "<Con from=\"i1\" weight=\"0.5\"/>"), model));
+        }
+
+        {
+            const char * const radialBasisLayer =
+                "<NeuralLayer activationFunction=\"radialBasis\">"
+                "<Neuron id=\"h1\" width=\"1\"><Con from=\"i1\" weight=\"0.8\"/><Con from=\"i2\" weight=\"1.2\"/></Neuron>"
+                "<Neuron id=\"h2\" width=\"2\"><Con from=\"i2\" weight=\"-0.7\"/></Neuron>"
+                "</NeuralLayer>";
+            PMMLExporter::NativeModel model;
+            CPPUNIT_ASSERT(!convert(regressionNetwork(radialBasisLayer), model));
+        }
+    }
+
+    CPPUNIT_TEST_SUITE(TestNeuralNetwork);
+    CPPUNIT_TEST(testRegression);
+    CPPUNIT_TEST(testBlocks);
+    CPPUNIT_TEST(testClassification);
+    CPPUNIT_TEST(testNotCaptured);
+    CPPUNIT_TEST_SUITE_END();
+};
@@ -0,0 +1,258 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "Cuti.h"
+
+#include "app/basicexport.hpp"
+#include "app/modeloutput.hpp"
+#include "app/optimisedmodel.hpp"
+#include "luaconverter/luaoutputter.hpp"
+#include "testutils.hpp"
+#include <sstream>
+#include <stdio.h>
+using namespace TestUtils;
+
+TEST_CLASS (TestOptimisedModel)
+{
+    // Saves and loads a model of path, checking that the scripts written from it in each format are those written from path
+    // directly.
+    static void checkRoundTrip(const std::string & path)
+    {
+        PMMLExporter::OptimisedModel model;
+        std::vector<PMMLExporter::ModelOutput> modelInputs;
+        std::vector<PMMLExporter::ModelOutput> modelOutputs;
+        CPPUNIT_ASSERT(PMMLExporter::createOptimisedModel(path.c_str(), model, modelInputs, modelOutputs));
+        std::ostringstream saved;
+        CPPUNIT_ASSERT(model.save(saved));
+
+        PMMLExporter::OptimisedModel loaded;
+        std::istringstream source(saved.str());
+        std::string error;
+        CPPUNIT_ASSERT(loaded.load(source, error));
+        CPPUNIT_ASSERT_EQUAL(std::string(), error);
+
+        for (unsigned int luaOptions : {0u, unsigned(LuaOutputter::OPTION_LOWERCASE)})
+        {
+            for (PMMLExporter::Format inputFormat : {PMMLExporter::Format::AS_MULTI_ARG, PMMLExporter::Format::AS_TABLE})
+            {
+                for (PMMLExporter::Format outputFormat : {PMMLExporter::Format::AS_MULTI_ARG, PMMLExporter::Format::AS_TABLE})
+                {
+                    std::ostringstream expected;
+                    LuaOutputter expectedOutputter(expected, luaOptions);
+                    std::vector<PMMLExporter::ModelOutput> inputs;
+                    std::vector<PMMLExporter::ModelOutput> outputs;
+                    CPPUNIT_ASSERT(PMMLExporter::createScript(path.c_str(), expectedOutputter, inputs, outputs, inputFormat, outputFormat));
+
+                    // The same model can be written more than once.
+                    for (const PMMLExporter::OptimisedModel * written : {&model, &loaded, &loaded})
+                    {
+                        std::ostringstream script;
+                        LuaOutputter outputter(script, luaOptions);
+                        std::vector<PMMLExporter::ModelOutput> writtenInputs;
+                        std::vector<PMMLExporter::ModelOutput> writtenOutputs;
+                        CPPUNIT_ASSERT(PMMLExporter::createScript(*written, outputter, writtenInputs, writtenOutputs, inputFormat, outputFormat));
+                        CPPUNIT_ASSERT_EQUAL(expected.str(), script.str());
+                        CPPUNIT_ASSERT_EQUAL(inputs.size(), writtenInputs.size());
+                        CPPUNIT_ASSERT_EQUAL(outputs.size(), writtenOutputs.size());
+                    }
+                }
+            }
+        }
+        // Saving it again gives the same file.
+        std::ostringstream savedAgain;
+        CPPUNIT_ASSERT(loaded.save(savedAgain));
+        CPPUNIT_ASSERT(saved.str() == savedAgain.str());
+    }
+
+    static std::string saveModel(const char * file)
+    {
+        PMMLExporter::OptimisedModel model;
+        std::vector<PMMLExporter::ModelOutput> inputs;
+        std::vector<PMMLExporter::ModelOutput> outputs;
+        CPPUNIT_ASSERT(PMMLExporter::createOptimisedModel(getPathToFile(file).c_str(), model, inputs, outputs));
+        std::ostringstream saved;
+        CPPUNIT_ASSERT(model.save(saved));
+        return saved.str();
+    }
+public:
+    void testRoundTrip()
+    {
+        for (const char * file : {"MiningModelMajority.pmml", "MiningModelRegressionAverage.pmml", "NaiveBayes.pmml",
+                                  "SampleScorecard-Attribute.pmml", "SupportVectorXor.pmml", "TreeMissingValue.pmml"})
+        {
+            checkRoundTrip(getPathToFile(file));
+        }
+    }
+
+    void testFormats()
+    {
+        PMMLExporter::OptimisedModel model;
+        std::vector<PMMLExporter::ModelOutput> inputs;
+        std::vector<PMMLExporter::ModelOutput> outputs = {PMMLExporter::ModelOutput("whatIdo", "whatIdo")};
+        CPPUNIT_ASSERT(PMMLExporter::createOptimisedModel(getPathToFile("TreeMissingValue.pmml").c_str(), model, inputs, outputs));
+
+        // Each way of passing the inputs and outputs gives the same answer from the same model.
+        for (PMMLExporter::Format inputFormat : {PMMLExporter::Format::AS_MULTI_ARG, PMMLExporter::Format::AS_TABLE})
+        {
+            for (PMMLExporter::Format outputFormat : {PMMLExporter::Format::AS_MULTI_ARG, PMMLExporter::Format::AS_TABLE})
+            {
+                std::ostringstream script;
+                LuaOutputter outputter(script);
+                inputs.clear();
+                CPPUNIT_ASSERT(PMMLExporter::createScript(model, outputter, inputs, outputs, inputFormat, outputFormat));
+
+                lua_State * L = luaL_newstate();
+                luaL_openlibs(L);
+                CPPUNIT_ASSERT_EQUAL(0, luaL_dostring(L, script.str().c_str()));
+                lua_getglobal(L, "func");
+                if (inputFormat == PMMLExporter::Format::AS_TABLE)
+                {
+                    lua_newtable(L);
+                }
+                int arguments = 0;
+                for (const PMMLExporter::ModelOutput & input : inputs)
+                {
+                    if (input.field)
+                    {
+                        if (input.modelOutput == "outlook")
+                        {
+                            lua_pushstring(L, "sunny");
+                        }
+                        else if (input.modelOutput == "temperature")
+                        {
+                            lua_pushnumber(L, 40);
+                        }
+                        else if (input.modelOutput == "humidity")
+                        {
+                            lua_pushnumber(L, 70);
+                        }
+                        else
+                        {
+                            lua_pushnil(L);
+                        }
+                        if (inputFormat == PMMLExporter::Format::AS_TABLE)
+                        {
+                            lua_setfield(L, -2, input.variableOrAttribute.c_str());
+                        }
+                        else
+                        {
+                            arguments++;
+                        }
+                    }
+                }
+                CPPUNIT_ASSERT_EQUAL(0, lua_pcall(L, inputFormat == PMMLExporter::Format::AS_TABLE ? 1 : arguments, 1, 0));
+                if (outputFormat == PMMLExporter::Format::AS_TABLE)
+                {
+                    CPPUNIT_ASSERT(lua_istable(L, -1));
+                    lua_getfield(L, -1, "whatIdo");
+                }
+                CPPUNIT_ASSERT(lua_isstring(L, -1));
+                CPPUNIT_ASSERT_EQUAL(std::string("no play"), std::string(lua_tostring(L, -1)));
+                lua_close(L);
+            }
+        }
+    }
+
+    void testMismatch()
+    {
+        PMMLExporter::OptimisedModel model;
+        std::vector<PMMLExporter::ModelOutput> inputs;
+        std::vector<PMMLExporter::ModelOutput> outputs;
+        std::ostringstream script;
+        LuaOutputter outputter(script);
+        // Nothing can be written from an empty model.
+        CPPUNIT_ASSERT(!PMMLExporter::createScript(model, outputter, inputs, outputs));
+        CPPUNIT_ASSERT(!model.save(script));
+
+        CPPUNIT_ASSERT(PMMLExporter::createOptimisedModel(getPathToFile("TreeMissingValue.pmml").c_str(), model, inputs, outputs));
+        inputs.clear();
+        outputs.clear();
+        outputs.emplace_back("something_else", "something_else");
+        CPPUNIT_ASSERT(!PMMLExporter::createScript(model, outputter, inputs, outputs));
+        outputs.clear();
+        inputs.emplace_back("something_else", "something_else");
+        CPPUNIT_ASSERT(!PMMLExporter::createScript(model, outputter, inputs, outputs));
+        CPPUNIT_ASSERT(script.str().empty());
+
+        // The same inputs and outputs are fine.
+        inputs = model.inputs;
+        outputs = model.outputs;
+        CPPUNIT_ASSERT(PMMLExporter::createScript(model, outputter, inputs, outputs));
+        CPPUNIT_ASSERT(!script.str().empty());
+    }
+
+    void testDamaged()
+    {
+        const std::string saved = saveModel("MiningModelClassificationFirst.pmml");
+        std::string error;
+        for (size_t length = 0; length < saved.size(); ++length)
+        {
+            PMMLExporter::OptimisedModel model;
+            std::istringstream source(saved.substr(0, length));
+            CPPUNIT_ASSERT(!model.load(source, error));
+            CPPUNIT_ASSERT(!error.empty());
+            CPPUNIT_ASSERT(model.tree.pFunction == nullptr);
+        }
+
+        PMMLExporter::OptimisedModel model;
+        std::istringstream longer(saved + '\0');
+        CPPUNIT_ASSERT(!model.load(longer, error));
+        std::istringstream pmml("<PMML/>");
+        CPPUNIT_ASSERT(!model.load(pmml, error));
+        CPPUNIT_ASSERT(!model.load(getPathToFile("DoesNotExist.model").c_str(), error));
+
+        // Damage is found without reading past what is there, whichever byte it is in.
+        for (size_t i = 0; i < saved.size(); ++i)
+        {
+            std::string damaged = saved;
+            damaged[i] = char(damaged[i] ^ 0x81);
+            std::istringstream source(damaged);
+            CPPUNIT_ASSERT(model.load(source, error) || model.tree.pFunction == nullptr);
+        }
+    }
+
+    void testSavedFile()
+    {
+        const std::string path = writeTemporaryFile(saveModel("MiningModelRegressionAverage.pmml"));
+        CPPUNIT_ASSERT(!path.empty());
+
+        CPPUNIT_ASSERT(PMMLExporter::OptimisedModel::isSavedModel(path.c_str()));
+        CPPUNIT_ASSERT(!PMMLExporter::OptimisedModel::isSavedModel(getPathToFile("MiningModelRegressionAverage.pmml").c_str()));
+
+        // A saved model can be given anywhere the PMML could, in any format.
+        std::ostringstream expected;
+        LuaOutputter expectedOutputter(expected, LuaOutputter::OPTION_LOWERCASE);
+        std::vector<PMMLExporter::ModelOutput> inputs;
+        std::vector<PMMLExporter::ModelOutput> outputs;
+        CPPUNIT_ASSERT(PMMLExporter::createScript(getPathToFile("MiningModelRegressionAverage.pmml").c_str(), expectedOutputter, inputs, outputs,
+                                                  PMMLExporter::Format::AS_TABLE, PMMLExporter::Format::AS_MULTI_ARG));
+        std::ostringstream script;
+        LuaOutputter outputter(script, LuaOutputter::OPTION_LOWERCASE);
+        inputs.clear();
+        outputs.clear();
+        CPPUNIT_ASSERT(PMMLExporter::createScript(path.c_str(), outputter, inputs, outputs, PMMLExporter::Format::AS_TABLE,
+                                                  PMMLExporter::Format::AS_MULTI_ARG));
+        CPPUNIT_ASSERT_EQUAL(expected.str(), script.str());
+        remove(path.c_str());
+    }
+
+    CPPUNIT_TEST_SUITE(TestOptimisedModel);
+    CPPUNIT_TEST(testRoundTrip);
+    CPPUNIT_TEST(testFormats);
+    CPPUNIT_TEST(testMismatch);
+    CPPUNIT_TEST(testDamaged);
+    CPPUNIT_TEST(testSavedFile);
+    CPPUNIT_TEST_SUITE_END();
+};
@@ -0,0 +1,182 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "Cuti.h"
+
+#include "segmentcache.hpp"
+#include "document.hpp"
+#include "app/basicexport.hpp"
+#include "app/modeloutput.hpp"
+#include "luaconverter/luaoutputter.hpp"
+#include "native/linearmodel.hpp"
+#include "testutils.hpp"
+#include <algorithm>
+#include <sstream>
+using namespace TestUtils;
+
+namespace
+{
+    const char * const SUM_OF_REGRESSIONS =
+        "<PMML version=\"4.3\"><Header/>"
+        "<DataDictionary numberOfFields=\"3\">"
+        "<DataField name=\"x1\" optype=\"continuous\" dataType=\"double\"/>"
+        "<DataField name=\"x2\" optype=\"continuous\" dataType=\"double\"/>"
+        "<DataField name=\"y\" optype=\"continuous\" dataType=\"double\"/>"
+        "</DataDictionary>"
+        "<MiningModel functionName=\"regression\">"
+        "<MiningSchema><MiningField name=\"x1\"/><MiningField name=\"x2\"/><MiningField name=\"y\" usageType=\"target\"/></MiningSchema>"
+        "<Segmentation multipleModelMethod=\"sum\">"
+        "<Segment id=\"1\"><True/><RegressionModel functionName=\"regression\">"
+        "<MiningSchema><MiningField name=\"x1\"/><MiningField name=\"y\" usageType=\"target\"/></MiningSchema>"
+        "<RegressionTable intercept=\"0.5\"><NumericPredictor name=\"x1\" coefficient=\"0.3\"/></RegressionTable>"
+        "</RegressionModel></Segment>"
+        "<Segment id=\"2\"><True/><RegressionModel functionName=\"regression\">"
+        "<MiningSchema><MiningField name=\"x2\"/><MiningField name=\"y\" usageType=\"target\"/></MiningSchema>"
+        "<RegressionTable intercept=\"-1\"><NumericPredictor name=\"x2\" coefficient=\"0.2\"/></RegressionTable>"
+        "</RegressionModel></Segment>"
+        "</Segmentation></MiningModel></PMML>";
+}
+
+TEST_CLASS (TestSegmentCache)
+{
+    static std::string convert(const tinyxml2::XMLDocument & document, PMMLDocument::SegmentCache * cache)
+    {
+        std::ostringstream stream;
+        LuaOutputter outputter(stream);
+        std::vector<PMMLExporter::ModelOutput> inputs;
+        std::vector<PMMLExporter::ModelOutput> outputs;
+        const bool converted = PMMLExporter::createScript(document, outputter, inputs, outputs, PMMLExporter::Format::AS_MULTI_ARG,
+                                                          PMMLExporter::Format::AS_MULTI_ARG, nullptr, cache);
+        return converted ? stream.str() : std::string();
+    }
+
+    static tinyxml2::XMLElement * segment(tinyxml2::XMLDocument & document, int index)
+    {
+        tinyxml2::XMLElement * found = document.RootElement()->FirstChildElement("MiningModel")->FirstChildElement("Segmentation")->FirstChildElement("Segment");
+        for (int i = 0; i < index; ++i)
+        {
+            found = found->NextSiblingElement("Segment");
+        }
+        return found;
+    }
+public:
+    void testUnchanged()
+    {
+        for (const char * file : {"MiningModelRegressionAverage.pmml", "MiningModelMajority.pmml"})
+        {
+            tinyxml2::XMLDocument document;
+            CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.LoadFile(getPathToFile(file).c_str()));
+            const std::string expected = convert(document, nullptr);
+            CPPUNIT_ASSERT(!expected.empty());
+
+            PMMLDocument::SegmentCache cache;
+            CPPUNIT_ASSERT_EQUAL(expected, convert(document, &cache));
+            CPPUNIT_ASSERT_EQUAL(size_t(3), cache.size());
+            CPPUNIT_ASSERT_EQUAL(size_t(0), cache.hits());
+
+            // Every segment is found the second time, more than once if need be, and the script is the same.
+            CPPUNIT_ASSERT_EQUAL(expected, convert(document, &cache));
+            CPPUNIT_ASSERT_EQUAL(expected, convert(document, &cache));
+            CPPUNIT_ASSERT_EQUAL(size_t(3), cache.size());
+            CPPUNIT_ASSERT_EQUAL(size_t(6), cache.hits());
+        }
+    }
+
+    void testChangedSegment()
+    {
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.LoadFile(getPathToFile("MiningModelRegressionAverage.pmml").c_str()));
+        PMMLDocument::SegmentCache cache;
+        const std::string original = convert(document, &cache);
+        CPPUNIT_ASSERT(!original.empty());
+
+        // Only the segment that changed is converted again.
+        segment(document, 1)->SetAttribute("weight", "0.3");
+        const std::string expected = convert(document, nullptr);
+        CPPUNIT_ASSERT(expected != original);
+        CPPUNIT_ASSERT_EQUAL(expected, convert(document, &cache));
+        CPPUNIT_ASSERT_EQUAL(size_t(2), cache.hits());
+        CPPUNIT_ASSERT_EQUAL(size_t(4), cache.size());
+
+        // Segments don't depend on where they are.
+        document.RootElement()->FirstChildElement("MiningModel")->FirstChildElement("Segmentation")->DeleteChild(segment(document, 0));
+        CPPUNIT_ASSERT_EQUAL(convert(document, nullptr), convert(document, &cache));
+        CPPUNIT_ASSERT_EQUAL(size_t(4), cache.hits());
+    }
+
+    void testChangedDocument()
+    {
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.LoadFile(getPathToFile("MiningModelRegressionAverage.pmml").c_str()));
+        PMMLDocument::SegmentCache cache;
+        CPPUNIT_ASSERT(!convert(document, &cache).empty());
+
+        // Anything outside of the segments might change what they are converted into, so none of them are used.
+        document.RootElement()->FirstChildElement("MiningModel")->FirstChildElement("Segmentation")->SetAttribute("multipleModelMethod", "sum");
+        CPPUNIT_ASSERT_EQUAL(convert(document, nullptr), convert(document, &cache));
+        CPPUNIT_ASSERT_EQUAL(size_t(0), cache.hits());
+        CPPUNIT_ASSERT_EQUAL(size_t(6), cache.size());
+    }
+
+    void testNativeModels()
+    {
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.Parse(SUM_OF_REGRESSIONS));
+        PMMLDocument::SegmentCache cache;
+        AstBuilder first;
+        first.context().setCaptureNativeModels(true);
+        first.context().setSegmentCache(&cache);
+        CPPUNIT_ASSERT(PMMLDocument::convertPMML(first, document.RootElement()));
+
+        AstBuilder second;
+        second.context().setCaptureNativeModels(true);
+        second.context().setSegmentCache(&cache);
+        CPPUNIT_ASSERT(PMMLDocument::convertPMML(second, document.RootElement()));
+        CPPUNIT_ASSERT_EQUAL(size_t(2), cache.hits());
+
+        // Segments converted with native models captured aren't used for a conversion without them, or the other way round.
+        AstBuilder uncaptured;
+        uncaptured.context().setSegmentCache(&cache);
+        CPPUNIT_ASSERT(PMMLDocument::convertPMML(uncaptured, document.RootElement()));
+        CPPUNIT_ASSERT_EQUAL(size_t(2), cache.hits());
+        CPPUNIT_ASSERT(uncaptured.context().getLinearModels().empty());
+
+        // The copied models use the fields of the conversion that they were copied into.
+        const PMMLDocument::LinearModels & firstModels = first.context().getLinearModels();
+        const PMMLDocument::LinearModels & secondModels = second.context().getLinearModels();
+        CPPUNIT_ASSERT_EQUAL(size_t(2), secondModels.size());
+        const PMMLDocument::DataDictionary & inputs = second.context().getInputs();
+        for (size_t i = 0; i < secondModels.size(); ++i)
+        {
+            CPPUNIT_ASSERT(secondModels[i].first != firstModels[i].first);
+            CPPUNIT_ASSERT_EQUAL(firstModels[i].first->luaName, secondModels[i].first->luaName);
+            CPPUNIT_ASSERT_EQUAL(firstModels[i].second->coefficient.size(), secondModels[i].second->coefficient.size());
+            for (const PMMLDocument::ConstFieldDescriptionPtr & feature : secondModels[i].second->features)
+            {
+                CPPUNIT_ASSERT(std::any_of(inputs.begin(), inputs.end(), [&feature](const PMMLDocument::DataDictionary::value_type & input)
+                {
+                    return input.second == feature;
+                }));
+            }
+        }
+    }
+
+    CPPUNIT_TEST_SUITE(TestSegmentCache);
+    CPPUNIT_TEST(testUnchanged);
+    CPPUNIT_TEST(testChangedSegment);
+    CPPUNIT_TEST(testChangedDocument);
+    CPPUNIT_TEST(testNativeModels);
+    CPPUNIT_TEST_SUITE_END();
+};
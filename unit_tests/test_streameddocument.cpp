@@ -0,0 +1,135 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "Cuti.h"
+
+#include "streameddocument.hpp"
+#include "app/basicexport.hpp"
+#include "app/modeloutput.hpp"
+#include "luaconverter/luaoutputter.hpp"
+#include "testutils.hpp"
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+using namespace TestUtils;
+
+TEST_CLASS (TestStreamedDocument)
+{
+    // Converts path both as a whole and streamed, checking that the two give the same script and errors.
+    static std::string convertBothWays(const std::string & path, std::string & errors)
+    {
+        tinyxml2::XMLDocument whole;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, whole.LoadFile(path.c_str()));
+        std::ostringstream wholeScript;
+        LuaOutputter wholeOutputter(wholeScript);
+        std::vector<PMMLExporter::ModelOutput> inputs;
+        std::vector<PMMLExporter::ModelOutput> outputs;
+        const bool wholeConverted = PMMLExporter::createScript(whole, wholeOutputter, inputs, outputs, PMMLExporter::Format::AS_MULTI_ARG,
+                                                               PMMLExporter::Format::AS_MULTI_ARG, std::make_shared<PMMLExporter::ErrorCollector>(errors));
+
+        PMMLDocument::StreamedDocument streamed;
+        CPPUNIT_ASSERT(streamed.load(path.c_str(), 0));
+        std::string streamedErrors;
+        std::ostringstream streamedScript;
+        LuaOutputter streamedOutputter(streamedScript);
+        inputs.clear();
+        outputs.clear();
+        const bool streamedConverted = PMMLExporter::createScript(streamed, streamedOutputter, inputs, outputs, PMMLExporter::Format::AS_MULTI_ARG,
+                                                                  PMMLExporter::Format::AS_MULTI_ARG, std::make_shared<PMMLExporter::ErrorCollector>(streamedErrors));
+
+        CPPUNIT_ASSERT_EQUAL(wholeConverted, streamedConverted);
+        CPPUNIT_ASSERT_EQUAL(errors, streamedErrors);
+        CPPUNIT_ASSERT_EQUAL(wholeScript.str(), streamedScript.str());
+        return wholeConverted ? wholeScript.str() : std::string();
+    }
+public:
+    void testSkeleton()
+    {
+        const std::string path = getPathToFile("MiningModelRegressionAverage.pmml");
+        tinyxml2::XMLDocument whole;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, whole.LoadFile(path.c_str()));
+        PMMLDocument::StreamedDocument streamed;
+        CPPUNIT_ASSERT(streamed.load(path.c_str(), 0));
+
+        const tinyxml2::XMLElement * wholeSegment = whole.RootElement()->FirstChildElement("MiningModel")->FirstChildElement("Segmentation")->FirstChildElement("Segment");
+        const tinyxml2::XMLElement * segment = streamed.skeleton().RootElement()->FirstChildElement("MiningModel")->FirstChildElement("Segmentation")->FirstChildElement("Segment");
+        int count = 0;
+        for (; segment != nullptr; segment = segment->NextSiblingElement("Segment"), wholeSegment = wholeSegment->NextSiblingElement("Segment"))
+        {
+            // Only the attributes are kept in memory, but the lines still match the file.
+            CPPUNIT_ASSERT(streamed.isStreamed(segment));
+            CPPUNIT_ASSERT(segment->FirstChildElement() == nullptr);
+            CPPUNIT_ASSERT_EQUAL(std::string(wholeSegment->Attribute("weight")), std::string(segment->Attribute("weight")));
+            CPPUNIT_ASSERT_EQUAL(wholeSegment->GetLineNum(), segment->GetLineNum());
+
+            tinyxml2::XMLDocument segmentDocument;
+            int lineOffset = 0;
+            const tinyxml2::XMLElement * loaded = streamed.loadSegment(segment, segmentDocument, lineOffset);
+            CPPUNIT_ASSERT(loaded != nullptr);
+            CPPUNIT_ASSERT_EQUAL(std::string("Segment"), std::string(loaded->Name()));
+            const tinyxml2::XMLElement * model = loaded->FirstChildElement("TreeModel");
+            CPPUNIT_ASSERT(model != nullptr);
+            CPPUNIT_ASSERT_EQUAL(wholeSegment->FirstChildElement("TreeModel")->GetLineNum(), model->GetLineNum() + lineOffset);
+            count++;
+        }
+        CPPUNIT_ASSERT_EQUAL(3, count);
+        CPPUNIT_ASSERT(wholeSegment == nullptr);
+
+        // Small files are only streamed if asked to.
+        PMMLDocument::StreamedDocument small;
+        CPPUNIT_ASSERT(small.load(path.c_str()));
+        segment = small.skeleton().RootElement()->FirstChildElement("MiningModel")->FirstChildElement("Segmentation")->FirstChildElement("Segment");
+        CPPUNIT_ASSERT(!small.isStreamed(segment));
+        CPPUNIT_ASSERT(segment->FirstChildElement("TreeModel") != nullptr);
+
+        CPPUNIT_ASSERT(!small.load(getPathToFile("DoesNotExist.pmml").c_str(), 0));
+    }
+
+    void testConvert()
+    {
+        for (const char * file : {"MiningModelMajority.pmml", "MiningModelRegressionAverage.pmml", "MiningModelClassificationFirst.pmml", "TreeMissingValue.pmml"})
+        {
+            std::string errors;
+            CPPUNIT_ASSERT(!convertBothWays(getPathToFile(file), errors).empty());
+            CPPUNIT_ASSERT_EQUAL(std::string(), errors);
+        }
+    }
+
+    void testErrorLines()
+    {
+        std::ifstream source(getPathToFile("MiningModelRegressionAverage.pmml"));
+        std::ostringstream contents;
+        contents << source.rdbuf();
+        std::string pmml = contents.str();
+        // Break a predicate in the last segment, which is on line 170.
+        const std::string predicate = "operator=\"greaterThan\" value=\"6.05\"";
+        CPPUNIT_ASSERT(pmml.rfind(predicate) != std::string::npos);
+        pmml.replace(pmml.rfind(predicate), predicate.size(), "operator=\"sortOf\" value=\"6.05\"");
+
+        const std::string path = writeTemporaryFile(pmml);
+        CPPUNIT_ASSERT(!path.empty());
+
+        std::string errors;
+        CPPUNIT_ASSERT(convertBothWays(path, errors).empty());
+        CPPUNIT_ASSERT(errors.find(" at 170\n") != std::string::npos);
+        remove(path.c_str());
+    }
+
+    CPPUNIT_TEST_SUITE(TestStreamedDocument);
+    CPPUNIT_TEST(testSkeleton);
+    CPPUNIT_TEST(testConvert);
+    CPPUNIT_TEST(testErrorLines);
+    CPPUNIT_TEST_SUITE_END();
+};
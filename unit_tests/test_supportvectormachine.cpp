@@ -20,8 +20,12 @@
 #include "Cuti.h"
 
 #include "document.hpp"
+#include "app/basicexport.hpp"
+#include "app/modeloutput.hpp"
+#include "luaconverter/luaoutputter.hpp"
 
 #include "testutils.hpp"
+#include <sstream>
 using namespace TestUtils;
 
 
@@ -70,9 +74,75 @@ TEST_CLASS (TestSupportVectorMachine)
         CPPUNIT_ASSERT_EQUAL(std::string("1"), prediction);
     }
     
+    // A linear model of x1, x2 and x3 with the given dense vector. The sparse one is (1.25, 0, 0.5), as the last value for
+    // a repeated index is used.
+    static std::string vectorModel(const char * dense)
+    {
+        return std::string("<PMML xmlns=\"http://www.dmg.org/PMML-4_3\" version=\"4.3\"><Header/>"
+                           "<DataDictionary>"
+                           "<DataField name=\"x1\" optype=\"continuous\" dataType=\"double\"/>"
+                           "<DataField name=\"x2\" optype=\"continuous\" dataType=\"double\"/>"
+                           "<DataField name=\"x3\" optype=\"continuous\" dataType=\"double\"/>"
+                           "<DataField name=\"y\" optype=\"continuous\" dataType=\"double\"/>"
+                           "</DataDictionary>"
+                           "<SupportVectorMachineModel functionName=\"regression\">"
+                           "<MiningSchema><MiningField name=\"x1\"/><MiningField name=\"x2\"/><MiningField name=\"x3\"/>"
+                           "<MiningField name=\"y\" usageType=\"target\"/></MiningSchema>"
+                           "<Output><OutputField name=\"predicted\" feature=\"predictedValue\" dataType=\"double\"/></Output>"
+                           "<LinearKernelType/>"
+                           "<VectorDictionary><VectorFields><FieldRef field=\"x1\"/><FieldRef field=\"x2\"/><FieldRef field=\"x3\"/></VectorFields>") +
+               "<VectorInstance id=\"dense\"><Array n=\"3\" type=\"real\">" + dense + "</Array></VectorInstance>"
+               "<VectorInstance id=\"sparse\"><REAL-SparseArray n=\"3\"><Indices>3 1 3</Indices><REAL-Entries>4 1.25 .5</REAL-Entries></REAL-SparseArray></VectorInstance>"
+               "<VectorInstance id=\"empty\"><Array n=\"0\" type=\"real\"/></VectorInstance>"
+               "</VectorDictionary>"
+               "<SupportVectorMachine><SupportVectors><SupportVector vectorId=\"dense\"/><SupportVector vectorId=\"sparse\"/></SupportVectors>"
+               "<Coefficients absoluteValue=\"1\"><Coefficient value=\"2\"/><Coefficient value=\"-1\"/></Coefficients>"
+               "</SupportVectorMachine></SupportVectorMachineModel></PMML>";
+    }
+
+    void testVectorArrays()
+    {
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.Parse(vectorModel(" 0  25e-1\t&quot;-1.5&quot; ").c_str()));
+        lua_State * L = makeState(document);
+        CPPUNIT_ASSERT(L != nullptr);
+
+        double prediction;
+        CPPUNIT_ASSERT(executeModel(L, "x1", 1, "x2", 2, "x3", 3));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "predicted", prediction));
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(1 + 2 * (2.5 * 2 - 1.5 * 3) - (1.25 * 1 + 0.5 * 3), prediction, 1e-9);
+        CPPUNIT_ASSERT(executeModel(L, "x1", 4, "x2", 0, "x3", -2));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "predicted", prediction));
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(1 + 2 * (1.5 * 2) - (1.25 * 4 - 0.5 * 2), prediction, 1e-9);
+
+        for (const char * bad : {"0 2.5x -1.5", "0 1e -1.5", "0 &quot;2 5&quot; -1.5"})
+        {
+            tinyxml2::XMLDocument badDocument;
+            CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, badDocument.Parse(vectorModel(bad).c_str()));
+            CPPUNIT_ASSERT(makeState(badDocument) == nullptr);
+        }
+    }
+    
+    void testSharedDistances()
+    {
+        // Each support vector of the XOR model works out the squared distance from it on each axis, and half of those
+        // distances are the same as in another vector, so they are only worked out once.
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.LoadFile(getPathToFile("SupportVectorXor.pmml").c_str()));
+        std::ostringstream script;
+        LuaOutputter outputter(script);
+        std::vector<PMMLExporter::ModelOutput> inputs;
+        std::vector<PMMLExporter::ModelOutput> outputs;
+        CPPUNIT_ASSERT(PMMLExporter::createScript(document, outputter, inputs, outputs));
+        CPPUNIT_ASSERT(script.str().find("local shared_1 =") != std::string::npos);
+        CPPUNIT_ASSERT(script.str().find("local shared_2 =") != std::string::npos);
+    }
+
     CPPUNIT_TEST_SUITE(TestSupportVectorMachine);
     CPPUNIT_TEST(testSVM);
     CPPUNIT_TEST(testBinaryClass);
+    CPPUNIT_TEST(testVectorArrays);
+    CPPUNIT_TEST(testSharedDistances);
     CPPUNIT_TEST_SUITE_END();
 };
 
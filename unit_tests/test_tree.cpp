@@ -17,13 +17,84 @@
 #include "Cuti.h"
 
 #include "document.hpp"
+#include "app/basicexport.hpp"
+#include "app/modeloutput.hpp"
+#include "luaconverter/luaoutputter.hpp"
+#include "luaconverter/optimiser.hpp"
 
 #include "testutils.hpp"
+#include <sstream>
+#include <streambuf>
 using namespace TestUtils;
 
 
 TEST_CLASS (TestTree)
 {
+    // This makes a tree like the unbalanced ones some tools export, where each Node has a leaf and then the next Node in it.
+    static void makeDeepTree(tinyxml2::XMLDocument & document, int depth)
+    {
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.Parse(
+            "<PMML version=\"4.3\"><Header/>"
+            "<DataDictionary numberOfFields=\"2\">"
+            "<DataField name=\"x\" optype=\"continuous\" dataType=\"double\"/>"
+            "<DataField name=\"y\" optype=\"continuous\" dataType=\"double\"/>"
+            "</DataDictionary>"
+            "<TreeModel functionName=\"regression\" missingValueStrategy=\"lastPrediction\">"
+            "<MiningSchema><MiningField name=\"x\"/><MiningField name=\"y\" usageType=\"target\"/></MiningSchema>"
+            "<Node score=\"0\"><True/></Node>"
+            "</TreeModel></PMML>"));
+        tinyxml2::XMLElement * node = document.RootElement()->FirstChildElement("TreeModel")->FirstChildElement("Node");
+        for (int i = 1; i <= depth; ++i)
+        {
+            tinyxml2::XMLElement * child = document.NewElement("Node");
+            child->SetAttribute("score", i);
+            tinyxml2::XMLElement * predicate = document.NewElement("SimplePredicate");
+            predicate->SetAttribute("field", "x");
+            predicate->SetAttribute("operator", "greaterThan");
+            predicate->SetAttribute("value", i);
+            child->InsertEndChild(predicate);
+            node->InsertEndChild(child);
+
+            tinyxml2::XMLElement * leaf = document.NewElement("Node");
+            leaf->SetAttribute("score", -i);
+            leaf->InsertEndChild(document.NewElement("True"));
+            node->InsertEndChild(leaf);
+            node = child;
+        }
+    }
+    // This keeps what is written to it without the spaces at the start of each line, as a deep tree's script is mostly indentation.
+    class UnindentedBuffer : public std::streambuf
+    {
+    public:
+        std::string contents;
+    protected:
+        int_type overflow(int_type c) override
+        {
+            if (c != traits_type::eof())
+            {
+                const char character = traits_type::to_char_type(c);
+                xsputn(&character, 1);
+            }
+            return traits_type::not_eof(c);
+        }
+
+        std::streamsize xsputn(const char * text, std::streamsize count) override
+        {
+            std::streamsize start = 0;
+            while (m_lineStart && start < count && text[start] == ' ')
+            {
+                ++start;
+            }
+            if (start < count)
+            {
+                contents.append(text + start, size_t(count - start));
+                m_lineStart = text[count - 1] == '\n';
+            }
+            return count;
+        }
+    private:
+        bool m_lineStart = true;
+    };
 public:
     void testNoTrueChild()
     {
@@ -232,11 +303,192 @@ public:
         lua_close(L);
     }
 
+    void testDeepTree()
+    {
+        // Each level of the tree is a level of if statements, and the whole conversion works without recursing for each one,
+        // so it fits in a small stack.
+        tinyxml2::XMLDocument deep;
+        makeDeepTree(deep, 20000);
+        UnindentedBuffer script;
+        bool converted = false;
+        CPPUNIT_ASSERT(runWithStackSize(1024 * 1024, [&deep, &script, &converted]()
+        {
+            std::ostream stream(&script);
+            LuaOutputter outputter(stream);
+            std::vector<PMMLExporter::ModelOutput> inputs;
+            std::vector<PMMLExporter::ModelOutput> outputs;
+            converted = PMMLExporter::createScript(deep, outputter, inputs, outputs);
+        }));
+        CPPUNIT_ASSERT(converted);
+        CPPUNIT_ASSERT(script.contents.find("x > 20000") != std::string::npos);
+    }
+
+    void testDerivedFieldInBranch()
+    {
+        // d is only tested under the first child, and e only under the last two, so they are only worked out there.
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.Parse(
+            "<PMML version=\"4.3\"><Header/>"
+            "<DataDictionary numberOfFields=\"4\">"
+            "<DataField name=\"x\" optype=\"continuous\" dataType=\"double\"/>"
+            "<DataField name=\"a\" optype=\"categorical\" dataType=\"string\"/>"
+            "<DataField name=\"b\" optype=\"categorical\" dataType=\"string\"/>"
+            "<DataField name=\"y\" optype=\"continuous\" dataType=\"double\"/>"
+            "</DataDictionary>"
+            "<TreeModel functionName=\"regression\">"
+            "<MiningSchema><MiningField name=\"x\"/><MiningField name=\"a\"/><MiningField name=\"b\"/>"
+            "<MiningField name=\"y\" usageType=\"target\"/></MiningSchema>"
+            "<LocalTransformations>"
+            "<DerivedField name=\"d\" optype=\"categorical\" dataType=\"string\">"
+            "<Apply function=\"uppercase\"><Apply function=\"concat\"><FieldRef field=\"a\"/><FieldRef field=\"b\"/></Apply></Apply>"
+            "</DerivedField>"
+            "<DerivedField name=\"e\" optype=\"categorical\" dataType=\"string\">"
+            "<Apply function=\"lowercase\"><Apply function=\"concat\"><FieldRef field=\"b\"/><FieldRef field=\"a\"/></Apply></Apply>"
+            "</DerivedField>"
+            "</LocalTransformations>"
+            "<Node score=\"0\"><True/>"
+            "<Node score=\"1\"><SimplePredicate field=\"x\" operator=\"lessThan\" value=\"1\"/>"
+            "<Node score=\"2\"><SimplePredicate field=\"d\" operator=\"equal\" value=\"AB\"/></Node>"
+            "<Node score=\"3\"><SimplePredicate field=\"d\" operator=\"equal\" value=\"BA\"/></Node>"
+            "</Node>"
+            "<Node score=\"4\"><SimplePredicate field=\"x\" operator=\"lessThan\" value=\"2\"/>"
+            "<Node score=\"5\"><SimplePredicate field=\"e\" operator=\"equal\" value=\"ab\"/></Node>"
+            "<Node score=\"6\"><SimplePredicate field=\"e\" operator=\"equal\" value=\"ba\"/></Node>"
+            "</Node>"
+            "<Node score=\"7\"><SimplePredicate field=\"x\" operator=\"lessThan\" value=\"3\"/></Node>"
+            "<Node score=\"8\"><True/>"
+            "<Node score=\"9\"><SimplePredicate field=\"e\" operator=\"equal\" value=\"cd\"/></Node>"
+            "<Node score=\"10\"><SimplePredicate field=\"e\" operator=\"equal\" value=\"dc\"/></Node>"
+            "</Node>"
+            "</Node>"
+            "</TreeModel></PMML>"));
+
+        std::ostringstream script;
+        LuaOutputter outputter(script);
+        std::vector<PMMLExporter::ModelOutput> inputs;
+        std::vector<PMMLExporter::ModelOutput> outputs;
+        CPPUNIT_ASSERT(PMMLExporter::createScript(document, outputter, inputs, outputs));
+        const std::string text = script.str();
+        CPPUNIT_ASSERT(text.find("local d =") > text.find("x < 1"));
+        CPPUNIT_ASSERT(text.find("local d =") < text.find("x < 2"));
+        CPPUNIT_ASSERT(text.find("local e =") > text.find("x < 2"));
+        CPPUNIT_ASSERT(text.find("local e_2 =") > text.find("x < 3"));
+        CPPUNIT_ASSERT(text.find("local e_2 =") != std::string::npos);
+
+        lua_State * L = makeState(document);
+        CPPUNIT_ASSERT(L != nullptr);
+        double prediction;
+        CPPUNIT_ASSERT(executeModel(L, "x", 0, "a", "b", "b", "a"));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "y", prediction));
+        CPPUNIT_ASSERT_EQUAL(3.0, prediction);
+        CPPUNIT_ASSERT(executeModel(L, "x", 1, "a", "b", "b", "a"));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "y", prediction));
+        CPPUNIT_ASSERT_EQUAL(5.0, prediction);
+        CPPUNIT_ASSERT(executeModel(L, "x", 2, "a", "b", "b", "a"));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "y", prediction));
+        CPPUNIT_ASSERT_EQUAL(7.0, prediction);
+        CPPUNIT_ASSERT(executeModel(L, "x", 3, "a", "C", "b", "D"));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "y", prediction));
+        CPPUNIT_ASSERT_EQUAL(10.0, prediction);
+        lua_close(L);
+    }
+
+    void testDefaultChildSharing()
+    {
+        // Whether the first child was missing is checked again for the default child, so its predicate is worked out once.
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.Parse(
+            "<PMML version=\"4.3\"><Header/>"
+            "<DataDictionary numberOfFields=\"4\">"
+            "<DataField name=\"x\" optype=\"continuous\" dataType=\"double\"/>"
+            "<DataField name=\"z\" optype=\"continuous\" dataType=\"double\"/>"
+            "<DataField name=\"flag\" optype=\"categorical\" dataType=\"boolean\"/>"
+            "<DataField name=\"y\" optype=\"continuous\" dataType=\"double\"/>"
+            "</DataDictionary>"
+            "<TreeModel functionName=\"regression\" missingValueStrategy=\"defaultChild\">"
+            "<MiningSchema><MiningField name=\"x\"/><MiningField name=\"z\"/><MiningField name=\"flag\"/>"
+            "<MiningField name=\"y\" usageType=\"target\"/></MiningSchema>"
+            "<Node score=\"0\" defaultChild=\"n2\"><True/>"
+            "<Node id=\"n1\" score=\"1\"><CompoundPredicate booleanOperator=\"and\">"
+            "<SimplePredicate field=\"x\" operator=\"lessThan\" value=\"1\"/>"
+            "<SimplePredicate field=\"z\" operator=\"lessThan\" value=\"5\"/>"
+            "<SimplePredicate field=\"flag\" operator=\"equal\" value=\"true\"/>"
+            "</CompoundPredicate></Node>"
+            "<Node id=\"n2\" score=\"2\"><CompoundPredicate booleanOperator=\"and\">"
+            "<SimplePredicate field=\"x\" operator=\"lessThan\" value=\"2\"/>"
+            "<SimplePredicate field=\"z\" operator=\"greaterThan\" value=\"5\"/>"
+            "</CompoundPredicate></Node>"
+            "<Node id=\"n3\" score=\"3\"><CompoundPredicate booleanOperator=\"or\">"
+            "<SimplePredicate field=\"x\" operator=\"greaterOrEqual\" value=\"2\"/>"
+            "<SimplePredicate field=\"flag\" operator=\"equal\" value=\"false\"/>"
+            "</CompoundPredicate></Node>"
+            "</Node>"
+            "</TreeModel></PMML>"));
+
+        std::ostringstream script;
+        LuaOutputter outputter(script);
+        std::vector<PMMLExporter::ModelOutput> inputs;
+        std::vector<PMMLExporter::ModelOutput> outputs;
+        CPPUNIT_ASSERT(PMMLExporter::createScript(document, outputter, inputs, outputs));
+        CPPUNIT_ASSERT(script.str().find("local shared_") != std::string::npos);
+
+        lua_State * L = makeState(document);
+        CPPUNIT_ASSERT(L != nullptr);
+        double prediction;
+        // executeModel would take whole numbers as booleans too, so flag is set here.
+        auto setFlag = [L](bool value)
+        {
+            lua_pushboolean(L, value);
+            lua_setglobal(L, "flag");
+        };
+
+        // The shared AND has to be true, rather than the last value that it checked, to take the first child.
+        setFlag(true);
+        CPPUNIT_ASSERT(executeModel(L, "x", 0.0, "z", 1.0));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "y", prediction));
+        CPPUNIT_ASSERT_EQUAL(1.0, prediction);
+        lua_pop(L, 1);
+
+        // The first child is unknown, so the default child is taken.
+        CPPUNIT_ASSERT(executeModel(L, "x", nullptr, "z", 1.0));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "y", prediction));
+        CPPUNIT_ASSERT_EQUAL(2.0, prediction);
+        lua_pop(L, 1);
+
+        // A missing flag is neither true nor false.
+        CPPUNIT_ASSERT(executeModel(L, "x", 0.0, "z", 1.0, "flag", nullptr));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "y", prediction));
+        CPPUNIT_ASSERT_EQUAL(2.0, prediction);
+        lua_pop(L, 1);
+
+        setFlag(false);
+        CPPUNIT_ASSERT(executeModel(L, "x", 0.0, "z", 1.0));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "y", prediction));
+        CPPUNIT_ASSERT_EQUAL(3.0, prediction);
+        lua_pop(L, 1);
+
+        // The first two children are false whatever z is.
+        setFlag(true);
+        CPPUNIT_ASSERT(executeModel(L, "x", 5.0, "z", nullptr));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "y", prediction));
+        CPPUNIT_ASSERT_EQUAL(3.0, prediction);
+        lua_pop(L, 1);
+
+        // The first child is false and the default child is unknown.
+        CPPUNIT_ASSERT(executeModel(L, "x", 1.5, "z", nullptr));
+        CPPUNIT_ASSERT_EQUAL(true, getValue(L, "y", prediction));
+        CPPUNIT_ASSERT_EQUAL(2.0, prediction);
+        lua_close(L);
+    }
+
     CPPUNIT_TEST_SUITE(TestTree);
     CPPUNIT_TEST(testNoTrueChild);
     CPPUNIT_TEST(testMissingValue);
     CPPUNIT_TEST(testMissingValuePenalty);
     CPPUNIT_TEST(testDefaultValue);
+    CPPUNIT_TEST(testDeepTree);
+    CPPUNIT_TEST(testDerivedFieldInBranch);
+    CPPUNIT_TEST(testDefaultChildSharing);
     CPPUNIT_TEST_SUITE_END();
 };
 
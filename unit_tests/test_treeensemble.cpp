@@ -0,0 +1,171 @@
+//  Copyright 2018-2020 Lexis Nexis Risk Solutions
+//
+//  Licensed under the Apache License, Version 2.0 (the "License");
+//  you may not use this file except in compliance with the License.
+//  You may obtain a copy of the License at
+//
+//  http://www.apache.org/licenses/LICENSE-2.0
+//
+//  Unless required by applicable law or agreed to in writing, software
+//  distributed under the License is distributed on an "AS IS" BASIS,
+//  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+//  See the License for the specific language governing permissions and
+//  limitations under the License.
+//
+
+#include "Cuti.h"
+
+#include "document.hpp"
+#include "conversioncontext.hpp"
+#include "app/basicexport.hpp"
+#include "app/modeloutput.hpp"
+#include "app/nativemodel.hpp"
+#include "native/treeensemble.hpp"
+
+#include "testutils.hpp"
+#include <limits>
+#include <memory>
+using namespace TestUtils;
+
+TEST_CLASS (TestTreeEnsemble)
+{
+    static tinyxml2::XMLElement * segmentation(tinyxml2::XMLDocument & document)
+    {
+        return document.RootElement()->FirstChildElement("MiningModel")->FirstChildElement("Segmentation");
+    }
+
+    // Converts the document natively, taking rows of petal_length, petal_width and sepal_width and scoring sepal_length.
+    static bool convert(tinyxml2::XMLDocument & document, PMMLExporter::NativeModel & model)
+    {
+        std::vector<PMMLExporter::ModelOutput> inputs = {{"petal_length", "petal_length"}, {"petal_width", "petal_width"}, {"sepal_width", "sepal_width"}};
+        std::vector<PMMLExporter::ModelOutput> outputs = {{"sepal_length", "sepal_length"}};
+        std::string errors;
+        return PMMLExporter::createNativeModel(document, model, inputs, outputs, std::make_shared<PMMLExporter::ErrorCollector>(errors));
+    }
+public:
+    void testRegressionWeightedAverage()
+    {
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.LoadFile(getPathToFile("MiningModelRegressionAverage.pmml").c_str()));
+        PMMLExporter::NativeModel model;
+        CPPUNIT_ASSERT(convert(document, model));
+
+        // Enough rows to span more than one block.
+        std::vector<double> rows;
+        for (int i = 0; i < 100; ++i)
+        {
+            rows.insert(rows.end(), {2.0, 1.5, 3});
+            rows.insert(rows.end(), {4.0, 2.5, 3});
+        }
+        std::vector<double> results(rows.size() / 3);
+        model.score(rows.data(), results.size(), results.data());
+
+        for (size_t i = 0; i < results.size(); i += 2)
+        {
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(5.005660 * 0.25 + 6.413333 * 0.25 + 5.005660 * 0.5, results[i], 1e-12);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(4.735000 * 0.25 + 6.768966 * 0.25 + 5.640000 * 0.5, results[i + 1], 1e-12);
+        }
+    }
+
+    void testOnlyCapturedWhenAsked()
+    {
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.LoadFile(getPathToFile("MiningModelRegressionAverage.pmml").c_str()));
+        {
+            AstBuilder builder;
+            CPPUNIT_ASSERT(PMMLDocument::convertPMML(builder, document.RootElement()));
+            CPPUNIT_ASSERT(builder.context().getTreeEnsembles().empty());
+        }
+        {
+            AstBuilder builder;
+            builder.context().setCaptureNativeModels(true);
+            CPPUNIT_ASSERT(PMMLDocument::convertPMML(builder, document.RootElement()));
+            const PMMLDocument::TreeEnsembles & ensembles = builder.context().getTreeEnsembles();
+            CPPUNIT_ASSERT_EQUAL(size_t(1), ensembles.size());
+            CPPUNIT_ASSERT_EQUAL(size_t(3), ensembles.front().second->root.size());
+            CPPUNIT_ASSERT_EQUAL(size_t(3), ensembles.front().second->features.size());
+        }
+    }
+
+    void testRegressionSumAndAverage()
+    {
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.LoadFile(getPathToFile("MiningModelRegressionAverage.pmml").c_str()));
+        const double row[] = {2.0, 1.5, 3};
+        double result;
+
+        segmentation(document)->SetAttribute("multipleModelMethod", "sum");
+        {
+            PMMLExporter::NativeModel model;
+            CPPUNIT_ASSERT(convert(document, model));
+            model.score(row, 1, &result);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(5.005660 + 6.413333 + 5.005660, result, 1e-12);
+        }
+
+        segmentation(document)->SetAttribute("multipleModelMethod", "average");
+        {
+            PMMLExporter::NativeModel model;
+            CPPUNIT_ASSERT(convert(document, model));
+            model.score(row, 1, &result);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL((5.005660 + 6.413333 + 5.005660) / 3.0, result, 1e-12);
+        }
+    }
+
+    void testMissingValues()
+    {
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.LoadFile(getPathToFile("MiningModelRegressionAverage.pmml").c_str()));
+        const double nan = std::numeric_limits<double>::quiet_NaN();
+        const double row[] = {nan, nan, nan};
+        double result;
+
+        // With no prediction from any tree, nothing is added.
+        {
+            PMMLExporter::NativeModel model;
+            CPPUNIT_ASSERT(convert(document, model));
+            model.score(row, 1, &result);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(0, result, 1e-12);
+        }
+
+        // Every tree stops at the root.
+        for (tinyxml2::XMLElement * segment = segmentation(document)->FirstChildElement("Segment"); segment; segment = segment->NextSiblingElement("Segment"))
+        {
+            segment->FirstChildElement("TreeModel")->SetAttribute("missingValueStrategy", "lastPrediction");
+        }
+        {
+            PMMLExporter::NativeModel model;
+            CPPUNIT_ASSERT(convert(document, model));
+            model.score(row, 1, &result);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(5.843333, result, 1e-12);
+        }
+    }
+
+    void testNotFlattened()
+    {
+        tinyxml2::XMLDocument document;
+        CPPUNIT_ASSERT_EQUAL(tinyxml2::XML_SUCCESS, document.LoadFile(getPathToFile("MiningModelRegressionAverage.pmml").c_str()));
+
+        segmentation(document)->SetAttribute("multipleModelMethod", "median");
+        {
+            PMMLExporter::NativeModel model;
+            CPPUNIT_ASSERT(!convert(document, model));
+        }
+
+        // A replacement value changes the input before the tree sees it.
+        segmentation(document)->SetAttribute("multipleModelMethod", "sum");
+        segmentation(document)->FirstChildElement("Segment")->FirstChildElement("TreeModel")->FirstChildElement("MiningSchema")
+            ->FirstChildElement("MiningField")->SetAttribute("missingValueReplacement", "1");
+        {
+            PMMLExporter::NativeModel model;
+            CPPUNIT_ASSERT(!convert(document, model));
+        }
+    }
+
+    CPPUNIT_TEST_SUITE(TestTreeEnsemble);
+    CPPUNIT_TEST(testRegressionWeightedAverage);
+    CPPUNIT_TEST(testOnlyCapturedWhenAsked);
+    CPPUNIT_TEST(testRegressionSumAndAverage);
+    CPPUNIT_TEST(testMissingValues);
+    CPPUNIT_TEST(testNotFlattened);
+    CPPUNIT_TEST_SUITE_END();
+};
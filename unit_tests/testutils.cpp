@@ -20,7 +20,20 @@
 #include "luaconverter/luaconverter.hpp"
 #include "luaconverter/luaoutputter.hpp"
 #include "luaconverter/optimiser.hpp"
+#include "cconverter/cconverter.hpp"
+#include <fstream>
+#include <limits>
+#include <random>
 #include <sstream>
+#include <stdlib.h>
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 std::string TestUtils::getPathToFile(const char * name)
 {
@@ -40,6 +53,71 @@ std::string TestUtils::getPathToFile(const char * name)
     return thisFileName + preferred_sep + name;
 }
 
+std::string TestUtils::writeTemporaryFile(const std::string & contents)
+{
+#if _WIN32
+    const char * directory = getenv("TEMP");
+#else
+    const char * directory = getenv("TMPDIR");
+    if (directory == nullptr)
+    {
+        directory = "/tmp";
+    }
+#endif
+    // The name is random, so that tests that are run at the same time don't write over each other's files.
+    std::random_device random;
+    const std::string path = std::string(directory ? directory : ".") + "/pamplemousse_" + std::to_string(random()) + "_" + std::to_string(random());
+    std::ofstream file(path, std::ios::binary);
+    if (!file.write(contents.data(), contents.size()))
+    {
+        return std::string();
+    }
+    return path;
+}
+
+namespace
+{
+#ifdef _WIN32
+    DWORD WINAPI runFunction(LPVOID function)
+    {
+        (*static_cast<const std::function<void()> *>(function))();
+        return 0;
+    }
+#else
+    void * runFunction(void * function)
+    {
+        (*static_cast<const std::function<void()> *>(function))();
+        return nullptr;
+    }
+#endif
+}
+
+bool TestUtils::runWithStackSize(size_t stackSize, const std::function<void()> & function)
+{
+    void * argument = const_cast<std::function<void()> *>(&function);
+#ifdef _WIN32
+    HANDLE thread = CreateThread(nullptr, stackSize, runFunction, argument, STACK_SIZE_PARAM_IS_A_RESERVATION, nullptr);
+    if (thread == nullptr)
+    {
+        return false;
+    }
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+#else
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_t thread;
+    const bool started = pthread_attr_setstacksize(&attributes, stackSize) == 0 && pthread_create(&thread, &attributes, runFunction, argument) == 0;
+    pthread_attr_destroy(&attributes);
+    if (!started)
+    {
+        return false;
+    }
+    pthread_join(thread, nullptr);
+#endif
+    return true;
+}
+
 const Function::Definition ReturnStatement =
 {
     nullptr,
@@ -77,6 +155,7 @@ lua_State * TestUtils::makeState(const tinyxml2::XMLDocument & document)
     LuaOutputter output(mystream);
     PMMLDocument::optimiseAST(astTree, output);
     
+    LuaConverter::convertSections(astTree, output);
     output.function("func");
     output.finishedArguments();
     
@@ -98,6 +177,85 @@ lua_State * TestUtils::makeState(const tinyxml2::XMLDocument & document)
     return L;
 }
 
+TestUtils::CModel::~CModel()
+{
+#ifndef _WIN32
+    if (library)
+    {
+        dlclose(library);
+    }
+#endif
+}
+
+bool TestUtils::makeCModel(CModel & model, const tinyxml2::XMLDocument & document,
+                           const std::vector<std::string> & inputs, const std::vector<std::string> & outputs)
+{
+#ifdef _WIN32
+    return false;
+#else
+    AstBuilder builder;
+    PMMLDocument::ConversionContext & context = builder.context();
+    if (!PMMLDocument::convertPMML( builder, document.RootElement() ))
+    {
+        return false;
+    }
+    
+    CConverter::NamedFields inputFields;
+    for (const auto & input : inputs)
+    {
+        auto found = context.getInputs().find(input);
+        if (found == context.getInputs().end())
+        {
+            return false;
+        }
+        inputFields.emplace_back(input, found->second);
+    }
+    for (const auto & output : outputs)
+    {
+        auto found = context.getOutputs().find(output);
+        if (found == context.getOutputs().end())
+        {
+            return false;
+        }
+        builder.field(found->second);
+    }
+    builder.function(ReturnStatement, outputs.size());
+    builder.block(builder.stackSize());
+    
+    AstNode astTree = builder.popNode();
+    std::stringstream unused;
+    LuaOutputter output(unused);
+    output.setMaxVariables(std::numeric_limits<size_t>::max());
+    PMMLDocument::optimiseAST(astTree, output);
+    
+    static int modelNumber = 0;
+    const std::string baseName = "/tmp/pamplemousse_test_" + std::to_string(getpid()) + "_" + std::to_string(modelNumber++);
+    {
+        std::ofstream source(baseName + ".c");
+        if (!CConverter::convertAstToC(astTree, inputFields, outputs, "func", source))
+        {
+            return false;
+        }
+    }
+    
+    const char * compiler = getenv("CC");
+    const std::string command = std::string(compiler ? compiler : "cc") + " -std=c99 -shared -fPIC -O1 -o " + baseName + ".so " + baseName + ".c -lm";
+    const bool compiled = system(command.c_str()) == 0;
+    if (compiled)
+    {
+        model.library = dlopen((baseName + ".so").c_str(), RTLD_NOW | RTLD_LOCAL);
+    }
+    remove((baseName + ".c").c_str());
+    remove((baseName + ".so").c_str());
+    if (model.library == nullptr)
+    {
+        return false;
+    }
+    model.function = reinterpret_cast<CModel::Function>(dlsym(model.library, "func"));
+    return model.function != nullptr;
+#endif
+}
+
 bool TestUtils::executeModel(lua_State * L)
 {
     lua_getglobal(L, "func");
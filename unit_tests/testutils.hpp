@@ -18,7 +18,9 @@
 #ifndef testutils_hpp
 #define testutils_hpp
 
+#include <functional>
 #include <string>
+#include <vector>
 
 extern "C"
 {
@@ -35,6 +37,12 @@ static const char * const ROOT_PATH = "/../jpmml-samples/test-models/";
 namespace TestUtils
 {
     std::string getPathToFile(const char * name);
+    // This writes contents to a new file in the temporary directory and returns its path, or an empty string if it can't be
+    // written. Removing it is up to the caller.
+    std::string writeTemporaryFile(const std::string & contents);
+    // This runs function on a new thread with a stack of stackSize bytes and waits for it to finish. It returns false if the
+    // thread can't be started.
+    bool runWithStackSize(size_t stackSize, const std::function<void()> & function);
     lua_State * makeState(const tinyxml2::XMLDocument & document);
     void setupIDOutput(tinyxml2::XMLDocument & document, tinyxml2::XMLElement * model);
     void setupProbOutput(tinyxml2::XMLDocument & document, tinyxml2::XMLElement * model, const char * value);
@@ -55,6 +63,32 @@ namespace TestUtils
         return executeModel(L, args...);
     }
     
+    // This matches the pmml_value written by the C backend.
+    struct CValue
+    {
+        enum Type
+        {
+            MISSING = 0,
+            NUMBER = 1,
+            STRING = 2,
+            BOOL = 3
+        };
+        int type;
+        double number;
+        const char * string;
+    };
+
+    // A model converted to C, compiled with the system C compiler and loaded as a shared library.
+    struct CModel
+    {
+        typedef int (*Function)(const CValue * inputs, CValue * outputs, char * scratch, size_t scratchSize);
+        void * library = nullptr;
+        Function function = nullptr;
+        ~CModel();
+    };
+    bool makeCModel(CModel & model, const tinyxml2::XMLDocument & document,
+                    const std::vector<std::string> & inputs, const std::vector<std::string> & outputs);
+    
     inline bool mightBeMissingRecursive(Analyser::AnalyserContext & analyserContext, AstNode & node)
     {
         return analyserContext.mightBeMissing(node);